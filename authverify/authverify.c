@@ -0,0 +1,321 @@
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <authverify.h>
+
+#define OPCODE_MAC		0x08
+#define MAC_MODE		0x00
+
+#define SN_FNV_OFFSET		0xcbf29ce484222325ULL
+#define SN_FNV_PRIME		0x100000001b3ULL
+
+/* MAC command, Mode 0: the key, the challenge, and a few bytes of the
+ * serial number. Sect 8.5.8 of the ATSHA204A datasheet.
+ */
+struct __attribute__((__packed__)) mac_in {
+	uint8_t key[32];
+	uint8_t challenge[32];
+	uint8_t opcode;
+	uint8_t mode;
+	uint8_t param2[2];
+	uint8_t otp[11];	/* Zero unless Mode:5 is set */
+	uint8_t sn8;
+	uint8_t sn4[4];		/* Zero unless Mode:6 is set */
+	uint8_t sn0[2];
+	uint8_t sn2[2];		/* Zero unless Mode:6 is set */
+};
+
+struct verify_job {
+	struct av_table *table;
+	const struct av_response *resp;
+	int *results;
+	size_t start;
+	size_t end;
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static size_t sn_hash(const uint8_t *sn)
+{
+	uint64_t h = SN_FNV_OFFSET;
+
+	for (int i = 0; i < S96AT_SERIAL_NUMBER_LEN; i++) {
+		h ^= sn[i];
+		h *= SN_FNV_PRIME;
+	}
+	return h;
+}
+
+/* The table is sized for a load factor of at most 1/2, so that probe
+ * sequences stay short.
+ */
+int av_table_init(struct av_table *table, size_t num_devices)
+{
+	size_t capacity = 16;
+
+	while (capacity < 2 * num_devices)
+		capacity <<= 1;
+
+	if (posix_memalign((void **)&table->entries, sizeof(struct av_entry),
+			   capacity * sizeof(struct av_entry)))
+		return -1;
+
+	memset(table->entries, 0, capacity * sizeof(struct av_entry));
+	table->mask = capacity - 1;
+	table->num = 0;
+
+	return 0;
+}
+
+int av_table_add(struct av_table *table, const uint8_t *sn, uint8_t slot,
+		 const uint8_t *key)
+{
+	struct av_entry *e;
+
+	if (2 * (table->num + 1) > table->mask + 1)
+		return -1;
+
+	for (size_t i = sn_hash(sn) & table->mask; ; i = (i + 1) & table->mask) {
+		e = &table->entries[i];
+		if (!e->used || !memcmp(e->sn, sn, S96AT_SERIAL_NUMBER_LEN))
+			break;
+	}
+
+	if (!e->used)
+		table->num++;
+	memcpy(e->sn, sn, S96AT_SERIAL_NUMBER_LEN);
+	memcpy(e->key, key, AV_KEY_LEN);
+	e->slot = slot;
+	e->used = 1;
+	e->pending = 0;
+
+	return 0;
+}
+
+static struct av_entry *av_table_find(const struct av_table *table, const uint8_t *sn)
+{
+	struct av_entry *e;
+
+	for (size_t i = sn_hash(sn) & table->mask; ; i = (i + 1) & table->mask) {
+		e = &table->entries[i];
+		if (!e->used)
+			return NULL;
+		if (!memcmp(e->sn, sn, S96AT_SERIAL_NUMBER_LEN))
+			return e;
+	}
+}
+
+const struct av_entry *av_table_lookup(const struct av_table *table, const uint8_t *sn)
+{
+	return av_table_find(table, sn);
+}
+
+void av_table_free(struct av_table *table)
+{
+	if (table->entries)
+		OPENSSL_cleanse(table->entries, (table->mask + 1) * sizeof(struct av_entry));
+	free(table->entries);
+	memset(table, 0, sizeof(*table));
+}
+
+int av_challenge(struct av_table *table, const uint8_t *sn, uint8_t *challenge)
+{
+	struct av_entry *e;
+
+	e = av_table_find(table, sn);
+	if (!e)
+		return -1;
+
+	e->pending = 0;
+	if (RAND_bytes(e->challenge, S96AT_CHALLENGE_LEN) != 1)
+		return -1;
+
+	memcpy(challenge, e->challenge, S96AT_CHALLENGE_LEN);
+	e->expires_ms = now_ms() + AV_CHALLENGE_TTL_MS;
+	__atomic_store_n(&e->pending, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* Consume the challenge pending for the device, if the response answers
+ * it. A response with another challenge leaves it pending, so that a
+ * forged response does not lock the device out. Of two responses to the
+ * same challenge, verified on different threads, only one consumes it.
+ */
+static int consume_challenge(struct av_entry *e, const uint8_t *challenge,
+			     uint64_t now)
+{
+	if (!__atomic_load_n(&e->pending, __ATOMIC_ACQUIRE) ||
+	    CRYPTO_memcmp(e->challenge, challenge, S96AT_CHALLENGE_LEN))
+		return -1;
+
+	if (!__atomic_exchange_n(&e->pending, 0, __ATOMIC_ACQ_REL))
+		return -1;
+
+	return now > e->expires_ms ? -1 : 0;
+}
+
+static void build_mac_in(const struct av_entry *entry, const uint8_t *challenge,
+			 struct mac_in *in)
+{
+	memset(in, 0, sizeof(*in));
+	memcpy(in->key, entry->key, sizeof(in->key));
+	memcpy(in->challenge, challenge, sizeof(in->challenge));
+	in->opcode = OPCODE_MAC;
+	in->mode = MAC_MODE;
+	in->param2[0] = entry->slot;
+	in->sn8 = entry->sn[8];
+	in->sn0[0] = entry->sn[0];
+	in->sn0[1] = entry->sn[1];
+}
+
+/* SHA-256 with a context and digest fetched once by the caller, rather
+ * than on every call as the one-shot functions do.
+ */
+static int sha256(EVP_MD_CTX *ctx, const EVP_MD *md, const void *msg, size_t len,
+		  uint8_t *hash)
+{
+	return EVP_DigestInit_ex2(ctx, md, NULL) &&
+	       EVP_DigestUpdate(ctx, msg, len) &&
+	       EVP_DigestFinal_ex(ctx, hash, NULL);
+}
+
+int av_expected_mac(const struct av_entry *entry, const uint8_t *challenge,
+		    uint8_t *mac)
+{
+	struct mac_in in;
+	EVP_MD_CTX *ctx;
+	EVP_MD *md;
+	int ret = -1;
+
+	ctx = EVP_MD_CTX_new();
+	md = EVP_MD_fetch(NULL, "SHA256", NULL);
+	if (ctx && md) {
+		build_mac_in(entry, challenge, &in);
+		if (sha256(ctx, md, &in, sizeof(in), mac))
+			ret = 0;
+		OPENSSL_cleanse(&in, sizeof(in));
+	}
+
+	EVP_MD_free(md);
+	EVP_MD_CTX_free(ctx);
+	return ret;
+}
+
+static int verify_one(struct av_table *table, const struct av_response *resp,
+		      EVP_MD_CTX *ctx, const EVP_MD *md, uint64_t now)
+{
+	struct av_entry *entry;
+	struct mac_in in;
+	uint8_t mac[S96AT_MAC_LEN];
+	int ok;
+
+	entry = av_table_find(table, resp->sn);
+	if (!entry)
+		return AV_UNKNOWN_DEVICE;
+
+	if (consume_challenge(entry, resp->challenge, now))
+		return AV_BAD_CHALLENGE;
+
+	build_mac_in(entry, resp->challenge, &in);
+	ok = sha256(ctx, md, &in, sizeof(in), mac);
+	OPENSSL_cleanse(&in, sizeof(in));
+	if (!ok)
+		return AV_ERROR;
+
+	return CRYPTO_memcmp(mac, resp->mac, sizeof(mac)) ? AV_BAD_MAC : AV_OK;
+}
+
+int av_verify(struct av_table *table, const struct av_response *resp)
+{
+	EVP_MD_CTX *ctx;
+	EVP_MD *md;
+	int ret = AV_ERROR;
+
+	ctx = EVP_MD_CTX_new();
+	md = EVP_MD_fetch(NULL, "SHA256", NULL);
+	if (ctx && md)
+		ret = verify_one(table, resp, ctx, md, now_ms());
+
+	EVP_MD_free(md);
+	EVP_MD_CTX_free(ctx);
+	return ret;
+}
+
+static void *verify_thread(void *arg)
+{
+	struct verify_job *job = arg;
+	EVP_MD_CTX *ctx;
+	EVP_MD *md;
+	uint64_t now = now_ms();
+
+	ctx = EVP_MD_CTX_new();
+	md = EVP_MD_fetch(NULL, "SHA256", NULL);
+	for (size_t i = job->start; i < job->end; i++) {
+		if (!ctx || !md)
+			job->results[i] = AV_ERROR;
+		else
+			job->results[i] = verify_one(job->table, &job->resp[i], ctx, md, now);
+	}
+
+	EVP_MD_free(md);
+	EVP_MD_CTX_free(ctx);
+	return NULL;
+}
+
+/* Verify a batch of responses, split in contiguous chunks across threads.
+ * Each thread reuses one digest context for its whole chunk.
+ */
+void av_verify_batch(struct av_table *table, const struct av_response *resp,
+		     size_t num, int *results, int num_threads)
+{
+	pthread_t threads[AV_MAX_THREADS];
+	struct verify_job jobs[AV_MAX_THREADS];
+	size_t chunk;
+	int started = 0;
+
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > AV_MAX_THREADS)
+		num_threads = AV_MAX_THREADS;
+	if (num_threads > num)
+		num_threads = num ? num : 1;
+
+	chunk = (num + num_threads - 1) / num_threads;
+	for (int i = 0; i < num_threads; i++) {
+		jobs[i].table = table;
+		jobs[i].resp = resp;
+		jobs[i].results = results;
+		jobs[i].start = i * chunk;
+		jobs[i].end = (i + 1) * chunk < num ? (i + 1) * chunk : num;
+		if (jobs[i].start >= jobs[i].end)
+			break;
+
+		/* The last chunk, or any chunk a thread cannot be started
+		 * for, is done on the calling thread.
+		 */
+		if (jobs[i].end == num ||
+		    pthread_create(&threads[started], NULL, verify_thread, &jobs[i])) {
+			jobs[i].end = num;
+			verify_thread(&jobs[i]);
+			break;
+		}
+		started++;
+	}
+
+	for (int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+}
@@ -0,0 +1,79 @@
+#ifndef __AUTHVERIFY_H
+#define __AUTHVERIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#define AV_KEY_LEN		32
+#define AV_MAX_THREADS		64
+
+/* How long a challenge can be answered after it was issued */
+#define AV_CHALLENGE_TTL_MS	10000
+
+/* Verification results */
+#define AV_OK			0
+#define AV_UNKNOWN_DEVICE	1
+#define AV_BAD_MAC		2
+#define AV_ERROR		3
+#define AV_BAD_CHALLENGE	4	/* Not issued, already used or expired */
+
+/* One entry per device. A probe only reads the serial number and the
+ * used flag, in the first cache line of the entry. The challenge the
+ * device was last sent is kept with it, until a response consumes it.
+ */
+struct __attribute__((aligned(64))) av_entry {
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint8_t slot;		/* Slot holding the key on the device */
+	uint8_t used;
+	uint8_t pending;	/* challenge was issued, and not answered yet */
+	uint8_t reserved[4];
+	uint8_t key[AV_KEY_LEN];
+	uint64_t expires_ms;
+	uint8_t challenge[S96AT_CHALLENGE_LEN];
+};
+
+/* Open-addressed hash table of devices, indexed by serial number */
+struct av_table {
+	struct av_entry *entries;
+	size_t mask;		/* Capacity - 1, capacity is a power of 2 */
+	size_t num;
+};
+
+/* What a device returns for a challenge */
+struct av_response {
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint8_t challenge[S96AT_CHALLENGE_LEN];
+	uint8_t mac[S96AT_MAC_LEN];
+};
+
+int av_table_init(struct av_table *table, size_t num_devices);
+
+int av_table_add(struct av_table *table, const uint8_t *sn, uint8_t slot,
+		 const uint8_t *key);
+
+const struct av_entry *av_table_lookup(const struct av_table *table, const uint8_t *sn);
+
+void av_table_free(struct av_table *table);
+
+/* Generate a random challenge for the device sn, and remember it until a
+ * response consumes it or AV_CHALLENGE_TTL_MS pass. A new challenge
+ * replaces the one pending, if any. Must not run concurrently with a
+ * verification for the same device. Returns 0, or -1 if the device is
+ * unknown or no random bytes are available.
+ */
+int av_challenge(struct av_table *table, const uint8_t *sn, uint8_t *challenge);
+
+int av_expected_mac(const struct av_entry *entry, const uint8_t *challenge,
+		    uint8_t *mac);
+
+/* A response is only checked if it answers the challenge pending for its
+ * device, and that challenge is consumed, whether the MAC is good or not.
+ */
+int av_verify(struct av_table *table, const struct av_response *resp);
+
+void av_verify_batch(struct av_table *table, const struct av_response *resp,
+		     size_t num, int *results, int num_threads);
+
+#endif
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <secure96/s96at.h>
+
+#include <authverify.h>
+
+#define BENCH_DEVICES		100000
+#define BENCH_ROUNDS		10
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s device <slot>\n", progname);
+	fprintf(stderr, "       %s bench [num_responses] [num_threads]\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "device challenges the ATSHA204A to compute a MAC with the key in <slot>\n");
+	fprintf(stderr, "and verifies the response\n");
+	fprintf(stderr, "bench verifies synthetic responses from up to %d devices, one each,\n", BENCH_DEVICES);
+	fprintf(stderr, "and reports the verifications per second\n");
+}
+
+static void print_hex(FILE *fp, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		fprintf(fp, "%02x", buf[i]);
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *result_str(int result)
+{
+	switch (result) {
+	case AV_OK:
+		return "OK";
+	case AV_UNKNOWN_DEVICE:
+		return "unknown device";
+	case AV_BAD_MAC:
+		return "bad MAC";
+	case AV_BAD_CHALLENGE:
+		return "bad challenge";
+	default:
+		return "error";
+	}
+}
+
+/* The key of each slot is set to the slot number repeated, as programmed
+ * by the personalization example.
+ */
+static void slot_key(uint8_t slot, uint8_t *key)
+{
+	memset(key, slot * 0x11, AV_KEY_LEN);
+}
+
+static int run_device(uint8_t slot)
+{
+	int result = AV_ERROR;
+	uint8_t ret;
+	uint8_t key[AV_KEY_LEN];
+	struct av_table table = { 0 };
+	struct av_response resp;
+	struct s96at_desc desc;
+
+	if (slot > 15) {
+		fprintf(stderr, "Invalid slot %u\n", slot);
+		return -1;
+	}
+
+	ret = s96at_init(S96AT_ATSHA204A, S96AT_IO_I2C_LINUX, &desc);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize the device\n");
+		return -1;
+	}
+
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	ret = s96at_get_serialnbr(&desc, resp.sn);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read the serial number\n");
+		goto out;
+	}
+
+	if (av_table_init(&table, 1)) {
+		fprintf(stderr, "Could not allocate the device table\n");
+		goto out;
+	}
+
+	slot_key(slot, key);
+	av_table_add(&table, resp.sn, slot, key);
+	memset(key, 0, sizeof(key));
+
+	if (av_challenge(&table, resp.sn, resp.challenge)) {
+		fprintf(stderr, "Could not generate a challenge\n");
+		goto out;
+	}
+
+	ret = s96at_gen_mac(&desc, S96AT_MAC_MODE_0, slot, resp.challenge, resp.mac);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not generate MAC\n");
+		goto out;
+	}
+
+	result = av_verify(&table, &resp);
+
+	printf("SN:        ");
+	print_hex(stdout, resp.sn, sizeof(resp.sn));
+	printf("\nChallenge: ");
+	print_hex(stdout, resp.challenge, sizeof(resp.challenge));
+	printf("\nMAC:       ");
+	print_hex(stdout, resp.mac, sizeof(resp.mac));
+	printf("\nResult:    %s\n", result_str(result));
+
+out:
+	av_table_free(&table);
+	s96at_sleep(&desc);
+	s96at_cleanup(&desc);
+
+	return result == AV_OK ? 0 : -1;
+}
+
+/* Issue a challenge to the device of each response, and answer it with
+ * the same code that verifies it. One response in 16 has its MAC
+ * corrupted, one in 64 comes from an unknown device, and one in 128
+ * answers a challenge that was not issued, to exercise the failure paths.
+ */
+static int bench_responses(struct av_table *table, uint8_t (*sn)[S96AT_SERIAL_NUMBER_LEN],
+			   struct av_response *resp, size_t num)
+{
+	const struct av_entry *entry;
+
+	/* 7919 is prime to BENCH_DEVICES, so each response has its own
+	 * device, spread over the table.
+	 */
+	for (size_t i = 0; i < num; i++) {
+		memcpy(resp[i].sn, sn[(i * 7919) % BENCH_DEVICES], sizeof(resp[i].sn));
+		if (av_challenge(table, resp[i].sn, resp[i].challenge)) {
+			fprintf(stderr, "Could not generate a challenge\n");
+			return -1;
+		}
+		entry = av_table_lookup(table, resp[i].sn);
+		av_expected_mac(entry, resp[i].challenge, resp[i].mac);
+		if (i % 16 == 15)
+			resp[i].mac[0] ^= 0x01;
+		if (i % 64 == 63)
+			resp[i].sn[8] = 0xff;
+		if (i % 128 == 64)
+			resp[i].challenge[0] ^= 0x01;
+	}
+
+	return 0;
+}
+
+/* The host side of the challenges is done before each round, so the
+ * benchmark measures verification throughput only. A challenge is
+ * consumed by its response, so each round issues new ones.
+ */
+static int run_bench(size_t num, int num_threads)
+{
+	int ret = -1;
+	int *results = NULL;
+	size_t counts[AV_BAD_CHALLENGE + 1] = { 0 };
+	double best = 0;
+	double t;
+	uint8_t (*sn)[S96AT_SERIAL_NUMBER_LEN] = NULL;
+	uint8_t key[AV_KEY_LEN];
+	struct av_table table = { 0 };
+	struct av_response *resp = NULL;
+
+	sn = calloc(BENCH_DEVICES, sizeof(*sn));
+	resp = calloc(num, sizeof(*resp));
+	results = calloc(num, sizeof(*results));
+	if (!sn || !resp || !results || av_table_init(&table, BENCH_DEVICES)) {
+		fprintf(stderr, "Could not allocate %zu responses\n", num);
+		goto out;
+	}
+
+	for (size_t i = 0; i < BENCH_DEVICES; i++) {
+		sn[i][0] = 0x01;
+		sn[i][1] = 0x23;
+		memcpy(&sn[i][2], &i, sizeof(uint32_t));
+		sn[i][8] = 0xee;
+		for (int j = 0; j < AV_KEY_LEN; j++)
+			key[j] = i * 31 + j;
+		av_table_add(&table, sn[i], i % 16, key);
+	}
+
+	printf("Verifying %zu responses from %zu devices on %d threads\n",
+	       num, table.num, num_threads);
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		if (bench_responses(&table, sn, resp, num))
+			goto out;
+
+		t = now_s();
+		av_verify_batch(&table, resp, num, results, num_threads);
+		t = now_s() - t;
+		if (num / t > best)
+			best = num / t;
+	}
+
+	for (size_t i = 0; i < num; i++)
+		counts[results[i]]++;
+
+	printf("OK: %zu, bad MAC: %zu, bad challenge: %zu, unknown: %zu, error: %zu\n",
+	       counts[AV_OK], counts[AV_BAD_MAC], counts[AV_BAD_CHALLENGE],
+	       counts[AV_UNKNOWN_DEVICE], counts[AV_ERROR]);
+	printf("%.0f verifications/s, %.0f per thread (best of %d)\n",
+	       best, best / num_threads, BENCH_ROUNDS);
+
+	ret = counts[AV_ERROR] ? -1 : 0;
+out:
+	av_table_free(&table);
+	free(results);
+	free(resp);
+	free(sn);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+	int num_threads;
+	size_t num = BENCH_DEVICES;
+
+	progname = argv[0];
+
+	if (argc < 2) {
+		usage();
+		return -1;
+	}
+
+	if (!strcmp(argv[1], "device")) {
+		if (argc != 3) {
+			usage();
+			return -1;
+		}
+		ret = run_device(strtoul(argv[2], NULL, 0));
+	} else if (!strcmp(argv[1], "bench")) {
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (argc > 2)
+			num = strtoul(argv[2], NULL, 0);
+		if (argc > 3)
+			num_threads = strtol(argv[3], NULL, 0);
+		if (!num || num > BENCH_DEVICES ||
+		    num_threads < 1 || num_threads > AV_MAX_THREADS) {
+			usage();
+			return -1;
+		}
+		ret = run_bench(num, num_threads);
+	} else {
+		usage();
+		return -1;
+	}
+
+	return ret;
+}
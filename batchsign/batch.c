@@ -0,0 +1,231 @@
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <batch.h>
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Sign the root of the batch. The root is loaded into TempKey using Nonce
+ * in passthrough mode, so that a single Sign in External mode covers
+ * every record of the batch.
+ */
+static uint8_t sign_root(struct batch_signer *bs, const uint8_t *root,
+			 struct s96at_ecdsa_sig *sig)
+{
+	uint8_t ret;
+	uint8_t num_in[S96AT_RANDOM_LEN];
+
+	memcpy(num_in, root, S96AT_RANDOM_LEN);
+
+	while (s96at_wake(bs->desc) != S96AT_STATUS_READY) {};
+
+	ret = s96at_gen_nonce(bs->desc, S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Nonce failed\n");
+		goto out;
+	}
+
+	ret = s96at_sign(bs->desc, S96AT_SIGN_MODE_EXTERNAL, bs->slot,
+			 S96AT_FLAG_NONE, sig);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Sign failed\n");
+		goto out;
+	}
+out:
+	s96at_idle(bs->desc);
+	return ret;
+}
+
+int batch_init(struct batch_signer *bs, struct s96at_desc *desc, uint8_t slot,
+	       size_t max_batch, unsigned int window_ms)
+{
+	if (max_batch == 0 || max_batch > MERKLE_MAX_LEAVES)
+		return -1;
+
+	memset(bs, 0, sizeof(*bs));
+	bs->desc = desc;
+	bs->slot = slot;
+	bs->max_batch = max_batch;
+	bs->window_ms = window_ms;
+
+	bs->reqs = calloc(max_batch, sizeof(struct batch_req));
+	if (!bs->reqs)
+		return -1;
+
+	return 0;
+}
+
+/* Queue a record for signing. The callback runs once the batch holding
+ * the record has been signed, either because the batch is full or
+ * because the caller flushed it after batch_timeout_ms() expired.
+ */
+int batch_submit(struct batch_signer *bs, const void *data, size_t len,
+		 batch_cb cb, void *arg)
+{
+	struct batch_req *req = &bs->reqs[bs->num_reqs++];
+
+	merkle_hash_leaf(data, len, req->leaf);
+	req->arrival_us = now_us();
+	req->cb = cb;
+	req->arg = arg;
+
+	if (bs->num_reqs == bs->max_batch)
+		return batch_flush(bs);
+
+	return 0;
+}
+
+/* Time left until the oldest pending record exceeds the batching window,
+ * or -1 if nothing is pending. Suitable as a poll() timeout.
+ */
+int batch_timeout_ms(struct batch_signer *bs)
+{
+	uint64_t waited;
+
+	if (!bs->num_reqs)
+		return -1;
+
+	waited = (now_us() - bs->reqs[0].arrival_us) / 1000;
+	if (waited >= bs->window_ms)
+		return 0;
+
+	return bs->window_ms - waited;
+}
+
+int batch_flush(struct batch_signer *bs)
+{
+	int ret;
+	uint8_t status;
+	uint64_t start, end;
+	uint8_t (*leaves)[MERKLE_HASH_LEN];
+	struct merkle_tree tree;
+	struct batch_result res;
+
+	if (!bs->num_reqs)
+		return 0;
+
+	leaves = malloc(bs->num_reqs * MERKLE_HASH_LEN);
+	if (!leaves)
+		return -1;
+
+	for (size_t i = 0; i < bs->num_reqs; i++)
+		memcpy(leaves[i], bs->reqs[i].leaf, MERKLE_HASH_LEN);
+
+	ret = merkle_build(&tree, (const uint8_t (*)[MERKLE_HASH_LEN])leaves,
+			   bs->num_reqs);
+	free(leaves);
+	if (ret)
+		return ret;
+
+	memcpy(res.root, merkle_root(&tree), MERKLE_HASH_LEN);
+
+	start = now_us();
+	status = sign_root(bs, res.root, &res.sig);
+	end = now_us();
+
+	bs->stats.batches++;
+	bs->stats.device_ops++;
+	bs->stats.device_us += end - start;
+
+	for (size_t i = 0; i < bs->num_reqs; i++) {
+		struct batch_req *req = &bs->reqs[i];
+		uint64_t latency = end - req->arrival_us;
+
+		merkle_get_proof(&tree, i, &res.proof);
+		req->cb(req->arg, &res, status);
+
+		bs->stats.records++;
+		if (status != S96AT_STATUS_OK)
+			bs->stats.failed++;
+		bs->stats.latency_us += latency;
+		if (latency > bs->stats.max_latency_us)
+			bs->stats.max_latency_us = latency;
+	}
+
+	bs->num_reqs = 0;
+	merkle_free(&tree);
+
+	return status == S96AT_STATUS_OK ? 0 : -1;
+}
+
+void batch_print_stats(struct batch_signer *bs, FILE *fp)
+{
+	struct batch_stats *s = &bs->stats;
+
+	fprintf(fp, "Records:            %llu (%llu failed)\n",
+		(unsigned long long)s->records, (unsigned long long)s->failed);
+	fprintf(fp, "Batches:            %llu\n", (unsigned long long)s->batches);
+	fprintf(fp, "Device ops:         %llu\n", (unsigned long long)s->device_ops);
+	if (!s->device_ops || !s->records)
+		return;
+	fprintf(fp, "Signatures/op:      %.1f\n", (double)s->records / s->device_ops);
+	fprintf(fp, "Device time/op:     %.1f ms\n", s->device_us / 1000.0 / s->device_ops);
+	fprintf(fp, "Latency avg / max:  %.1f / %.1f ms\n",
+		s->latency_us / 1000.0 / s->records, s->max_latency_us / 1000.0);
+}
+
+void batch_free(struct batch_signer *bs)
+{
+	free(bs->reqs);
+	bs->reqs = NULL;
+}
+
+/* Check a record against a batch result: recompute the root from the
+ * record and its proof, and verify the device signature over the root.
+ * The root is the message digest, so no hashing is done by the verifier.
+ */
+int batch_verify(EVP_PKEY *pub, const void *data, size_t len,
+		 const struct batch_result *res)
+{
+	int ret = -1;
+	uint8_t leaf[MERKLE_HASH_LEN];
+	uint8_t root[MERKLE_HASH_LEN];
+	uint8_t *der = NULL;
+	int der_len;
+	BIGNUM *r, *s;
+	ECDSA_SIG *sig;
+	EVP_PKEY_CTX *ctx = NULL;
+
+	merkle_hash_leaf(data, len, leaf);
+	if (merkle_proof_root(leaf, &res->proof, root))
+		return -1;
+
+	if (memcmp(root, res->root, MERKLE_HASH_LEN))
+		return -1;
+
+	sig = ECDSA_SIG_new();
+	r = BN_bin2bn(res->sig.r, S96AT_ECDSA_R_LEN, NULL);
+	s = BN_bin2bn(res->sig.s, S96AT_ECDSA_S_LEN, NULL);
+	if (!sig || !r || !s || !ECDSA_SIG_set0(sig, r, s)) {
+		BN_free(r);
+		BN_free(s);
+		goto out;
+	}
+
+	der_len = i2d_ECDSA_SIG(sig, &der);
+	if (der_len <= 0)
+		goto out;
+
+	ctx = EVP_PKEY_CTX_new(pub, NULL);
+	if (!ctx || EVP_PKEY_verify_init(ctx) <= 0)
+		goto out;
+
+	if (EVP_PKEY_verify(ctx, der, der_len, root, MERKLE_HASH_LEN) == 1)
+		ret = 0;
+out:
+	EVP_PKEY_CTX_free(ctx);
+	OPENSSL_free(der);
+	ECDSA_SIG_free(sig);
+	return ret;
+}
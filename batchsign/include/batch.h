@@ -0,0 +1,70 @@
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include <openssl/evp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#include <merkle.h>
+
+#define BATCH_DEFAULT_SIZE	256	/* Max records per device signature */
+#define BATCH_DEFAULT_WINDOW_MS	50	/* Max time a record waits for its batch */
+
+/* What a caller gets back for a record: the signature over the root of
+ * the batch, and the proof that the record is part of that batch.
+ */
+struct batch_result {
+	uint8_t root[MERKLE_HASH_LEN];
+	struct s96at_ecdsa_sig sig;
+	struct merkle_proof proof;
+};
+
+typedef void (*batch_cb)(void *arg, const struct batch_result *res, uint8_t status);
+
+struct batch_req {
+	uint8_t leaf[MERKLE_HASH_LEN];
+	uint64_t arrival_us;
+	batch_cb cb;
+	void *arg;
+};
+
+struct batch_stats {
+	uint64_t records;
+	uint64_t batches;
+	uint64_t device_ops;	/* Sign commands issued */
+	uint64_t failed;	/* Records in batches that failed to sign */
+	uint64_t device_us;	/* Time spent in Nonce + Sign */
+	uint64_t latency_us;	/* Sum of submit-to-callback latencies */
+	uint64_t max_latency_us;
+};
+
+struct batch_signer {
+	struct s96at_desc *desc;
+	uint8_t slot;
+	size_t max_batch;
+	unsigned int window_ms;
+	struct batch_req *reqs;
+	size_t num_reqs;
+	struct batch_stats stats;
+};
+
+int batch_init(struct batch_signer *bs, struct s96at_desc *desc, uint8_t slot,
+	       size_t max_batch, unsigned int window_ms);
+
+int batch_submit(struct batch_signer *bs, const void *data, size_t len,
+		 batch_cb cb, void *arg);
+
+int batch_timeout_ms(struct batch_signer *bs);
+
+int batch_flush(struct batch_signer *bs);
+
+void batch_print_stats(struct batch_signer *bs, FILE *fp);
+
+void batch_free(struct batch_signer *bs);
+
+int batch_verify(EVP_PKEY *pub, const void *data, size_t len,
+		 const struct batch_result *res);
+
+#endif
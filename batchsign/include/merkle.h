@@ -0,0 +1,50 @@
+#ifndef __MERKLE_H
+#define __MERKLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MERKLE_HASH_LEN		32
+#define MERKLE_MAX_DEPTH	16
+#define MERKLE_MAX_LEAVES	(1 << MERKLE_MAX_DEPTH)
+
+/* Leaves and inner nodes are hashed with a different prefix, so that an
+ * inner node can never be presented as a leaf (RFC 6962, Sect. 2.1).
+ */
+#define MERKLE_LEAF_PREFIX	0x00
+#define MERKLE_NODE_PREFIX	0x01
+
+struct merkle_tree {
+	size_t num_leaves;
+	int depth;
+	size_t level_off[MERKLE_MAX_DEPTH + 1];	/* Offset of each level in nodes */
+	uint8_t (*nodes)[MERKLE_HASH_LEN];	/* All levels, leaves first */
+};
+
+/* Inclusion proof of a leaf. A node without a sibling is promoted to the
+ * next level unchanged, so the number of siblings depends on the position
+ * of the leaf; it is recovered from index and num_leaves.
+ */
+struct merkle_proof {
+	uint32_t index;
+	uint32_t num_leaves;
+	int num_siblings;
+	uint8_t siblings[MERKLE_MAX_DEPTH][MERKLE_HASH_LEN];
+};
+
+void merkle_hash_leaf(const void *data, size_t len, uint8_t *hash);
+
+int merkle_build(struct merkle_tree *tree, const uint8_t (*leaves)[MERKLE_HASH_LEN],
+		 size_t num_leaves);
+
+const uint8_t *merkle_root(const struct merkle_tree *tree);
+
+int merkle_get_proof(const struct merkle_tree *tree, size_t index,
+		     struct merkle_proof *proof);
+
+int merkle_proof_root(const uint8_t *leaf, const struct merkle_proof *proof,
+		      uint8_t *root);
+
+void merkle_free(struct merkle_tree *tree);
+
+#endif
@@ -0,0 +1,333 @@
+#include <getopt.h>
+#include <openssl/pem.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <secure96/s96at.h>
+
+#include <batch.h>
+
+#define LINE_LEN_MAX	4096
+
+struct line_reader {
+	int fd;
+	char buf[LINE_LEN_MAX];
+	size_t len;
+	int eof;
+};
+
+struct record {
+	char *data;
+	size_t len;
+};
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s sign [-n batch_size] [-w window_ms] slot_priv\n", progname);
+	fprintf(stderr, "       %s verify pub.pem\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "sign reads one record per line from stdin and prints one line per\n");
+	fprintf(stderr, "record: root signature index num_leaves siblings record\n");
+	fprintf(stderr, "verify reads the output of sign from stdin and checks each line\n");
+}
+
+static void print_hex(FILE *fp, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		fprintf(fp, "%02x", buf[i]);
+}
+
+static int parse_hex(const char *str, uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (sscanf(str + 2 * i, "%2hhx", &buf[i]) != 1)
+			return -1;
+	}
+	return 0;
+}
+
+/* Return the next complete line in the buffer, without the newline, or
+ * NULL if none is available yet. The line is valid until the next call.
+ */
+static char *next_line(struct line_reader *lr, size_t *consumed)
+{
+	char *nl = memchr(lr->buf, '\n', lr->len);
+
+	if (!nl) {
+		if (!lr->eof && lr->len < sizeof(lr->buf) - 1)
+			return NULL;
+		if (!lr->len)
+			return NULL;
+		nl = lr->buf + lr->len; /* Last line without newline, or too long */
+	}
+
+	*nl = '\0';
+	*consumed = nl - lr->buf + 1;
+	return lr->buf;
+}
+
+static void drop_line(struct line_reader *lr, size_t consumed)
+{
+	if (consumed > lr->len)
+		consumed = lr->len;
+	memmove(lr->buf, lr->buf + consumed, lr->len - consumed);
+	lr->len -= consumed;
+}
+
+static int fill(struct line_reader *lr, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = lr->fd, .events = POLLIN };
+	ssize_t n;
+
+	if (poll(&pfd, 1, timeout_ms) <= 0)
+		return 0;
+
+	n = read(lr->fd, lr->buf + lr->len, sizeof(lr->buf) - 1 - lr->len);
+	if (n <= 0)
+		lr->eof = 1;
+	else
+		lr->len += n;
+
+	return n;
+}
+
+static void sign_done(void *arg, const struct batch_result *res, uint8_t status)
+{
+	struct record *rec = arg;
+
+	if (status != S96AT_STATUS_OK) {
+		fprintf(stderr, "Failed to sign record: %.*s\n", (int)rec->len, rec->data);
+		goto out;
+	}
+
+	print_hex(stdout, res->root, MERKLE_HASH_LEN);
+	printf(" ");
+	print_hex(stdout, res->sig.r, S96AT_ECDSA_R_LEN);
+	print_hex(stdout, res->sig.s, S96AT_ECDSA_S_LEN);
+	printf(" %u %u ", res->proof.index, res->proof.num_leaves);
+	if (!res->proof.num_siblings)
+		printf("-");
+	for (int i = 0; i < res->proof.num_siblings; i++) {
+		if (i)
+			printf(":");
+		print_hex(stdout, res->proof.siblings[i], MERKLE_HASH_LEN);
+	}
+	printf(" %.*s\n", (int)rec->len, rec->data);
+out:
+	free(rec->data);
+	free(rec);
+}
+
+static int do_sign(int argc, char *argv[])
+{
+	int ret;
+	int opt;
+	uint8_t slot;
+	size_t max_batch = BATCH_DEFAULT_SIZE;
+	unsigned int window_ms = BATCH_DEFAULT_WINDOW_MS;
+	struct s96at_desc desc;
+	struct batch_signer bs;
+	struct line_reader lr = { .fd = STDIN_FILENO };
+
+	while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+		switch (opt) {
+		case 'n':
+			max_batch = atoi(optarg);
+			break;
+		case 'w':
+			window_ms = atoi(optarg);
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage();
+		return -1;
+	}
+
+	slot = atoi(argv[optind]);
+	if (slot > 15) {
+		fprintf(stderr, "Invalid slot: %d\n", slot);
+		return -1;
+	}
+
+	ret = s96at_init(S96AT_ATECC508A, S96AT_IO_I2C_LINUX, &desc);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize descriptor\n");
+		return ret;
+	}
+
+	ret = batch_init(&bs, &desc, slot, max_batch, window_ms);
+	if (ret) {
+		fprintf(stderr, "Invalid batch size: %zu\n", max_batch);
+		goto out;
+	}
+
+	while (!lr.eof || lr.len) {
+		size_t consumed;
+		char *line;
+		struct record *rec;
+
+		line = next_line(&lr, &consumed);
+		if (!line) {
+			/* Wait for more input, but no longer than the oldest
+			 * pending record is allowed to wait for its batch.
+			 */
+			if (!fill(&lr, batch_timeout_ms(&bs)))
+				ret |= batch_flush(&bs);
+			continue;
+		}
+
+		rec = malloc(sizeof(*rec));
+		if (!rec) {
+			ret = -1;
+			break;
+		}
+		rec->len = strlen(line);
+		rec->data = strdup(line);
+		if (!rec->data) {
+			free(rec);
+			ret = -1;
+			break;
+		}
+		drop_line(&lr, consumed);
+
+		ret |= batch_submit(&bs, rec->data, rec->len, sign_done, rec);
+		if (!batch_timeout_ms(&bs))
+			ret |= batch_flush(&bs);
+	}
+	ret |= batch_flush(&bs);
+	fflush(stdout);
+
+	batch_print_stats(&bs, stderr);
+	batch_free(&bs);
+out:
+	if (s96at_cleanup(&desc) != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not cleanup\n");
+		ret = -1;
+	}
+
+	return ret;
+}
+
+static int parse_result(char *line, struct batch_result *res, char **data)
+{
+	char *root, *sig, *index, *num_leaves, *siblings;
+	char *save;
+
+	root = strtok_r(line, " ", &save);
+	sig = strtok_r(NULL, " ", &save);
+	index = strtok_r(NULL, " ", &save);
+	num_leaves = strtok_r(NULL, " ", &save);
+	siblings = strtok_r(NULL, " ", &save);
+	*data = strtok_r(NULL, "", &save);
+	if (!siblings)
+		return -1;
+	if (!*data)
+		*data = "";
+
+	if (strlen(root) != 2 * MERKLE_HASH_LEN ||
+	    parse_hex(root, res->root, MERKLE_HASH_LEN))
+		return -1;
+
+	if (strlen(sig) != 2 * (S96AT_ECDSA_R_LEN + S96AT_ECDSA_S_LEN) ||
+	    parse_hex(sig, res->sig.r, S96AT_ECDSA_R_LEN) ||
+	    parse_hex(sig + 2 * S96AT_ECDSA_R_LEN, res->sig.s, S96AT_ECDSA_S_LEN))
+		return -1;
+
+	res->proof.index = strtoul(index, NULL, 10);
+	res->proof.num_leaves = strtoul(num_leaves, NULL, 10);
+	res->proof.num_siblings = 0;
+
+	if (!strcmp(siblings, "-"))
+		return 0;
+
+	for (char *s = strtok_r(siblings, ":", &save); s; s = strtok_r(NULL, ":", &save)) {
+		if (res->proof.num_siblings == MERKLE_MAX_DEPTH ||
+		    strlen(s) != 2 * MERKLE_HASH_LEN)
+			return -1;
+		if (parse_hex(s, res->proof.siblings[res->proof.num_siblings++],
+			      MERKLE_HASH_LEN))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int do_verify(int argc, char *argv[])
+{
+	FILE *fp;
+	EVP_PKEY *pub;
+	char line[2 * LINE_LEN_MAX];
+	char *data;
+	struct batch_result res;
+	unsigned int good = 0, bad = 0;
+
+	if (argc != 2) {
+		usage();
+		return -1;
+	}
+
+	fp = fopen(argv[1], "r");
+	if (!fp) {
+		perror("fopen");
+		return -1;
+	}
+
+	pub = PEM_read_PUBKEY(fp, NULL, NULL, NULL);
+	fclose(fp);
+	if (!pub) {
+		fprintf(stderr, "Could not read Public Key\n");
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), stdin)) {
+		line[strcspn(line, "\n")] = '\0';
+
+		if (parse_result(line, &res, &data)) {
+			fprintf(stderr, "Malformed line\n");
+			bad++;
+			continue;
+		}
+
+		if (batch_verify(pub, data, strlen(data), &res)) {
+			printf("FAIL %s\n", data);
+			bad++;
+		} else {
+			printf("OK   %s\n", data);
+			good++;
+		}
+	}
+
+	fprintf(stderr, "%u verified, %u failed\n", good, bad);
+	EVP_PKEY_free(pub);
+
+	return bad ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	progname = argv[0];
+
+	if (argc < 2) {
+		usage();
+		return -1;
+	}
+
+	if (!strcmp(argv[1], "sign"))
+		return do_sign(argc - 1, argv + 1);
+	else if (!strcmp(argv[1], "verify"))
+		return do_verify(argc - 1, argv + 1);
+
+	usage();
+	return -1;
+}
@@ -0,0 +1,145 @@
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <merkle.h>
+
+static void hash_node(const uint8_t *left, const uint8_t *right, uint8_t *hash)
+{
+	uint8_t buf[1 + 2 * MERKLE_HASH_LEN];
+
+	buf[0] = MERKLE_NODE_PREFIX;
+	memcpy(buf + 1, left, MERKLE_HASH_LEN);
+	memcpy(buf + 1 + MERKLE_HASH_LEN, right, MERKLE_HASH_LEN);
+	SHA256(buf, sizeof(buf), hash);
+}
+
+void merkle_hash_leaf(const void *data, size_t len, uint8_t *hash)
+{
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+	uint8_t prefix = MERKLE_LEAF_PREFIX;
+
+	EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+	EVP_DigestUpdate(ctx, &prefix, 1);
+	EVP_DigestUpdate(ctx, data, len);
+	EVP_DigestFinal_ex(ctx, hash, NULL);
+	EVP_MD_CTX_free(ctx);
+}
+
+int merkle_build(struct merkle_tree *tree, const uint8_t (*leaves)[MERKLE_HASH_LEN],
+		 size_t num_leaves)
+{
+	size_t total = 0;
+	size_t n;
+	int depth = 0;
+
+	if (num_leaves == 0 || num_leaves > MERKLE_MAX_LEAVES)
+		return -1;
+
+	/* Every level holds ceil(n / 2) nodes of the level below */
+	for (n = num_leaves; ; n = (n + 1) / 2) {
+		tree->level_off[depth] = total;
+		total += n;
+		if (n == 1)
+			break;
+		depth++;
+	}
+
+	tree->nodes = malloc(total * MERKLE_HASH_LEN);
+	if (!tree->nodes)
+		return -1;
+
+	tree->num_leaves = num_leaves;
+	tree->depth = depth;
+	memcpy(tree->nodes, leaves, num_leaves * MERKLE_HASH_LEN);
+
+	n = num_leaves;
+	for (int l = 0; l < depth; l++) {
+		uint8_t (*cur)[MERKLE_HASH_LEN] = tree->nodes + tree->level_off[l];
+		uint8_t (*next)[MERKLE_HASH_LEN] = tree->nodes + tree->level_off[l + 1];
+
+		for (size_t i = 0; i < n / 2; i++)
+			hash_node(cur[2 * i], cur[2 * i + 1], next[i]);
+		if (n & 1)
+			memcpy(next[n / 2], cur[n - 1], MERKLE_HASH_LEN);
+		n = (n + 1) / 2;
+	}
+
+	return 0;
+}
+
+const uint8_t *merkle_root(const struct merkle_tree *tree)
+{
+	return tree->nodes[tree->level_off[tree->depth]];
+}
+
+int merkle_get_proof(const struct merkle_tree *tree, size_t index,
+		     struct merkle_proof *proof)
+{
+	size_t n = tree->num_leaves;
+
+	if (index >= n)
+		return -1;
+
+	proof->index = index;
+	proof->num_leaves = n;
+	proof->num_siblings = 0;
+
+	for (int l = 0; l < tree->depth; l++) {
+		size_t sibling = index ^ 1;
+
+		if (sibling < n)
+			memcpy(proof->siblings[proof->num_siblings++],
+			       tree->nodes[tree->level_off[l] + sibling],
+			       MERKLE_HASH_LEN);
+		index >>= 1;
+		n = (n + 1) / 2;
+	}
+
+	return 0;
+}
+
+/* Recompute the root from a leaf hash and its inclusion proof. The caller
+ * compares the result with the signed root.
+ */
+int merkle_proof_root(const uint8_t *leaf, const struct merkle_proof *proof,
+		      uint8_t *root)
+{
+	uint8_t hash[MERKLE_HASH_LEN];
+	size_t index = proof->index;
+	size_t n = proof->num_leaves;
+	int s = 0;
+
+	if (index >= n || n > MERKLE_MAX_LEAVES)
+		return -1;
+
+	memcpy(hash, leaf, MERKLE_HASH_LEN);
+	while (n > 1) {
+		if ((index ^ 1) < n) {
+			if (s == proof->num_siblings)
+				return -1;
+			if (index & 1)
+				hash_node(proof->siblings[s], hash, hash);
+			else
+				hash_node(hash, proof->siblings[s], hash);
+			s++;
+		}
+		index >>= 1;
+		n = (n + 1) / 2;
+	}
+
+	if (s != proof->num_siblings)
+		return -1;
+
+	memcpy(root, hash, MERKLE_HASH_LEN);
+	return 0;
+}
+
+void merkle_free(struct merkle_tree *tree)
+{
+	free(tree->nodes);
+	tree->nodes = NULL;
+}
@@ -0,0 +1,138 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <certstore.h>
+
+/* FNV-1a of the serial number */
+static uint32_t hash_sn(const uint8_t *sn)
+{
+	uint32_t h = 0x811c9dc5;
+
+	for (int i = 0; i < CERT_SN_LEN; i++) {
+		h ^= sn[i];
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+int cert_cache_init(struct cert_cache *cache, uint32_t capacity)
+{
+	memset(cache, 0, sizeof(*cache));
+
+	if (!capacity)
+		return -1;
+
+	cache->num_buckets = 1;
+	while (cache->num_buckets < 2 * capacity)
+		cache->num_buckets <<= 1;
+
+	cache->entries = calloc(capacity, sizeof(*cache->entries));
+	cache->buckets = malloc(cache->num_buckets * sizeof(*cache->buckets));
+	if (!cache->entries || !cache->buckets) {
+		cert_cache_free(cache);
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < cache->num_buckets; i++)
+		cache->buckets[i] = -1;
+
+	cache->capacity = capacity;
+	cache->head = -1;
+	cache->tail = -1;
+	return 0;
+}
+
+void cert_cache_free(struct cert_cache *cache)
+{
+	free(cache->entries);
+	free(cache->buckets);
+	memset(cache, 0, sizeof(*cache));
+}
+
+static void list_unlink(struct cert_cache *cache, int32_t i)
+{
+	struct cert_cache_entry *e = &cache->entries[i];
+
+	if (e->prev >= 0)
+		cache->entries[e->prev].next = e->next;
+	else
+		cache->head = e->next;
+
+	if (e->next >= 0)
+		cache->entries[e->next].prev = e->prev;
+	else
+		cache->tail = e->prev;
+}
+
+static void list_push_front(struct cert_cache *cache, int32_t i)
+{
+	struct cert_cache_entry *e = &cache->entries[i];
+
+	e->prev = -1;
+	e->next = cache->head;
+	if (cache->head >= 0)
+		cache->entries[cache->head].prev = i;
+	cache->head = i;
+	if (cache->tail < 0)
+		cache->tail = i;
+}
+
+static void bucket_remove(struct cert_cache *cache, int32_t i)
+{
+	int32_t *p = &cache->buckets[hash_sn(cache->entries[i].sn) & (cache->num_buckets - 1)];
+
+	while (*p != i)
+		p = &cache->entries[*p].hnext;
+	*p = cache->entries[i].hnext;
+}
+
+/* Look a certificate up, and make it the most recently used */
+const struct cert_der *cert_cache_get(struct cert_cache *cache, const uint8_t *sn)
+{
+	int32_t i = cache->buckets[hash_sn(sn) & (cache->num_buckets - 1)];
+
+	while (i >= 0 && memcmp(cache->entries[i].sn, sn, CERT_SN_LEN))
+		i = cache->entries[i].hnext;
+
+	if (i < 0) {
+		cache->misses++;
+		return NULL;
+	}
+
+	cache->hits++;
+	if (cache->head != i) {
+		list_unlink(cache, i);
+		list_push_front(cache, i);
+	}
+	return &cache->entries[i].cert;
+}
+
+/* Return the entry to store the certificate of sn in, evicting the least
+ * recently used one if the cache is full. The serial number must not be
+ * in the cache already.
+ */
+struct cert_der *cert_cache_put(struct cert_cache *cache, const uint8_t *sn)
+{
+	int32_t i;
+	uint32_t b;
+	struct cert_cache_entry *e;
+
+	if (cache->num < cache->capacity) {
+		i = cache->num++;
+	} else {
+		i = cache->tail;
+		list_unlink(cache, i);
+		bucket_remove(cache, i);
+		cache->evictions++;
+	}
+
+	e = &cache->entries[i];
+	memcpy(e->sn, sn, CERT_SN_LEN);
+	b = hash_sn(sn) & (cache->num_buckets - 1);
+	e->hnext = cache->buckets[b];
+	cache->buckets[b] = i;
+	list_push_front(cache, i);
+
+	return &e->cert;
+}
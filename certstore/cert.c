@@ -0,0 +1,472 @@
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <certstore.h>
+
+/* Placeholders of the template certificates, replaced when a certificate
+ * is rebuilt.
+ */
+#define PH_SERIAL_BYTE		0x5a
+#define PH_NOT_BEFORE		"000101000000Z"
+#define PH_NOT_AFTER		"000102000000Z"
+#define PH_SIGNER_ID		"Signer FFFF"
+#define PH_SN			"ZZZZZZZZZZZZZZZZZZ"
+
+#define ROOT_CN			"Secure96 Root"
+#define SIGNER_CN		"Secure96 " PH_SIGNER_ID
+#define ORG			"Secure96"
+
+/* DER SubjectPublicKeyInfo of a P-256 key, up to the uncompressed point */
+static const uint8_t spki_p256_prefix[] = {
+	0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2a, 0x86,
+	0x48, 0xce, 0x3d, 0x02, 0x01, 0x06, 0x08, 0x2a,
+	0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03,
+	0x42, 0x00, 0x04
+};
+
+/* AlgorithmIdentifier of ecdsa-with-SHA256 */
+static const uint8_t ecdsa_with_sha256[] = {
+	0x30, 0x0a, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce,
+	0x3d, 0x04, 0x03, 0x02
+};
+
+static const char hex[] = "0123456789ABCDEF";
+
+EVP_PKEY *cert_pub_to_pkey(const uint8_t *pub)
+{
+	uint8_t der[sizeof(spki_p256_prefix) + CERT_PUB_LEN];
+	const uint8_t *p = der;
+
+	memcpy(der, spki_p256_prefix, sizeof(spki_p256_prefix));
+	memcpy(der + sizeof(spki_p256_prefix), pub, CERT_PUB_LEN);
+
+	return d2i_PUBKEY(NULL, &p, sizeof(der));
+}
+
+int cert_pkey_to_pub(EVP_PKEY *pkey, uint8_t *pub)
+{
+	uint8_t point[1 + CERT_PUB_LEN];
+	size_t len;
+
+	if (!EVP_PKEY_get_octet_string_param(pkey, "encoded-pub-key", point, sizeof(point), &len) ||
+	    len != sizeof(point) || point[0] != 0x04)
+		return -1;
+
+	memcpy(pub, point + 1, CERT_PUB_LEN);
+	return 0;
+}
+
+static size_t find(const uint8_t *buf, size_t len, const void *pattern, size_t pattern_len)
+{
+	for (size_t i = 0; i + pattern_len <= len; i++) {
+		if (!memcmp(buf + i, pattern, pattern_len))
+			return i;
+	}
+	return 0;
+}
+
+static int add_ext(X509 *x509, int nid, const char *value)
+{
+	X509_EXTENSION *ext;
+	int ret;
+
+	ext = X509V3_EXT_conf_nid(NULL, NULL, nid, value);
+	if (!ext)
+		return -1;
+	ret = X509_add_ext(x509, ext, -1) ? 0 : -1;
+	X509_EXTENSION_free(ext);
+	return ret;
+}
+
+/* Build a template from a certificate holding the placeholders, and find
+ * where they are in its TBSCertificate.
+ */
+static int template_init(struct cert_template *tpl, uint8_t id, const char *subject_cn,
+			 const char *issuer_cn, int ca)
+{
+	int ret = -1;
+	int len;
+	uint8_t serial[CERT_SERIAL_LEN];
+	uint8_t point[1 + CERT_PUB_LEN];
+	uint8_t *tbs = NULL;
+	EVP_PKEY *pkey;
+	X509 *x509 = NULL;
+	X509_NAME *name;
+	BIGNUM *bn = NULL;
+	ASN1_TIME *not_before = NULL;
+	ASN1_TIME *not_after = NULL;
+
+	memset(tpl, 0, sizeof(*tpl));
+	tpl->id = id;
+
+	/* Any key will do: the key signs the template, and its public key
+	 * is found and replaced.
+	 */
+	pkey = EVP_EC_gen("P-256");
+	x509 = X509_new();
+	if (!pkey || !x509 || cert_pkey_to_pub(pkey, point + 1))
+		goto out;
+	point[0] = 0x04;
+
+	memset(serial, PH_SERIAL_BYTE, sizeof(serial));
+	bn = BN_bin2bn(serial, sizeof(serial), NULL);
+	not_before = ASN1_UTCTIME_new();
+	not_after = ASN1_UTCTIME_new();
+	if (!bn || !not_before || !not_after ||
+	    !ASN1_UTCTIME_set_string(not_before, PH_NOT_BEFORE) ||
+	    !ASN1_UTCTIME_set_string(not_after, PH_NOT_AFTER) ||
+	    !X509_set_version(x509, 2) ||
+	    !BN_to_ASN1_INTEGER(bn, X509_get_serialNumber(x509)) ||
+	    !X509_set1_notBefore(x509, not_before) ||
+	    !X509_set1_notAfter(x509, not_after) ||
+	    !X509_set_pubkey(x509, pkey))
+		goto out;
+
+	name = X509_get_subject_name(x509);
+	if (!X509_NAME_add_entry_by_txt(name, "O", MBSTRING_ASC, (uint8_t *)ORG, -1, -1, 0) ||
+	    !X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (uint8_t *)subject_cn, -1, -1, 0))
+		goto out;
+
+	name = X509_get_issuer_name(x509);
+	if (!X509_NAME_add_entry_by_txt(name, "O", MBSTRING_ASC, (uint8_t *)ORG, -1, -1, 0) ||
+	    !X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (uint8_t *)issuer_cn, -1, -1, 0))
+		goto out;
+
+	if (add_ext(x509, NID_basic_constraints, ca ? "critical,CA:TRUE,pathlen:0" : "critical,CA:FALSE") ||
+	    add_ext(x509, NID_key_usage, ca ? "critical,keyCertSign,cRLSign" : "critical,digitalSignature"))
+		goto out;
+
+	if (!X509_sign(x509, pkey, EVP_sha256()))
+		goto out;
+
+	len = i2d_re_X509_tbs(x509, &tbs);
+	if (len <= 0 || len > CERT_TBS_MAX)
+		goto out;
+	memcpy(tpl->tbs, tbs, len);
+	tpl->tbs_len = len;
+
+	tpl->pub_off = find(tbs, len, point, sizeof(point)) + 1;
+	tpl->serial_off = find(tbs, len, serial, sizeof(serial));
+	tpl->not_before_off = find(tbs, len, PH_NOT_BEFORE, strlen(PH_NOT_BEFORE));
+	tpl->not_after_off = find(tbs, len, PH_NOT_AFTER, strlen(PH_NOT_AFTER));
+	tpl->signer_id_off = find(tbs, len, PH_SIGNER_ID, strlen(PH_SIGNER_ID));
+	if (tpl->signer_id_off)
+		tpl->signer_id_off += strlen(PH_SIGNER_ID) - 4;
+	tpl->sn_off = find(tbs, len, PH_SN, strlen(PH_SN));
+
+	if (tpl->pub_off == 1 || !tpl->serial_off || !tpl->not_before_off ||
+	    !tpl->not_after_off || !tpl->signer_id_off) {
+		fprintf(stderr, "Template %u: placeholder not found\n", id);
+		goto out;
+	}
+
+	ret = 0;
+out:
+	OPENSSL_free(tbs);
+	ASN1_TIME_free(not_before);
+	ASN1_TIME_free(not_after);
+	BN_free(bn);
+	X509_free(x509);
+	EVP_PKEY_free(pkey);
+	return ret;
+}
+
+/* The signer certificate is issued by the root. Device certificates are
+ * issued by the signer, and have the device serial number as their CN.
+ */
+int cert_templates_init(struct cert_templates *set)
+{
+	if (template_init(&set->signer, CERT_TEMPLATE_SIGNER, SIGNER_CN, ROOT_CN, 1) ||
+	    template_init(&set->device, CERT_TEMPLATE_DEVICE, PH_SN, SIGNER_CN, 0) ||
+	    !set->device.sn_off) {
+		fprintf(stderr, "Could not build the certificate templates\n");
+		return -1;
+	}
+	return 0;
+}
+
+const struct cert_template *cert_template_get(const struct cert_templates *set, uint8_t id)
+{
+	if (id == CERT_TEMPLATE_SIGNER)
+		return &set->signer;
+	if (id == CERT_TEMPLATE_DEVICE)
+		return &set->device;
+	return NULL;
+}
+
+void cert_dates_encode(const struct cert_dates *dates, uint8_t *out)
+{
+	uint32_t v;
+
+	v = (dates->year - 2000) << 19 | dates->month << 15 | dates->day << 10 |
+	    dates->hour << 5 | dates->expire_years;
+	out[0] = v >> 16;
+	out[1] = v >> 8;
+	out[2] = v;
+}
+
+void cert_dates_decode(const uint8_t *in, struct cert_dates *dates)
+{
+	uint32_t v = in[0] << 16 | in[1] << 8 | in[2];
+
+	dates->year = 2000 + (v >> 19);
+	dates->month = (v >> 15) & 0x0f;
+	dates->day = (v >> 10) & 0x1f;
+	dates->hour = (v >> 5) & 0x1f;
+	dates->expire_years = v & 0x1f;
+}
+
+static void put_dec2(uint8_t *buf, unsigned int val)
+{
+	buf[0] = '0' + val / 10 % 10;
+	buf[1] = '0' + val % 10;
+}
+
+/* YYMMDDHH0000Z. The fields were range checked by the caller, and each is
+ * written as exactly two digits, so nothing can overflow the 13 bytes.
+ */
+static void put_utctime(uint8_t *buf, unsigned int year, unsigned int month,
+			unsigned int day, unsigned int hour)
+{
+	put_dec2(buf, year % 100);
+	put_dec2(buf + 2, month);
+	put_dec2(buf + 4, day);
+	put_dec2(buf + 6, hour);
+	memcpy(buf + 8, "0000Z", 5);
+}
+
+static void put_hex(uint8_t *buf, const uint8_t *bin, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		buf[2 * i] = hex[bin[i] >> 4];
+		buf[2 * i + 1] = hex[bin[i] & 0x0f];
+	}
+}
+
+/* Fill the TBSCertificate of the template with the fields. The serial
+ * number is derived from the public key and the dates.
+ */
+static int fill_tbs(const struct cert_template *tpl, const struct cert_fields *fields,
+		    const uint8_t *enc_dates, uint16_t signer_id, uint8_t *tbs)
+{
+	uint8_t msg[CERT_PUB_LEN + 3];
+	uint8_t hash[SHA256_DIGEST_LENGTH];
+	uint8_t id[2] = { signer_id >> 8, signer_id & 0xff };
+	struct cert_dates dates;
+
+	cert_dates_decode(enc_dates, &dates);
+
+	/* UTCTime only covers years up to 2049 */
+	if (dates.month < 1 || dates.month > 12 || dates.day < 1 || dates.day > 31 ||
+	    dates.hour > 23 || !dates.expire_years || dates.year + dates.expire_years > 2049)
+		return -1;
+
+	memcpy(tbs, tpl->tbs, tpl->tbs_len);
+	memcpy(tbs + tpl->pub_off, fields->pub, CERT_PUB_LEN);
+
+	memcpy(msg, fields->pub, CERT_PUB_LEN);
+	memcpy(msg + CERT_PUB_LEN, enc_dates, 3);
+	SHA256(msg, sizeof(msg), hash);
+	hash[0] = (hash[0] & 0x7f) | 0x40;	/* Positive, without padding */
+	memcpy(tbs + tpl->serial_off, hash, CERT_SERIAL_LEN);
+
+	put_utctime(tbs + tpl->not_before_off, dates.year, dates.month, dates.day, dates.hour);
+	put_utctime(tbs + tpl->not_after_off, dates.year + dates.expire_years,
+		    dates.month, dates.day, dates.hour);
+	put_hex(tbs + tpl->signer_id_off, id, sizeof(id));
+	if (tpl->sn_off)
+		put_hex(tbs + tpl->sn_off, fields->sn, CERT_SN_LEN);
+
+	return 0;
+}
+
+/* Issue a certificate from a template, signed by the issuer key, and
+ * return it in compressed form.
+ */
+int cert_issue(const struct cert_template *tpl, const struct cert_fields *fields,
+	       const struct cert_dates *dates, uint16_t signer_id, EVP_PKEY *issuer_key,
+	       struct cert_compressed *out)
+{
+	int ret = -1;
+	uint8_t tbs[CERT_TBS_MAX];
+	uint8_t der[80];
+	const uint8_t *p = der;
+	size_t len = sizeof(der);
+	EVP_MD_CTX *ctx;
+	ECDSA_SIG *sig = NULL;
+	const BIGNUM *r;
+	const BIGNUM *s;
+
+	memset(out, 0, sizeof(*out));
+	cert_dates_encode(dates, out->dates);
+	out->signer_id[0] = signer_id >> 8;
+	out->signer_id[1] = signer_id & 0xff;
+	out->template_chain = tpl->id << 4;
+	out->sn_source_format = CERT_SN_SOURCE_PUB_DATES << 4 | CERT_FORMAT_V0;
+
+	if (fill_tbs(tpl, fields, out->dates, signer_id, tbs)) {
+		fprintf(stderr, "Invalid certificate dates\n");
+		return -1;
+	}
+
+	ctx = EVP_MD_CTX_new();
+	if (!ctx ||
+	    EVP_DigestSignInit(ctx, NULL, EVP_sha256(), NULL, issuer_key) != 1 ||
+	    EVP_DigestSign(ctx, der, &len, tbs, tpl->tbs_len) != 1)
+		goto out;
+
+	sig = d2i_ECDSA_SIG(NULL, &p, len);
+	if (!sig)
+		goto out;
+	ECDSA_SIG_get0(sig, &r, &s);
+	if (BN_bn2binpad(r, out->sig, 32) != 32 || BN_bn2binpad(s, out->sig + 32, 32) != 32)
+		goto out;
+
+	ret = 0;
+out:
+	ECDSA_SIG_free(sig);
+	EVP_MD_CTX_free(ctx);
+	return ret;
+}
+
+static size_t put_len(uint8_t *buf, size_t len)
+{
+	if (len < 0x80) {
+		buf[0] = len;
+		return 1;
+	}
+	if (len < 0x100) {
+		buf[0] = 0x81;
+		buf[1] = len;
+		return 2;
+	}
+	buf[0] = 0x82;
+	buf[1] = len >> 8;
+	buf[2] = len & 0xff;
+	return 3;
+}
+
+/* DER INTEGER of an unsigned big-endian number */
+static size_t put_uint(uint8_t *buf, const uint8_t *num, size_t len)
+{
+	size_t n = 0;
+
+	while (len > 1 && !num[0]) {
+		num++;
+		len--;
+	}
+
+	buf[n++] = 0x02;
+	if (num[0] & 0x80) {
+		buf[n++] = len + 1;
+		buf[n++] = 0x00;
+	} else {
+		buf[n++] = len;
+	}
+	memcpy(buf + n, num, len);
+	return n + len;
+}
+
+/* Rebuild the DER certificate: the TBSCertificate from the template and
+ * the fields, followed by the signature algorithm and the signature.
+ */
+int cert_rebuild(const struct cert_templates *set, const struct cert_compressed *c,
+		 const struct cert_fields *fields, struct cert_der *out)
+{
+	const struct cert_template *tpl;
+	uint8_t sig[2 + 2 * (2 + 33)];
+	uint8_t hdr[4];
+	size_t sig_len;
+	size_t hdr_len;
+	size_t body_len;
+	size_t n;
+	uint8_t *p;
+
+	tpl = cert_template_get(set, c->template_chain >> 4);
+	if (!tpl || (c->sn_source_format >> 4) != CERT_SN_SOURCE_PUB_DATES ||
+	    (c->sn_source_format & 0x0f) != CERT_FORMAT_V0)
+		return -1;
+
+	/* ECDSA-Sig-Value ::= SEQUENCE { r INTEGER, s INTEGER } */
+	n = put_uint(sig + 2, c->sig, 32);
+	n += put_uint(sig + 2 + n, c->sig + 32, 32);
+	sig[0] = 0x30;
+	sig[1] = n;
+	sig_len = n + 2;
+
+	/* BIT STRING with no unused bits */
+	body_len = tpl->tbs_len + sizeof(ecdsa_with_sha256) + 1 + put_len(hdr, sig_len + 1) +
+		   sig_len + 1;
+
+	p = out->der;
+	*p++ = 0x30;
+	hdr_len = put_len(hdr, body_len);
+	memcpy(p, hdr, hdr_len);
+	p += hdr_len;
+
+	out->tbs_off = p - out->der;
+	out->tbs_len = tpl->tbs_len;
+	if (fill_tbs(tpl, fields, c->dates, c->signer_id[0] << 8 | c->signer_id[1], p))
+		return -1;
+	p += tpl->tbs_len;
+
+	memcpy(p, ecdsa_with_sha256, sizeof(ecdsa_with_sha256));
+	p += sizeof(ecdsa_with_sha256);
+
+	*p++ = 0x03;
+	p += put_len(p, sig_len + 1);
+	*p++ = 0x00;
+	memcpy(p, sig, sig_len);
+	p += sig_len;
+
+	out->len = p - out->der;
+	return 0;
+}
+
+/* Check the signature of a rebuilt certificate. The TBSCertificate is
+ * verified directly, without parsing the certificate.
+ */
+int cert_verify(const struct cert_der *cert, const struct cert_compressed *c,
+		EVP_PKEY *issuer_pub)
+{
+	int ret = -1;
+	uint8_t der[80];
+	uint8_t *p = der;
+	int len;
+	EVP_MD_CTX *ctx;
+	ECDSA_SIG *sig;
+	BIGNUM *r;
+	BIGNUM *s;
+
+	sig = ECDSA_SIG_new();
+	r = BN_bin2bn(c->sig, 32, NULL);
+	s = BN_bin2bn(c->sig + 32, 32, NULL);
+	if (!sig || !r || !s || !ECDSA_SIG_set0(sig, r, s)) {
+		BN_free(r);
+		BN_free(s);
+		ECDSA_SIG_free(sig);
+		return -1;
+	}
+
+	len = i2d_ECDSA_SIG(sig, &p);
+	ECDSA_SIG_free(sig);
+	if (len <= 0)
+		return -1;
+
+	ctx = EVP_MD_CTX_new();
+	if (ctx &&
+	    EVP_DigestVerifyInit(ctx, NULL, EVP_sha256(), NULL, issuer_pub) == 1 &&
+	    EVP_DigestVerify(ctx, der, len, cert->der + cert->tbs_off, cert->tbs_len) == 1)
+		ret = 0;
+
+	EVP_MD_CTX_free(ctx);
+	return ret;
+}
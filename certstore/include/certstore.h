@@ -0,0 +1,131 @@
+#ifndef __CERTSTORE_H
+#define __CERTSTORE_H
+
+#include <openssl/evp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CERT_TEMPLATE_SIGNER	1
+#define CERT_TEMPLATE_DEVICE	2
+
+#define CERT_TBS_MAX		512
+#define CERT_DER_MAX		(CERT_TBS_MAX + 96)
+#define CERT_PUB_LEN		64	/* X || Y */
+#define CERT_SIG_LEN		64	/* R || S */
+#define CERT_SERIAL_LEN		16
+#define CERT_SN_LEN		9
+
+#define CERT_SN_SOURCE_PUB_DATES	0x0a	/* Serial from the public key and dates */
+#define CERT_FORMAT_V0			0x00
+
+/* A certificate in 72 bytes, the size of a public key slot. Everything
+ * else is either in the template, or derived from the public key, the
+ * device serial number and the fields below.
+ */
+struct __attribute__((__packed__)) cert_compressed {
+	uint8_t sig[CERT_SIG_LEN];
+	uint8_t dates[3];		/* Year - 2000:5, month:4, day:5, hour:5, expire years:5 */
+	uint8_t signer_id[2];
+	uint8_t template_chain;		/* Template ID:4, chain ID:4 */
+	uint8_t sn_source_format;	/* Serial number source:4, format:4 */
+	uint8_t reserved;
+};
+
+struct cert_dates {
+	int year;
+	int month;
+	int day;
+	int hour;
+	int expire_years;
+};
+
+/* The TBSCertificate of a certificate, with the offsets of the fields
+ * that change from one certificate to the next. Fields that are not part
+ * of the template have an offset of 0.
+ */
+struct cert_template {
+	uint8_t id;
+	uint8_t tbs[CERT_TBS_MAX];
+	size_t tbs_len;
+	size_t pub_off;			/* 64 bytes, X || Y */
+	size_t serial_off;		/* 16 bytes */
+	size_t not_before_off;		/* UTCTime, YYMMDDHHMMSSZ */
+	size_t not_after_off;
+	size_t signer_id_off;		/* 4 hex digits, in the subject or issuer */
+	size_t sn_off;			/* 18 hex digits, in the subject */
+};
+
+struct cert_templates {
+	struct cert_template signer;
+	struct cert_template device;
+};
+
+/* The fields of a certificate that are not in the compressed form */
+struct cert_fields {
+	uint8_t pub[CERT_PUB_LEN];
+	uint8_t sn[CERT_SN_LEN];	/* Of the device, for device certificates */
+};
+
+/* A rebuilt certificate */
+struct cert_der {
+	uint8_t der[CERT_DER_MAX];
+	size_t len;
+	size_t tbs_off;
+	size_t tbs_len;
+};
+
+struct cert_cache_entry {
+	uint8_t sn[CERT_SN_LEN];
+	int32_t prev;
+	int32_t next;
+	int32_t hnext;
+	struct cert_der cert;
+};
+
+/* LRU cache of rebuilt and verified device certificates, keyed by the
+ * device serial number.
+ */
+struct cert_cache {
+	struct cert_cache_entry *entries;
+	int32_t *buckets;
+	uint32_t num_buckets;
+	uint32_t capacity;
+	uint32_t num;
+	int32_t head;			/* Most recently used */
+	int32_t tail;			/* Least recently used */
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+};
+
+int cert_templates_init(struct cert_templates *set);
+
+const struct cert_template *cert_template_get(const struct cert_templates *set, uint8_t id);
+
+void cert_dates_encode(const struct cert_dates *dates, uint8_t *out);
+
+void cert_dates_decode(const uint8_t *in, struct cert_dates *dates);
+
+int cert_issue(const struct cert_template *tpl, const struct cert_fields *fields,
+	       const struct cert_dates *dates, uint16_t signer_id, EVP_PKEY *issuer_key,
+	       struct cert_compressed *out);
+
+int cert_rebuild(const struct cert_templates *set, const struct cert_compressed *c,
+		 const struct cert_fields *fields, struct cert_der *out);
+
+int cert_verify(const struct cert_der *cert, const struct cert_compressed *c,
+		EVP_PKEY *issuer_pub);
+
+EVP_PKEY *cert_pub_to_pkey(const uint8_t *pub);
+
+int cert_pkey_to_pub(EVP_PKEY *pkey, uint8_t *pub);
+
+int cert_cache_init(struct cert_cache *cache, uint32_t capacity);
+
+void cert_cache_free(struct cert_cache *cache);
+
+const struct cert_der *cert_cache_get(struct cert_cache *cache, const uint8_t *sn);
+
+struct cert_der *cert_cache_put(struct cert_cache *cache, const uint8_t *sn);
+
+#endif
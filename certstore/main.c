@@ -0,0 +1,466 @@
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <secure96/s96at.h>
+
+#include <certstore.h>
+
+/* Where the certificates are stored on the device */
+#define SIGNER_PUB_SLOT		8	/* Blocks 0-1 */
+#define DEVICE_CERT_SLOT	10
+#define SIGNER_CERT_SLOT	12
+
+#define EXPIRE_YEARS		20
+
+#define BENCH_DEVICES		10000
+#define BENCH_LOOKUPS		200000
+#define BENCH_CACHE		2000
+#define BENCH_SIGNER_ID		0x0001
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s provision <root_key.pem> <signer_key.pem> <signer_id> <key_slot>\n", progname);
+	fprintf(stderr, "       %s read <root_pub.pem> <key_slot>\n", progname);
+	fprintf(stderr, "       %s bench <root_key.pem> [num_devices] [lookups] [cache_size]\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "provision issues the signer and device certificates, and stores them compressed\n");
+	fprintf(stderr, "read rebuilds the certificates from the device, verifies the chain and prints them\n");
+	fprintf(stderr, "bench times rebuilding and verifying device certificates on a backend\n");
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void dates_now(struct cert_dates *dates)
+{
+	time_t t = time(NULL);
+	struct tm tm;
+
+	gmtime_r(&t, &tm);
+	dates->year = tm.tm_year + 1900;
+	dates->month = tm.tm_mon + 1;
+	dates->day = tm.tm_mday;
+	dates->hour = tm.tm_hour;
+
+	/* UTCTime only covers years up to 2049 */
+	dates->expire_years = EXPIRE_YEARS;
+	if (dates->year + dates->expire_years > 2049)
+		dates->expire_years = 2049 - dates->year;
+}
+
+static EVP_PKEY *read_key(const char *path, int priv)
+{
+	FILE *fp;
+	EVP_PKEY *pkey;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return NULL;
+	}
+
+	/* A public key can be read from either a public or a private key */
+	pkey = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+	if (!pkey && !priv) {
+		rewind(fp);
+		pkey = PEM_read_PUBKEY(fp, NULL, NULL, NULL);
+	}
+	fclose(fp);
+
+	if (!pkey)
+		fprintf(stderr, "Could not read the key in %s\n", path);
+	return pkey;
+}
+
+/* A 72-byte slot is written as two blocks, then two words */
+static uint8_t slot_write(struct s96at_desc *desc, uint8_t slot, const uint8_t *buf, size_t len)
+{
+	uint8_t ret = S96AT_STATUS_OK;
+	struct s96at_slot_addr addr = { .slot = slot };
+
+	for (size_t off = 0; off < len && ret == S96AT_STATUS_OK; ) {
+		addr.block = off / S96AT_BLOCK_SIZE;
+		addr.offset = (off % S96AT_BLOCK_SIZE) / S96AT_WORD_SIZE;
+		if (len - off >= S96AT_BLOCK_SIZE && !addr.offset) {
+			ret = s96at_write_data(desc, &addr, S96AT_FLAG_NONE, buf + off, S96AT_BLOCK_SIZE);
+			off += S96AT_BLOCK_SIZE;
+		} else {
+			ret = s96at_write_data(desc, &addr, S96AT_FLAG_NONE, buf + off, S96AT_WORD_SIZE);
+			off += S96AT_WORD_SIZE;
+		}
+	}
+	return ret;
+}
+
+static uint8_t slot_read(struct s96at_desc *desc, uint8_t slot, uint8_t *buf, size_t len)
+{
+	uint8_t ret = S96AT_STATUS_OK;
+	struct s96at_slot_addr addr = { .slot = slot };
+
+	for (size_t off = 0; off < len && ret == S96AT_STATUS_OK; ) {
+		addr.block = off / S96AT_BLOCK_SIZE;
+		addr.offset = (off % S96AT_BLOCK_SIZE) / S96AT_WORD_SIZE;
+		if (len - off >= S96AT_BLOCK_SIZE && !addr.offset) {
+			ret = s96at_read_data(desc, &addr, S96AT_FLAG_NONE, buf + off, S96AT_BLOCK_SIZE);
+			off += S96AT_BLOCK_SIZE;
+		} else {
+			ret = s96at_read_data(desc, &addr, S96AT_FLAG_NONE, buf + off, S96AT_WORD_SIZE);
+			off += S96AT_WORD_SIZE;
+		}
+	}
+	return ret;
+}
+
+static uint8_t device_pub(struct s96at_desc *desc, uint8_t key_slot, uint8_t *sn, uint8_t *pub)
+{
+	uint8_t ret;
+	struct s96at_ecc_pub ecc_pub;
+
+	ret = s96at_get_serialnbr(desc, sn);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read the serial number\n");
+		return ret;
+	}
+
+	ret = s96at_gen_key(desc, S96AT_GENKEY_MODE_PUBLIC, key_slot, &ecc_pub);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not get the public key of slot %u\n", key_slot);
+		return ret;
+	}
+
+	memcpy(pub, ecc_pub.x, S96AT_ECC_PUB_X_LEN);
+	memcpy(pub + S96AT_ECC_PUB_X_LEN, ecc_pub.y, S96AT_ECC_PUB_Y_LEN);
+	return S96AT_STATUS_OK;
+}
+
+static int run_provision(const char *root_path, const char *signer_path, uint16_t signer_id,
+			 uint8_t key_slot)
+{
+	int ret = -1;
+	uint8_t s96_ret;
+	struct s96at_desc desc;
+	struct cert_templates set;
+	struct cert_dates dates;
+	struct cert_fields signer_fields = {0};
+	struct cert_fields device_fields = {0};
+	struct cert_compressed signer_cert;
+	struct cert_compressed device_cert;
+	EVP_PKEY *root_key;
+	EVP_PKEY *signer_key = NULL;
+
+	if (key_slot > 15) {
+		fprintf(stderr, "Invalid slot: %u\n", key_slot);
+		return -1;
+	}
+
+	if (cert_templates_init(&set))
+		return -1;
+
+	root_key = read_key(root_path, 1);
+	if (!root_key)
+		return -1;
+	signer_key = read_key(signer_path, 1);
+	if (!signer_key || cert_pkey_to_pub(signer_key, signer_fields.pub)) {
+		fprintf(stderr, "Signer key must be a P-256 key\n");
+		goto out_keys;
+	}
+
+	dates_now(&dates);
+	if (cert_issue(&set.signer, &signer_fields, &dates, signer_id, root_key, &signer_cert)) {
+		fprintf(stderr, "Could not issue the signer certificate\n");
+		goto out_keys;
+	}
+
+	s96_ret = s96at_init(S96AT_ATECC508A, S96AT_IO_I2C_LINUX, &desc);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize the device\n");
+		goto out_keys;
+	}
+
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	if (device_pub(&desc, key_slot, device_fields.sn, device_fields.pub) != S96AT_STATUS_OK)
+		goto out;
+
+	if (cert_issue(&set.device, &device_fields, &dates, signer_id, signer_key, &device_cert)) {
+		fprintf(stderr, "Could not issue the device certificate\n");
+		goto out;
+	}
+
+	s96_ret = slot_write(&desc, SIGNER_PUB_SLOT, signer_fields.pub, CERT_PUB_LEN);
+	if (s96_ret == S96AT_STATUS_OK)
+		s96_ret = slot_write(&desc, SIGNER_CERT_SLOT, (uint8_t *)&signer_cert,
+				     sizeof(signer_cert));
+	if (s96_ret == S96AT_STATUS_OK)
+		s96_ret = slot_write(&desc, DEVICE_CERT_SLOT, (uint8_t *)&device_cert,
+				     sizeof(device_cert));
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not write the certificates: 0x%02x\n", s96_ret);
+		goto out;
+	}
+
+	printf("Signer certificate: %zu bytes in slot %d\n", sizeof(signer_cert), SIGNER_CERT_SLOT);
+	printf("Device certificate: %zu bytes in slot %d\n", sizeof(device_cert), DEVICE_CERT_SLOT);
+	printf("Signer public key:  %d bytes in slot %d\n", CERT_PUB_LEN, SIGNER_PUB_SLOT);
+	ret = 0;
+out:
+	s96at_sleep(&desc);
+	s96at_cleanup(&desc);
+out_keys:
+	EVP_PKEY_free(signer_key);
+	EVP_PKEY_free(root_key);
+	return ret;
+}
+
+static int run_read(const char *root_path, uint8_t key_slot)
+{
+	int ret = -1;
+	uint8_t s96_ret;
+	const uint8_t *p;
+	struct s96at_desc desc;
+	struct cert_templates set;
+	struct cert_fields signer_fields = {0};
+	struct cert_fields device_fields = {0};
+	struct cert_compressed signer_cert;
+	struct cert_compressed device_cert;
+	struct cert_der signer_der;
+	struct cert_der device_der;
+	EVP_PKEY *root_pub;
+	EVP_PKEY *signer_pub = NULL;
+	X509 *x509;
+
+	if (key_slot > 15) {
+		fprintf(stderr, "Invalid slot: %u\n", key_slot);
+		return -1;
+	}
+
+	if (cert_templates_init(&set))
+		return -1;
+
+	root_pub = read_key(root_path, 0);
+	if (!root_pub)
+		return -1;
+
+	s96_ret = s96at_init(S96AT_ATECC508A, S96AT_IO_I2C_LINUX, &desc);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize the device\n");
+		goto out_keys;
+	}
+
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	s96_ret = slot_read(&desc, SIGNER_PUB_SLOT, signer_fields.pub, CERT_PUB_LEN);
+	if (s96_ret == S96AT_STATUS_OK)
+		s96_ret = slot_read(&desc, SIGNER_CERT_SLOT, (uint8_t *)&signer_cert,
+				    sizeof(signer_cert));
+	if (s96_ret == S96AT_STATUS_OK)
+		s96_ret = slot_read(&desc, DEVICE_CERT_SLOT, (uint8_t *)&device_cert,
+				    sizeof(device_cert));
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read the certificates: 0x%02x\n", s96_ret);
+		goto out;
+	}
+
+	if (device_pub(&desc, key_slot, device_fields.sn, device_fields.pub) != S96AT_STATUS_OK)
+		goto out;
+
+	if (cert_rebuild(&set, &signer_cert, &signer_fields, &signer_der) ||
+	    cert_rebuild(&set, &device_cert, &device_fields, &device_der)) {
+		fprintf(stderr, "Could not rebuild the certificates\n");
+		goto out;
+	}
+
+	signer_pub = cert_pub_to_pkey(signer_fields.pub);
+	if (!signer_pub ||
+	    cert_verify(&signer_der, &signer_cert, root_pub) ||
+	    cert_verify(&device_der, &device_cert, signer_pub)) {
+		fprintf(stderr, "Certificate chain does not verify\n");
+		goto out;
+	}
+
+	p = signer_der.der;
+	x509 = d2i_X509(NULL, &p, signer_der.len);
+	if (x509)
+		PEM_write_X509(stdout, x509);
+	X509_free(x509);
+
+	p = device_der.der;
+	x509 = d2i_X509(NULL, &p, device_der.len);
+	if (x509)
+		PEM_write_X509(stdout, x509);
+	X509_free(x509);
+
+	fprintf(stderr, "Rebuilt %zu + %zu bytes of DER from %zu + %zu bytes\n",
+		signer_der.len, device_der.len, sizeof(signer_cert), sizeof(device_cert));
+	ret = 0;
+out:
+	s96at_sleep(&desc);
+	s96at_cleanup(&desc);
+out_keys:
+	EVP_PKEY_free(signer_pub);
+	EVP_PKEY_free(root_pub);
+	return ret;
+}
+
+/* What a backend keeps per device: the compressed certificate, the
+ * public key and the serial number.
+ */
+struct bench_device {
+	struct cert_compressed cert;
+	struct cert_fields fields;
+};
+
+/* Issue certificates for num synthetic devices, then look them up with
+ * 80% of the lookups on 20% of the devices. A miss rebuilds and verifies
+ * the device certificate, a hit returns it from the cache.
+ */
+static int run_bench(const char *root_path, uint32_t num, uint32_t lookups, uint32_t cache_size)
+{
+	int ret = -1;
+	uint32_t idx;
+	uint32_t *picks = NULL;
+	double t;
+	struct cert_templates set;
+	struct cert_dates dates;
+	struct cert_fields signer_fields = {0};
+	struct cert_compressed signer_cert;
+	struct cert_der der;
+	struct cert_der *slot;
+	struct cert_cache cache = {0};
+	struct bench_device *devs = NULL;
+	EVP_PKEY *root_key;
+	EVP_PKEY *signer_key = NULL;
+	EVP_PKEY *dev_key;
+
+	if (!num || !lookups || !cache_size) {
+		usage();
+		return -1;
+	}
+
+	if (cert_templates_init(&set))
+		return -1;
+
+	root_key = read_key(root_path, 1);
+	if (!root_key)
+		return -1;
+
+	devs = calloc(num, sizeof(*devs));
+	picks = calloc(lookups, sizeof(*picks));
+	signer_key = EVP_EC_gen("P-256");
+	if (!devs || !picks || !signer_key || cert_cache_init(&cache, cache_size) ||
+	    cert_pkey_to_pub(signer_key, signer_fields.pub))
+		goto out;
+
+	dates_now(&dates);
+	if (cert_issue(&set.signer, &signer_fields, &dates, BENCH_SIGNER_ID, root_key, &signer_cert) ||
+	    cert_rebuild(&set, &signer_cert, &signer_fields, &der) ||
+	    cert_verify(&der, &signer_cert, root_key)) {
+		fprintf(stderr, "Could not issue the signer certificate\n");
+		goto out;
+	}
+
+	t = now_s();
+	for (uint32_t i = 0; i < num; i++) {
+		dev_key = EVP_EC_gen("P-256");
+		if (!dev_key || cert_pkey_to_pub(dev_key, devs[i].fields.pub)) {
+			EVP_PKEY_free(dev_key);
+			goto out;
+		}
+		EVP_PKEY_free(dev_key);
+
+		devs[i].fields.sn[0] = 0x01;
+		devs[i].fields.sn[1] = 0x23;
+		memcpy(devs[i].fields.sn + 2, &i, sizeof(i));
+		devs[i].fields.sn[8] = 0xee;
+
+		if (cert_issue(&set.device, &devs[i].fields, &dates, BENCH_SIGNER_ID,
+			       signer_key, &devs[i].cert))
+			goto out;
+	}
+	t = now_s() - t;
+	printf("Issue:   %u device certificates in %.3f s (%.0f certs/s)\n", num, t, num / t);
+
+	t = now_s();
+	for (uint32_t i = 0; i < num; i++) {
+		if (cert_rebuild(&set, &devs[i].cert, &devs[i].fields, &der))
+			goto out;
+	}
+	t = now_s() - t;
+	printf("Rebuild: %u certificates in %.3f s (%.0f certs/s, %zu bytes each)\n",
+	       num, t, num / t, der.len);
+
+	t = now_s();
+	for (uint32_t i = 0; i < num; i++) {
+		if (cert_rebuild(&set, &devs[i].cert, &devs[i].fields, &der) ||
+		    cert_verify(&der, &devs[i].cert, signer_key)) {
+			fprintf(stderr, "Device %u does not verify\n", i);
+			goto out;
+		}
+	}
+	t = now_s() - t;
+	printf("Verify:  %u rebuilt certificates in %.3f s (%.0f certs/s)\n", num, t, num / t);
+
+	if (RAND_bytes((uint8_t *)picks, lookups * sizeof(*picks)) != 1)
+		goto out;
+
+	t = now_s();
+	for (uint32_t i = 0; i < lookups; i++) {
+		idx = picks[i] % 10 < 8 ? (picks[i] / 10) % (num / 5 ? num / 5 : 1) :
+					  (picks[i] / 10) % num;
+		if (cert_cache_get(&cache, devs[idx].fields.sn))
+			continue;
+
+		slot = cert_cache_put(&cache, devs[idx].fields.sn);
+		if (cert_rebuild(&set, &devs[idx].cert, &devs[idx].fields, slot) ||
+		    cert_verify(slot, &devs[idx].cert, signer_key)) {
+			fprintf(stderr, "Device %u does not verify\n", idx);
+			goto out;
+		}
+	}
+	t = now_s() - t;
+	printf("Lookup:  %u lookups in %.3f s (%.0f lookups/s), cache of %u: "
+	       "%.1f%% hits, %lu evictions\n",
+	       lookups, t, lookups / t, cache_size,
+	       100.0 * cache.hits / (cache.hits + cache.misses), cache.evictions);
+
+	ret = 0;
+out:
+	cert_cache_free(&cache);
+	free(picks);
+	free(devs);
+	EVP_PKEY_free(signer_key);
+	EVP_PKEY_free(root_key);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	progname = argv[0];
+
+	if (argc == 6 && !strcmp(argv[1], "provision"))
+		return run_provision(argv[2], argv[3], strtoul(argv[4], NULL, 0), atoi(argv[5]));
+	else if (argc == 4 && !strcmp(argv[1], "read"))
+		return run_read(argv[2], atoi(argv[3]));
+	else if (argc >= 3 && argc <= 6 && !strcmp(argv[1], "bench"))
+		return run_bench(argv[2],
+				 argc > 3 ? strtoul(argv[3], NULL, 0) : BENCH_DEVICES,
+				 argc > 4 ? strtoul(argv[4], NULL, 0) : BENCH_LOOKUPS,
+				 argc > 5 ? strtoul(argv[5], NULL, 0) : BENCH_CACHE);
+
+	usage();
+	return -1;
+}
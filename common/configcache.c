@@ -0,0 +1,94 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <configcache.h>
+#include <privfile.h>
+
+/* The cache holds a bitmask of the blocks it covers, the config zone and
+ * a CRC, which catches a file torn by something else than privfile.
+ */
+struct __attribute__((__packed__)) config_cache {
+	uint8_t blocks;
+	uint8_t config[S96AT_ATECC508A_ZONE_CONFIG_LEN];
+	uint16_t crc;
+};
+
+static void config_cache_name(const uint8_t *block0, char *name, size_t len)
+{
+	/* SN[0:3] is at bytes 0-3, SN[4:8] at bytes 8-12 */
+	snprintf(name, len, "config-%02x%02x%02x%02x%02x%02x%02x%02x%02x",
+		 block0[0], block0[1], block0[2], block0[3],
+		 block0[8], block0[9], block0[10], block0[11], block0[12]);
+}
+
+static uint16_t config_cache_crc(const struct config_cache *cache)
+{
+	return s96at_crc((const uint8_t *)cache, offsetof(struct config_cache, crc), 0);
+}
+
+uint8_t configcache_read(struct s96at_desc *desc, uint8_t *buf,
+			 const uint8_t *offsets, size_t num_offsets)
+{
+	uint8_t ret;
+	uint8_t blocks = 0x01;
+	uint8_t read = 0;
+	uint8_t lock_config;
+	struct config_cache cache;
+	char name[32];
+
+	for (int i = 0; i < num_offsets; i++)
+		blocks |= 1 << (offsets[i] / S96AT_BLOCK_SIZE);
+
+	ret = s96at_read_config(desc, 0, buf);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Failed to read config block 0\n");
+		return ret;
+	}
+
+	/* The cached blocks are only used if block 0 as cached matches the
+	 * one just read: the same serial number, and the same SlotConfig of
+	 * slots 0 to 5.
+	 */
+	config_cache_name(buf, name, sizeof(name));
+	if (privfile_read(name, &cache, sizeof(cache)) ||
+	    cache.crc != config_cache_crc(&cache) || !(cache.blocks & 0x01) ||
+	    memcmp(cache.config, buf, S96AT_BLOCK_SIZE))
+		memset(&cache, 0, sizeof(cache));
+
+	for (int i = 1; i < S96AT_ATECC508A_ZONE_CONFIG_NUM_BLOCKS; i++) {
+		if (!(blocks & (1 << i)))
+			continue;
+		if (cache.blocks & (1 << i)) {
+			memcpy(buf + i * S96AT_BLOCK_SIZE,
+			       cache.config + i * S96AT_BLOCK_SIZE, S96AT_BLOCK_SIZE);
+			continue;
+		}
+		ret = s96at_read_config(desc, i, buf + i * S96AT_BLOCK_SIZE);
+		if (ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "Failed to read config block %u\n", i);
+			return ret;
+		}
+		read |= 1 << i;
+	}
+
+	if (!read)
+		return S96AT_STATUS_OK;
+
+	/* Only a locked config can be cached. Failing to cache is not an error */
+	ret = s96at_get_lock_config(desc, &lock_config);
+	if (ret != S96AT_STATUS_OK || lock_config != S96AT_ZONE_LOCKED)
+		return S96AT_STATUS_OK;
+
+	cache.blocks |= blocks;
+	for (int i = 0; i < S96AT_ATECC508A_ZONE_CONFIG_NUM_BLOCKS; i++) {
+		if (blocks & (1 << i))
+			memcpy(cache.config + i * S96AT_BLOCK_SIZE,
+			       buf + i * S96AT_BLOCK_SIZE, S96AT_BLOCK_SIZE);
+	}
+	cache.crc = config_cache_crc(&cache);
+	privfile_write(name, &cache, sizeof(cache));
+
+	return S96AT_STATUS_OK;
+}
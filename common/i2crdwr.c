@@ -0,0 +1,345 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <i2crdwr.h>
+
+#define WORD_ADDR_RESET		0x00
+#define WORD_ADDR_SLEEP		0x01
+#define WORD_ADDR_IDLE		0x02
+#define WORD_ADDR_COMMAND	0x03
+
+#define WAKE_TWHI_US		1500	/* Wake high delay to data comm */
+#define POLL_STEP_US		250	/* Interval between response polls */
+#define EXEC_MARGIN_US		1000	/* Added to the worst case before giving up */
+
+/* Maximum execution time of ATECC508A commands, in us (Table 9-4) */
+static const struct {
+	uint8_t opcode;
+	uint32_t max_us;
+} exec_max[] = {
+	{ 0x02, 1000 },		/* Read */
+	{ 0x08, 14000 },	/* MAC */
+	{ 0x11, 23000 },	/* HMAC */
+	{ 0x12, 26000 },	/* Write */
+	{ 0x15, 11000 },	/* GenDig */
+	{ 0x16, 7000 },		/* Nonce */
+	{ 0x17, 32000 },	/* Lock */
+	{ 0x1b, 23000 },	/* Random */
+	{ 0x1c, 50000 },	/* DeriveKey */
+	{ 0x20, 10000 },	/* UpdateExtra */
+	{ 0x24, 20000 },	/* Counter */
+	{ 0x28, 13000 },	/* CheckMac */
+	{ 0x30, 1000 },		/* Info */
+	{ 0x40, 115000 },	/* GenKey */
+	{ 0x41, 50000 },	/* Sign */
+	{ 0x43, 58000 },	/* ECDH */
+	{ 0x45, 58000 },	/* Verify */
+	{ 0x46, 48000 },	/* PrivWrite */
+	{ 0x47, 9000 },		/* SHA */
+};
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_us(uint32_t us)
+{
+	struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+
+	nanosleep(&ts, NULL);
+}
+
+static uint32_t exec_max_us(uint8_t opcode)
+{
+	for (int i = 0; i < sizeof(exec_max) / sizeof(exec_max[0]); i++) {
+		if (exec_max[i].opcode == opcode)
+			return exec_max[i].max_us;
+	}
+	return 115000;
+}
+
+/* CRC-16 of the device, polynomial 0x8005, bits in LSB first (Sect 5.2) */
+uint16_t i2crdwr_crc(const uint8_t *buf, size_t len)
+{
+	uint16_t crc = 0;
+	uint8_t data_bit;
+	uint8_t crc_bit;
+
+	for (size_t i = 0; i < len; i++) {
+		for (uint8_t shift = 0x01; shift; shift <<= 1) {
+			data_bit = !!(buf[i] & shift);
+			crc_bit = crc >> 15;
+			crc <<= 1;
+			if (data_bit != crc_bit)
+				crc ^= 0x8005;
+		}
+	}
+	return crc;
+}
+
+/* Stock mode: the slave address is set once per open */
+static int adapter_open(struct i2crdwr *dev)
+{
+	dev->fd = open(dev->path, O_RDWR);
+	dev->stats.syscalls++;
+	if (dev->fd < 0) {
+		fprintf(stderr, "Could not open %s: %s\n", dev->path, strerror(errno));
+		return -1;
+	}
+
+	if (dev->mode == I2CRDWR_MODE_STOCK) {
+		dev->stats.syscalls++;
+		if (ioctl(dev->fd, I2C_SLAVE, dev->addr) < 0) {
+			fprintf(stderr, "Could not set slave address: %s\n", strerror(errno));
+			close(dev->fd);
+			dev->fd = -1;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void adapter_close(struct i2crdwr *dev)
+{
+	if (dev->fd < 0)
+		return;
+	close(dev->fd);
+	dev->stats.syscalls++;
+	dev->fd = -1;
+}
+
+static int xfer_write(struct i2crdwr *dev, uint16_t addr, const uint8_t *buf, size_t len)
+{
+	struct i2c_msg msg = { addr, 0, len, (uint8_t *)buf };
+	struct i2c_rdwr_ioctl_data xfer = { &msg, 1 };
+
+	dev->stats.syscalls++;
+	if (dev->mode == I2CRDWR_MODE_STOCK)
+		return write(dev->fd, buf, len) == len ? 0 : -1;
+	return ioctl(dev->fd, I2C_RDWR, &xfer) == 1 ? 0 : -1;
+}
+
+/* Read a response. With idle set, the idle word address is written in the
+ * same transaction.
+ */
+static int xfer_read(struct i2crdwr *dev, uint8_t *buf, size_t len, int idle)
+{
+	uint8_t idle_addr = WORD_ADDR_IDLE;
+	struct i2c_msg msgs[2] = {
+		{ dev->addr, I2C_M_RD, len, buf },
+		{ dev->addr, 0, 1, &idle_addr },
+	};
+	struct i2c_rdwr_ioctl_data xfer = { msgs, idle ? 2 : 1 };
+
+	dev->stats.syscalls++;
+	if (dev->mode == I2CRDWR_MODE_STOCK)
+		return read(dev->fd, buf, len) == len ? 0 : -1;
+	return ioctl(dev->fd, I2C_RDWR, &xfer) == xfer.nmsgs ? 0 : -1;
+}
+
+static uint8_t check_response(const uint8_t *buf, size_t len)
+{
+	uint16_t crc;
+
+	if (buf[0] < 4 || buf[0] > len)
+		return I2CRDWR_STATUS_COMM_ERROR;
+
+	crc = i2crdwr_crc(buf, buf[0] - 2);
+	if (buf[buf[0] - 2] != (crc & 0xff) || buf[buf[0] - 1] != crc >> 8)
+		return I2CRDWR_STATUS_COMM_ERROR;
+
+	return buf[0] == 4 ? buf[1] : I2CRDWR_STATUS_OK;
+}
+
+/* Wait for the response of a command. In RDWR mode, the first poll is at
+ * the execution time learned from previous runs of the opcode, and the
+ * learned time follows the observed one: it moves down quickly when the
+ * device answers at the first poll, and up by the time spent polling
+ * otherwise. A NACK while the device is busy costs one ioctl.
+ */
+static uint8_t wait_response(struct i2crdwr *dev, uint8_t opcode, uint8_t *buf, size_t len,
+			     int idle)
+{
+	uint64_t start = now_us();
+	uint64_t elapsed;
+	uint32_t max_us = exec_max_us(opcode);
+	uint32_t *learned = &dev->exec_us[opcode];
+	int polls = 0;
+
+	if (dev->mode == I2CRDWR_MODE_STOCK) {
+		sleep_us(max_us);
+		if (xfer_read(dev, buf, len, 0))
+			return I2CRDWR_STATUS_IO_ERROR;
+		dev->stats.busy_us += now_us() - start;
+		return check_response(buf, len);
+	}
+
+	if (!*learned || *learned > max_us)
+		*learned = max_us / 2;
+
+	sleep_us(*learned);
+	for (;;) {
+		if (!xfer_read(dev, buf, len, idle))
+			break;
+		if (errno != ENXIO && errno != EREMOTEIO && errno != EIO)
+			return I2CRDWR_STATUS_IO_ERROR;
+
+		polls++;
+		dev->stats.polls++;
+		if (now_us() - start > max_us + EXEC_MARGIN_US)
+			return I2CRDWR_STATUS_TIMEOUT;
+		sleep_us(POLL_STEP_US);
+	}
+
+	elapsed = now_us() - start;
+	dev->stats.busy_us += elapsed;
+
+	if (!polls)
+		*learned -= *learned / 8;
+	else
+		*learned = elapsed;
+
+	return check_response(buf, len);
+}
+
+int i2crdwr_open(struct i2crdwr *dev, enum i2crdwr_mode mode, const char *path, uint16_t addr)
+{
+	memset(dev, 0, sizeof(*dev));
+	dev->mode = mode;
+	dev->addr = addr;
+	dev->fd = -1;
+	snprintf(dev->path, sizeof(dev->path), "%s", path);
+
+	/* The adapter is kept open across sessions in RDWR mode */
+	if (mode == I2CRDWR_MODE_RDWR)
+		return adapter_open(dev);
+
+	return 0;
+}
+
+void i2crdwr_close(struct i2crdwr *dev)
+{
+	adapter_close(dev);
+}
+
+/* Addressing the general call address at 100 kHz holds SDA low long
+ * enough to wake the device up. The write is not acknowledged.
+ */
+uint8_t i2crdwr_wake(struct i2crdwr *dev)
+{
+	uint8_t zero = 0;
+	uint8_t buf[4];
+
+	if (dev->mode == I2CRDWR_MODE_STOCK && dev->fd < 0 && adapter_open(dev))
+		return I2CRDWR_STATUS_IO_ERROR;
+
+	if (dev->mode == I2CRDWR_MODE_STOCK) {
+		dev->stats.syscalls++;
+		ioctl(dev->fd, I2C_SLAVE, 0x00);
+		xfer_write(dev, 0x00, &zero, 1);
+		dev->stats.syscalls++;
+		ioctl(dev->fd, I2C_SLAVE, dev->addr);
+	} else {
+		xfer_write(dev, 0x00, &zero, 1);
+	}
+
+	sleep_us(WAKE_TWHI_US);
+
+	if (xfer_read(dev, buf, sizeof(buf), 0))
+		return I2CRDWR_STATUS_IO_ERROR;
+
+	return check_response(buf, sizeof(buf)) == I2CRDWR_STATUS_WAKE ?
+		I2CRDWR_STATUS_OK : I2CRDWR_STATUS_COMM_ERROR;
+}
+
+uint8_t i2crdwr_idle(struct i2crdwr *dev)
+{
+	uint8_t word_addr = WORD_ADDR_IDLE;
+	uint8_t ret = I2CRDWR_STATUS_OK;
+
+	if (xfer_write(dev, dev->addr, &word_addr, 1))
+		ret = I2CRDWR_STATUS_IO_ERROR;
+
+	if (dev->mode == I2CRDWR_MODE_STOCK)
+		adapter_close(dev);
+
+	return ret;
+}
+
+/* Send a command and read its response into resp, which must hold at
+ * least resp_len bytes: the count byte, the data and the CRC.
+ */
+uint8_t i2crdwr_command(struct i2crdwr *dev, uint8_t opcode, uint8_t param1, uint16_t param2,
+			const uint8_t *data, size_t data_len, uint8_t *resp, size_t resp_len,
+			uint32_t flags)
+{
+	uint8_t ret;
+	uint8_t pkt[1 + 6 + I2CRDWR_MAX_DATA_LEN + 2];
+	size_t count = 7 + data_len;
+	uint16_t crc;
+	int idle = flags & I2CRDWR_FLAG_IDLE;
+
+	if (data_len > I2CRDWR_MAX_DATA_LEN || resp_len < 4)
+		return I2CRDWR_STATUS_PARSE_ERROR;
+
+	pkt[0] = WORD_ADDR_COMMAND;
+	pkt[1] = count;
+	pkt[2] = opcode;
+	pkt[3] = param1;
+	pkt[4] = param2 & 0xff;
+	pkt[5] = param2 >> 8;
+	if (data_len)
+		memcpy(pkt + 6, data, data_len);
+	crc = i2crdwr_crc(pkt + 1, count - 2);
+	pkt[count - 1] = crc & 0xff;
+	pkt[count] = crc >> 8;
+
+	dev->stats.commands++;
+	if (xfer_write(dev, dev->addr, pkt, count + 1))
+		return I2CRDWR_STATUS_IO_ERROR;
+
+	/* Idle is only folded into the read in RDWR mode */
+	ret = wait_response(dev, opcode, resp, resp_len, idle);
+	if (idle && dev->mode == I2CRDWR_MODE_STOCK)
+		i2crdwr_idle(dev);
+
+	return ret;
+}
+
+int i2crdwr_parse(const char *spec, char *path, size_t path_len, uint16_t *addr)
+{
+	const char *colon = strrchr(spec, ':');
+	size_t len = colon ? colon - spec : strlen(spec);
+	unsigned long val;
+	char *end;
+
+	if (!len || len >= path_len)
+		return -1;
+	memcpy(path, spec, len);
+	path[len] = '\0';
+
+	*addr = I2CRDWR_DEFAULT_ADDR;
+	if (!colon)
+		return 0;
+
+	val = strtoul(colon + 1, &end, 0);
+	if (end == colon + 1 || *end || val > 0x7f)
+		return -1;
+	*addr = val;
+
+	return 0;
+}
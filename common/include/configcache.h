@@ -0,0 +1,22 @@
+#ifndef __CONFIGCACHE_H
+#define __CONFIGCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+/* Read the ATECC508A config fields at the given offsets into buf. The
+ * config zone is read in 32-byte blocks, so only the blocks covering the
+ * fields are read, rather than the whole zone. Block 0 is always read
+ * from the device, as it holds the serial number. Other parts of buf are
+ * left untouched.
+ *
+ * A locked config zone never changes, so the blocks read are cached per
+ * serial number in the private directory, and later calls only read block
+ * 0. The device must be awake.
+ */
+uint8_t configcache_read(struct s96at_desc *desc, uint8_t *buf,
+			 const uint8_t *offsets, size_t num_offsets);
+
+#endif
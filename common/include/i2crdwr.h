@@ -0,0 +1,77 @@
+#ifndef __I2CRDWR_H
+#define __I2CRDWR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define I2CRDWR_DEFAULT_ADDR	0x60
+
+#define I2CRDWR_MAX_DATA_LEN	155	/* Largest command data, Write of 32 bytes + MAC */
+#define I2CRDWR_MAX_RESP_LEN	75	/* Largest response, ECC public key */
+
+/* Status byte of a 4-byte response (Sect 9.1.3) */
+#define I2CRDWR_STATUS_OK		0x00
+#define I2CRDWR_STATUS_MISCOMPARE	0x01
+#define I2CRDWR_STATUS_PARSE_ERROR	0x03
+#define I2CRDWR_STATUS_ECC_FAULT	0x05
+#define I2CRDWR_STATUS_EXEC_ERROR	0x0f
+#define I2CRDWR_STATUS_WAKE		0x11
+#define I2CRDWR_STATUS_WATCHDOG		0xee
+#define I2CRDWR_STATUS_COMM_ERROR	0xff
+
+/* Returned when the transport itself fails */
+#define I2CRDWR_STATUS_IO_ERROR		0xf0
+#define I2CRDWR_STATUS_TIMEOUT		0xf1
+
+/* Flags of i2crdwr_command() */
+#define I2CRDWR_FLAG_NONE	0
+#define I2CRDWR_FLAG_IDLE	(1 << 0)	/* Put the device to idle after the response */
+
+enum i2crdwr_mode {
+	/* Like the stock backend: write(), sleep for the worst-case
+	 * execution time, read(). The adapter is opened and the slave
+	 * address set for every session.
+	 */
+	I2CRDWR_MODE_STOCK,
+	/* I2C_RDWR transactions on an adapter kept open, polling the
+	 * response on a schedule learned from previous commands.
+	 */
+	I2CRDWR_MODE_RDWR,
+};
+
+struct i2crdwr_stats {
+	unsigned long commands;
+	unsigned long syscalls;		/* open, close, ioctl, read, write */
+	unsigned long polls;		/* Response reads NACKed while busy */
+	uint64_t busy_us;		/* Time from command write to response */
+};
+
+struct i2crdwr {
+	enum i2crdwr_mode mode;
+	char path[64];
+	uint16_t addr;
+	int fd;
+	uint32_t exec_us[256];		/* Learned execution time, per opcode */
+	struct i2crdwr_stats stats;
+};
+
+int i2crdwr_open(struct i2crdwr *dev, enum i2crdwr_mode mode, const char *path, uint16_t addr);
+
+void i2crdwr_close(struct i2crdwr *dev);
+
+uint8_t i2crdwr_wake(struct i2crdwr *dev);
+
+uint8_t i2crdwr_idle(struct i2crdwr *dev);
+
+uint8_t i2crdwr_command(struct i2crdwr *dev, uint8_t opcode, uint8_t param1, uint16_t param2,
+			const uint8_t *data, size_t data_len, uint8_t *resp, size_t resp_len,
+			uint32_t flags);
+
+uint16_t i2crdwr_crc(const uint8_t *buf, size_t len);
+
+/* Parse a device given as adapter[:addr], eg /dev/i2c-1:0x61. Without an
+ * address, I2CRDWR_DEFAULT_ADDR is used. Returns 0 or -1.
+ */
+int i2crdwr_parse(const char *spec, char *path, size_t path_len, uint16_t *addr);
+
+#endif
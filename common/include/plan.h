@@ -0,0 +1,93 @@
+#ifndef __PLAN_H
+#define __PLAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* I2C clock, and the time a wake takes (tWLO + tWHI) */
+#define PLAN_I2C_KHZ		100
+#define PLAN_WAKE_MS		1.6
+
+/* Time to transfer len bytes, 9 clocks each with the ACK */
+#define PLAN_XFER_MS(len)	((len) * 9.0 / PLAN_I2C_KHZ)
+
+/* The watchdog puts the device to sleep this long after a wake, whatever
+ * it is doing. It is 1.3 s typical, but may be as short as 0.7 s, which is
+ * what wakes are planned with. Commands are only started with this margin
+ * left.
+ */
+#define PLAN_WATCHDOG_MS	700
+#define PLAN_MARGIN_MS		100
+
+/* Worst case execution times, to size the wake needed by a sequence */
+#define PLAN_EXEC_READ_MS	5
+#define PLAN_EXEC_WRITE_MS	26
+#define PLAN_EXEC_LOCK_MS	32
+#define PLAN_EXEC_NONCE_MS	7
+#define PLAN_EXEC_GENDIG_MS	11
+#define PLAN_EXEC_PRIVWRITE_MS	48
+#define PLAN_EXEC_MAC_MS	14
+#define PLAN_EXEC_SHA_MS	9
+#define PLAN_EXEC_SIGN_MS	50
+#define PLAN_EXEC_ECDH_MS	58
+#define PLAN_EXEC_GENKEY_MS	115
+
+enum plan_op {
+	PLAN_OP_READ,
+	PLAN_OP_WRITE,
+	PLAN_OP_LOCK,
+	PLAN_OP_NONCE,
+	PLAN_OP_GENDIG,
+	PLAN_OP_PRIVWRITE,
+	PLAN_OP_NUM
+};
+
+/* Execution time of a command. The typical time is what a device usually
+ * takes, the max one what the datasheet allows, and what wakes are
+ * planned with.
+ */
+struct plan_model {
+	const char *name;
+	uint8_t opcode;
+	double typ_ms;
+	double max_ms;
+};
+
+/* A dry run. Commands are not sent, but priced with the model, on two
+ * clocks: the typical one and the worst case one. The watchdog is checked
+ * against the worst case clock, which is also the one to decide on wakes
+ * with.
+ */
+struct plan {
+	double typ_ms;
+	double max_ms;
+	double woken_ms;	/* Worst case clock at the last wake */
+	int awake;
+
+	unsigned int wakes;
+	unsigned int commands[PLAN_OP_NUM];
+	unsigned long bytes;	/* Bytes on the bus, wakes excluded */
+	unsigned int risks;	/* Commands that may end past the margin */
+};
+
+/* Replace the typical times of the model with measured ones, read from
+ * path as lines of a command name and a time in ms. Empty lines and lines
+ * starting with # are skipped. A time above the worst case one is
+ * rejected, as wakes would be planned too short. Returns 0 or -1.
+ */
+int plan_calibrate(const char *path);
+
+void plan_init(struct plan *plan);
+
+void plan_wake(struct plan *plan);
+
+void plan_idle(struct plan *plan);
+
+void plan_sleep(struct plan *plan);
+
+void plan_cmd(struct plan *plan, enum plan_op op, size_t tx_len, size_t rx_len,
+	      const char *what);
+
+void plan_summary(const struct plan *plan);
+
+#endif
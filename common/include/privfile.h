@@ -0,0 +1,38 @@
+#ifndef __PRIVFILE_H
+#define __PRIVFILE_H
+
+#include <stddef.h>
+
+/* Host-side state of the examples: caches, mirrors and journals. The
+ * directory is created 0700, and only used if it is a directory owned by
+ * the effective user and not accessible to anyone else, so that no other
+ * user can plant, replace or read the files in it.
+ */
+#define PRIVFILE_DIR		"/var/lib/secure96"
+
+/* Read exactly len bytes of the file name in the private directory.
+ * Returns 0, or -1 if the file is missing, of another size, or not a
+ * regular file of the effective user.
+ */
+int privfile_read(const char *name, void *buf, size_t len);
+
+/* Replace the file name in the private directory with len bytes of buf:
+ * they are written to a new file, synced and renamed over the old one, so
+ * that a crash leaves either the old or the new contents. Returns 0 or -1.
+ */
+int privfile_write(const char *name, const void *buf, size_t len);
+
+/* Remove the file name, durably. A missing file is not an error. */
+int privfile_remove(const char *name);
+
+/* Open the lock file name in the private directory, creating it if
+ * needed, for flock(). Returns the descriptor, or -1.
+ */
+int privfile_lock(const char *name);
+
+/* Read the random key name of len bytes, which is created on first use.
+ * Returns 0 or -1.
+ */
+int privfile_key(const char *name, void *key, size_t len);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __SLOTKEY_H
+#define __SLOTKEY_H
+
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#define SLOTKEY_MASTER_LEN	32
+#define SLOTKEY_LEN		32
+#define SLOTKEY_NUM_SLOTS	8  /* Symmetric keys in slots 0 to 7 */
+
+/* The per-device keys s96util -m writes to slots 0 to 7, derived from a
+ * master key and the serial number of the device.
+ */
+
+int slotkey_read_master(const char *path, uint8_t *master);
+
+void slotkey_derive(const uint8_t *master, const uint8_t *sn,
+		    uint8_t keys[SLOTKEY_NUM_SLOTS][SLOTKEY_LEN]);
+
+/* The key of a single slot. Returns -1 if the slot has no derived key. */
+int slotkey_derive_one(const uint8_t *master, const uint8_t *sn, uint8_t slot,
+		       uint8_t *key);
+
+#endif
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <plan.h>
+
+/* Typical times are the ones of the ATECC508A datasheet, Table 9-4, until
+ * plan_calibrate() replaces them with measured ones. Max times are the
+ * ones wakes are planned with.
+ */
+static struct plan_model models[PLAN_OP_NUM] = {
+	[PLAN_OP_READ]		= { "Read",	 0x02, 0.1,  PLAN_EXEC_READ_MS },
+	[PLAN_OP_WRITE]		= { "Write",	 0x12, 7.0,  PLAN_EXEC_WRITE_MS },
+	[PLAN_OP_LOCK]		= { "Lock",	 0x17, 8.0,  PLAN_EXEC_LOCK_MS },
+	[PLAN_OP_NONCE]		= { "Nonce",	 0x16, 0.1,  PLAN_EXEC_NONCE_MS },
+	[PLAN_OP_GENDIG]	= { "GenDig",	 0x15, 5.0,  PLAN_EXEC_GENDIG_MS },
+	[PLAN_OP_PRIVWRITE]	= { "PrivWrite", 0x46, 41.0, PLAN_EXEC_PRIVWRITE_MS },
+};
+
+static double xfer_ms(size_t len)
+{
+	return PLAN_XFER_MS(len);
+}
+
+int plan_calibrate(const char *path)
+{
+	FILE *fp;
+	char line[80];
+	char name[16];
+	double ms;
+	int lineno = 0;
+	int ret = 0;
+	int i;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror("fopen");
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+
+		if (sscanf(line, "%15s %lf", name, &ms) != 2 || ms < 0) {
+			fprintf(stderr, "%s:%d: expected a command and a time in ms\n",
+				path, lineno);
+			ret = -1;
+			break;
+		}
+
+		for (i = 0; i < PLAN_OP_NUM; i++) {
+			if (!strcmp(models[i].name, name))
+				break;
+		}
+		if (i == PLAN_OP_NUM) {
+			fprintf(stderr, "%s:%d: unknown command %s\n", path, lineno, name);
+			ret = -1;
+			break;
+		}
+
+		if (ms > models[i].max_ms) {
+			fprintf(stderr, "%s:%d: %s takes %.1f ms, more than the %.1f ms "
+				"wakes are planned with\n", path, lineno, name, ms,
+				models[i].max_ms);
+			ret = -1;
+			break;
+		}
+		models[i].typ_ms = ms;
+	}
+	fclose(fp);
+
+	return ret;
+}
+
+void plan_init(struct plan *plan)
+{
+	memset(plan, 0, sizeof(*plan));
+
+	printf("     typ      max  command   %-22s watchdog\n", "");
+}
+
+static void plan_advance(struct plan *plan, double typ_ms, double max_ms)
+{
+	plan->typ_ms += typ_ms;
+	plan->max_ms += max_ms;
+}
+
+void plan_wake(struct plan *plan)
+{
+	printf("%8.1f %8.1f  wake\n", plan->typ_ms, plan->max_ms);
+
+	plan_advance(plan, PLAN_WAKE_MS + xfer_ms(4), PLAN_WAKE_MS + xfer_ms(4));
+	plan->woken_ms = plan->max_ms;
+	plan->awake = 1;
+	plan->wakes++;
+}
+
+/* Idle and sleep are a single byte to the word address */
+void plan_idle(struct plan *plan)
+{
+	printf("%8.1f %8.1f  idle\n", plan->typ_ms, plan->max_ms);
+
+	plan_advance(plan, xfer_ms(2), xfer_ms(2));
+	plan->awake = 0;
+}
+
+void plan_sleep(struct plan *plan)
+{
+	printf("%8.1f %8.1f  sleep\n", plan->typ_ms, plan->max_ms);
+
+	plan_advance(plan, xfer_ms(2), xfer_ms(2));
+	plan->awake = 0;
+}
+
+/* Price a command with tx_len bytes of data, answering rx_len bytes (a
+ * status byte if 0). A command goes out with the I2C address, the word
+ * address, count, opcode, param1, param2 and CRC, and comes back with
+ * the I2C address, count and CRC.
+ */
+void plan_cmd(struct plan *plan, enum plan_op op, size_t tx_len, size_t rx_len,
+	      const char *what)
+{
+	const struct plan_model *m = &models[op];
+	double io_ms = xfer_ms(9 + tx_len) + xfer_ms(4 + (rx_len ? rx_len : 1));
+	double left;
+	const char *risk = "";
+
+	left = PLAN_WATCHDOG_MS - (plan->max_ms + io_ms + m->max_ms - plan->woken_ms);
+	if (!plan->awake)
+		risk = "  ASLEEP";
+	else if (left < 0)
+		risk = "  WATCHDOG";
+	else if (left < PLAN_MARGIN_MS)
+		risk = "  MARGIN";
+	if (*risk)
+		plan->risks++;
+
+	printf("%8.1f %8.1f  %-9s %-22s %6.1f ms left%s\n", plan->typ_ms, plan->max_ms,
+	       m->name, what, left, risk);
+
+	plan_advance(plan, io_ms + m->typ_ms, io_ms + m->max_ms);
+	plan->commands[op]++;
+	plan->bytes += 13 + tx_len + (rx_len ? rx_len : 1);
+}
+
+void plan_summary(const struct plan *plan)
+{
+	unsigned int total = 0;
+
+	printf("\nCommands:");
+	for (int i = 0; i < PLAN_OP_NUM; i++) {
+		if (!plan->commands[i])
+			continue;
+		printf(" %u %s (0x%02x)", plan->commands[i], models[i].name, models[i].opcode);
+		total += plan->commands[i];
+	}
+	printf("\n");
+	printf("Transactions: %u commands, %u wakes, %lu bytes\n", total, plan->wakes,
+	       plan->bytes);
+	printf("Predicted: %.0f ms typical, %.0f ms worst case\n", plan->typ_ms,
+	       plan->max_ms);
+	printf("Watchdog risks: %u\n", plan->risks);
+}
@@ -0,0 +1,177 @@
+#include <openssl/rand.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <privfile.h>
+
+#define PRIVFILE_PATH_LEN	128
+
+/* Create the directory if needed, and check that nobody else can use it */
+static int privfile_dir(void)
+{
+	struct stat st;
+
+	if (mkdir(PRIVFILE_DIR, 0700) && errno != EEXIST) {
+		perror("mkdir " PRIVFILE_DIR);
+		return -1;
+	}
+
+	if (lstat(PRIVFILE_DIR, &st)) {
+		perror("lstat " PRIVFILE_DIR);
+		return -1;
+	}
+
+	if (!S_ISDIR(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 077)) {
+		fprintf(stderr, "%s: not a private directory of this user\n", PRIVFILE_DIR);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int privfile_path(const char *name, const char *suffix, char *path)
+{
+	if (strchr(name, '/') ||
+	    snprintf(path, PRIVFILE_PATH_LEN, "%s/%s%s", PRIVFILE_DIR, name,
+		     suffix) >= PRIVFILE_PATH_LEN)
+		return -1;
+	return 0;
+}
+
+/* Make a rename or unlink in the directory durable */
+static int privfile_sync_dir(void)
+{
+	int fd;
+	int ret;
+
+	fd = open(PRIVFILE_DIR, O_RDONLY | O_DIRECTORY);
+	if (fd < 0)
+		return -1;
+	ret = fsync(fd);
+	close(fd);
+
+	return ret;
+}
+
+int privfile_read(const char *name, void *buf, size_t len)
+{
+	char path[PRIVFILE_PATH_LEN];
+	struct stat st;
+	ssize_t n;
+	int fd;
+	int ret = -1;
+
+	if (privfile_dir() || privfile_path(name, "", path))
+		return -1;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return -1;
+
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_uid == geteuid() &&
+	    st.st_size == len) {
+		n = read(fd, buf, len);
+		if (n == len)
+			ret = 0;
+	}
+	close(fd);
+
+	return ret;
+}
+
+int privfile_write(const char *name, const void *buf, size_t len)
+{
+	char path[PRIVFILE_PATH_LEN];
+	char tmp[PRIVFILE_PATH_LEN];
+	int fd;
+	int ret = -1;
+
+	if (privfile_dir() || privfile_path(name, "", path) ||
+	    privfile_path(name, ".tmp", tmp))
+		return -1;
+
+	/* Only a crash of a previous write leaves a temporary file behind, as
+	 * nobody else can create one in the directory.
+	 */
+	unlink(tmp);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	if (write(fd, buf, len) == len && !fsync(fd))
+		ret = 0;
+	close(fd);
+
+	if (ret || rename(tmp, path)) {
+		fprintf(stderr, "Could not write %s\n", path);
+		unlink(tmp);
+		return -1;
+	}
+
+	return privfile_sync_dir();
+}
+
+int privfile_remove(const char *name)
+{
+	char path[PRIVFILE_PATH_LEN];
+
+	if (privfile_dir() || privfile_path(name, "", path))
+		return -1;
+
+	if (unlink(path) && errno != ENOENT) {
+		perror("unlink");
+		return -1;
+	}
+
+	return privfile_sync_dir();
+}
+
+int privfile_lock(const char *name)
+{
+	char path[PRIVFILE_PATH_LEN];
+	struct stat st;
+	int fd;
+
+	if (privfile_dir() || privfile_path(name, "", path))
+		return -1;
+
+	fd = open(path, O_RDONLY | O_CREAT | O_NOFOLLOW, 0600);
+	if (fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_uid != geteuid()) {
+		fprintf(stderr, "%s: not a lock file of this user\n", path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int privfile_key(const char *name, void *key, size_t len)
+{
+	errno = 0;
+	if (!privfile_read(name, key, len))
+		return 0;
+
+	/* Anything but a missing key is left for the user to look at */
+	if (errno != ENOENT) {
+		fprintf(stderr, "Could not read the key %s/%s\n", PRIVFILE_DIR, name);
+		return -1;
+	}
+
+	if (RAND_bytes(key, len) != 1 || privfile_write(name, key, len))
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <slotkey.h>
+
+#define SLOTKEY_INFO		"secure96 slot key"
+
+int slotkey_read_master(const char *path, uint8_t *master)
+{
+	FILE *fp;
+	size_t len;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror("fopen");
+		return -1;
+	}
+
+	len = fread(master, 1, SLOTKEY_MASTER_LEN, fp);
+	fclose(fp);
+	if (len != SLOTKEY_MASTER_LEN) {
+		fprintf(stderr, "Master key must be %d bytes\n", SLOTKEY_MASTER_LEN);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* HKDF-SHA256 (RFC 5869), with the serial number as salt:
+ *
+ *   PRK = HMAC(SN, master)
+ *   key[n] = HMAC(PRK, "secure96 slot key" || n || 0x01)
+ *
+ * Each key is a single output block.
+ */
+static void slotkey_prk(const uint8_t *master, const uint8_t *sn, uint8_t *prk)
+{
+	unsigned int len;
+
+	HMAC(EVP_sha256(), sn, S96AT_SERIAL_NUMBER_LEN, master, SLOTKEY_MASTER_LEN,
+	     prk, &len);
+}
+
+static void slotkey_expand(const uint8_t *prk, uint8_t slot, uint8_t *key)
+{
+	uint8_t info[sizeof(SLOTKEY_INFO) + 1];
+	unsigned int len;
+
+	/* The NUL of SLOTKEY_INFO is replaced with the slot number */
+	memcpy(info, SLOTKEY_INFO, sizeof(SLOTKEY_INFO) - 1);
+	info[sizeof(info) - 2] = slot;
+	info[sizeof(info) - 1] = 0x01;
+	HMAC(EVP_sha256(), prk, S96AT_SHA_LEN, info, sizeof(info), key, &len);
+}
+
+void slotkey_derive(const uint8_t *master, const uint8_t *sn,
+		    uint8_t keys[SLOTKEY_NUM_SLOTS][SLOTKEY_LEN])
+{
+	uint8_t prk[S96AT_SHA_LEN];
+
+	slotkey_prk(master, sn, prk);
+	for (int i = 0; i < SLOTKEY_NUM_SLOTS; i++)
+		slotkey_expand(prk, i, keys[i]);
+
+	memset(prk, 0, sizeof(prk));
+}
+
+int slotkey_derive_one(const uint8_t *master, const uint8_t *sn, uint8_t slot,
+		       uint8_t *key)
+{
+	uint8_t prk[S96AT_SHA_LEN];
+
+	if (slot >= SLOTKEY_NUM_SLOTS)
+		return -1;
+
+	slotkey_prk(master, sn, prk);
+	slotkey_expand(prk, slot, key);
+
+	memset(prk, 0, sizeof(prk));
+	return 0;
+}
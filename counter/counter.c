@@ -0,0 +1,349 @@
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <counter.h>
+#include <privfile.h>
+
+#define STATE_MAGIC	0x43363953	/* "S96C" */
+#define STATE_KEY_NAME	"counter-host.key"
+
+/* The unused tail of the current lease and the spare lease, written on
+ * close. It is only valid while the device counter still holds the last
+ * of them, ie nothing advanced it since. A planted state could hand out
+ * values again, so it carries an HMAC under a random key of the host.
+ */
+struct __attribute__((__packed__)) counter_state {
+	uint32_t magic;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint8_t id;
+	uint32_t lease;
+	uint32_t next;		/* Offset of the first unused value */
+	uint32_t spare;		/* 0 if none */
+	uint8_t mac[32];
+};
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void state_name(struct counter *c)
+{
+	const uint8_t *sn = c->sn;
+
+	snprintf(c->name, sizeof(c->name), "counter-"
+		 "%02x%02x%02x%02x%02x%02x%02x%02x%02x-%u",
+		 sn[0], sn[1], sn[2], sn[3], sn[4], sn[5], sn[6], sn[7], sn[8], c->id);
+}
+
+static int state_mac(const struct counter_state *st, uint8_t *mac)
+{
+	uint8_t key[32];
+	unsigned int len;
+
+	if (privfile_key(STATE_KEY_NAME, key, sizeof(key)))
+		return -1;
+
+	HMAC(EVP_sha256(), key, sizeof(key), (const uint8_t *)st,
+	     offsetof(struct counter_state, mac), mac, &len);
+	OPENSSL_cleanse(key, sizeof(key));
+
+	return 0;
+}
+
+/* A missing state is the normal case after a crash. Any other state that
+ * cannot be used is reported, and a new lease is taken.
+ */
+static int state_read(struct counter *c, struct counter_state *st)
+{
+	uint8_t mac[sizeof(st->mac)];
+
+	errno = 0;
+	if (privfile_read(c->name, st, sizeof(*st))) {
+		if (errno != ENOENT)
+			fprintf(stderr, "Could not read %s/%s\n", PRIVFILE_DIR, c->name);
+		return -1;
+	}
+
+	if (state_mac(st, mac) || CRYPTO_memcmp(mac, st->mac, sizeof(mac)) ||
+	    st->magic != STATE_MAGIC ||
+	    memcmp(st->sn, c->sn, sizeof(st->sn)) || st->id != c->id ||
+	    st->next >= COUNTER_LEASE_SIZE || (st->spare && st->spare <= st->lease)) {
+		fprintf(stderr, "Ignoring %s/%s: not a state of this counter\n",
+			PRIVFILE_DIR, c->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* The state is replaced atomically, so that a crash leaves either the old
+ * or the new state.
+ */
+static int state_write(struct counter *c, uint32_t lease, uint32_t next, uint32_t spare)
+{
+	struct counter_state st;
+
+	memset(&st, 0, sizeof(st));
+	st.magic = STATE_MAGIC;
+	memcpy(st.sn, c->sn, sizeof(st.sn));
+	st.id = c->id;
+	st.lease = lease;
+	st.next = next;
+	st.spare = spare;
+
+	if (state_mac(&st, st.mac))
+		return -1;
+
+	return privfile_write(c->name, &st, sizeof(st));
+}
+
+/* The state file is removed before any value of the resumed lease is
+ * handed out. After a crash, the next run finds no state and takes a new
+ * lease, whatever was handed out of the old one.
+ */
+static int state_remove(struct counter *c)
+{
+	return privfile_remove(c->name);
+}
+
+/* Take the spare lease from the device whenever it is wanted. A lease
+ * in progress is completed before stopping, so that the state written on
+ * close matches the device counter.
+ */
+static void *lease_thread(void *arg)
+{
+	struct counter *c = arg;
+	uint8_t ret;
+	uint32_t hw;
+	uint32_t last;
+	double t;
+
+	pthread_mutex_lock(&c->lock);
+	for (;;) {
+		while (!c->stop && !(c->want_spare && !c->spare && !c->error))
+			pthread_cond_wait(&c->cond, &c->lock);
+		if (c->stop)
+			break;
+
+		c->want_spare = 0;
+		last = __atomic_load_n(&c->word, __ATOMIC_ACQUIRE) >> 32;
+		pthread_mutex_unlock(&c->lock);
+
+		t = now_ms();
+		if (last < COUNTER_HW_MAX) {
+			while (s96at_wake(c->desc) != S96AT_STATUS_READY) {};
+			ret = s96at_increment_counter(c->desc, c->id, &hw);
+			s96at_idle(c->desc);
+		} else {
+			fprintf(stderr, "Counter %u exhausted\n", c->id);
+			ret = S96AT_STATUS_EXEC_ERROR;
+		}
+		t = now_ms() - t;
+
+		pthread_mutex_lock(&c->lock);
+		if (ret == S96AT_STATUS_OK && hw > last) {
+			c->spare = hw;
+			c->leases++;
+			c->lease_ms += t;
+		} else {
+			if (last < COUNTER_HW_MAX)
+				fprintf(stderr, "Could not increment counter %u\n", c->id);
+			c->error = 1;
+		}
+		pthread_cond_broadcast(&c->ready);
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	return NULL;
+}
+
+int counter_open(struct counter *c, struct s96at_desc *desc, uint8_t id)
+{
+	uint8_t ret;
+	uint32_t hw;
+	struct counter_state st;
+
+	memset(c, 0, sizeof(*c));
+	c->desc = desc;
+	c->id = id;
+
+	if (id >= COUNTER_NUM) {
+		fprintf(stderr, "Invalid counter %u\n", id);
+		return -1;
+	}
+
+	while (s96at_wake(desc) != S96AT_STATUS_READY) {};
+
+	ret = s96at_get_serialnbr(desc, c->sn);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read the serial number\n");
+		goto out;
+	}
+
+	ret = s96at_get_counter(desc, id, &hw);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read counter %u\n", id);
+		goto out;
+	}
+out:
+	s96at_idle(desc);
+	if (ret != S96AT_STATUS_OK)
+		return -1;
+
+	state_name(c);
+
+	/* The current device value may have been handed out already. It is
+	 * only reused if the state says which part of it was not.
+	 */
+	if (!state_read(c, &st) && (st.spare ? st.spare : st.lease) == hw) {
+		c->word = (uint64_t)st.lease << 32 | st.next;
+		c->spare = st.spare;
+		c->resumed = 1;
+	} else {
+		c->word = (uint64_t)hw << 32 | COUNTER_LEASE_SIZE;
+	}
+	c->want_spare = !c->spare;
+
+	if (state_remove(c))
+		return -1;
+
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->cond, NULL);
+	pthread_cond_init(&c->ready, NULL);
+
+	if (pthread_create(&c->thread, NULL, lease_thread, c)) {
+		fprintf(stderr, "Could not start lease thread\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Switch to the spare lease once the current one is used up, unless
+ * another thread did it already.
+ */
+static int counter_switch(struct counter *c, uint32_t lease)
+{
+	uint64_t word;
+	int err = 0;
+
+	pthread_mutex_lock(&c->lock);
+
+	word = __atomic_load_n(&c->word, __ATOMIC_ACQUIRE);
+	if (word >> 32 != lease)
+		goto out;
+
+	/* Another thread waiting for the same spare lease may switch to it
+	 * first, and this one must not switch again to the lease after.
+	 */
+	if (!c->spare && !c->error)
+		c->stalls++;
+	while (!c->spare && !c->error) {
+		c->want_spare = 1;
+		pthread_cond_signal(&c->cond);
+		pthread_cond_wait(&c->ready, &c->lock);
+
+		word = __atomic_load_n(&c->word, __ATOMIC_ACQUIRE);
+		if (word >> 32 != lease)
+			goto out;
+	}
+
+	if (!c->spare) {
+		err = -1;
+		goto out;
+	}
+
+	__atomic_store_n(&c->word, (uint64_t)c->spare << 32, __ATOMIC_RELEASE);
+	c->spare = 0;
+	c->want_spare = 1;
+	pthread_cond_signal(&c->cond);
+out:
+	pthread_mutex_unlock(&c->lock);
+	return err;
+}
+
+int counter_next(struct counter *c, uint64_t *value)
+{
+	uint64_t word;
+
+	/* The offset saturates at the lease size instead of being increased
+	 * past it, so it never carries into the lease, however many calls
+	 * fail once the device is in error.
+	 */
+	word = __atomic_load_n(&c->word, __ATOMIC_RELAXED);
+	for (;;) {
+		if ((uint32_t)word < COUNTER_LEASE_SIZE) {
+			if (__atomic_compare_exchange_n(&c->word, &word, word + 1, 1,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+			continue;
+		}
+
+		if (counter_switch(c, word >> 32))
+			return -1;
+		word = __atomic_load_n(&c->word, __ATOMIC_RELAXED);
+	}
+
+	/* The thread that gets the middle of a lease makes sure the next one
+	 * is on its way, in case the device was not available earlier.
+	 */
+	if ((uint32_t)word == COUNTER_LEASE_SIZE / 2) {
+		pthread_mutex_lock(&c->lock);
+		if (!c->spare) {
+			c->want_spare = 1;
+			pthread_cond_signal(&c->cond);
+		}
+		pthread_mutex_unlock(&c->lock);
+	}
+
+	*value = (word >> 32) * COUNTER_LEASE_SIZE + (uint32_t)word;
+	return 0;
+}
+
+/* Save the unused tail of the current lease and the spare lease for the
+ * next run. No other thread may use the counter any more.
+ */
+int counter_close(struct counter *c)
+{
+	uint64_t word;
+	uint32_t lease;
+	uint32_t next;
+	int ret = 0;
+
+	pthread_mutex_lock(&c->lock);
+	c->stop = 1;
+	pthread_cond_signal(&c->cond);
+	pthread_mutex_unlock(&c->lock);
+	pthread_join(c->thread, NULL);
+
+	word = __atomic_load_n(&c->word, __ATOMIC_ACQUIRE);
+	lease = word >> 32;
+	next = (uint32_t)word;
+
+	if (next >= COUNTER_LEASE_SIZE && c->spare) {
+		lease = c->spare;
+		next = 0;
+		c->spare = 0;
+	}
+
+	if (next < COUNTER_LEASE_SIZE)
+		ret = state_write(c, lease, next, c->spare);
+
+	pthread_cond_destroy(&c->ready);
+	pthread_cond_destroy(&c->cond);
+	pthread_mutex_destroy(&c->lock);
+
+	return ret;
+}
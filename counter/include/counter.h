@@ -0,0 +1,59 @@
+#ifndef __COUNTER_H
+#define __COUNTER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#define COUNTER_NUM		2		/* Monotonic counters on ATECC508A */
+#define COUNTER_HW_MAX		2097151		/* Largest value of a counter */
+
+/* Values handed out per increment of the device counter. Value v belongs
+ * to lease v / COUNTER_LEASE_SIZE, which is the device counter value
+ * after the increment that took it. This must never change for a given
+ * device, or values would be handed out again.
+ */
+#define COUNTER_LEASE_SIZE	0x100000	/* 2^41 values in total */
+
+/* A counter on top of one device counter. Values of the current lease
+ * are taken with a compare-and-swap increment of word, which holds the
+ * lease in the upper 32 bits and the offset of the next value in the
+ * lower ones. The offset stops at COUNTER_LEASE_SIZE.
+ * A separate thread takes the next lease from the device once half of
+ * the current one is handed out, so that the thread using it up only has
+ * to switch to it.
+ */
+struct counter {
+	struct s96at_desc *desc;
+	uint8_t id;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	char name[32];		/* Of the state file in the private directory */
+
+	uint64_t word;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;	/* Signals the lease thread */
+	pthread_cond_t ready;	/* Signals threads waiting for the spare lease */
+
+	/* Protected by the lock */
+	uint32_t spare;		/* Lease taken ahead, 0 if none */
+	int want_spare;
+	int error;
+	int stop;
+
+	/* Statistics, protected by the lock */
+	unsigned long leases;
+	unsigned long stalls;	/* Switches that had to wait for the spare lease */
+	double lease_ms;	/* Time spent leasing from the device */
+	int resumed;		/* Leases were resumed from the state file */
+};
+
+int counter_open(struct counter *c, struct s96at_desc *desc, uint8_t id);
+
+int counter_next(struct counter *c, uint64_t *value);
+
+int counter_close(struct counter *c);
+
+#endif
@@ -0,0 +1,204 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <secure96/s96at.h>
+
+#include <counter.h>
+
+#define MAX_THREADS	64
+
+struct worker {
+	pthread_t thread;
+	struct counter *counter;
+	double end;
+	uint64_t count;
+	uint64_t first;
+	uint64_t last;
+	int failed;
+};
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-c counter] <command> <args>\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Commands:\n");
+	fprintf(stderr, "  next [count]              Print the next count values (default 1)\n");
+	fprintf(stderr, "  bench [threads] [seconds] Take values from several threads\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -c <counter>  Device counter to lease from, 0 or 1 (default 0)\n");
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Take values until the deadline, checking that each one is larger than
+ * the previous. The clock is only read every 4096 values.
+ */
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t value;
+
+	do {
+		for (int i = 0; i < 4096; i++) {
+			if (counter_next(w->counter, &value)) {
+				w->failed = 1;
+				return NULL;
+			}
+			if (w->count && value <= w->last) {
+				fprintf(stderr, "Value %" PRIu64 " after %" PRIu64 "\n",
+					value, w->last);
+				w->failed = 1;
+				return NULL;
+			}
+			if (!w->count)
+				w->first = value;
+			w->last = value;
+			w->count++;
+		}
+	} while (now_s() < w->end);
+
+	return NULL;
+}
+
+static int cmd_next(struct counter *c, unsigned long count)
+{
+	uint64_t value;
+
+	for (unsigned long i = 0; i < count; i++) {
+		if (counter_next(c, &value))
+			return -1;
+		printf("%" PRIu64 "\n", value);
+	}
+
+	return 0;
+}
+
+static int cmd_bench(struct counter *c, int num_threads, double seconds)
+{
+	struct worker workers[MAX_THREADS];
+	uint64_t total = 0;
+	uint64_t first = UINT64_MAX;
+	uint64_t last = 0;
+	int started = 0;
+	int ret = 0;
+	double t;
+
+	memset(workers, 0, sizeof(workers));
+
+	t = now_s();
+	for (int i = 0; i < num_threads; i++) {
+		workers[i].counter = c;
+		workers[i].end = t + seconds;
+		if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i])) {
+			fprintf(stderr, "Could not start thread %d\n", i);
+			break;
+		}
+		started++;
+	}
+
+	for (int i = 0; i < started; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].failed)
+			ret = -1;
+		if (!workers[i].count)
+			continue;
+		total += workers[i].count;
+		if (workers[i].first < first)
+			first = workers[i].first;
+		if (workers[i].last > last)
+			last = workers[i].last;
+	}
+	t = now_s() - t;
+
+	printf("%d threads: %" PRIu64 " values in %.2f s (%.1f M/s)\n",
+	       started, total, t, total / t / 1e6);
+	if (total)
+		printf("Range:  %" PRIu64 " - %" PRIu64 "\n", first, last);
+	printf("Leases: %lu in %.1f ms (%.2f ms each), %lu waited for\n", c->leases,
+	       c->lease_ms, c->leases ? c->lease_ms / c->leases : 0, c->stalls);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = -1;
+	int opt;
+	uint8_t id = 0;
+	uint8_t s96_ret;
+	const char *cmd;
+	struct s96at_desc desc;
+	struct counter counter;
+
+	progname = argv[0];
+
+	while ((opt = getopt(argc, argv, "c:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			id = atoi(optarg);
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage();
+		return -1;
+	}
+	cmd = argv[optind];
+
+	s96_ret = s96at_init(S96AT_ATECC508A, S96AT_IO_I2C_LINUX, &desc);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize the device\n");
+		return -1;
+	}
+
+	if (counter_open(&counter, &desc, id))
+		goto out;
+
+	if (counter.resumed)
+		fprintf(stderr, "Resumed lease %" PRIu64 " at %" PRIu64 "\n",
+			counter.word >> 32, counter.word & 0xffffffff);
+
+	if (!strcmp(cmd, "next")) {
+		ret = cmd_next(&counter, optind + 1 < argc ? strtoul(argv[optind + 1], NULL, 0) : 1);
+	} else if (!strcmp(cmd, "bench")) {
+		int num_threads = optind + 1 < argc ? atoi(argv[optind + 1]) : 1;
+		double seconds = optind + 2 < argc ? atof(argv[optind + 2]) : 1;
+
+		if (num_threads < 1 || num_threads > MAX_THREADS || seconds <= 0) {
+			usage();
+			num_threads = 0;
+		}
+
+		if (num_threads)
+			ret = cmd_bench(&counter, num_threads, seconds);
+	} else {
+		usage();
+	}
+
+	if (counter_close(&counter))
+		ret = -1;
+out:
+	s96at_sleep(&desc);
+	s96at_cleanup(&desc);
+
+	return ret;
+}
@@ -0,0 +1,384 @@
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <derivekey.h>
+#include <privfile.h>
+#include <slotkey.h>
+
+#define OPCODE_MAC		0x08
+#define OPCODE_GENDIG		0x15
+#define OPCODE_NONCE		0x16
+#define OPCODE_DERIVEKEY	0x1c
+
+#define NONCE_MODE_UPDATE_SEED	0x00
+
+#define MIRROR_AUTH_INFO	"secure96 derivekey mirror"
+#define HOST_KEY_NAME		"derivekey-host.key"
+
+/* The mirror as stored, with a MAC over it */
+struct __attribute__((__packed__)) dk_mirror_file {
+	struct dk_mirror m;
+	uint8_t mac[S96AT_SHA_LEN];
+};
+
+/* Sect 9.12, random mode */
+struct __attribute__((__packed__)) nonce_in {
+	uint8_t rand_out[S96AT_RANDOM_LEN];
+	uint8_t num_in[DK_NUM_IN_LEN];
+	uint8_t opcode;
+	uint8_t mode;
+	uint8_t zero;
+};
+
+/* Sect 9.3 */
+struct __attribute__((__packed__)) derivekey_in {
+	uint8_t parent_key[32];
+	uint8_t opcode;
+	uint8_t param1;
+	uint8_t param2[2];
+	uint8_t sn_hi;
+	uint8_t sn_lo[2];
+	uint8_t zero[25];
+	uint8_t temp_key[32];
+};
+
+/* Sect 9.3, authorizing MAC */
+struct __attribute__((__packed__)) derivekey_mac_in {
+	uint8_t write_key[32];
+	uint8_t opcode;
+	uint8_t param1;
+	uint8_t param2[2];
+	uint8_t sn_hi;
+	uint8_t sn_lo[2];
+};
+
+/* Sect 9.6 */
+struct __attribute__((__packed__)) gendig_in {
+	uint8_t data[32];
+	uint8_t opcode;
+	uint8_t param1;
+	uint8_t param2[2];
+	uint8_t sn_hi;
+	uint8_t sn_lo[2];
+	uint8_t zero[25];
+	uint8_t temp_key[32];
+};
+
+/* Sect 9.11, mode 0 */
+struct __attribute__((__packed__)) mac_in {
+	uint8_t key[32];
+	uint8_t challenge[32];
+	uint8_t opcode;
+	uint8_t mode;
+	uint8_t param2[2];
+	uint8_t otp[11];	/* Zero unless included by the mode */
+	uint8_t sn_hi;
+	uint8_t sn4[4];		/* SN[4:7], zero unless included by the mode */
+	uint8_t sn_lo[2];
+	uint8_t sn2[2];		/* SN[2:3], zero unless included by the mode */
+};
+
+/* SlotConfig.WriteConfig for DeriveKey (Table 2-7):
+ *   XX0X  DeriveKey not allowed
+ *   0X10  Roll: the parent key is the target itself, no MAC
+ *   0X11  Create: the parent key is WriteKey, no MAC
+ *   1X1X  As above, with an authorizing MAC
+ */
+int dk_slot_info(const uint8_t *slot_config, uint8_t slot, struct dk_slot *info)
+{
+	uint8_t write_config = slot_config[1] >> 4;
+
+	if (!(write_config & 0x02))
+		return -1;
+
+	info->slot = slot;
+	info->write_key = slot_config[1] & 0x0f;
+	info->roll = !(write_config & 0x01);
+	info->parent = info->roll ? slot : info->write_key;
+	info->auth_mac = !!(write_config & 0x08);
+
+	return 0;
+}
+
+static void mirror_name(const uint8_t *sn, char *name, size_t len)
+{
+	snprintf(name, len, "derive-%02x%02x%02x%02x%02x%02x%02x%02x%02x",
+		 sn[0], sn[1], sn[2], sn[3], sn[4], sn[5], sn[6], sn[7], sn[8]);
+}
+
+/* MAC of the mirror, under a key derived from the master key if there is
+ * one, so that a mirror written with another master key is rejected too.
+ * Without a master key, a random key of the host is used.
+ */
+static int mirror_mac(const struct dk_mirror *m, const uint8_t *master, uint8_t *mac)
+{
+	uint8_t key[DK_KEY_LEN];
+	unsigned int len;
+
+	if (master)
+		HMAC(EVP_sha256(), master, DK_MASTER_LEN, (const uint8_t *)MIRROR_AUTH_INFO,
+		     sizeof(MIRROR_AUTH_INFO) - 1, key, &len);
+	else if (privfile_key(HOST_KEY_NAME, key, sizeof(key)))
+		return -1;
+
+	HMAC(EVP_sha256(), key, sizeof(key), (const uint8_t *)m, sizeof(*m), mac, &len);
+	OPENSSL_cleanse(key, sizeof(key));
+
+	return 0;
+}
+
+/* A missing mirror is empty: all slots hold their personalization key.
+ * A mirror that cannot be read or fails authentication is an error, as
+ * storing over it would lose the keys it holds.
+ */
+int dk_mirror_load(struct dk_mirror *m, const uint8_t *sn, const uint8_t *master)
+{
+	struct dk_mirror_file f;
+	uint8_t mac[S96AT_SHA_LEN];
+	char name[32];
+	int ret = -1;
+
+	memset(m, 0, sizeof(*m));
+	memcpy(m->sn, sn, sizeof(m->sn));
+	mirror_name(sn, name, sizeof(name));
+
+	errno = 0;
+	if (privfile_read(name, &f, sizeof(f))) {
+		if (errno == ENOENT)
+			return 0;
+		fprintf(stderr, "Could not read the mirror %s/%s\n", PRIVFILE_DIR, name);
+		return -1;
+	}
+
+	if (mirror_mac(&f.m, master, mac))
+		goto out;
+
+	if (CRYPTO_memcmp(mac, f.mac, sizeof(mac)) ||
+	    memcmp(f.m.sn, sn, sizeof(f.m.sn))) {
+		fprintf(stderr, "The mirror %s/%s fails authentication: wrong master key, "
+			"or modified\n", PRIVFILE_DIR, name);
+		goto out;
+	}
+
+	memcpy(m, &f.m, sizeof(*m));
+	ret = 0;
+out:
+	OPENSSL_cleanse(&f, sizeof(f));
+	return ret;
+}
+
+int dk_mirror_store(const struct dk_mirror *m, const uint8_t *master)
+{
+	struct dk_mirror_file f;
+	char name[32];
+	int ret = -1;
+
+	mirror_name(m->sn, name, sizeof(name));
+	memcpy(&f.m, m, sizeof(f.m));
+
+	if (!mirror_mac(&f.m, master, f.mac))
+		ret = privfile_write(name, &f, sizeof(f));
+
+	OPENSSL_cleanse(&f, sizeof(f));
+	return ret;
+}
+
+/* The personalization key of a slot: derived from the master key like
+ * s96util -m does, or all n * 0x11 for slot n by convention.
+ */
+static void initial_key(const uint8_t *master, const uint8_t *sn, uint8_t slot, uint8_t *key)
+{
+	if (!master || slotkey_derive_one(master, sn, slot, key))
+		memset(key, slot * 0x11, DK_KEY_LEN);
+}
+
+void dk_mirror_key(const struct dk_mirror *m, const uint8_t *master, uint8_t slot,
+		   uint8_t *key)
+{
+	if (m->slots[slot].valid)
+		memcpy(key, m->slots[slot].key, DK_KEY_LEN);
+	else
+		initial_key(master, m->sn, slot, key);
+}
+
+/* TempKey after a random Nonce that updates the seed (mode 0) */
+void dk_nonce(const uint8_t *rand_out, const uint8_t *num_in, uint8_t *temp_key)
+{
+	struct nonce_in in = {0};
+
+	memcpy(in.rand_out, rand_out, S96AT_RANDOM_LEN);
+	memcpy(in.num_in, num_in, DK_NUM_IN_LEN);
+	in.opcode = OPCODE_NONCE;
+	in.mode = NONCE_MODE_UPDATE_SEED;
+
+	SHA256((uint8_t *)&in, sizeof(in), temp_key);
+	OPENSSL_cleanse(&in, sizeof(in));
+}
+
+/* The new key of the target slot, with TempKey set by a random Nonce.
+ * Param1 bit 2 must match TempKey.SourceFlag, which is 0 after a random
+ * Nonce, and s96at_derive_key() sends Param1 = 0.
+ */
+void dk_target_key(const uint8_t *parent_key, const uint8_t *sn, uint8_t slot,
+		   const uint8_t *temp_key, uint8_t *key)
+{
+	struct derivekey_in in = {0};
+
+	memcpy(in.parent_key, parent_key, 32);
+	in.opcode = OPCODE_DERIVEKEY;
+	in.param2[0] = slot;
+	in.sn_hi = sn[8];
+	in.sn_lo[0] = sn[0];
+	in.sn_lo[1] = sn[1];
+	memcpy(in.temp_key, temp_key, 32);
+
+	SHA256((uint8_t *)&in, sizeof(in), key);
+	OPENSSL_cleanse(&in, sizeof(in));
+}
+
+void dk_auth_mac(const uint8_t *write_key, const uint8_t *sn, uint8_t slot, uint8_t *mac)
+{
+	struct derivekey_mac_in in = {0};
+
+	memcpy(in.write_key, write_key, 32);
+	in.opcode = OPCODE_DERIVEKEY;
+	in.param2[0] = slot;
+	in.sn_hi = sn[8];
+	in.sn_lo[0] = sn[0];
+	in.sn_lo[1] = sn[1];
+
+	SHA256((uint8_t *)&in, sizeof(in), mac);
+	OPENSSL_cleanse(&in, sizeof(in));
+}
+
+/* The response of MAC in mode 0 */
+void dk_mac(const uint8_t *key, const uint8_t *sn, uint8_t slot, const uint8_t *challenge,
+	    uint8_t *mac)
+{
+	struct mac_in in = {0};
+
+	memcpy(in.key, key, 32);
+	memcpy(in.challenge, challenge, 32);
+	in.opcode = OPCODE_MAC;
+	in.param2[0] = slot;
+	in.sn_hi = sn[8];
+	in.sn_lo[0] = sn[0];
+	in.sn_lo[1] = sn[1];
+
+	SHA256((uint8_t *)&in, sizeof(in), mac);
+	OPENSSL_cleanse(&in, sizeof(in));
+}
+
+/* TempKey after GenDig on the slot */
+void dk_gendig(const uint8_t *key, const uint8_t *sn, uint8_t slot, const uint8_t *temp_key,
+	       uint8_t *out)
+{
+	struct gendig_in in = {0};
+
+	memcpy(in.data, key, 32);
+	in.opcode = OPCODE_GENDIG;
+	in.param1 = S96AT_ZONE_DATA;
+	in.param2[0] = slot;
+	in.sn_hi = sn[8];
+	in.sn_lo[0] = sn[0];
+	in.sn_lo[1] = sn[1];
+	memcpy(in.temp_key, temp_key, 32);
+
+	SHA256((uint8_t *)&in, sizeof(in), out);
+	OPENSSL_cleanse(&in, sizeof(in));
+}
+
+/* Run DeriveKey on the device, and the same derivation on the host. The
+ * mirror is only updated once the device has derived the key. If the
+ * command fails, the device may or may not have derived it, so the slot
+ * is marked unknown until the next derivation.
+ */
+uint8_t dk_derive(struct s96at_desc *desc, struct dk_mirror *m, const uint8_t *master,
+		  const struct dk_slot *info)
+{
+	uint8_t ret;
+	uint8_t num_in[DK_NUM_IN_LEN];
+	uint8_t rand_out[S96AT_RANDOM_LEN];
+	uint8_t temp_key[DK_KEY_LEN] = {0};
+	uint8_t parent_key[DK_KEY_LEN] = {0};
+	uint8_t write_key[DK_KEY_LEN] = {0};
+	uint8_t new_key[DK_KEY_LEN] = {0};
+	uint8_t mac[S96AT_MAC_LEN];
+	struct dk_entry *e = &m->slots[info->slot];
+
+	if (RAND_bytes(num_in, sizeof(num_in)) != 1)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ret = s96at_gen_nonce(desc, S96AT_NONCE_MODE_UPDATE_SEED, num_in, rand_out);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Nonce failed\n");
+		goto out;
+	}
+	dk_nonce(rand_out, num_in, temp_key);
+
+	dk_mirror_key(m, master, info->parent, parent_key);
+	dk_target_key(parent_key, m->sn, info->slot, temp_key, new_key);
+
+	if (info->auth_mac) {
+		dk_mirror_key(m, master, info->write_key, write_key);
+		dk_auth_mac(write_key, m->sn, info->slot, mac);
+	}
+
+	ret = s96at_derive_key(desc, info->slot, info->auth_mac ? mac : NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "DeriveKey failed: 0x%02x\n", ret);
+		e->valid = 0;
+		goto out;
+	}
+
+	memcpy(e->key, new_key, DK_KEY_LEN);
+	e->valid = 1;
+	e->generation++;
+out:
+	OPENSSL_cleanse(temp_key, sizeof(temp_key));
+	OPENSSL_cleanse(parent_key, sizeof(parent_key));
+	OPENSSL_cleanse(write_key, sizeof(write_key));
+	OPENSSL_cleanse(new_key, sizeof(new_key));
+	return ret;
+}
+
+/* Compare a MAC from the device with the MAC computed with the mirrored
+ * key. A mismatch means the slot was derived without going through the
+ * mirror, or the parent key was not the expected one: the entry is
+ * invalidated.
+ */
+uint8_t dk_check(struct s96at_desc *desc, struct dk_mirror *m, const uint8_t *master,
+		 uint8_t slot, int *stale)
+{
+	uint8_t ret;
+	uint8_t key[DK_KEY_LEN];
+	uint8_t challenge[S96AT_CHALLENGE_LEN];
+	uint8_t dev_mac[S96AT_MAC_LEN];
+	uint8_t host_mac[S96AT_MAC_LEN];
+
+	if (RAND_bytes(challenge, sizeof(challenge)) != 1)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ret = s96at_gen_mac(desc, S96AT_MAC_MODE_0, slot, challenge, dev_mac);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "MAC failed: 0x%02x\n", ret);
+		return ret;
+	}
+
+	dk_mirror_key(m, master, slot, key);
+	dk_mac(key, m->sn, slot, challenge, host_mac);
+	OPENSSL_cleanse(key, sizeof(key));
+
+	*stale = CRYPTO_memcmp(dev_mac, host_mac, sizeof(dev_mac)) != 0;
+	if (*stale)
+		m->slots[slot].valid = 0;
+
+	return S96AT_STATUS_OK;
+}
@@ -0,0 +1,70 @@
+#ifndef __DERIVEKEY_H
+#define __DERIVEKEY_H
+
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#include <slotkey.h>
+
+#define DK_NUM_SLOTS		16
+#define DK_KEY_LEN		32
+#define DK_MASTER_LEN		SLOTKEY_MASTER_LEN
+#define DK_NUM_IN_LEN		20	/* NumIn of a random Nonce */
+
+/* How DeriveKey may be run on a slot, from SlotConfig.WriteConfig */
+struct dk_slot {
+	uint8_t slot;
+	uint8_t parent;		/* The slot itself when rolling, WriteKey when creating */
+	uint8_t write_key;	/* Key of the authorizing MAC */
+	int roll;
+	int auth_mac;
+};
+
+struct __attribute__((__packed__)) dk_entry {
+	uint8_t valid;
+	uint32_t generation;	/* Derivations done through the mirror */
+	uint8_t key[DK_KEY_LEN];
+};
+
+/* Host mirror of the slot keys of one device. Slots without a valid
+ * entry hold their personalization key.
+ */
+struct __attribute__((__packed__)) dk_mirror {
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	struct dk_entry slots[DK_NUM_SLOTS];
+};
+
+int dk_slot_info(const uint8_t *slot_config, uint8_t slot, struct dk_slot *info);
+
+/* The mirror is kept in the private directory, with an HMAC under a key
+ * derived from the master key, or under a host key without one. Both
+ * return 0 or -1.
+ */
+int dk_mirror_load(struct dk_mirror *m, const uint8_t *sn, const uint8_t *master);
+
+int dk_mirror_store(const struct dk_mirror *m, const uint8_t *master);
+
+void dk_mirror_key(const struct dk_mirror *m, const uint8_t *master, uint8_t slot,
+		   uint8_t *key);
+
+void dk_nonce(const uint8_t *rand_out, const uint8_t *num_in, uint8_t *temp_key);
+
+void dk_target_key(const uint8_t *parent_key, const uint8_t *sn, uint8_t slot,
+		   const uint8_t *temp_key, uint8_t *key);
+
+void dk_auth_mac(const uint8_t *write_key, const uint8_t *sn, uint8_t slot, uint8_t *mac);
+
+void dk_mac(const uint8_t *key, const uint8_t *sn, uint8_t slot, const uint8_t *challenge,
+	    uint8_t *mac);
+
+void dk_gendig(const uint8_t *key, const uint8_t *sn, uint8_t slot, const uint8_t *temp_key,
+	       uint8_t *out);
+
+uint8_t dk_derive(struct s96at_desc *desc, struct dk_mirror *m, const uint8_t *master,
+		  const struct dk_slot *info);
+
+uint8_t dk_check(struct s96at_desc *desc, struct dk_mirror *m, const uint8_t *master,
+		 uint8_t slot, int *stale);
+
+#endif
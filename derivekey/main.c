@@ -0,0 +1,269 @@
+#include <openssl/crypto.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <secure96/s96at.h>
+
+#include <derivekey.h>
+
+#define SLOT_CONFIG_OFFSET	20
+#define SLOT_CONFIG_LEN		2
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-m master] <command> <args>\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Commands:\n");
+	fprintf(stderr, "  derive <slot>           Run DeriveKey on the slot and mirror the new key\n");
+	fprintf(stderr, "  check <slot>            Compare the slot key on the device with the mirror\n");
+	fprintf(stderr, "  mac <slot> <challenge>  Compute the mode 0 MAC of the slot on the host\n");
+	fprintf(stderr, "  gendig <slot> <tempkey> Compute TempKey after GenDig on the slot on the host\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -m <file>  Master key the slots were personalized with (s96util -m)\n");
+}
+
+static void print_hex(FILE *fp, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		fprintf(fp, "%02x", buf[i]);
+}
+
+static int parse_hex(const char *str, uint8_t *buf, size_t len)
+{
+	if (strlen(str) != 2 * len)
+		return -1;
+
+	for (size_t i = 0; i < len; i++) {
+		if (sscanf(str + 2 * i, "%2hhx", &buf[i]) != 1)
+			return -1;
+	}
+	return 0;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parse_slot(const char *str, uint8_t *slot)
+{
+	char *end;
+	long val = strtol(str, &end, 0);
+
+	if (*end || val < 0 || val >= DK_NUM_SLOTS) {
+		fprintf(stderr, "Invalid slot %s\n", str);
+		return -1;
+	}
+
+	*slot = val;
+	return 0;
+}
+
+static uint8_t read_slot_config(struct s96at_desc *desc, uint8_t slot, uint8_t *slot_config)
+{
+	uint8_t ret;
+	uint8_t buf[2 * S96AT_BLOCK_SIZE];
+	int offset = SLOT_CONFIG_OFFSET + SLOT_CONFIG_LEN * slot;
+
+	for (int i = 0; i < 2; i++) {
+		ret = s96at_read_config(desc, i, buf + i * S96AT_BLOCK_SIZE);
+		if (ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "Could not read the configuration\n");
+			return ret;
+		}
+	}
+
+	memcpy(slot_config, buf + offset, SLOT_CONFIG_LEN);
+
+	return S96AT_STATUS_OK;
+}
+
+static int cmd_derive(struct s96at_desc *desc, struct dk_mirror *m, const uint8_t *master,
+		      uint8_t slot)
+{
+	uint8_t ret;
+	uint8_t slot_config[SLOT_CONFIG_LEN];
+	struct dk_slot info;
+	int stale;
+	double t;
+
+	ret = read_slot_config(desc, slot, slot_config);
+	if (ret != S96AT_STATUS_OK)
+		return -1;
+
+	if (dk_slot_info(slot_config, slot, &info)) {
+		fprintf(stderr, "Slot %u is not configured for DeriveKey\n", slot);
+		return -1;
+	}
+
+	printf("Slot %u: %s from slot %u", slot, info.roll ? "roll" : "create", info.parent);
+	if (info.auth_mac)
+		printf(", MAC with slot %u", info.write_key);
+	printf("\n");
+
+	t = now_s();
+	ret = dk_derive(desc, m, master, &info);
+	t = now_s() - t;
+	if (dk_mirror_store(m, master) || ret != S96AT_STATUS_OK)
+		return -1;
+
+	printf("Derived generation %u in %.1f ms\n", m->slots[slot].generation, t * 1e3);
+
+	/* Make sure the device agrees before relying on the mirror */
+	ret = dk_check(desc, m, master, slot, &stale);
+	if (ret != S96AT_STATUS_OK)
+		return -1;
+
+	if (stale) {
+		fprintf(stderr, "The device key does not match the mirror\n");
+		dk_mirror_store(m, master);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int cmd_check(struct s96at_desc *desc, struct dk_mirror *m, const uint8_t *master,
+		     uint8_t slot)
+{
+	uint8_t ret;
+	int stale;
+	double t;
+
+	t = now_s();
+	ret = dk_check(desc, m, master, slot, &stale);
+	t = now_s() - t;
+	if (ret != S96AT_STATUS_OK)
+		return -1;
+
+	if (stale) {
+		printf("Slot %u: stale, mirror invalidated (%.1f ms)\n", slot, t * 1e3);
+		return dk_mirror_store(m, master) ? -1 : 1;
+	}
+
+	if (m->slots[slot].valid)
+		printf("Slot %u: fresh, generation %u (%.1f ms)\n", slot,
+		       m->slots[slot].generation, t * 1e3);
+	else
+		printf("Slot %u: fresh, personalization key (%.1f ms)\n", slot, t * 1e3);
+
+	return 0;
+}
+
+static void print_source(const struct dk_mirror *m, uint8_t slot)
+{
+	if (m->slots[slot].valid)
+		fprintf(stderr, "Slot %u: generation %u\n", slot, m->slots[slot].generation);
+	else
+		fprintf(stderr, "Slot %u: personalization key\n", slot);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = -1;
+	int opt;
+	int host_only;
+	uint8_t s96_ret;
+	uint8_t slot;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint8_t master_buf[DK_MASTER_LEN];
+	uint8_t *master = NULL;
+	uint8_t key[DK_KEY_LEN];
+	uint8_t in[S96AT_CHALLENGE_LEN];
+	uint8_t out[S96AT_SHA_LEN];
+	const char *cmd;
+	struct s96at_desc desc;
+	struct dk_mirror m;
+
+	progname = argv[0];
+
+	while ((opt = getopt(argc, argv, "m:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (slotkey_read_master(optarg, master_buf))
+				return -1;
+			master = master_buf;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (argc - optind < 2) {
+		usage();
+		return -1;
+	}
+
+	cmd = argv[optind];
+	host_only = !strcmp(cmd, "mac") || !strcmp(cmd, "gendig");
+
+	if (parse_slot(argv[optind + 1], &slot))
+		return -1;
+
+	if (host_only && (argc - optind != 3 || parse_hex(argv[optind + 2], in, sizeof(in)))) {
+		usage();
+		return -1;
+	}
+
+	s96_ret = s96at_init(S96AT_ATECC508A, S96AT_IO_I2C_LINUX, &desc);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize the device\n");
+		return -1;
+	}
+
+	/* The serial number selects the mirror, even for host only commands */
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	s96_ret = s96at_get_serialnbr(&desc, sn);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read the serial number\n");
+		goto out;
+	}
+
+	if (dk_mirror_load(&m, sn, master))
+		goto out;
+
+	if (!strcmp(cmd, "derive")) {
+		ret = cmd_derive(&desc, &m, master, slot);
+	} else if (!strcmp(cmd, "check")) {
+		ret = cmd_check(&desc, &m, master, slot);
+	} else if (!strcmp(cmd, "mac")) {
+		s96at_idle(&desc);
+		print_source(&m, slot);
+		dk_mirror_key(&m, master, slot, key);
+		dk_mac(key, sn, slot, in, out);
+		print_hex(stdout, out, sizeof(out));
+		printf("\n");
+		ret = 0;
+	} else if (!strcmp(cmd, "gendig")) {
+		s96at_idle(&desc);
+		print_source(&m, slot);
+		dk_mirror_key(&m, master, slot, key);
+		dk_gendig(key, sn, slot, in, out);
+		print_hex(stdout, out, sizeof(out));
+		printf("\n");
+		ret = 0;
+	} else {
+		usage();
+	}
+
+out:
+	OPENSSL_cleanse(key, sizeof(key));
+	OPENSSL_cleanse(master_buf, sizeof(master_buf));
+	OPENSSL_cleanse(&m, sizeof(m));
+	s96at_sleep(&desc);
+	s96at_cleanup(&desc);
+
+	return ret;
+}
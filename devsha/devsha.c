@@ -0,0 +1,212 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <devsha.h>
+
+#define PREP_DEPTH	2	/* Messages prepared ahead of the device */
+
+/* Messages are loaded and padded by a separate thread while the device
+ * hashes the previous one.
+ */
+struct devsha_prep {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char * const *paths;
+	size_t num;
+	size_t loaded;		/* Messages loaded by the prep thread */
+	size_t hashed;		/* Messages taken by the device */
+	struct devsha_msg msgs[PREP_DEPTH];
+	int status[PREP_DEPTH];
+};
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* SHA-256 appends 0x80 and the 64-bit message length, rounded up to a
+ * whole block.
+ */
+size_t devsha_padded_len(size_t msg_len)
+{
+	return (msg_len + 9 + DEVSHA_BLOCK_LEN - 1) / DEVSHA_BLOCK_LEN * DEVSHA_BLOCK_LEN;
+}
+
+int devsha_msg_init(struct devsha_msg *msg, const uint8_t *data, size_t len)
+{
+	memset(msg, 0, sizeof(*msg));
+
+	if (len > DEVSHA_MAX_MSG_LEN) {
+		fprintf(stderr, "Message of %zu bytes exceeds the watchdog budget of %d bytes, hash it on the host\n",
+			len, DEVSHA_MAX_MSG_LEN);
+		return -1;
+	}
+
+	msg->buf_len = devsha_padded_len(len);
+	msg->buf = calloc(1, msg->buf_len);
+	if (!msg->buf)
+		return -1;
+
+	memcpy(msg->buf, data, len);
+	msg->msg_len = len;
+
+	return 0;
+}
+
+int devsha_msg_load(struct devsha_msg *msg, const char *path)
+{
+	int ret = -1;
+	FILE *fp;
+	struct stat st;
+
+	memset(msg, 0, sizeof(*msg));
+
+	fp = fopen(path, "rb");
+	if (!fp) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return -1;
+	}
+
+	if (fstat(fileno(fp), &st) || !S_ISREG(st.st_mode)) {
+		fprintf(stderr, "%s is not a regular file\n", path);
+		goto out;
+	}
+
+	if (st.st_size > DEVSHA_MAX_MSG_LEN) {
+		fprintf(stderr, "%s: %lld bytes exceeds the watchdog budget of %d bytes, hash it on the host\n",
+			path, (long long)st.st_size, DEVSHA_MAX_MSG_LEN);
+		goto out;
+	}
+
+	msg->buf_len = devsha_padded_len(st.st_size);
+	msg->buf = calloc(1, msg->buf_len);
+	if (!msg->buf)
+		goto out;
+
+	if (fread(msg->buf, 1, st.st_size, fp) != (size_t)st.st_size) {
+		fprintf(stderr, "Could not read %s\n", path);
+		devsha_msg_free(msg);
+		goto out;
+	}
+	msg->msg_len = st.st_size;
+
+	ret = 0;
+out:
+	fclose(fp);
+	return ret;
+}
+
+void devsha_msg_free(struct devsha_msg *msg)
+{
+	free(msg->buf);
+	memset(msg, 0, sizeof(*msg));
+}
+
+/* Hash a message on the device. The device is idled and woken first so
+ * that the whole sequence runs on a fresh watchdog period. The device is
+ * left idle, keeping TempKey for a following command.
+ */
+uint8_t devsha_hash(struct s96at_desc *desc, struct devsha_msg *msg, uint8_t *hash)
+{
+	uint8_t ret;
+
+	s96at_idle(desc);
+	while (s96at_wake(desc) != S96AT_STATUS_READY) {};
+
+	ret = s96at_get_sha(desc, msg->buf, msg->buf_len, msg->msg_len, hash);
+
+	s96at_idle(desc);
+
+	return ret;
+}
+
+static void *prep_thread(void *arg)
+{
+	struct devsha_prep *prep = arg;
+	struct devsha_msg msg;
+	size_t i;
+	int status;
+
+	pthread_mutex_lock(&prep->lock);
+	while (prep->loaded < prep->num) {
+		if (prep->loaded - prep->hashed == PREP_DEPTH) {
+			pthread_cond_wait(&prep->cond, &prep->lock);
+			continue;
+		}
+		i = prep->loaded;
+		pthread_mutex_unlock(&prep->lock);
+
+		status = devsha_msg_load(&msg, prep->paths[i]);
+
+		pthread_mutex_lock(&prep->lock);
+		prep->msgs[i % PREP_DEPTH] = msg;
+		prep->status[i % PREP_DEPTH] = status;
+		prep->loaded++;
+		pthread_cond_broadcast(&prep->cond);
+	}
+	pthread_mutex_unlock(&prep->lock);
+
+	return NULL;
+}
+
+/* Hash a list of files on the device, one SHA sequence per file. Returns
+ * the number of files that could not be hashed.
+ */
+int devsha_hash_files(struct s96at_desc *desc, char * const *paths, size_t num,
+		      struct devsha_result *results)
+{
+	int failed = 0;
+	int status;
+	double t;
+	pthread_t thread;
+	struct devsha_msg msg;
+	struct devsha_prep prep = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.paths = paths,
+		.num = num,
+	};
+
+	if (pthread_create(&thread, NULL, prep_thread, &prep)) {
+		fprintf(stderr, "Could not start prep thread\n");
+		return num;
+	}
+
+	for (size_t i = 0; i < num; i++) {
+		pthread_mutex_lock(&prep.lock);
+		while (prep.loaded == i)
+			pthread_cond_wait(&prep.cond, &prep.lock);
+		msg = prep.msgs[i % PREP_DEPTH];
+		status = prep.status[i % PREP_DEPTH];
+		prep.hashed++;
+		pthread_cond_broadcast(&prep.cond);
+		pthread_mutex_unlock(&prep.lock);
+
+		memset(&results[i], 0, sizeof(results[i]));
+		if (status) {
+			results[i].ret = S96AT_STATUS_BAD_PARAMETERS;
+			failed++;
+			continue;
+		}
+
+		t = now_ms();
+		results[i].ret = devsha_hash(desc, &msg, results[i].hash);
+		results[i].ms = now_ms() - t;
+		if (results[i].ret != S96AT_STATUS_OK)
+			failed++;
+
+		devsha_msg_free(&msg);
+	}
+
+	pthread_join(thread, NULL);
+
+	return failed;
+}
@@ -0,0 +1,57 @@
+#ifndef __DEVSHA_H
+#define __DEVSHA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#include <plan.h>
+
+#define DEVSHA_BLOCK_LEN	64
+#define DEVSHA_HASH_LEN		32
+
+/* The SHA sequence has to complete within one wake period, as
+ * s96at_get_sha runs it in a single call and cannot idle and wake the
+ * device in between. The watchdog may expire 0.7 s after the wake, see
+ * plan.h. Each block costs its maximum execution time plus the transfer
+ * of the command carrying it, and the Start command and the digest
+ * returned by End come on top. Longer messages are rejected.
+ */
+#define DEVSHA_BLOCK_MS		(PLAN_EXEC_SHA_MS + PLAN_XFER_MS(9 + DEVSHA_BLOCK_LEN) + \
+				 PLAN_XFER_MS(4 + 1))
+#define DEVSHA_START_MS		(PLAN_EXEC_SHA_MS + PLAN_XFER_MS(9) + PLAN_XFER_MS(4 + 1))
+#define DEVSHA_MAX_BLOCKS	((int)((PLAN_WATCHDOG_MS - PLAN_MARGIN_MS - PLAN_WAKE_MS - \
+				       DEVSHA_START_MS - PLAN_XFER_MS(DEVSHA_HASH_LEN)) / \
+				      DEVSHA_BLOCK_MS))
+#define DEVSHA_MAX_MSG_LEN	(DEVSHA_MAX_BLOCKS * DEVSHA_BLOCK_LEN - 9)
+
+/* A message in a buffer large enough for the padding appended by
+ * s96at_get_sha.
+ */
+struct devsha_msg {
+	uint8_t *buf;
+	size_t buf_len;
+	size_t msg_len;
+};
+
+struct devsha_result {
+	uint8_t ret;
+	uint8_t hash[DEVSHA_HASH_LEN];
+	double ms;		/* Time spent on the device */
+};
+
+size_t devsha_padded_len(size_t msg_len);
+
+int devsha_msg_init(struct devsha_msg *msg, const uint8_t *data, size_t len);
+
+int devsha_msg_load(struct devsha_msg *msg, const char *path);
+
+void devsha_msg_free(struct devsha_msg *msg);
+
+uint8_t devsha_hash(struct s96at_desc *desc, struct devsha_msg *msg, uint8_t *hash);
+
+int devsha_hash_files(struct s96at_desc *desc, char * const *paths, size_t num,
+		      struct devsha_result *results);
+
+#endif
@@ -0,0 +1,227 @@
+#include <openssl/sha.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <secure96/s96at.h>
+
+#include <devsha.h>
+
+#define BENCH_RUNS		5
+#define HOST_RUNS		1000
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s hash <file>...\n", progname);
+	fprintf(stderr, "       %s sign <slot_priv> <file>\n", progname);
+	fprintf(stderr, "       %s bench\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "hash prints the SHA-256 of each file, computed on the device\n");
+	fprintf(stderr, "sign hashes the file on the device and signs the digest with the\n");
+	fprintf(stderr, "key in slot_priv\n");
+	fprintf(stderr, "bench compares device and host hashing for a range of message sizes\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Files are limited to %d bytes, the most the device can hash within\n",
+		DEVSHA_MAX_MSG_LEN);
+	fprintf(stderr, "one watchdog period\n");
+}
+
+static void print_hex(FILE *fp, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		fprintf(fp, "%02x", buf[i]);
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int run_hash(struct s96at_desc *desc, char * const *paths, size_t num)
+{
+	int failed;
+	double total = 0;
+	struct devsha_result *results;
+
+	results = calloc(num, sizeof(*results));
+	if (!results)
+		return -1;
+
+	failed = devsha_hash_files(desc, paths, num, results);
+
+	for (size_t i = 0; i < num; i++) {
+		if (results[i].ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "%s: not hashed (0x%02x)\n", paths[i], results[i].ret);
+			continue;
+		}
+		print_hex(stdout, results[i].hash, DEVSHA_HASH_LEN);
+		printf("  %s\n", paths[i]);
+		total += results[i].ms;
+	}
+
+	fprintf(stderr, "%zu files hashed, %d failed, %.0f ms on the device\n",
+		num - failed, failed, total);
+
+	free(results);
+	return failed ? -1 : 0;
+}
+
+/* The digest is loaded into TempKey with a passthrough Nonce, and signed
+ * in External mode, i.e. Sign over TempKey. It comes from the host, like
+ * any other passthrough digest.
+ */
+static int run_sign(struct s96at_desc *desc, uint8_t slot, const char *path)
+{
+	uint8_t ret;
+	uint8_t hash[DEVSHA_HASH_LEN];
+	struct devsha_msg msg;
+	struct s96at_ecdsa_sig sig;
+
+	if (devsha_msg_load(&msg, path))
+		return -1;
+
+	ret = devsha_hash(desc, &msg, hash);
+	devsha_msg_free(&msg);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "SHA failed\n");
+		return -1;
+	}
+
+	while (s96at_wake(desc) != S96AT_STATUS_READY) {};
+
+	ret = s96at_gen_nonce(desc, S96AT_NONCE_MODE_PASSTHROUGH, hash, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Nonce failed\n");
+		goto out;
+	}
+
+	ret = s96at_sign(desc, S96AT_SIGN_MODE_EXTERNAL, slot, S96AT_FLAG_NONE, &sig);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Sign failed\n");
+		goto out;
+	}
+
+	printf("Digest:    ");
+	print_hex(stdout, hash, sizeof(hash));
+	printf("\nSignature: ");
+	print_hex(stdout, sig.r, sizeof(sig.r));
+	print_hex(stdout, sig.s, sizeof(sig.s));
+	printf("\n");
+out:
+	s96at_idle(desc);
+	return ret == S96AT_STATUS_OK ? 0 : -1;
+}
+
+/* Hash messages of one block up to the watchdog budget on both the device
+ * and the host, check that the digests match and print the throughput of
+ * each.
+ */
+static int run_bench(struct s96at_desc *desc)
+{
+	int ret = 0;
+	uint8_t dev_hash[DEVSHA_HASH_LEN];
+	uint8_t host_hash[DEVSHA_HASH_LEN];
+	uint8_t *data;
+	size_t len;
+	double t;
+	double dev_ms;
+	double host_ms;
+	struct devsha_msg msg;
+
+	data = malloc(DEVSHA_MAX_MSG_LEN);
+	if (!data)
+		return -1;
+	for (size_t i = 0; i < DEVSHA_MAX_MSG_LEN; i++)
+		data[i] = i;
+
+	printf("%8s %12s %12s %14s\n", "bytes", "device ms", "device B/s", "host MB/s");
+	for (size_t blocks = 1; ; blocks *= 2) {
+		if (blocks > DEVSHA_MAX_BLOCKS)
+			blocks = DEVSHA_MAX_BLOCKS;
+		len = blocks * DEVSHA_BLOCK_LEN - 9;
+
+		if (devsha_msg_init(&msg, data, len)) {
+			ret = -1;
+			break;
+		}
+
+		t = now_ms();
+		for (int r = 0; r < BENCH_RUNS; r++) {
+			if (devsha_hash(desc, &msg, dev_hash) != S96AT_STATUS_OK) {
+				fprintf(stderr, "SHA failed at %zu bytes\n", len);
+				ret = -1;
+				break;
+			}
+		}
+		dev_ms = (now_ms() - t) / BENCH_RUNS;
+		devsha_msg_free(&msg);
+		if (ret)
+			break;
+
+		t = now_ms();
+		for (int r = 0; r < HOST_RUNS; r++)
+			SHA256(data, len, host_hash);
+		host_ms = (now_ms() - t) / HOST_RUNS;
+
+		if (memcmp(dev_hash, host_hash, sizeof(dev_hash))) {
+			fprintf(stderr, "Digest mismatch at %zu bytes\n", len);
+			ret = -1;
+			break;
+		}
+
+		printf("%8zu %12.1f %12.0f %14.1f\n", len, dev_ms, len * 1000 / dev_ms,
+		       host_ms > 0 ? len / host_ms / 1000 : 0);
+
+		if (blocks == DEVSHA_MAX_BLOCKS)
+			break;
+	}
+
+	free(data);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+	uint8_t s96_ret;
+	struct s96at_desc desc;
+
+	progname = argv[0];
+
+	if (argc < 2 ||
+	    (!strcmp(argv[1], "hash") && argc < 3) ||
+	    (!strcmp(argv[1], "sign") && argc != 4) ||
+	    (!strcmp(argv[1], "bench") && argc != 2)) {
+		usage();
+		return -1;
+	}
+
+	s96_ret = s96at_init(S96AT_ATECC508A, S96AT_IO_I2C_LINUX, &desc);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize the device\n");
+		return -1;
+	}
+
+	if (!strcmp(argv[1], "hash")) {
+		ret = run_hash(&desc, argv + 2, argc - 2);
+	} else if (!strcmp(argv[1], "sign")) {
+		ret = run_sign(&desc, strtoul(argv[2], NULL, 0), argv[3]);
+	} else if (!strcmp(argv[1], "bench")) {
+		ret = run_bench(&desc);
+	} else {
+		usage();
+		ret = -1;
+	}
+
+	s96at_sleep(&desc);
+	s96at_cleanup(&desc);
+
+	return ret;
+}
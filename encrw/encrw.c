@@ -0,0 +1,327 @@
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <encrw.h>
+
+#define OPCODE_GENDIG		0x15
+#define OPCODE_WRITE		0x12
+#define WRITE_PARAM1_DATA_32	0x82	/* 32 bytes to the Data zone */
+
+#define SLOT_CONFIG_OFFSET	20
+#define CONFIG_NUM_WORDS	13	/* Up to the end of SlotConfig */
+
+/* SlotConfig bits, Sect 2.2.1 of the ATSHA204A datasheet */
+#define SLOT_READ_KEY(c)	((c) & 0x0f)
+#define SLOT_ENCRYPT_READ(c)	((c) & (1 << 6))
+#define SLOT_IS_SECRET(c)	((c) & (1 << 7))
+#define SLOT_WRITE_KEY(c)	(((c) >> 8) & 0x0f)
+#define SLOT_WRITE_CONFIG(c)	(((c) >> 12) & 0x0f)
+
+#define WRITE_CONFIG_ALWAYS	0x0
+#define WRITE_CONFIG_ENCRYPT	0x4	/* 01xx */
+
+struct __attribute__((__packed__)) gendig_in {
+	uint8_t data[32];
+	uint8_t opcode;
+	uint8_t param1;
+	uint8_t param2[2];
+	uint8_t sn_hi;
+	uint8_t sn_lo[2];
+	uint8_t zero[25];
+	uint8_t temp_key[32];
+};
+
+struct __attribute__((__packed__)) write_mac_in {
+	uint8_t temp_key[32];
+	uint8_t opcode;
+	uint8_t param1;
+	uint8_t param2[2];
+	uint8_t sn_hi;
+	uint8_t sn_lo[2];
+	uint8_t zero[25];
+	uint8_t data[32];
+};
+
+/* Operations are prepared by a separate thread, ahead of the device */
+struct encrw_prep {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct encrw_ctx *ctx;
+	struct encrw_op *ops;
+	size_t num;
+	size_t prepared;
+	int failed;
+};
+
+/* Without a master key, the keys of our test configuration are assumed,
+ * where all bytes of each symmetric key are set to the slot number, ie for
+ * Slot 0 the key is all 0x00, for Slot 1 the key is all 0x11 etc. With a
+ * master key, slots 0 to 7 hold keys derived from it and the serial
+ * number, as s96util -m does, and the keys of the other slots are unknown.
+ */
+int encrw_open(struct encrw_ctx *ctx, struct s96at_desc *desc, const uint8_t *master)
+{
+	uint8_t ret;
+	uint8_t config[CONFIG_NUM_WORDS * S96AT_WORD_SIZE];
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->desc = desc;
+
+	while (s96at_wake(desc) != S96AT_STATUS_READY) {};
+
+	for (int i = 0; i < CONFIG_NUM_WORDS; i++) {
+		ret = s96at_read_config(desc, i, config + i * S96AT_WORD_SIZE);
+		if (ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "Could not read config word %d\n", i);
+			s96at_idle(desc);
+			return -1;
+		}
+	}
+
+	s96at_idle(desc);
+
+	/* SN[0:3] is at bytes 0-3 of the config zone, SN[4:8] at 8-12 */
+	memcpy(ctx->sn, config, 4);
+	memcpy(ctx->sn + 4, config + 8, 5);
+
+	for (int i = 0; i < ENCRW_NUM_SLOTS; i++) {
+		ctx->slot_config[i] = config[SLOT_CONFIG_OFFSET + 2 * i] |
+				      config[SLOT_CONFIG_OFFSET + 2 * i + 1] << 8;
+		if (!master) {
+			memset(ctx->keys[i], i * 0x11, S96AT_KEY_LEN);
+			ctx->known |= 1 << i;
+		} else if (!slotkey_derive_one(master, ctx->sn, i, ctx->keys[i])) {
+			ctx->known |= 1 << i;
+		}
+	}
+
+	return 0;
+}
+
+static void host_temp_key(struct encrw_ctx *ctx, struct encrw_op *op)
+{
+	struct gendig_in digest_in;
+
+	memcpy(digest_in.data, ctx->keys[op->key_slot], 32);
+	digest_in.opcode = OPCODE_GENDIG;
+	digest_in.param1 = S96AT_ZONE_DATA;
+	digest_in.param2[0] = op->key_slot;
+	digest_in.param2[1] = 0x00;
+	digest_in.sn_hi = ctx->sn[8];
+	digest_in.sn_lo[0] = ctx->sn[0];
+	digest_in.sn_lo[1] = ctx->sn[1];
+	memset(digest_in.zero, 0, 25);
+	memcpy(digest_in.temp_key, op->num_in, 32);
+
+	SHA256((uint8_t *)&digest_in, sizeof(digest_in), op->temp_key);
+}
+
+/* Compute the host side of an operation: the Nonce input, TempKey as set
+ * by Nonce and GenDig, and for writes the encrypted data and the
+ * authorizing MAC (Sect 8.5.18 of the ATSHA204A datasheet).
+ */
+int encrw_prepare(struct encrw_ctx *ctx, struct encrw_op *op)
+{
+	uint16_t config = ctx->slot_config[op->slot];
+	struct write_mac_in mac_in;
+
+	switch (op->mode) {
+	case ENCRW_READ:
+		if (!SLOT_IS_SECRET(config) || !SLOT_ENCRYPT_READ(config)) {
+			fprintf(stderr, "Slot %u is not configured for encrypted reads\n", op->slot);
+			return -1;
+		}
+		op->key_slot = SLOT_READ_KEY(config);
+		break;
+	case ENCRW_WRITE:
+		if ((SLOT_WRITE_CONFIG(config) & 0x0c) != WRITE_CONFIG_ENCRYPT) {
+			fprintf(stderr, "Slot %u is not configured for encrypted writes\n", op->slot);
+			return -1;
+		}
+		op->key_slot = SLOT_WRITE_KEY(config);
+		break;
+	case ENCRW_READ_PLAIN:
+		if (SLOT_IS_SECRET(config)) {
+			fprintf(stderr, "Slot %u cannot be read in the clear\n", op->slot);
+			return -1;
+		}
+		return 0;
+	case ENCRW_WRITE_PLAIN:
+		if (SLOT_WRITE_CONFIG(config) != WRITE_CONFIG_ALWAYS) {
+			fprintf(stderr, "Slot %u cannot be written in the clear\n", op->slot);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (!(ctx->known & (1 << op->key_slot))) {
+		fprintf(stderr, "Key slot %u has no key derived from the master key\n",
+			op->key_slot);
+		return -1;
+	}
+
+	if (RAND_bytes(op->num_in, sizeof(op->num_in)) != 1)
+		return -1;
+
+	host_temp_key(ctx, op);
+
+	if (op->mode != ENCRW_WRITE)
+		return 0;
+
+	memcpy(mac_in.temp_key, op->temp_key, 32);
+	mac_in.opcode = OPCODE_WRITE;
+	mac_in.param1 = WRITE_PARAM1_DATA_32;
+	mac_in.param2[0] = op->slot << 3;
+	mac_in.param2[1] = 0x00;
+	mac_in.sn_hi = ctx->sn[8];
+	mac_in.sn_lo[0] = ctx->sn[0];
+	mac_in.sn_lo[1] = ctx->sn[1];
+	memset(mac_in.zero, 0, 25);
+	memcpy(mac_in.data, op->data, 32);
+
+	for (int i = 0; i < ENCRW_BLOCK_LEN; i++)
+		op->payload[i] = op->data[i] ^ op->temp_key[i];
+	SHA256((uint8_t *)&mac_in, sizeof(mac_in), op->payload + ENCRW_BLOCK_LEN);
+
+	/* A slot that is its own WriteKey now holds a new key, which the
+	 * next operation using it must be prepared with.
+	 */
+	if (SLOT_WRITE_KEY(config) == op->slot) {
+		memcpy(ctx->keys[op->slot], op->data, S96AT_KEY_LEN);
+		ctx->known |= 1 << op->slot;
+	}
+
+	return 0;
+}
+
+/* Run a prepared operation on the device. The device must be awake. */
+uint8_t encrw_exec(struct encrw_ctx *ctx, struct encrw_op *op)
+{
+	uint8_t ret;
+	struct s96at_slot_addr addr = {
+		.slot = op->slot,
+		.block = 0,
+		.offset = 0
+	};
+
+	switch (op->mode) {
+	case ENCRW_READ_PLAIN:
+		return s96at_read_data(ctx->desc, &addr, S96AT_FLAG_NONE, op->data,
+				       ENCRW_BLOCK_LEN);
+	case ENCRW_WRITE_PLAIN:
+		return s96at_write_data(ctx->desc, &addr, S96AT_FLAG_NONE, op->data,
+					ENCRW_BLOCK_LEN);
+	default:
+		break;
+	}
+
+	ret = s96at_gen_nonce(ctx->desc, S96AT_NONCE_MODE_PASSTHROUGH, op->num_in, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not generate nonce\n");
+		return ret;
+	}
+
+	ret = s96at_gen_digest(ctx->desc, S96AT_ZONE_DATA, op->key_slot, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not generate digest\n");
+		return ret;
+	}
+
+	if (op->mode == ENCRW_WRITE)
+		return s96at_write_data(ctx->desc, &addr, S96AT_FLAG_ENCRYPT, op->payload,
+					sizeof(op->payload));
+
+	ret = s96at_read_data(ctx->desc, &addr, S96AT_FLAG_ENCRYPT, op->data, ENCRW_BLOCK_LEN);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	for (int i = 0; i < ENCRW_BLOCK_LEN; i++)
+		op->data[i] ^= op->temp_key[i];
+
+	return S96AT_STATUS_OK;
+}
+
+static void *prep_thread(void *arg)
+{
+	struct encrw_prep *prep = arg;
+	int failed;
+
+	for (size_t i = 0; i < prep->num; i++) {
+		failed = encrw_prepare(prep->ctx, &prep->ops[i]);
+
+		pthread_mutex_lock(&prep->lock);
+		prep->prepared++;
+		prep->failed = failed;
+		pthread_cond_broadcast(&prep->cond);
+		pthread_mutex_unlock(&prep->lock);
+
+		if (failed)
+			break;
+	}
+
+	return NULL;
+}
+
+/* Run a list of operations. When pipelined, the host side of each
+ * operation is computed by a separate thread while the device runs the
+ * previous ones. Returns the number of operations run successfully.
+ */
+int encrw_run(struct encrw_ctx *ctx, struct encrw_op *ops, size_t num, int pipelined)
+{
+	size_t done = 0;
+	int failed = 0;
+	pthread_t thread;
+	struct encrw_prep prep = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.ctx = ctx,
+		.ops = ops,
+		.num = num,
+	};
+
+	if (pipelined && pthread_create(&thread, NULL, prep_thread, &prep)) {
+		fprintf(stderr, "Could not start prep thread\n");
+		pipelined = 0;
+	}
+
+	for (; done < num; done++) {
+		if (pipelined) {
+			pthread_mutex_lock(&prep.lock);
+			while (prep.prepared == done)
+				pthread_cond_wait(&prep.cond, &prep.lock);
+			failed = prep.failed && prep.prepared == done + 1;
+			pthread_mutex_unlock(&prep.lock);
+			if (failed)
+				break;
+		} else if (encrw_prepare(ctx, &ops[done])) {
+			break;
+		}
+
+		/* Start on a fresh watchdog period every few operations */
+		if (done % ENCRW_OPS_PER_WAKE == 0) {
+			s96at_idle(ctx->desc);
+			while (s96at_wake(ctx->desc) != S96AT_STATUS_READY) {};
+		}
+
+		ops[done].ret = encrw_exec(ctx, &ops[done]);
+		if (ops[done].ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "Slot %u: operation failed (0x%02x)\n",
+				ops[done].slot, ops[done].ret);
+			break;
+		}
+	}
+
+	s96at_idle(ctx->desc);
+
+	if (pipelined) {
+		/* Let the prep thread run to completion */
+		pthread_join(thread, NULL);
+	}
+
+	return done;
+}
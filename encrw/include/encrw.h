@@ -0,0 +1,64 @@
+#ifndef __ENCRW_H
+#define __ENCRW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#include <plan.h>
+#include <slotkey.h>
+
+#define ENCRW_NUM_SLOTS		16
+#define ENCRW_BLOCK_LEN		32
+
+/* An encrypted write takes up to 60 ms for Nonce, 43 ms for GenDig and
+ * 42 ms for Write on the ATSHA204A, plus the I2C transfers. The device is
+ * woken again before the watchdog could expire, which may be as early as
+ * 0.7 s after the wake, see plan.h.
+ */
+#define ENCRW_OP_MS		150
+#define ENCRW_OPS_PER_WAKE	((PLAN_WATCHDOG_MS - PLAN_MARGIN_MS) / ENCRW_OP_MS)
+
+enum encrw_mode {
+	ENCRW_READ,
+	ENCRW_WRITE,
+	ENCRW_READ_PLAIN,
+	ENCRW_WRITE_PLAIN
+};
+
+/* One 32-byte slot access. For encrypted accesses, everything the host
+ * has to compute is done by encrw_prepare(), before the device is
+ * involved.
+ */
+struct encrw_op {
+	enum encrw_mode mode;
+	uint8_t slot;
+	uint8_t data[ENCRW_BLOCK_LEN];	/* Plaintext to write, or read */
+	uint8_t key_slot;
+	uint8_t num_in[S96AT_RANDOM_LEN];
+	uint8_t temp_key[S96AT_SHA_LEN];
+	uint8_t payload[2 * ENCRW_BLOCK_LEN];	/* Encrypted data and MAC */
+	uint8_t ret;
+};
+
+struct encrw_ctx {
+	struct s96at_desc *desc;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint16_t slot_config[ENCRW_NUM_SLOTS];
+	/* Host copy of the keys, and a bitmap of the ones that are known. A
+	 * slot written with itself as WriteKey gets a new key on each write.
+	 */
+	uint8_t keys[ENCRW_NUM_SLOTS][S96AT_KEY_LEN];
+	uint16_t known;
+};
+
+int encrw_open(struct encrw_ctx *ctx, struct s96at_desc *desc, const uint8_t *master);
+
+int encrw_prepare(struct encrw_ctx *ctx, struct encrw_op *op);
+
+uint8_t encrw_exec(struct encrw_ctx *ctx, struct encrw_op *op);
+
+int encrw_run(struct encrw_ctx *ctx, struct encrw_op *ops, size_t num, int pipelined);
+
+#endif
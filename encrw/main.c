@@ -0,0 +1,241 @@
+#include <openssl/crypto.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <secure96/s96at.h>
+
+#include <encrw.h>
+#include <slotkey.h>
+
+#define BENCH_NUM_OPS		32
+#define BENCH_ENC_SLOT		9	/* EncryptRead, Encrypt writes with itself */
+#define BENCH_PLAIN_SLOT	12	/* Clear reads and writes */
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-m master.key] read <slot>\n", progname);
+	fprintf(stderr, "       %s [-m master.key] write <slot> <hex>\n", progname);
+	fprintf(stderr, "       %s [-m master.key] bench [num_ops] [enc_slot] [plain_slot]\n",
+		progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "-m derives the keys of slots 0 to 7 from a master key, as s96util -m\n");
+	fprintf(stderr, "read and write access a slot of the ATSHA204A with encryption\n");
+	fprintf(stderr, "bench compares encrypted and plaintext reads and writes. Encrypted\n");
+	fprintf(stderr, "writes put the current contents of enc_slot back. Defaults: %d ops,\n",
+		BENCH_NUM_OPS);
+	fprintf(stderr, "enc_slot %d, plain_slot %d\n", BENCH_ENC_SLOT, BENCH_PLAIN_SLOT);
+}
+
+static void print_hex(FILE *fp, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		fprintf(fp, "%02x", buf[i]);
+}
+
+static int parse_hex(const char *str, uint8_t *buf, size_t len)
+{
+	if (strlen(str) != 2 * len)
+		return -1;
+
+	for (size_t i = 0; i < len; i++) {
+		if (sscanf(str + 2 * i, "%2hhx", &buf[i]) != 1)
+			return -1;
+	}
+	return 0;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parse_slot(const char *str, uint8_t *slot)
+{
+	unsigned long val;
+	char *end;
+
+	val = strtoul(str, &end, 0);
+	if (*end || val >= ENCRW_NUM_SLOTS) {
+		fprintf(stderr, "Invalid slot: %s\n", str);
+		return -1;
+	}
+	*slot = val;
+	return 0;
+}
+
+/* Run num copies of op, and print the throughput. Writes put the slot's
+ * current contents back, so that keys are left unchanged.
+ */
+static int bench_one(struct encrw_ctx *ctx, const char *name, const struct encrw_op *op,
+		     size_t num, int pipelined)
+{
+	int ret = -1;
+	size_t done;
+	double t;
+	struct encrw_op *ops;
+
+	ops = calloc(num, sizeof(*ops));
+	if (!ops)
+		return -1;
+
+	for (size_t i = 0; i < num; i++)
+		memcpy(&ops[i], op, sizeof(*op));
+
+	t = now_s();
+	done = encrw_run(ctx, ops, num, pipelined);
+	t = now_s() - t;
+
+	if (done == num) {
+		printf("%-28s %8.1f ms/op %8.0f B/s\n", name, t * 1000 / num,
+		       num * ENCRW_BLOCK_LEN / t);
+		ret = 0;
+	}
+
+	free(ops);
+	return ret;
+}
+
+static int run_bench(struct encrw_ctx *ctx, size_t num, uint8_t enc_slot, uint8_t plain_slot)
+{
+	int ret = 0;
+	struct encrw_op op;
+
+	printf("%zu ops of %d bytes, encrypted slot %u, plaintext slot %u\n",
+	       num, ENCRW_BLOCK_LEN, enc_slot, plain_slot);
+
+	memset(&op, 0, sizeof(op));
+	op.slot = plain_slot;
+	op.mode = ENCRW_READ_PLAIN;
+	ret |= bench_one(ctx, "plaintext read", &op, num, 0);
+
+	/* Write back what is in the slot */
+	if (encrw_run(ctx, &op, 1, 0) != 1)
+		return -1;
+	op.mode = ENCRW_WRITE_PLAIN;
+	ret |= bench_one(ctx, "plaintext write", &op, num, 0);
+
+	memset(&op, 0, sizeof(op));
+	op.slot = enc_slot;
+	op.mode = ENCRW_READ;
+	ret |= bench_one(ctx, "encrypted read", &op, num, 0);
+	ret |= bench_one(ctx, "encrypted read, pipelined", &op, num, 1);
+
+	memcpy(op.data, ctx->keys[enc_slot], ENCRW_BLOCK_LEN);
+	op.mode = ENCRW_WRITE;
+	ret |= bench_one(ctx, "encrypted write", &op, num, 0);
+	ret |= bench_one(ctx, "encrypted write, pipelined", &op, num, 1);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = -1;
+	int opt;
+	uint8_t s96_ret;
+	uint8_t slot;
+	uint8_t plain_slot = BENCH_PLAIN_SLOT;
+	uint8_t master[SLOTKEY_MASTER_LEN];
+	int use_master = 0;
+	size_t num = BENCH_NUM_OPS;
+	struct s96at_desc desc;
+	struct encrw_ctx ctx;
+	struct encrw_op op;
+
+	progname = argv[0];
+
+	while ((opt = getopt(argc, argv, "+m:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (slotkey_read_master(optarg, master))
+				return -1;
+			use_master = 1;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	/* The command is argv[1] from here on */
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	if (argc < 2 ||
+	    (!strcmp(argv[1], "read") && argc != 3) ||
+	    (!strcmp(argv[1], "write") && argc != 4) ||
+	    (!strcmp(argv[1], "bench") && argc > 5)) {
+		usage();
+		return -1;
+	}
+
+	memset(&op, 0, sizeof(op));
+	if (!strcmp(argv[1], "read")) {
+		if (parse_slot(argv[2], &op.slot))
+			return -1;
+		op.mode = ENCRW_READ;
+	} else if (!strcmp(argv[1], "write")) {
+		if (parse_slot(argv[2], &op.slot))
+			return -1;
+		if (parse_hex(argv[3], op.data, ENCRW_BLOCK_LEN)) {
+			fprintf(stderr, "Data must be %d bytes in hex\n", ENCRW_BLOCK_LEN);
+			return -1;
+		}
+		op.mode = ENCRW_WRITE;
+	} else if (!strcmp(argv[1], "bench")) {
+		slot = BENCH_ENC_SLOT;
+		if (argc > 2)
+			num = strtoul(argv[2], NULL, 0);
+		if ((argc > 3 && parse_slot(argv[3], &slot)) ||
+		    (argc > 4 && parse_slot(argv[4], &plain_slot)))
+			return -1;
+		if (!num) {
+			usage();
+			return -1;
+		}
+		op.slot = slot;
+	} else {
+		usage();
+		return -1;
+	}
+
+	s96_ret = s96at_init(S96AT_ATSHA204A, S96AT_IO_I2C_LINUX, &desc);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize the device\n");
+		goto key_out;
+	}
+
+	if (encrw_open(&ctx, &desc, use_master ? master : NULL))
+		goto out;
+
+	if (!strcmp(argv[1], "bench")) {
+		ret = run_bench(&ctx, num, op.slot, plain_slot);
+		goto out;
+	}
+
+	if (encrw_run(&ctx, &op, 1, 0) != 1)
+		goto out;
+
+	if (op.mode == ENCRW_READ) {
+		print_hex(stdout, op.data, ENCRW_BLOCK_LEN);
+		printf("\n");
+	}
+	ret = 0;
+out:
+	s96at_sleep(&desc);
+	s96at_cleanup(&desc);
+	OPENSSL_cleanse(&ctx, sizeof(ctx));
+key_out:
+	OPENSSL_cleanse(master, sizeof(master));
+
+	return ret;
+}
@@ -0,0 +1,197 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <i2crdwr.h>
+
+#define OPCODE_READ	0x02
+#define OPCODE_RANDOM	0x1b
+#define OPCODE_INFO	0x30
+
+#define ZONE_CONFIG	0x00
+#define READ_32_BYTES	0x80
+
+#define RESP_LEN_4	(1 + 4 + 2)
+#define RESP_LEN_32	(1 + 32 + 2)
+
+#define BENCH_SESSIONS	100
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-d adapter] [-a addr] info\n", progname);
+	fprintf(stderr, "       %s [-d adapter] [-a addr] bench [sessions]\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "info prints the revision and serial number of the device\n");
+	fprintf(stderr, "bench compares the stock and I2C_RDWR transports\n");
+	fprintf(stderr, "The adapter is /dev/i2c-1 and the address 0x60 by default\n");
+}
+
+static void print_hex(FILE *fp, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		fprintf(fp, "%02x", buf[i]);
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A session like the tools run: wake, Info, Random and a config read,
+ * then idle.
+ */
+static uint8_t run_session(struct i2crdwr *dev, uint8_t *rev, uint8_t *config)
+{
+	uint8_t ret;
+	uint8_t resp[RESP_LEN_32];
+
+	ret = i2crdwr_wake(dev);
+	if (ret != I2CRDWR_STATUS_OK) {
+		fprintf(stderr, "Wake failed: 0x%02x\n", ret);
+		return ret;
+	}
+
+	ret = i2crdwr_command(dev, OPCODE_INFO, 0x00, 0, NULL, 0, resp, RESP_LEN_4,
+			      I2CRDWR_FLAG_NONE);
+	if (ret != I2CRDWR_STATUS_OK) {
+		fprintf(stderr, "Info failed: 0x%02x\n", ret);
+		goto out;
+	}
+	if (rev)
+		memcpy(rev, resp + 1, 4);
+
+	ret = i2crdwr_command(dev, OPCODE_RANDOM, 0x00, 0, NULL, 0, resp, RESP_LEN_32,
+			      I2CRDWR_FLAG_NONE);
+	if (ret != I2CRDWR_STATUS_OK) {
+		fprintf(stderr, "Random failed: 0x%02x\n", ret);
+		goto out;
+	}
+
+	ret = i2crdwr_command(dev, OPCODE_READ, READ_32_BYTES | ZONE_CONFIG, 0, NULL, 0,
+			      resp, RESP_LEN_32, I2CRDWR_FLAG_IDLE);
+	if (ret != I2CRDWR_STATUS_OK) {
+		fprintf(stderr, "Read failed: 0x%02x\n", ret);
+		return ret;
+	}
+	if (config)
+		memcpy(config, resp + 1, 32);
+
+	return I2CRDWR_STATUS_OK;
+out:
+	i2crdwr_idle(dev);
+	return ret;
+}
+
+static int run_info(const char *path, uint16_t addr)
+{
+	uint8_t rev[4];
+	uint8_t config[32];
+	struct i2crdwr dev;
+
+	if (i2crdwr_open(&dev, I2CRDWR_MODE_RDWR, path, addr))
+		return -1;
+
+	if (run_session(&dev, rev, config) != I2CRDWR_STATUS_OK) {
+		i2crdwr_close(&dev);
+		return -1;
+	}
+	i2crdwr_close(&dev);
+
+	/* SN[0:3] is at bytes 0-3, SN[4:8] at bytes 8-12 */
+	printf("Revision: ");
+	print_hex(stdout, rev, sizeof(rev));
+	printf("\nSerial:   ");
+	print_hex(stdout, config, 4);
+	print_hex(stdout, config + 8, 5);
+	printf("\n");
+
+	return 0;
+}
+
+static int bench_mode(enum i2crdwr_mode mode, const char *name, const char *path,
+		      uint16_t addr, int sessions)
+{
+	int failed = 0;
+	double t;
+	struct i2crdwr dev;
+	struct i2crdwr_stats *st = &dev.stats;
+
+	if (i2crdwr_open(&dev, mode, path, addr))
+		return -1;
+
+	t = now_s();
+	for (int i = 0; i < sessions; i++) {
+		if (run_session(&dev, NULL, NULL) != I2CRDWR_STATUS_OK)
+			failed++;
+	}
+	t = now_s() - t;
+	i2crdwr_close(&dev);
+
+	printf("%-6s %5.2f ms/session  %5.2f ms/command  %4.1f syscalls/command  "
+	       "%4.1f polls/command  %5.2f ms busy/command  (%d failed)\n",
+	       name, t * 1e3 / sessions, t * 1e3 / st->commands,
+	       (double)st->syscalls / st->commands, (double)st->polls / st->commands,
+	       st->busy_us / 1e3 / st->commands, failed);
+
+	return failed ? -1 : 0;
+}
+
+static int run_bench(const char *path, uint16_t addr, int sessions)
+{
+	int ret = 0;
+
+	if (sessions < 1) {
+		usage();
+		return -1;
+	}
+
+	printf("%d sessions of wake, Info, Random, Read, idle\n", sessions);
+	if (bench_mode(I2CRDWR_MODE_STOCK, "stock", path, addr, sessions))
+		ret = -1;
+	if (bench_mode(I2CRDWR_MODE_RDWR, "rdwr", path, addr, sessions))
+		ret = -1;
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	const char *path = "/dev/i2c-1";
+	uint16_t addr = I2CRDWR_DEFAULT_ADDR;
+
+	progname = argv[0];
+
+	while ((opt = getopt(argc, argv, "d:a:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			path = optarg;
+			break;
+		case 'a':
+			addr = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 1 && !strcmp(argv[0], "info"))
+		return run_info(path, addr);
+	else if ((argc == 1 || argc == 2) && !strcmp(argv[0], "bench"))
+		return run_bench(path, addr, argc == 2 ? atoi(argv[1]) : BENCH_SESSIONS);
+
+	usage();
+	return -1;
+}
@@ -0,0 +1,139 @@
+#include <openssl/bn.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/objects.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <keygen.h>
+
+/* DER SubjectPublicKeyInfo of a P-256 key, up to the uncompressed point */
+static const uint8_t spki_p256_prefix[] = {
+	0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2a, 0x86,
+	0x48, 0xce, 0x3d, 0x02, 0x01, 0x06, 0x08, 0x2a,
+	0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03,
+	0x42, 0x00, 0x04
+};
+
+static EVP_PKEY *pub_to_pkey(const struct s96at_ecc_pub *pub)
+{
+	uint8_t der[sizeof(spki_p256_prefix) + S96AT_ECC_PUB_X_LEN + S96AT_ECC_PUB_Y_LEN];
+	const uint8_t *p = der;
+
+	memcpy(der, spki_p256_prefix, sizeof(spki_p256_prefix));
+	memcpy(der + sizeof(spki_p256_prefix), pub->x, S96AT_ECC_PUB_X_LEN);
+	memcpy(der + sizeof(spki_p256_prefix) + S96AT_ECC_PUB_X_LEN, pub->y,
+	       S96AT_ECC_PUB_Y_LEN);
+
+	return d2i_PUBKEY(NULL, &p, sizeof(der));
+}
+
+/* Build a CSR for the public key, with the serial number and the slot in
+ * the subject, and compute the digest of the CSR info that the device has
+ * to sign.
+ */
+X509_REQ *csr_prepare(const uint8_t *sn, uint8_t slot, const struct s96at_ecc_pub *pub,
+		      uint8_t *digest)
+{
+	int len;
+	char cn[64];
+	uint8_t *tbs = NULL;
+	X509_REQ *req;
+	X509_NAME *name;
+	X509_ALGOR *alg;
+	EVP_PKEY *pkey;
+
+	pkey = pub_to_pkey(pub);
+	if (!pkey) {
+		fprintf(stderr, "Slot %u: invalid public key\n", slot);
+		return NULL;
+	}
+
+	len = 0;
+	for (int i = 0; i < S96AT_SERIAL_NUMBER_LEN; i++)
+		len += sprintf(cn + len, "%02x", sn[i]);
+	sprintf(cn + len, "-slot%u", slot);
+
+	req = X509_REQ_new();
+	alg = X509_ALGOR_new();
+	if (!req || !alg)
+		goto err;
+
+	name = X509_REQ_get_subject_name(req);
+	if (!X509_REQ_set_version(req, 0) ||
+	    !X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (uint8_t *)cn, -1, -1, 0) ||
+	    !X509_REQ_set_pubkey(req, pkey) ||
+	    !X509_ALGOR_set0(alg, OBJ_nid2obj(NID_ecdsa_with_SHA256), V_ASN1_UNDEF, NULL) ||
+	    !X509_REQ_set1_signature_algo(req, alg))
+		goto err;
+
+	len = i2d_re_X509_REQ_tbs(req, &tbs);
+	if (len <= 0)
+		goto err;
+
+	SHA256(tbs, len, digest);
+
+	OPENSSL_free(tbs);
+	X509_ALGOR_free(alg);
+	EVP_PKEY_free(pkey);
+	return req;
+err:
+	fprintf(stderr, "Slot %u: could not build the CSR\n", slot);
+	X509_ALGOR_free(alg);
+	X509_REQ_free(req);
+	EVP_PKEY_free(pkey);
+	return NULL;
+}
+
+/* Attach the signature from the device, and check it against the public
+ * key in the CSR.
+ */
+int csr_finish(X509_REQ *req, const struct s96at_ecdsa_sig *sig)
+{
+	int ret = -1;
+	int len;
+	uint8_t *der = NULL;
+	BIGNUM *r;
+	BIGNUM *s;
+	ECDSA_SIG *ecdsa_sig;
+	ASN1_BIT_STRING *bits = NULL;
+	EVP_PKEY *pkey;
+
+	ecdsa_sig = ECDSA_SIG_new();
+	r = BN_bin2bn(sig->r, sizeof(sig->r), NULL);
+	s = BN_bin2bn(sig->s, sizeof(sig->s), NULL);
+	if (!ecdsa_sig || !r || !s || !ECDSA_SIG_set0(ecdsa_sig, r, s)) {
+		BN_free(r);
+		BN_free(s);
+		goto out;
+	}
+
+	len = i2d_ECDSA_SIG(ecdsa_sig, &der);
+	if (len <= 0)
+		goto out;
+
+	bits = ASN1_BIT_STRING_new();
+	if (!bits || !ASN1_BIT_STRING_set(bits, der, len))
+		goto out;
+	bits->flags &= ~(ASN1_STRING_FLAG_BITS_LEFT | 0x07);
+	bits->flags |= ASN1_STRING_FLAG_BITS_LEFT;
+
+	X509_REQ_set0_signature(req, bits);
+	bits = NULL;
+
+	pkey = X509_REQ_get0_pubkey(req);
+	if (!pkey || X509_REQ_verify(req, pkey) != 1) {
+		fprintf(stderr, "CSR signature does not verify\n");
+		goto out;
+	}
+
+	ret = 0;
+out:
+	ASN1_BIT_STRING_free(bits);
+	OPENSSL_free(der);
+	ECDSA_SIG_free(ecdsa_sig);
+	return ret;
+}
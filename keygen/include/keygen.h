@@ -0,0 +1,39 @@
+#ifndef __KEYGEN_H
+#define __KEYGEN_H
+
+#include <openssl/x509.h>
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#define KEYGEN_NUM_SLOTS	16
+
+struct keygen_slot {
+	uint8_t slot;
+	struct s96at_ecc_pub pub;
+	X509_REQ *req;
+	uint8_t digest[S96AT_SHA_LEN];	/* Of the CSR info, to be signed */
+	struct s96at_ecdsa_sig sig;
+	int ok;
+	double gen_ms;
+	double csr_ms;
+	double sign_ms;
+};
+
+struct keygen_device {
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	int num;
+	struct keygen_slot slots[KEYGEN_NUM_SLOTS];
+	double total_ms;
+};
+
+X509_REQ *csr_prepare(const uint8_t *sn, uint8_t slot, const struct s96at_ecc_pub *pub,
+		      uint8_t *digest);
+
+int csr_finish(X509_REQ *req, const struct s96at_ecdsa_sig *sig);
+
+int keygen_run(struct s96at_desc *desc, struct keygen_device *dev);
+
+void keygen_free(struct keygen_device *dev);
+
+#endif
@@ -0,0 +1,213 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <keygen.h>
+
+#define KEY_CONFIG_BLOCK	3	/* KeyConfig is at bytes 96-127 */
+
+/* CSRs are built by a separate thread, in the order the keys are
+ * generated, while the device generates the next key.
+ */
+struct csr_worker {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct keygen_device *dev;
+	int posted;		/* Slots with a public key */
+	int done;		/* Slots with a CSR ready to sign */
+	int stop;
+};
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void *csr_thread(void *arg)
+{
+	struct csr_worker *w = arg;
+	struct keygen_slot *ks;
+	double t;
+	int i;
+
+	pthread_mutex_lock(&w->lock);
+	while (!w->stop) {
+		if (w->done == w->posted) {
+			pthread_cond_wait(&w->cond, &w->lock);
+			continue;
+		}
+		i = w->done;
+		pthread_mutex_unlock(&w->lock);
+
+		ks = &w->dev->slots[i];
+		t = now_ms();
+		ks->req = csr_prepare(w->dev->sn, ks->slot, &ks->pub, ks->digest);
+		ks->csr_ms = now_ms() - t;
+
+		pthread_mutex_lock(&w->lock);
+		w->done++;
+		pthread_cond_broadcast(&w->cond);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+static void post(struct csr_worker *w)
+{
+	pthread_mutex_lock(&w->lock);
+	w->posted++;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void wait_done(struct csr_worker *w, int i)
+{
+	pthread_mutex_lock(&w->lock);
+	while (w->done <= i)
+		pthread_cond_wait(&w->cond, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* Sign the CSR digest: it is loaded into TempKey with a passthrough
+ * Nonce, and signed in External mode.
+ */
+static uint8_t sign_csr(struct s96at_desc *desc, struct keygen_slot *ks)
+{
+	uint8_t ret;
+	double t = now_ms();
+
+	if (!ks->req)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ret = s96at_gen_nonce(desc, S96AT_NONCE_MODE_PASSTHROUGH, ks->digest, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Slot %u: Nonce failed\n", ks->slot);
+		return ret;
+	}
+
+	ret = s96at_sign(desc, S96AT_SIGN_MODE_EXTERNAL, ks->slot, S96AT_FLAG_NONE, &ks->sig);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Slot %u: Sign failed\n", ks->slot);
+		return ret;
+	}
+	ks->sign_ms = now_ms() - t;
+
+	if (csr_finish(ks->req, &ks->sig))
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ks->ok = 1;
+	return S96AT_STATUS_OK;
+}
+
+/* Generate a key in every slot configured for a private key, and get a
+ * CSR signed by each. The device runs GenKey for a slot while the host
+ * builds the CSR of the previous slot, and then signs it:
+ *
+ *   device: GenKey 0 | GenKey 1, Sign 0 | GenKey 2, Sign 1 | Sign 2
+ *   host:             CSR 0              CSR 1              CSR 2
+ *
+ * Each step runs on a fresh wake, so that the watchdog does not expire.
+ */
+int keygen_run(struct s96at_desc *desc, struct keygen_device *dev)
+{
+	int ret = -1;
+	uint8_t s96_ret;
+	uint8_t key_config[S96AT_BLOCK_SIZE];
+	double start;
+	double t;
+	pthread_t thread;
+	struct keygen_slot *ks;
+	struct csr_worker w = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.dev = dev,
+	};
+
+	memset(dev, 0, sizeof(*dev));
+
+	while (s96at_wake(desc) != S96AT_STATUS_READY) {};
+
+	s96_ret = s96at_get_serialnbr(desc, dev->sn);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read the serial number\n");
+		goto out_idle;
+	}
+
+	s96_ret = s96at_read_config(desc, KEY_CONFIG_BLOCK, key_config);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read KeyConfig\n");
+		goto out_idle;
+	}
+
+	for (int slot = 0; slot < KEYGEN_NUM_SLOTS; slot++) {
+		if (key_config[2 * slot] & 0x01) /* Private */
+			dev->slots[dev->num++].slot = slot;
+	}
+
+	if (!dev->num) {
+		fprintf(stderr, "No slot configured for a private key\n");
+		goto out_idle;
+	}
+
+	if (pthread_create(&thread, NULL, csr_thread, &w)) {
+		fprintf(stderr, "Could not start CSR thread\n");
+		goto out_idle;
+	}
+
+	start = now_ms();
+	for (int i = 0; i <= dev->num; i++) {
+		s96at_idle(desc);
+		while (s96at_wake(desc) != S96AT_STATUS_READY) {};
+
+		if (i < dev->num) {
+			ks = &dev->slots[i];
+			t = now_ms();
+			s96_ret = s96at_gen_key(desc, S96AT_GENKEY_MODE_PRIVATE, ks->slot, &ks->pub);
+			if (s96_ret != S96AT_STATUS_OK) {
+				fprintf(stderr, "Slot %u: GenKey failed\n", ks->slot);
+				break;
+			}
+			ks->gen_ms = now_ms() - t;
+			post(&w);
+		}
+
+		if (i > 0) {
+			wait_done(&w, i - 1);
+			if (sign_csr(desc, &dev->slots[i - 1]) != S96AT_STATUS_OK)
+				break;
+		}
+	}
+	dev->total_ms = now_ms() - start;
+
+	pthread_mutex_lock(&w.lock);
+	while (w.done < w.posted)
+		pthread_cond_wait(&w.cond, &w.lock);
+	w.stop = 1;
+	pthread_cond_broadcast(&w.cond);
+	pthread_mutex_unlock(&w.lock);
+	pthread_join(thread, NULL);
+
+	ret = 0;
+	for (int i = 0; i < dev->num; i++) {
+		if (!dev->slots[i].ok)
+			ret = -1;
+	}
+
+out_idle:
+	s96at_idle(desc);
+	return ret;
+}
+
+void keygen_free(struct keygen_device *dev)
+{
+	for (int i = 0; i < dev->num; i++)
+		X509_REQ_free(dev->slots[i].req);
+	memset(dev, 0, sizeof(*dev));
+}
@@ -0,0 +1,128 @@
+#include <openssl/pem.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <secure96/s96at.h>
+
+#include <keygen.h>
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-o outdir]\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Generates a private key in every slot configured for one, and\n");
+	fprintf(stderr, "writes a CSR signed by each key to <outdir>/<sn>-slot<N>.csr\n");
+}
+
+static void print_hex(FILE *fp, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		fprintf(fp, "%02x", buf[i]);
+}
+
+static int write_csr(const char *outdir, const uint8_t *sn, const struct keygen_slot *ks)
+{
+	int ret = 0;
+	int len;
+	char path[4096];
+	FILE *fp;
+
+	len = snprintf(path, sizeof(path), "%s/", outdir);
+	for (int i = 0; i < S96AT_SERIAL_NUMBER_LEN; i++)
+		len += snprintf(path + len, sizeof(path) - len, "%02x", sn[i]);
+	snprintf(path + len, sizeof(path) - len, "-slot%u.csr", ks->slot);
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return -1;
+	}
+
+	if (!PEM_write_X509_REQ(fp, ks->req)) {
+		fprintf(stderr, "Could not write %s\n", path);
+		ret = -1;
+	}
+
+	if (fclose(fp))
+		ret = -1;
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = -1;
+	int opt;
+	uint8_t s96_ret;
+	double device_ms = 0;
+	double csr_ms = 0;
+	const char *outdir = ".";
+	struct s96at_desc desc;
+	struct keygen_device dev;
+
+	progname = argv[0];
+
+	while ((opt = getopt(argc, argv, "o:h")) != -1) {
+		switch (opt) {
+		case 'o':
+			outdir = optarg;
+			break;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	if (optind != argc) {
+		usage();
+		return -1;
+	}
+
+	s96_ret = s96at_init(S96AT_ATECC508A, S96AT_IO_I2C_LINUX, &desc);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize the device\n");
+		return -1;
+	}
+
+	ret = keygen_run(&desc, &dev);
+
+	for (int i = 0; i < dev.num; i++) {
+		struct keygen_slot *ks = &dev.slots[i];
+
+		if (!ks->ok)
+			continue;
+
+		printf("Slot %2u: ", ks->slot);
+		print_hex(stdout, ks->pub.x, S96AT_ECC_PUB_X_LEN);
+		print_hex(stdout, ks->pub.y, S96AT_ECC_PUB_Y_LEN);
+		printf("\n");
+		printf("         GenKey %.1f ms, CSR %.1f ms, Sign %.1f ms\n",
+		       ks->gen_ms, ks->csr_ms, ks->sign_ms);
+
+		if (write_csr(outdir, dev.sn, ks))
+			ret = -1;
+
+		device_ms += ks->gen_ms + ks->sign_ms;
+		csr_ms += ks->csr_ms;
+	}
+
+	if (dev.num) {
+		print_hex(stdout, dev.sn, sizeof(dev.sn));
+		printf(": %d keys in %.1f ms (device %.1f ms, host CSR %.1f ms)\n",
+		       dev.num, dev.total_ms, device_ms, csr_ms);
+		/* Time spent on CSRs while the device was busy */
+		printf("Overlapped: %.1f ms\n", device_ms + csr_ms > dev.total_ms ?
+		       device_ms + csr_ms - dev.total_ms : 0);
+	}
+
+	keygen_free(&dev);
+	s96at_sleep(&desc);
+	s96at_cleanup(&desc);
+
+	return ret;
+}
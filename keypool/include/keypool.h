@@ -0,0 +1,70 @@
+#ifndef __KEYPOOL_H
+#define __KEYPOOL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <secure96/s96at.h>
+
+#include <i2crdwr.h>
+
+#define KEYPOOL_MAX_MEMBERS	16	/* Max number of boards in a pool */
+#define KEYPOOL_MAX_KEYS	8	/* Max number of logical keys per pool */
+#define KEYPOOL_SLOT_NONE	0xff	/* Logical key not available on a board */
+
+#define KEYPOOL_MAX_FAILURES	3	/* Consecutive failures before ejecting a board */
+#define KEYPOOL_BACKOFF_MS	1000	/* Initial delay before an ejected board is retried */
+#define KEYPOOL_BACKOFF_MAX_MS	60000
+#define KEYPOOL_WAKE_RETRIES	10
+
+/* A logical key as provisioned on one board. Every board in the pool
+ * holds its own private key for a given logical key, so the signature
+ * must be checked against the certificate of the board that produced it.
+ */
+struct keypool_key {
+	uint8_t slot;		/* Private key slot, or KEYPOOL_SLOT_NONE */
+	const char *cert;	/* Certificate of the key, may be NULL */
+};
+
+/* A board is addressed by its I2C adapter and address, through the
+ * I2C_RDWR transport: the I/O backend of libs96at cannot select either.
+ */
+struct keypool_member {
+	struct i2crdwr dev;
+	struct keypool_key keys[KEYPOOL_MAX_KEYS];
+	pthread_mutex_t lock;	/* Serializes commands to the device */
+
+	/* Protected by the pool lock */
+	unsigned int inflight;	/* Requests dispatched and not yet completed */
+	unsigned int failures;	/* Consecutive failures */
+	int ejected;
+	uint64_t readmit_at;	/* Monotonic time (ms) of the next re-admission attempt */
+	uint32_t backoff_ms;
+
+	/* Statistics, protected by the pool lock */
+	uint64_t signs;
+	uint64_t errors;
+	uint64_t ejections;
+	uint64_t busy_us;	/* Time spent executing successful requests */
+};
+
+struct keypool {
+	pthread_mutex_t lock;	/* Protects member selection state */
+	struct keypool_member members[KEYPOOL_MAX_MEMBERS];
+	int num_members;
+};
+
+int keypool_init(struct keypool *pool);
+
+int keypool_add(struct keypool *pool, const char *path, uint16_t addr,
+		const struct keypool_key *keys, size_t num_keys);
+
+int keypool_sign(struct keypool *pool, uint8_t key, const uint8_t *digest,
+		 struct s96at_ecdsa_sig *sig, int *member);
+
+void keypool_stats(struct keypool *pool, FILE *fp);
+
+void keypool_cleanup(struct keypool *pool);
+
+#endif
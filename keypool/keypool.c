@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <keypool.h>
+
+#define OPCODE_NONCE		0x16
+#define OPCODE_SIGN		0x41
+#define NONCE_MODE_PASSTHROUGH	0x03
+#define SIGN_MODE_EXTERNAL	0x80
+
+/* Count, data and CRC */
+#define RESP_LEN_STATUS		(1 + 1 + 2)
+#define RESP_LEN_SIGN		(1 + 64 + 2)
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint8_t wake(struct i2crdwr *dev)
+{
+	for (int i = 0; i < KEYPOOL_WAKE_RETRIES; i++) {
+		if (i2crdwr_wake(dev) == I2CRDWR_STATUS_OK)
+			return S96AT_STATUS_OK;
+	}
+	return S96AT_STATUS_EXEC_ERROR;
+}
+
+/* Sign a digest in External mode: the digest is loaded into TempKey
+ * using Nonce in passthrough mode, and Sign is then run over TempKey.
+ * The device is put back to idle afterwards so that the watchdog does
+ * not expire between requests; on success, the idle is folded into the
+ * read of the signature.
+ */
+static uint8_t member_sign(struct keypool_member *m, uint8_t slot,
+			   const uint8_t *digest, struct s96at_ecdsa_sig *sig)
+{
+	uint8_t ret;
+	uint8_t resp[RESP_LEN_SIGN];
+
+	ret = wake(&m->dev);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = i2crdwr_command(&m->dev, OPCODE_NONCE, NONCE_MODE_PASSTHROUGH, 0,
+			      digest, S96AT_SHA_LEN, resp, RESP_LEN_STATUS, I2CRDWR_FLAG_NONE);
+	if (ret != I2CRDWR_STATUS_OK)
+		goto out;
+
+	ret = i2crdwr_command(&m->dev, OPCODE_SIGN, SIGN_MODE_EXTERNAL, slot, NULL, 0,
+			      resp, sizeof(resp), I2CRDWR_FLAG_IDLE);
+	if (ret != I2CRDWR_STATUS_OK)
+		goto out;
+
+	memcpy(sig->r, resp + 1, sizeof(sig->r));
+	memcpy(sig->s, resp + 1 + sizeof(sig->r), sizeof(sig->s));
+	return S96AT_STATUS_OK;
+out:
+	i2crdwr_idle(&m->dev);
+	return ret;
+}
+
+/* Pick the least loaded member that holds the requested key and has not
+ * been tried yet. Ejected members are skipped until their back-off has
+ * elapsed; they are then handed out once as a probe, and re-admitted if
+ * the request succeeds. Must be called with the pool lock held.
+ */
+static int select_member(struct keypool *pool, uint8_t key, uint32_t tried)
+{
+	int best = -1;
+	uint64_t now = now_us() / 1000;
+
+	for (int i = 0; i < pool->num_members; i++) {
+		struct keypool_member *m = &pool->members[i];
+
+		if (tried & (1 << i))
+			continue;
+		if (m->keys[key].slot == KEYPOOL_SLOT_NONE)
+			continue;
+		if (m->ejected && (now < m->readmit_at || m->inflight))
+			continue;
+
+		if (best < 0 || m->inflight < pool->members[best].inflight) {
+			best = i;
+			continue;
+		}
+
+		/* Same load: prefer the member that has been faster so far */
+		if (m->inflight == pool->members[best].inflight &&
+		    m->signs && pool->members[best].signs &&
+		    m->busy_us / m->signs <
+		    pool->members[best].busy_us / pool->members[best].signs)
+			best = i;
+	}
+
+	if (best >= 0)
+		pool->members[best].inflight++;
+
+	return best;
+}
+
+static void complete_member(struct keypool *pool, int idx, uint8_t ret,
+			    uint64_t elapsed_us)
+{
+	struct keypool_member *m = &pool->members[idx];
+
+	pthread_mutex_lock(&pool->lock);
+	m->inflight--;
+	if (ret == S96AT_STATUS_OK) {
+		if (m->ejected)
+			fprintf(stderr, "keypool: board %d re-admitted\n", idx);
+		m->ejected = 0;
+		m->failures = 0;
+		m->backoff_ms = KEYPOOL_BACKOFF_MS;
+		m->signs++;
+		m->busy_us += elapsed_us;
+	} else {
+		m->errors++;
+		m->failures++;
+		if (m->ejected) {
+			/* Failed probe: stay out for longer */
+			m->backoff_ms *= 2;
+			if (m->backoff_ms > KEYPOOL_BACKOFF_MAX_MS)
+				m->backoff_ms = KEYPOOL_BACKOFF_MAX_MS;
+			m->readmit_at = now_us() / 1000 + m->backoff_ms;
+		} else if (m->failures >= KEYPOOL_MAX_FAILURES) {
+			fprintf(stderr, "keypool: board %d ejected after %u failures\n",
+				idx, m->failures);
+			m->ejected = 1;
+			m->ejections++;
+			m->readmit_at = now_us() / 1000 + m->backoff_ms;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int keypool_init(struct keypool *pool)
+{
+	memset(pool, 0, sizeof(*pool));
+	return pthread_mutex_init(&pool->lock, NULL);
+}
+
+int keypool_add(struct keypool *pool, const char *path, uint16_t addr,
+		const struct keypool_key *keys, size_t num_keys)
+{
+	int ret = 0;
+	struct keypool_member *m;
+
+	if (num_keys > KEYPOOL_MAX_KEYS)
+		return -1;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->num_members == KEYPOOL_MAX_MEMBERS) {
+		ret = -1;
+		goto out;
+	}
+
+	m = &pool->members[pool->num_members];
+	memset(m, 0, sizeof(*m));
+	if (i2crdwr_open(&m->dev, I2CRDWR_MODE_RDWR, path, addr)) {
+		ret = -1;
+		goto out;
+	}
+	m->backoff_ms = KEYPOOL_BACKOFF_MS;
+	for (int i = 0; i < KEYPOOL_MAX_KEYS; i++)
+		m->keys[i].slot = KEYPOOL_SLOT_NONE;
+	memcpy(m->keys, keys, num_keys * sizeof(*keys));
+
+	if (pthread_mutex_init(&m->lock, NULL)) {
+		i2crdwr_close(&m->dev);
+		ret = -1;
+		goto out;
+	}
+
+	ret = pool->num_members++;
+out:
+	pthread_mutex_unlock(&pool->lock);
+	return ret;
+}
+
+/* Sign a SHA-256 digest with the logical key 'key'. The request is
+ * dispatched to the least loaded board; if that board fails, the request
+ * is retried on the remaining boards. On success, the index of the board
+ * that produced the signature is returned in 'member', so that the caller
+ * can pick the matching certificate.
+ */
+int keypool_sign(struct keypool *pool, uint8_t key, const uint8_t *digest,
+		 struct s96at_ecdsa_sig *sig, int *member)
+{
+	int idx;
+	uint8_t ret = S96AT_STATUS_EXEC_ERROR;
+	uint32_t tried = 0;
+	uint64_t start;
+	struct keypool_member *m;
+
+	if (key >= KEYPOOL_MAX_KEYS)
+		return S96AT_STATUS_BAD_PARAMETERS;
+
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		idx = select_member(pool, key, tried);
+		pthread_mutex_unlock(&pool->lock);
+
+		if (idx < 0)
+			break;
+		tried |= 1 << idx;
+		m = &pool->members[idx];
+
+		pthread_mutex_lock(&m->lock);
+		start = now_us();
+		ret = member_sign(m, m->keys[key].slot, digest, sig);
+		pthread_mutex_unlock(&m->lock);
+
+		complete_member(pool, idx, ret, now_us() - start);
+		if (ret == S96AT_STATUS_OK) {
+			if (member)
+				*member = idx;
+			return ret;
+		}
+	}
+
+	if (!tried) {
+		fprintf(stderr, "keypool: no board available for key %u\n", key);
+		return -1;
+	}
+
+	return ret;
+}
+
+void keypool_stats(struct keypool *pool, FILE *fp)
+{
+	pthread_mutex_lock(&pool->lock);
+	fprintf(fp, "Board  Device           Signs     Errors  Ejections  Avg (ms)  State\n");
+	for (int i = 0; i < pool->num_members; i++) {
+		struct keypool_member *m = &pool->members[i];
+
+		fprintf(fp, "%-6d %-11s 0x%02x %-9llu %-7llu %-10llu %-9.1f %s\n", i,
+			m->dev.path, m->dev.addr,
+			(unsigned long long)m->signs,
+			(unsigned long long)m->errors,
+			(unsigned long long)m->ejections,
+			m->signs ? m->busy_us / 1000.0 / m->signs : 0.0,
+			m->ejected ? "ejected" : "active");
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void keypool_cleanup(struct keypool *pool)
+{
+	for (int i = 0; i < pool->num_members; i++) {
+		i2crdwr_close(&pool->members[i].dev);
+		pthread_mutex_destroy(&pool->members[i].lock);
+	}
+	pthread_mutex_destroy(&pool->lock);
+	pool->num_members = 0;
+}
@@ -0,0 +1,166 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <secure96/s96at.h>
+
+#include <keypool.h>
+
+#define ARRAY_LEN(arr) (sizeof(arr) / sizeof(arr[0]))
+
+#define MAX_THREADS	64
+
+struct worker {
+	pthread_t thread;
+	struct keypool *pool;
+	unsigned int count;
+	unsigned int failed;
+	unsigned int seed;
+};
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	struct s96at_ecdsa_sig sig;
+	uint8_t digest[S96AT_SHA_LEN];
+	int board;
+
+	for (unsigned int i = 0; i < w->count; i++) {
+		/* The digest of the record to sign. Use whatever the
+		 * application is signing here.
+		 */
+		for (int j = 0; j < ARRAY_LEN(digest); j++)
+			digest[j] = rand_r(&w->seed) % 0x100;
+
+		if (keypool_sign(w->pool, 0, digest, &sig, &board) != S96AT_STATUS_OK)
+			w->failed++;
+	}
+	return NULL;
+}
+
+static void usage(const char *progname)
+{
+	fprintf(stderr, "Usage: %s [-t threads] slot_priv count board...\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Each board is given as adapter[:addr], eg /dev/i2c-1:0x61. The address\n");
+	fprintf(stderr, "is 0x%02x by default. threads defaults to twice the number of boards.\n",
+		I2CRDWR_DEFAULT_ADDR);
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+	int opt;
+	struct keypool pool;
+	struct worker workers[MAX_THREADS];
+	struct timespec start, end;
+	struct keypool_key key;
+	char path[sizeof(pool.members[0].dev.path)];
+	uint16_t addr;
+
+	int num_boards;
+	int num_threads = 0;
+	unsigned int num_signs;
+	unsigned int failed = 0;
+	double elapsed;
+
+	while ((opt = getopt(argc, argv, "t:h")) != -1) {
+		switch (opt) {
+		case 't':
+			num_threads = atoi(optarg);
+			if (num_threads < 1 || num_threads > MAX_THREADS) {
+				fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+				return -1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (argc - optind < 3) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	key.slot = atoi(argv[optind]);
+	key.cert = NULL;
+	num_signs = atoi(argv[optind + 1]);
+	num_boards = argc - optind - 2;
+
+	if (num_boards > KEYPOOL_MAX_MEMBERS) {
+		fprintf(stderr, "Too many boards: %d, at most %d\n", num_boards,
+			KEYPOOL_MAX_MEMBERS);
+		return -1;
+	}
+
+	if (key.slot > 15) {
+		fprintf(stderr, "Invalid slot: %d\n", key.slot);
+		return -1;
+	}
+
+	if (!num_threads)
+		num_threads = 2 * num_boards > MAX_THREADS ? MAX_THREADS : 2 * num_boards;
+
+	ret = keypool_init(&pool);
+	if (ret) {
+		fprintf(stderr, "Could not initialize pool\n");
+		return -1;
+	}
+
+	for (int i = 0; i < num_boards; i++) {
+		const char *spec = argv[optind + 2 + i];
+
+		if (i2crdwr_parse(spec, path, sizeof(path), &addr)) {
+			fprintf(stderr, "Invalid board: %s\n", spec);
+			ret = -1;
+			goto out;
+		}
+
+		/* All boards are expected to have been provisioned with the
+		 * same layout, so logical key 0 maps to the same slot on each.
+		 */
+		ret = keypool_add(&pool, path, addr, &key, 1);
+		if (ret < 0) {
+			fprintf(stderr, "Could not add board %s\n", spec);
+			goto out;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < num_threads; i++) {
+		workers[i].pool = &pool;
+		workers[i].count = num_signs / num_threads +
+				   (i < num_signs % num_threads);
+		workers[i].failed = 0;
+		workers[i].seed = time(NULL) + i;
+		pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		failed += workers[i].failed;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	keypool_stats(&pool, stdout);
+	printf("\n");
+	printf("Signatures:   %u (%u failed)\n", num_signs - failed, failed);
+	printf("Elapsed:      %.3f s\n", elapsed);
+	printf("Throughput:   %.1f sig/s (%.1f sig/s per board)\n",
+	       (num_signs - failed) / elapsed,
+	       (num_signs - failed) / elapsed / num_boards);
+
+	ret = failed ? -1 : 0;
+out:
+	keypool_cleanup(&pool);
+
+	return ret;
+}
@@ -0,0 +1,67 @@
+#ifndef __KEYROTATE_H
+#define __KEYROTATE_H
+
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+/* Where an interrupted rotation stands, as recorded in the journal */
+enum keyrotate_phase {
+	KEYROTATE_IDLE,		/* The active slot is valid, the other one standby */
+	KEYROTATE_WRITE,	/* The new key goes to the standby slot and is validated */
+	KEYROTATE_RETIRE	/* The active slot changed, the old one is invalidated */
+};
+
+enum keyrotate_step {
+	KEYROTATE_STEP_WRITE,
+	KEYROTATE_STEP_VALIDATE,
+	KEYROTATE_STEP_SWITCH,
+	KEYROTATE_STEP_RETIRE,
+	KEYROTATE_STEP_NUM
+};
+
+/* A pair of public key slots, one active and one standby, validated with
+ * the private key in the parent slot. The journal holds the active slot,
+ * and the phase of the rotation in progress along with the new key, so
+ * that an interrupted rotation is completed on the next open. It is kept
+ * in the private directory, with an HMAC under a random key of the host.
+ */
+struct keyrotate {
+	struct s96at_desc *desc;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint8_t slot[2];
+	uint8_t parent;
+	uint8_t slot_config[2][2];
+	uint8_t key_config[2][2];
+	uint8_t slot_locked[2];	/* Bit of the slot in Config.SlotLocked */
+	char name[40];		/* Of the journal in the private directory */
+
+	/* Journal */
+	uint32_t gen;		/* Rotations completed */
+	uint8_t active;
+	enum keyrotate_phase phase;
+	struct s96at_ecc_pub pub;	/* Key being rotated in */
+
+	double times[KEYROTATE_STEP_NUM];
+	int recovered;		/* An interrupted rotation was completed on open */
+};
+
+extern const char *keyrotate_step_names[KEYROTATE_STEP_NUM];
+
+int keyrotate_open(struct keyrotate *kr, struct s96at_desc *desc, uint8_t slot_a,
+		   uint8_t slot_b, uint8_t parent);
+
+int keyrotate_rotate(struct keyrotate *kr, const struct s96at_ecc_pub *pub);
+
+/* For verification callers, which do not need the device: the active
+ * slot of the pair on the device with serial number sn. The slot stays
+ * valid until keyrotate_release, as the old slot of a rotation is only
+ * invalidated once no caller holds it. Returns the descriptor to release,
+ * or -1.
+ */
+int keyrotate_acquire(const uint8_t *sn, uint8_t slot_a, uint8_t slot_b,
+		      uint8_t *active);
+
+void keyrotate_release(int fd);
+
+#endif
@@ -0,0 +1,504 @@
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <keyrotate.h>
+#include <privfile.h>
+
+#define JOURNAL_MAGIC		0x52363953	/* "S96R" */
+#define JOURNAL_KEY_NAME	"keyrotate-host.key"
+
+#define SLOT_CONFIG_OFFSET	20
+#define SLOT_LOCKED_OFFSET	88
+#define KEY_CONFIG_OFFSET	96
+
+#define PUB_SLOT_LEN		72
+
+/* Info command in State mode (Sect 9.9) */
+#define STATE_KEY_ID_MASK	0x0f	/* Byte 0 */
+#define STATE_GEN_KEY_DATA	0x40	/* Byte 0 */
+#define STATE_TEMPKEY_VALID	0x80	/* Byte 1 */
+
+const char *keyrotate_step_names[KEYROTATE_STEP_NUM] = {
+	"write", "validate", "switch", "retire"
+};
+
+struct __attribute__((__packed__)) keyrotate_journal {
+	uint32_t magic;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint8_t slot[2];
+	uint8_t active;
+	uint8_t phase;
+	uint32_t gen;
+	struct s96at_ecc_pub pub;
+	uint8_t mac[32];
+};
+
+/* Sect 9.20 */
+struct __attribute__((__packed__)) verify_msg {
+	uint8_t mode;
+	uint8_t key_id[2];	/* ParentPriv slot */
+	uint8_t slot_config[2];	/* SlotConfig[Pub] */
+	uint8_t key_config[2];	/* KeyConfig[Pub] */
+	uint8_t temp_key_flags;
+	uint8_t zeros[2];
+	uint8_t sn4[4];		/* SN[4:7] or zero */
+	uint8_t sn2[2];		/* SN[2:3] or zero */
+	uint8_t slot_locked;	/* Config.SlotLocked[Pub] */
+	uint8_t pub_key_valid;	/* 0 if pub key is currently invalid, 1 if currently valid */
+	uint8_t zero;
+};
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void journal_name(char *name, size_t len, const uint8_t *sn, uint8_t slot_a,
+			 uint8_t slot_b)
+{
+	snprintf(name, len, "rotate-"
+		 "%02x%02x%02x%02x%02x%02x%02x%02x%02x-%u-%u",
+		 sn[0], sn[1], sn[2], sn[3], sn[4], sn[5], sn[6], sn[7], sn[8],
+		 slot_a, slot_b);
+}
+
+/* Callers hold the lock file shared while they use the active slot. It
+ * is separate from the journal, which is replaced on every update.
+ */
+static int lock_open(const char *name)
+{
+	char lock_name[48];
+
+	snprintf(lock_name, sizeof(lock_name), "%s.lock", name);
+	return privfile_lock(lock_name);
+}
+
+static int journal_mac(const struct keyrotate_journal *j, uint8_t *mac)
+{
+	uint8_t key[32];
+	unsigned int len;
+
+	if (privfile_key(JOURNAL_KEY_NAME, key, sizeof(key)))
+		return -1;
+
+	HMAC(EVP_sha256(), key, sizeof(key), (const uint8_t *)j,
+	     offsetof(struct keyrotate_journal, mac), mac, &len);
+	OPENSSL_cleanse(key, sizeof(key));
+
+	return 0;
+}
+
+/* Returns 0, or -1 with errno set to ENOENT if there is no journal. A
+ * journal that fails the checks is reported: a planted one could make
+ * callers verify with a slot that is about to be invalidated.
+ */
+static int journal_read(const char *name, const uint8_t *sn, uint8_t slot_a,
+			uint8_t slot_b, struct keyrotate_journal *j)
+{
+	uint8_t mac[sizeof(j->mac)];
+
+	errno = 0;
+	if (privfile_read(name, j, sizeof(*j))) {
+		if (errno != ENOENT)
+			fprintf(stderr, "Could not read %s/%s\n", PRIVFILE_DIR, name);
+		return -1;
+	}
+
+	if (journal_mac(j, mac) || CRYPTO_memcmp(mac, j->mac, sizeof(mac)) ||
+	    j->magic != JOURNAL_MAGIC ||
+	    memcmp(j->sn, sn, sizeof(j->sn)) ||
+	    j->slot[0] != slot_a || j->slot[1] != slot_b ||
+	    (j->active != slot_a && j->active != slot_b) ||
+	    j->phase > KEYROTATE_RETIRE) {
+		fprintf(stderr, "The journal %s/%s fails authentication\n", PRIVFILE_DIR, name);
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* The journal is replaced atomically, so that a crash leaves either the
+ * old or the new one. The rename is the commit point of each phase.
+ */
+static int journal_write(struct keyrotate *kr)
+{
+	struct keyrotate_journal j;
+
+	memset(&j, 0, sizeof(j));
+	j.magic = JOURNAL_MAGIC;
+	memcpy(j.sn, kr->sn, sizeof(j.sn));
+	j.slot[0] = kr->slot[0];
+	j.slot[1] = kr->slot[1];
+	j.active = kr->active;
+	j.phase = kr->phase;
+	j.gen = kr->gen;
+	memcpy(&j.pub, &kr->pub, sizeof(j.pub));
+
+	if (journal_mac(&j, j.mac))
+		return -1;
+
+	return privfile_write(kr->name, &j, sizeof(j));
+}
+
+static uint8_t other_slot(const struct keyrotate *kr, uint8_t slot)
+{
+	return slot == kr->slot[0] ? kr->slot[1] : kr->slot[0];
+}
+
+static int slot_index(const struct keyrotate *kr, uint8_t slot)
+{
+	return slot == kr->slot[0] ? 0 : 1;
+}
+
+/* A public key slot holds X and Y, each preceded by 4 pad bytes. The key
+ * is invalid once written, until Verify validates it.
+ */
+static int write_pub(struct keyrotate *kr, uint8_t slot, const struct s96at_ecc_pub *pub)
+{
+	uint8_t ret;
+	uint8_t buf[PUB_SLOT_LEN] = { 0 };
+	struct s96at_slot_addr addr = { .slot = slot };
+
+	memcpy(buf + 4, pub->x, sizeof(pub->x));
+	memcpy(buf + 40, pub->y, sizeof(pub->y));
+
+	while (s96at_wake(kr->desc) != S96AT_STATUS_READY) {};
+
+	for (addr.block = 0; addr.block < 2; addr.block++) {
+		ret = s96at_write_data(kr->desc, &addr, S96AT_FLAG_NONE,
+				       buf + addr.block * S96AT_BLOCK_SIZE, S96AT_BLOCK_SIZE);
+		if (ret != S96AT_STATUS_OK)
+			goto out;
+	}
+
+	/* The last 8 bytes, in 4-byte words */
+	for (addr.offset = 0; addr.offset < 2; addr.offset++) {
+		ret = s96at_write_data(kr->desc, &addr, S96AT_FLAG_NONE,
+				       buf + 2 * S96AT_BLOCK_SIZE + addr.offset * S96AT_WORD_SIZE,
+				       S96AT_WORD_SIZE);
+		if (ret != S96AT_STATUS_OK)
+			goto out;
+	}
+out:
+	s96at_idle(kr->desc);
+	if (ret != S96AT_STATUS_OK)
+		fprintf(stderr, "Could not write slot %u\n", slot);
+	return ret;
+}
+
+static void notrandom(uint8_t *buf, size_t count)
+{
+	srand (time(NULL));
+	for (int i = 0; i < count; i++)
+		buf[i] = rand() % 0x100;
+}
+
+/* Validate or invalidate the key in slot, as the verify example does:
+ * the parent key signs the GenKey digest of the key, and Verify checks
+ * the signature and updates the validity of the key. Both sides run on
+ * the same device, so the digest Sign used is still in TempKey, unless
+ * the device cleared it.
+ */
+static int verify_key(struct keyrotate *kr, uint8_t slot, int invalidate)
+{
+	uint8_t ret;
+	uint8_t state[2];
+	uint8_t num_in[S96AT_RANDOM_LEN];
+	struct s96at_ecdsa_sig sig;
+	struct verify_msg message;
+	int i = slot_index(kr, slot);
+
+	notrandom(num_in, sizeof(num_in));
+
+	while (s96at_wake(kr->desc) != S96AT_STATUS_READY) {};
+
+	ret = s96at_gen_nonce(kr->desc, S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_gen_key(kr->desc, S96AT_GENKEY_MODE_DIGEST, slot, NULL);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_sign(kr->desc, S96AT_SIGN_MODE_INTERNAL, kr->parent,
+			 invalidate ? S96AT_FLAG_INVALIDATE : S96AT_FLAG_NONE, &sig);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_get_state(kr->desc, state);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	if (!(state[1] & STATE_TEMPKEY_VALID) || !(state[0] & STATE_GEN_KEY_DATA) ||
+	    (state[0] & STATE_KEY_ID_MASK) != slot) {
+		ret = s96at_gen_nonce(kr->desc, S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
+		if (ret != S96AT_STATUS_OK)
+			goto out;
+		ret = s96at_gen_key(kr->desc, S96AT_GENKEY_MODE_DIGEST, slot, NULL);
+		if (ret != S96AT_STATUS_OK)
+			goto out;
+		ret = s96at_get_state(kr->desc, state);
+		if (ret != S96AT_STATUS_OK)
+			goto out;
+	}
+
+	memset(&message, 0, sizeof(message));
+	message.mode = invalidate ? 0x01 : 0x00;
+	message.key_id[0] = kr->parent;
+	memcpy(message.slot_config, kr->slot_config[i], sizeof(message.slot_config));
+	memcpy(message.key_config, kr->key_config[i], sizeof(message.key_config));
+	message.temp_key_flags = state[0];
+	message.slot_locked = kr->slot_locked[i];
+	message.pub_key_valid = invalidate ? 1 : 0;
+
+	ret = s96at_verify_key(kr->desc, invalidate ? S96AT_VERIFY_KEY_MODE_INVALIDATE :
+			       S96AT_VERIFY_KEY_MODE_VALIDATE, &sig, slot, (uint8_t *)&message);
+out:
+	s96at_idle(kr->desc);
+	return ret;
+}
+
+/* Info in KeyValid mode reports the validity nibble of a public key slot */
+static uint8_t key_valid(struct keyrotate *kr, uint8_t slot, uint8_t *valid)
+{
+	uint8_t ret;
+
+	while (s96at_wake(kr->desc) != S96AT_STATUS_READY) {};
+	ret = s96at_get_key_valid(kr->desc, slot, valid);
+	s96at_idle(kr->desc);
+
+	return ret;
+}
+
+/* Invalidate the old slot once no verification caller holds it. The
+ * lock is held while the device invalidates it, so callers that come
+ * next find the new active slot in the journal.
+ */
+static int retire(struct keyrotate *kr, uint8_t slot)
+{
+	uint8_t ret;
+	uint8_t valid;
+	int fd;
+
+	fd = lock_open(kr->name);
+	if (fd < 0 || flock(fd, LOCK_EX)) {
+		perror("lock");
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	/* A rotation interrupted after the invalidation did it already, and
+	 * the device would refuse to invalidate the slot again.
+	 */
+	ret = key_valid(kr, slot, &valid);
+	if (ret == S96AT_STATUS_OK && valid)
+		ret = verify_key(kr, slot, 1);
+	close(fd);
+
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not invalidate slot %u: 0x%02x\n", slot, ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Take the rotation from the phase in the journal to its end. Each step
+ * can be run again if it was interrupted: the standby slot is written
+ * again before it is validated, so that it is invalid whatever happened
+ * to it.
+ */
+static int keyrotate_run(struct keyrotate *kr)
+{
+	uint8_t ret;
+	uint8_t old;
+	double t;
+
+	if (kr->phase == KEYROTATE_WRITE) {
+		uint8_t standby = other_slot(kr, kr->active);
+
+		t = now_ms();
+		if (write_pub(kr, standby, &kr->pub))
+			return -1;
+		kr->times[KEYROTATE_STEP_WRITE] = now_ms() - t;
+
+		t = now_ms();
+		ret = verify_key(kr, standby, 0);
+		if (ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "Could not validate slot %u: 0x%02x\n", standby, ret);
+			return -1;
+		}
+		kr->times[KEYROTATE_STEP_VALIDATE] = now_ms() - t;
+
+		/* Both keys are valid: switch callers to the new one */
+		t = now_ms();
+		kr->active = standby;
+		kr->phase = KEYROTATE_RETIRE;
+		if (journal_write(kr))
+			return -1;
+		kr->times[KEYROTATE_STEP_SWITCH] = now_ms() - t;
+	}
+
+	if (kr->phase == KEYROTATE_RETIRE) {
+		old = other_slot(kr, kr->active);
+
+		t = now_ms();
+		if (retire(kr, old))
+			return -1;
+		kr->times[KEYROTATE_STEP_RETIRE] = now_ms() - t;
+
+		kr->phase = KEYROTATE_IDLE;
+		kr->gen++;
+		if (journal_write(kr))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* The SN and the SlotConfig of the public key slots are in blocks 0 and
+ * 1, SlotLocked in block 2 and KeyConfig in block 3.
+ */
+static int read_config(struct keyrotate *kr)
+{
+	uint8_t ret;
+	uint8_t config[S96AT_ATECC508A_ZONE_CONFIG_LEN];
+	uint8_t *key_config;
+
+	while (s96at_wake(kr->desc) != S96AT_STATUS_READY) {};
+	for (int i = 0; i < S96AT_ATECC508A_ZONE_CONFIG_NUM_BLOCKS; i++) {
+		ret = s96at_read_config(kr->desc, i, config + i * S96AT_BLOCK_SIZE);
+		if (ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "Failed to read config block %d\n", i);
+			s96at_idle(kr->desc);
+			return -1;
+		}
+	}
+	s96at_idle(kr->desc);
+
+	/* SN[0:3] is at bytes 0-3, SN[4:8] at bytes 8-12 */
+	memcpy(kr->sn, config, 4);
+	memcpy(kr->sn + 4, config + 8, 5);
+
+	for (int i = 0; i < 2; i++) {
+		memcpy(kr->slot_config[i], config + SLOT_CONFIG_OFFSET + 2 * kr->slot[i], 2);
+		memcpy(kr->key_config[i], config + KEY_CONFIG_OFFSET + 2 * kr->slot[i], 2);
+		kr->slot_locked[i] = config[SLOT_LOCKED_OFFSET + kr->slot[i] / 8] >>
+				     (kr->slot[i] % 8) & 0x01;
+		if (kr->key_config[i][0] & 0x01) {
+			fprintf(stderr, "Slot %u: Not a public key\n", kr->slot[i]);
+			return -1;
+		}
+	}
+
+	key_config = config + KEY_CONFIG_OFFSET + 2 * kr->parent;
+	if (!(key_config[0] & 0x01)) {
+		fprintf(stderr, "Slot %u: Not a private key\n", kr->parent);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Without a journal, slot_a is taken as the active slot: it must hold a
+ * valid key, eg validated with the verify example. A journal that fails
+ * authentication is an error, left for the user to look at.
+ */
+int keyrotate_open(struct keyrotate *kr, struct s96at_desc *desc, uint8_t slot_a,
+		   uint8_t slot_b, uint8_t parent)
+{
+	struct keyrotate_journal j;
+
+	memset(kr, 0, sizeof(*kr));
+	kr->desc = desc;
+	kr->slot[0] = slot_a;
+	kr->slot[1] = slot_b;
+	kr->parent = parent;
+
+	if (slot_a < 8 || slot_a > 15 || slot_b < 8 || slot_b > 15 || slot_a == slot_b ||
+	    parent > 15) {
+		fprintf(stderr, "Invalid slots\n");
+		return -1;
+	}
+
+	if (read_config(kr))
+		return -1;
+
+	journal_name(kr->name, sizeof(kr->name), kr->sn, slot_a, slot_b);
+	if (journal_read(kr->name, kr->sn, slot_a, slot_b, &j)) {
+		if (errno != ENOENT)
+			return -1;
+		kr->active = slot_a;
+		kr->phase = KEYROTATE_IDLE;
+		return journal_write(kr);
+	}
+
+	kr->active = j.active;
+	kr->phase = j.phase;
+	kr->gen = j.gen;
+	memcpy(&kr->pub, &j.pub, sizeof(kr->pub));
+
+	if (kr->phase == KEYROTATE_IDLE)
+		return 0;
+
+	kr->recovered = 1;
+	return keyrotate_run(kr);
+}
+
+int keyrotate_rotate(struct keyrotate *kr, const struct s96at_ecc_pub *pub)
+{
+	memset(kr->times, 0, sizeof(kr->times));
+	kr->recovered = 0;
+
+	/* The new key is journaled first, so that a rotation interrupted
+	 * before the switch is completed with the same key.
+	 */
+	memcpy(&kr->pub, pub, sizeof(kr->pub));
+	kr->phase = KEYROTATE_WRITE;
+	if (journal_write(kr))
+		return -1;
+
+	return keyrotate_run(kr);
+}
+
+int keyrotate_acquire(const uint8_t *sn, uint8_t slot_a, uint8_t slot_b,
+		      uint8_t *active)
+{
+	struct keyrotate_journal j;
+	char name[40];
+	int fd;
+
+	journal_name(name, sizeof(name), sn, slot_a, slot_b);
+
+	fd = lock_open(name);
+	if (fd < 0)
+		return -1;
+
+	if (flock(fd, LOCK_SH) || journal_read(name, sn, slot_a, slot_b, &j)) {
+		close(fd);
+		return -1;
+	}
+
+	*active = j.active;
+	return fd;
+}
+
+void keyrotate_release(int fd)
+{
+	close(fd);
+}
@@ -0,0 +1,142 @@
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <secure96/s96at.h>
+
+#include <keyrotate.h>
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s <command> <args>\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Commands:\n");
+	fprintf(stderr, "  rotate <slot_a> <slot_b> <parent> <pub.pem>  Rotate the key of the pair\n");
+	fprintf(stderr, "  status <slot_a> <slot_b> <parent>            Print the active slot\n");
+}
+
+static void print_hex(FILE *fp, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		fprintf(fp, "%02x", buf[i]);
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int read_pub(const char *path, struct s96at_ecc_pub *pub)
+{
+	FILE *fp;
+	EVP_PKEY *pkey;
+	uint8_t point[1 + S96AT_ECC_PUB_X_LEN + S96AT_ECC_PUB_Y_LEN];
+	size_t len;
+	int ret = -1;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror("fopen");
+		return -1;
+	}
+
+	pkey = PEM_read_PUBKEY(fp, NULL, NULL, NULL);
+	fclose(fp);
+	if (!pkey) {
+		fprintf(stderr, "Could not read Public Key\n");
+		return -1;
+	}
+
+	if (EVP_PKEY_get_octet_string_param(pkey, "encoded-pub-key", point, sizeof(point), &len) &&
+	    len == sizeof(point) && point[0] == 0x04) {
+		memcpy(pub->x, point + 1, sizeof(pub->x));
+		memcpy(pub->y, point + 1 + sizeof(pub->x), sizeof(pub->y));
+		ret = 0;
+	} else {
+		fprintf(stderr, "Not a P-256 Public Key\n");
+	}
+	EVP_PKEY_free(pkey);
+
+	return ret;
+}
+
+static void print_result(const struct keyrotate *kr, int ret, int rotate, uint8_t prev,
+			 double ms)
+{
+	print_hex(stdout, kr->sn, sizeof(kr->sn));
+	if (ret) {
+		printf(" FAIL");
+		if (kr->phase != KEYROTATE_IDLE)
+			printf(" (%s pending)", kr->phase == KEYROTATE_WRITE ? "write" : "retire");
+		printf("\n");
+		return;
+	}
+
+	printf(" active=%u gen=%u", kr->active, kr->gen);
+	if (kr->recovered)
+		printf(" recovered");
+	if (rotate)
+		printf(" %u->%u", prev, kr->active);
+	if (rotate || kr->recovered) {
+		for (int i = 0; i < KEYROTATE_STEP_NUM; i++)
+			printf(" %s=%.0fms", keyrotate_step_names[i], kr->times[i]);
+	}
+	printf(" total=%.0fms\n", ms);
+}
+
+/* Open the pair, which completes a rotation interrupted earlier, then
+ * rotate if asked to.
+ */
+int main(int argc, char *argv[])
+{
+	int ret = -1;
+	int rotate;
+	uint8_t prev;
+	struct s96at_desc desc;
+	struct keyrotate kr;
+	struct s96at_ecc_pub pub;
+	double t;
+
+	progname = argv[0];
+
+	if (argc < 5) {
+		usage();
+		return -1;
+	}
+
+	rotate = !strcmp(argv[1], "rotate");
+	if (rotate) {
+		if (argc != 6 || read_pub(argv[5], &pub))
+			return -1;
+	} else if (strcmp(argv[1], "status") || argc != 5) {
+		usage();
+		return -1;
+	}
+
+	if (s96at_init(S96AT_ATECC508A, S96AT_IO_I2C_LINUX, &desc) != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize descriptor\n");
+		return -1;
+	}
+
+	t = now_ms();
+	ret = keyrotate_open(&kr, &desc, atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+	prev = kr.active;
+	if (!ret && rotate)
+		ret = keyrotate_rotate(&kr, &pub);
+	s96at_sleep(&desc);
+	t = now_ms() - t;
+
+	print_result(&kr, ret, rotate, prev, t);
+	s96at_cleanup(&desc);
+
+	return ret;
+}
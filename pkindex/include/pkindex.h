@@ -0,0 +1,49 @@
+#ifndef __PKINDEX_H
+#define __PKINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#define PKINDEX_MAGIC		"S96PKIX"
+#define PKINDEX_VERSION		1
+#define PKINDEX_PUB_LEN		64	/* X || Y */
+#define PKINDEX_KEY_LEN		(S96AT_SERIAL_NUMBER_LEN + 1)
+
+/* One public key of one device. Records are sorted by serial number, then
+ * slot, so that the first PKINDEX_KEY_LEN bytes are the search key.
+ */
+struct __attribute__((__packed__)) pkindex_record {
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint8_t slot;
+	uint8_t reserved[6];
+	uint8_t pub[PKINDEX_PUB_LEN];
+};
+
+/* File header, followed by the records. Integers are little endian. */
+struct __attribute__((__packed__)) pkindex_header {
+	uint8_t magic[8];
+	uint8_t version[4];
+	uint8_t record_len[4];
+	uint8_t num_records[8];
+	uint8_t reserved[8];
+};
+
+struct pkindex {
+	void *map;
+	size_t map_len;
+	const struct pkindex_record *records;
+	size_t num;
+};
+
+int pkindex_build(const char *path, struct pkindex_record *records, size_t num);
+
+int pkindex_open(struct pkindex *idx, const char *path);
+
+void pkindex_close(struct pkindex *idx);
+
+const struct pkindex_record *pkindex_lookup(const struct pkindex *idx, const uint8_t *sn,
+					    uint8_t slot);
+
+#endif
@@ -0,0 +1,320 @@
+#include <openssl/rand.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <secure96/s96at.h>
+
+#include <pkindex.h>
+
+#define FIRST_KEY_SLOT		9
+#define LAST_KEY_SLOT		15
+#define KEY_CONFIG_BLOCK	3	/* KeyConfig is at bytes 96-127 */
+
+#define BENCH_DEVICES		1000000
+#define BENCH_SLOT		11
+#define BENCH_LOOKUPS		4000000
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s export <records>\n", progname);
+	fprintf(stderr, "       %s build <index> <records>...\n", progname);
+	fprintf(stderr, "       %s lookup <index> <sn> [slot]\n", progname);
+	fprintf(stderr, "       %s bench <index> [num_devices]\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "export appends the public keys of the device to a records file\n");
+	fprintf(stderr, "build sorts records files into an index\n");
+	fprintf(stderr, "lookup prints the public keys of a device, or of one slot\n");
+	fprintf(stderr, "bench builds an index of synthetic devices and times lookups\n");
+}
+
+static void print_hex(FILE *fp, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		fprintf(fp, "%02x", buf[i]);
+}
+
+static int parse_hex(const char *str, uint8_t *buf, size_t len)
+{
+	if (strlen(str) != 2 * len)
+		return -1;
+
+	for (size_t i = 0; i < len; i++) {
+		if (sscanf(str + 2 * i, "%2hhx", &buf[i]) != 1)
+			return -1;
+	}
+	return 0;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Export the public key of each slot holding a private key, as returned by
+ * GenKey in public mode.
+ */
+static int run_export(const char *path)
+{
+	int ret = -1;
+	int num = 0;
+	uint8_t s96_ret;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint8_t key_config[S96AT_BLOCK_SIZE];
+	FILE *fp = NULL;
+	struct s96at_desc desc;
+	struct s96at_ecc_pub pub;
+	struct pkindex_record rec;
+
+	s96_ret = s96at_init(S96AT_ATECC508A, S96AT_IO_I2C_LINUX, &desc);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize the device\n");
+		return -1;
+	}
+
+	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+
+	s96_ret = s96at_get_serialnbr(&desc, sn);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read the serial number\n");
+		goto out;
+	}
+
+	s96_ret = s96at_read_config(&desc, KEY_CONFIG_BLOCK, key_config);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read KeyConfig\n");
+		goto out;
+	}
+
+	fp = fopen(path, "ab");
+	if (!fp) {
+		fprintf(stderr, "Could not open %s\n", path);
+		goto out;
+	}
+
+	for (int slot = FIRST_KEY_SLOT; slot <= LAST_KEY_SLOT; slot++) {
+		if (!(key_config[2 * slot] & 0x01)) /* Private */
+			continue;
+
+		s96_ret = s96at_gen_key(&desc, S96AT_GENKEY_MODE_PUBLIC, slot, &pub);
+		if (s96_ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "Could not get the public key of slot %d\n", slot);
+			goto out;
+		}
+
+		memset(&rec, 0, sizeof(rec));
+		memcpy(rec.sn, sn, sizeof(rec.sn));
+		rec.slot = slot;
+		memcpy(rec.pub, pub.x, S96AT_ECC_PUB_X_LEN);
+		memcpy(rec.pub + S96AT_ECC_PUB_X_LEN, pub.y, S96AT_ECC_PUB_Y_LEN);
+
+		if (fwrite(&rec, sizeof(rec), 1, fp) != 1) {
+			fprintf(stderr, "Could not write %s\n", path);
+			goto out;
+		}
+		num++;
+	}
+
+	print_hex(stdout, sn, sizeof(sn));
+	printf(": %d public keys exported\n", num);
+	ret = 0;
+out:
+	if (fp && fclose(fp))
+		ret = -1;
+	s96at_sleep(&desc);
+	s96at_cleanup(&desc);
+
+	return ret;
+}
+
+static int read_records(const char *path, struct pkindex_record **records, size_t *num)
+{
+	int ret = -1;
+	size_t n;
+	FILE *fp;
+	struct stat st;
+	struct pkindex_record *tmp;
+
+	fp = fopen(path, "rb");
+	if (!fp) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return -1;
+	}
+
+	if (fstat(fileno(fp), &st) || st.st_size % sizeof(**records)) {
+		fprintf(stderr, "%s: not a records file\n", path);
+		goto out;
+	}
+
+	n = st.st_size / sizeof(**records);
+	tmp = realloc(*records, (*num + n) * sizeof(**records));
+	if (!tmp)
+		goto out;
+	*records = tmp;
+
+	if (fread(*records + *num, sizeof(**records), n, fp) != n) {
+		fprintf(stderr, "Could not read %s\n", path);
+		goto out;
+	}
+	*num += n;
+
+	ret = 0;
+out:
+	fclose(fp);
+	return ret;
+}
+
+static int run_build(const char *path, char **inputs, int num_inputs)
+{
+	int ret;
+	size_t num = 0;
+	struct pkindex_record *records = NULL;
+
+	for (int i = 0; i < num_inputs; i++) {
+		if (read_records(inputs[i], &records, &num)) {
+			free(records);
+			return -1;
+		}
+	}
+
+	ret = pkindex_build(path, records, num);
+	if (ret >= 0)
+		printf("%zu records, %d in the index\n", num, ret);
+
+	free(records);
+	return ret < 0 ? -1 : 0;
+}
+
+static int run_lookup(const char *path, const char *sn_str, const char *slot_str)
+{
+	int found = 0;
+	int first = FIRST_KEY_SLOT;
+	int last = LAST_KEY_SLOT;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	struct pkindex idx;
+	const struct pkindex_record *rec;
+
+	if (parse_hex(sn_str, sn, sizeof(sn))) {
+		fprintf(stderr, "Invalid serial number: %s\n", sn_str);
+		return -1;
+	}
+
+	if (slot_str)
+		first = last = strtoul(slot_str, NULL, 0);
+
+	if (pkindex_open(&idx, path))
+		return -1;
+
+	for (int slot = first; slot <= last; slot++) {
+		rec = pkindex_lookup(&idx, sn, slot);
+		if (!rec)
+			continue;
+		printf("Slot %2d: ", slot);
+		print_hex(stdout, rec->pub, sizeof(rec->pub));
+		printf("\n");
+		found++;
+	}
+
+	pkindex_close(&idx);
+
+	if (!found) {
+		fprintf(stderr, "Not found\n");
+		return -1;
+	}
+	return 0;
+}
+
+/* Build an index of num devices with one key each, and time random
+ * lookups of devices in the index and of unknown devices.
+ */
+static int run_bench(const char *path, size_t num)
+{
+	int ret = -1;
+	size_t hits = 0;
+	double t;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint32_t *picks = NULL;
+	struct pkindex_record *records;
+	struct pkindex_record *sns = NULL;
+	struct pkindex idx;
+
+	if (!num) {
+		usage();
+		return -1;
+	}
+
+	records = calloc(num, sizeof(*records));
+	sns = calloc(num, sizeof(*sns));
+	picks = calloc(BENCH_LOOKUPS, sizeof(*picks));
+	if (!records || !sns || !picks)
+		goto out;
+
+	if (RAND_bytes((uint8_t *)records, num * sizeof(*records)) != 1 ||
+	    RAND_bytes((uint8_t *)picks, BENCH_LOOKUPS * sizeof(*picks)) != 1)
+		goto out;
+
+	for (size_t i = 0; i < num; i++) {
+		records[i].sn[0] = 0x01;
+		records[i].sn[1] = 0x23;
+		records[i].sn[8] = 0xee;
+		records[i].slot = BENCH_SLOT;
+		sns[i] = records[i];
+	}
+
+	t = now_s();
+	if (pkindex_build(path, records, num) < 0)
+		goto out;
+	t = now_s() - t;
+	printf("Build:  %zu records in %.3f s (%.0f records/s)\n", num, t, num / t);
+
+	t = now_s();
+	if (pkindex_open(&idx, path))
+		goto out;
+	printf("Open:   %.1f us\n", (now_s() - t) * 1e6);
+
+	/* One lookup in 4 is for an unknown device */
+	t = now_s();
+	for (size_t i = 0; i < BENCH_LOOKUPS; i++) {
+		memcpy(sn, sns[picks[i] % num].sn, sizeof(sn));
+		if (i % 4 == 3)
+			sn[8] ^= 0xff;
+		if (pkindex_lookup(&idx, sn, BENCH_SLOT))
+			hits++;
+	}
+	t = now_s() - t;
+	printf("Lookup: %d lookups, %zu found, in %.3f s (%.0f lookups/s)\n",
+	       BENCH_LOOKUPS, hits, t, BENCH_LOOKUPS / t);
+
+	pkindex_close(&idx);
+	ret = 0;
+out:
+	free(picks);
+	free(sns);
+	free(records);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	progname = argv[0];
+
+	if (argc == 3 && !strcmp(argv[1], "export"))
+		return run_export(argv[2]);
+	else if (argc >= 4 && !strcmp(argv[1], "build"))
+		return run_build(argv[2], argv + 3, argc - 3);
+	else if ((argc == 4 || argc == 5) && !strcmp(argv[1], "lookup"))
+		return run_lookup(argv[2], argv[3], argc == 5 ? argv[4] : NULL);
+	else if ((argc == 3 || argc == 4) && !strcmp(argv[1], "bench"))
+		return run_bench(argv[2], argc == 4 ? strtoul(argv[3], NULL, 0) : BENCH_DEVICES);
+
+	usage();
+	return -1;
+}
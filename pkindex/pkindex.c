@@ -0,0 +1,197 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <pkindex.h>
+
+static void put_le(uint8_t *buf, uint64_t val, int len)
+{
+	for (int i = 0; i < len; i++)
+		buf[i] = val >> (8 * i);
+}
+
+static uint64_t get_le(const uint8_t *buf, int len)
+{
+	uint64_t val = 0;
+
+	for (int i = 0; i < len; i++)
+		val |= (uint64_t)buf[i] << (8 * i);
+	return val;
+}
+
+static int record_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, PKINDEX_KEY_LEN);
+}
+
+/* Records with the same key are ordered by their position in the input,
+ * kept in the reserved bytes while sorting.
+ */
+static int record_cmp_seq(const void *a, const void *b)
+{
+	const struct pkindex_record *ra = a;
+	const struct pkindex_record *rb = b;
+	uint64_t sa;
+	uint64_t sb;
+	int cmp;
+
+	cmp = record_cmp(a, b);
+	if (cmp)
+		return cmp;
+
+	sa = get_le(ra->reserved, sizeof(ra->reserved));
+	sb = get_le(rb->reserved, sizeof(rb->reserved));
+	return (sa > sb) - (sa < sb);
+}
+
+/* Sort the records, keep the last of any duplicates, and write the index.
+ * The index is written to a temporary file and renamed, so that readers
+ * never see a partial index.
+ */
+int pkindex_build(const char *path, struct pkindex_record *records, size_t num)
+{
+	int ret = -1;
+	size_t n = 0;
+	char *tmp;
+	FILE *fp;
+	struct pkindex_header hdr;
+
+	for (size_t i = 0; i < num; i++)
+		put_le(records[i].reserved, i, sizeof(records[i].reserved));
+
+	qsort(records, num, sizeof(*records), record_cmp_seq);
+
+	for (size_t i = 0; i < num; i++) {
+		if (i + 1 < num && !record_cmp(&records[i], &records[i + 1]))
+			continue;
+		records[n] = records[i];
+		memset(records[n].reserved, 0, sizeof(records[n].reserved));
+		n++;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PKINDEX_MAGIC, sizeof(PKINDEX_MAGIC));
+	put_le(hdr.version, PKINDEX_VERSION, sizeof(hdr.version));
+	put_le(hdr.record_len, sizeof(struct pkindex_record), sizeof(hdr.record_len));
+	put_le(hdr.num_records, n, sizeof(hdr.num_records));
+
+	tmp = malloc(strlen(path) + 5);
+	if (!tmp)
+		return -1;
+	sprintf(tmp, "%s.tmp", path);
+
+	fp = fopen(tmp, "wb");
+	if (!fp) {
+		fprintf(stderr, "Could not create %s\n", tmp);
+		goto out;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    fwrite(records, sizeof(*records), n, fp) != n ||
+	    fflush(fp) || fsync(fileno(fp))) {
+		fprintf(stderr, "Could not write %s\n", tmp);
+		fclose(fp);
+		unlink(tmp);
+		goto out;
+	}
+	fclose(fp);
+
+	if (rename(tmp, path)) {
+		fprintf(stderr, "Could not rename %s to %s\n", tmp, path);
+		unlink(tmp);
+		goto out;
+	}
+
+	ret = n;
+out:
+	free(tmp);
+	return ret;
+}
+
+/* Map the index. Nothing is parsed beyond the header: records are
+ * searched in place.
+ */
+int pkindex_open(struct pkindex *idx, const char *path)
+{
+	int fd;
+	uint64_t num;
+	struct stat st;
+	const struct pkindex_header *hdr;
+
+	memset(idx, 0, sizeof(*idx));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return -1;
+	}
+
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		fprintf(stderr, "%s: not an index\n", path);
+		close(fd);
+		return -1;
+	}
+
+	idx->map_len = st.st_size;
+	idx->map = mmap(NULL, idx->map_len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (idx->map == MAP_FAILED) {
+		fprintf(stderr, "Could not map %s\n", path);
+		idx->map = NULL;
+		return -1;
+	}
+
+	hdr = idx->map;
+	num = get_le(hdr->num_records, sizeof(hdr->num_records));
+	if (memcmp(hdr->magic, PKINDEX_MAGIC, sizeof(PKINDEX_MAGIC)) ||
+	    get_le(hdr->version, sizeof(hdr->version)) != PKINDEX_VERSION ||
+	    get_le(hdr->record_len, sizeof(hdr->record_len)) != sizeof(struct pkindex_record) ||
+	    num > (idx->map_len - sizeof(*hdr)) / sizeof(struct pkindex_record)) {
+		fprintf(stderr, "%s: not an index, or unsupported version\n", path);
+		pkindex_close(idx);
+		return -1;
+	}
+
+	idx->records = (const struct pkindex_record *)(hdr + 1);
+	idx->num = num;
+
+	return 0;
+}
+
+void pkindex_close(struct pkindex *idx)
+{
+	if (idx->map)
+		munmap(idx->map, idx->map_len);
+	memset(idx, 0, sizeof(*idx));
+}
+
+const struct pkindex_record *pkindex_lookup(const struct pkindex *idx, const uint8_t *sn,
+					    uint8_t slot)
+{
+	uint8_t key[PKINDEX_KEY_LEN];
+	size_t lo = 0;
+	size_t hi = idx->num;
+	size_t mid;
+	int cmp;
+
+	memcpy(key, sn, S96AT_SERIAL_NUMBER_LEN);
+	key[S96AT_SERIAL_NUMBER_LEN] = slot;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = memcmp(idx->records[mid].sn, key, PKINDEX_KEY_LEN);
+		if (!cmp)
+			return &idx->records[mid];
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return NULL;
+}
@@ -1,6 +1,7 @@
 #include <openssl/ec.h>
 #include <openssl/sha.h>
 #include <openssl/ssl.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -8,6 +9,10 @@
 
 #include <secure96/s96at.h>
 
+#include <configcache.h>
+#include <plan.h>
+#include <slotkey.h>
+
 #define ARRAY_LEN(arr) (sizeof(arr) / sizeof(arr[0]))
 
 #define OPCODE_GENDIG		0x15
@@ -41,20 +46,6 @@ struct __attribute__((__packed__)) auth_mac_in {
 	uint8_t padded_key[36];
 };
 
-static int atecc508a_read_config(struct s96at_desc *desc, uint8_t *buf)
-{
-	uint8_t ret;
-
-	for (int i = 0; i < S96AT_ATECC508A_ZONE_CONFIG_NUM_BLOCKS; i++) {
-		ret = s96at_read_config(desc, i, buf + i * S96AT_BLOCK_SIZE);
-		if (ret != S96AT_STATUS_OK) {
-			fprintf(stderr, "Failed to read config block %u\n", i);
-			continue;
-		}
-	}
-	return ret;
-}
-
 static int check_config(uint8_t *config_buf, uint8_t slot)
 {
 	int ret = 0;
@@ -130,6 +121,42 @@ static int read_EC_priv_from_pem(const char *file, uint8_t *buf)
 	return 0;
 }
 
+/* Walk the command sequence of main() for count runs on the same device,
+ * without touching it. The first run reads the config blocks holding the
+ * SlotConfig and KeyConfig of the slot, and caches them; later runs only
+ * read block 0. Each run is a separate process, so it wakes the device.
+ */
+static void dry_run(uint8_t slot, unsigned int count)
+{
+	struct plan plan;
+	char what[32];
+	uint8_t blocks;
+
+	plan_init(&plan);
+
+	blocks = 1 << ((SLOT_CONFIG_OFFSET + 2 * slot) / S96AT_BLOCK_SIZE) |
+		 1 << ((KEY_CONFIG_OFFSET + 2 * slot) / S96AT_BLOCK_SIZE);
+	for (unsigned int run = 0; run < count; run++) {
+		plan_wake(&plan);
+		plan_cmd(&plan, PLAN_OP_READ, 0, S96AT_BLOCK_SIZE, "config block 0");
+		for (int i = 1; !run && i < S96AT_ATECC508A_ZONE_CONFIG_NUM_BLOCKS; i++) {
+			if (!(blocks & (1 << i)))
+				continue;
+			snprintf(what, sizeof(what), "config block %d", i);
+			plan_cmd(&plan, PLAN_OP_READ, 0, S96AT_BLOCK_SIZE, what);
+		}
+		if (!run)
+			plan_cmd(&plan, PLAN_OP_READ, 0, S96AT_WORD_SIZE, "LockConfig");
+		plan_cmd(&plan, PLAN_OP_NONCE, S96AT_RANDOM_LEN, 0, "passthrough");
+		plan_cmd(&plan, PLAN_OP_GENDIG, 0, 0, "parent key");
+		snprintf(what, sizeof(what), "slot %u", slot);
+		plan_cmd(&plan, PLAN_OP_PRIVWRITE, 36 + S96AT_SHA_LEN, 0, what);
+	}
+
+	plan_summary(&plan);
+	printf("Per key: %.1f ms typical\n", plan.typ_ms / count);
+}
+
 static void notrandom(uint8_t *buf, size_t count)
 {
 	srand (time(NULL));
@@ -148,6 +175,7 @@ int main(int argc, char *argv[])
 	uint8_t parent_key_slot;
 
 	uint8_t config_buf[S96AT_ATECC508A_ZONE_CONFIG_LEN] = {0};
+	uint8_t config_offsets[2];
 
 	struct gendig_in digest_in;
 
@@ -163,19 +191,51 @@ int main(int argc, char *argv[])
 	struct auth_mac_in mac_in;
 	uint8_t auth_mac[S96AT_SHA_LEN];
 
-	if (argc != 3) {
-		fprintf(stderr, "Usage: %s slot priv.pem\n", argv[0]);
+	uint8_t master[SLOTKEY_MASTER_LEN];
+	int use_master = 0;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	unsigned int dry_count = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:n:C:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (slotkey_read_master(optarg, master))
+				return -1;
+			use_master = 1;
+			break;
+		case 'n':
+			dry_count = strtoul(optarg, NULL, 0);
+			break;
+		case 'C':
+			if (plan_calibrate(optarg))
+				return -1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-m master] [-n count [-C times]] slot priv.pem\n", argv[0]);
+			return -1;
+		}
+	}
+
+	/* A dry run does not need the key */
+	if (argc - optind != 2 && !(dry_count && argc - optind == 1)) {
+		fprintf(stderr, "Usage: %s [-m master] [-n count [-C times]] slot priv.pem\n", argv[0]);
 		return -1;
 	}
 
-	priv_key_slot = atoi(argv[1]);
-	priv_key_file = argv[2];
+	priv_key_slot = atoi(argv[optind]);
+	priv_key_file = argv[optind + 1];
 
 	if (priv_key_slot > 15) {
 		fprintf(stderr, "Invalid slot: %d\n", priv_key_slot);
 		return -1;
 	}
 
+	if (dry_count) {
+		dry_run(priv_key_slot, dry_count);
+		return 0;
+	}
+
 	ret = read_EC_priv_from_pem(priv_key_file, priv);
 	if (ret)
 		return ret;
@@ -188,7 +248,11 @@ int main(int argc, char *argv[])
 
 	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
 
-	ret = atecc508a_read_config(&desc, config_buf);
+	config_offsets[0] = SLOT_CONFIG_OFFSET + 2 * priv_key_slot;
+	config_offsets[1] = KEY_CONFIG_OFFSET + 2 * priv_key_slot;
+
+	ret = configcache_read(&desc, config_buf, config_offsets,
+			      ARRAY_LEN(config_offsets));
 	if (ret != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not read device config\n");
 		goto out;
@@ -199,6 +263,28 @@ int main(int argc, char *argv[])
 	if (ret)
 		goto out;
 
+	/* With a master key, the parent key is derived from it and the
+	 * serial number, like s96util -m does on personalization. Only
+	 * slots 0 to 7 get a derived key.
+	 *
+	 * Otherwise, by convention, in our test configuration all bytes
+	 * of each symmetric keys are set to the slot number, ie for Slot 0
+	 * the key is all 0x00, for Slot 1 the key is all 0x11 etc.
+	 * Adjust this to your own setup.
+	 *
+	 * SN[0:3] is at bytes 0-3 of the config zone, SN[4:8] at 8-12.
+	 */
+	memcpy(sn, config_buf, 4);
+	memcpy(sn + 4, config_buf + 8, 5);
+	if (!use_master) {
+		memset(digest_in.data, parent_key_slot * 0x11, 32);
+	} else if (slotkey_derive_one(master, sn, parent_key_slot, digest_in.data)) {
+		fprintf(stderr, "Parent key slot %d has no key derived from the master key\n",
+			parent_key_slot);
+		ret = S96AT_STATUS_EXEC_ERROR;
+		goto out;
+	}
+
 	/* Before GenDig is executed, it is required that TempKey is
 	 * populated using the Nonce command. We'll run Nonce in passthrough
 	 * mode, and pass a series of pseudo-random bytes. Adjust this to
@@ -220,20 +306,14 @@ int main(int argc, char *argv[])
 	/* Now compute the value of TempKey as set by Nonce and GenDigest.
 	 * This will be our encryption key. The device will use it on its
 	 * end to decrypt the EC Private Key.
-	 *
-	 * By convention, in our test configuration all bytes of each
-	 * symmetric keys are set to the slot number, ie for Slot 0
-	 * the key is all 0x00, for Slot 1 the key is all 0x11 etc.
-	 * Adjust this to your own setup.
 	 */
-	memset(digest_in.data, parent_key_slot, 32);
 	digest_in.opcode = OPCODE_GENDIG;
 	digest_in.param1 = S96AT_ZONE_DATA;
 	digest_in.param2[0] = parent_key_slot;
 	digest_in.param2[1] = 0x00;
-	digest_in.sn_hi = 0xee;
-	digest_in.sn_lo[0] = 0x01;
-	digest_in.sn_lo[1] = 0x23;
+	digest_in.sn_hi = sn[8];
+	digest_in.sn_lo[0] = sn[0];
+	digest_in.sn_lo[1] = sn[1];
 	memset(digest_in.zero, 0, 25);
 	memcpy(digest_in.temp_key, num_in, 32);
 
@@ -259,9 +339,9 @@ int main(int argc, char *argv[])
 	mac_in.param1 = 1 << 6;
 	mac_in.param2[0] = priv_key_slot;
 	mac_in.param2[1] = 0;
-	mac_in.sn_hi = 0xee;
-	mac_in.sn_lo[0] = 0x01;
-	mac_in.sn_lo[1] = 0x23;
+	mac_in.sn_hi = sn[8];
+	mac_in.sn_lo[0] = sn[0];
+	mac_in.sn_lo[1] = sn[1];
 	memset(mac_in.zero, 0 , 21);
 	memcpy(mac_in.padded_key, padded_priv, 36);
 
@@ -275,9 +355,11 @@ int main(int argc, char *argv[])
 	}
 
 out:
-	ret = s96at_cleanup(&desc);
-	if (ret != S96AT_STATUS_OK)
+	memset(master, 0, sizeof(master));
+	if (s96at_cleanup(&desc) != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not cleanup\n");
+		ret = S96AT_STATUS_EXEC_ERROR;
+	}
 
 	return ret;
 }
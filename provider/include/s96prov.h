@@ -0,0 +1,93 @@
+#ifndef __S96PROV_H
+#define __S96PROV_H
+
+#include <openssl/core.h>
+#include <openssl/core_dispatch.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#include <plan.h>
+
+#define S96PROV_NAME		"Secure96 ATECC508A provider"
+#define S96PROV_PROPS		"provider=s96at"
+#define S96PROV_URI_SCHEME	"s96at"
+
+#define S96PROV_NUM_SLOTS	16
+#define S96PROV_KEY_SLOT_MIN	10	/* ECC keys live in slots 10..15 */
+
+#define S96PROV_GROUP_NAME	"prime256v1"
+#define S96PROV_BITS		256
+#define S96PROV_SECURITY_BITS	128
+#define S96PROV_SIG_MAX_LEN	72	/* DER encoded ECDSA P-256 signature */
+#define S96PROV_PUB_LEN		65	/* Uncompressed point */
+
+#define S96PROV_SLOT_NONE	0xff
+
+/* The watchdog puts the device to sleep after a wake, regardless of
+ * activity: 1.3 s typical, but as early as 0.7 s. A command is only
+ * started if it completes within the shortest watchdog in the worst case,
+ * see plan.h. Otherwise the device is cycled through idle first, so that
+ * the session survives between requests.
+ */
+#define S96PROV_WAKE_RETRIES		10
+
+#define SLOT_CONFIG_OFFSET	20
+#define KEY_CONFIG_OFFSET	96
+
+/* Decoded SlotConfig / KeyConfig of a slot */
+struct s96prov_slot {
+	int is_ecc;		/* KeyConfig.KeyType == P256 */
+	int is_private;		/* KeyConfig.Private */
+	int ecdh;		/* SlotConfig.ReadKey: ECDH permitted */
+	int ecdh_to_slot;	/* SlotConfig.ReadKey: ECDH secret written to slot N + 1 */
+	int pub_valid;		/* pub holds the cached public key */
+	struct s96at_ecc_pub pub;
+};
+
+struct s96prov_ctx {
+	const OSSL_CORE_HANDLE *handle;
+	OSSL_LIB_CTX *libctx;
+
+	/* Warm device session, shared by all keys. Commands are serialized
+	 * with lock.
+	 */
+	pthread_mutex_t lock;
+	struct s96at_desc desc;
+	int open;
+	uint64_t wake_ms;	/* Time of the last wake */
+
+	uint8_t config[S96AT_ATECC508A_ZONE_CONFIG_LEN];
+	struct s96prov_slot slots[S96PROV_NUM_SLOTS];
+};
+
+/* Key object. Device keys reference a private key slot; keys imported
+ * from other providers (such as ECDH peer keys) only carry a public key.
+ */
+struct s96prov_key {
+	struct s96prov_ctx *ctx;
+	int refcnt;
+	uint8_t slot;
+	int has_pub;
+	struct s96at_ecc_pub pub;
+};
+
+int s96prov_session_open(struct s96prov_ctx *ctx);
+void s96prov_session_close(struct s96prov_ctx *ctx);
+int s96prov_get_pub(struct s96prov_ctx *ctx, uint8_t slot, struct s96at_ecc_pub *pub);
+int s96prov_sign(struct s96prov_ctx *ctx, uint8_t slot, const uint8_t *digest,
+		 struct s96at_ecdsa_sig *sig);
+int s96prov_ecdh(struct s96prov_ctx *ctx, uint8_t slot, const struct s96at_ecc_pub *peer,
+		 uint8_t *secret);
+
+struct s96prov_key *s96prov_key_new(struct s96prov_ctx *ctx, uint8_t slot);
+struct s96prov_key *s96prov_key_ref(struct s96prov_key *key);
+void s96prov_key_free(struct s96prov_key *key);
+
+extern const OSSL_DISPATCH s96prov_keymgmt_functions[];
+extern const OSSL_DISPATCH s96prov_signature_functions[];
+extern const OSSL_DISPATCH s96prov_keyexch_functions[];
+extern const OSSL_DISPATCH s96prov_store_functions[];
+
+#endif
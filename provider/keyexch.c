@@ -0,0 +1,111 @@
+#include <openssl/core_names.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <s96prov.h>
+
+struct ecdh_ctx {
+	struct s96prov_ctx *provctx;
+	struct s96prov_key *key;
+	struct s96prov_key *peer;
+};
+
+static void *ecdh_newctx(void *provctx)
+{
+	struct ecdh_ctx *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx)
+		ctx->provctx = provctx;
+
+	return ctx;
+}
+
+static void ecdh_freectx(void *vctx)
+{
+	struct ecdh_ctx *ctx = vctx;
+
+	if (!ctx)
+		return;
+	s96prov_key_free(ctx->key);
+	s96prov_key_free(ctx->peer);
+	free(ctx);
+}
+
+static void *ecdh_dupctx(void *vctx)
+{
+	struct ecdh_ctx *ctx = vctx;
+	struct ecdh_ctx *dup;
+
+	dup = ecdh_newctx(ctx->provctx);
+	if (!dup)
+		return NULL;
+
+	if (ctx->key)
+		dup->key = s96prov_key_ref(ctx->key);
+	if (ctx->peer)
+		dup->peer = s96prov_key_ref(ctx->peer);
+
+	return dup;
+}
+
+static int ecdh_init(void *vctx, void *provkey, const OSSL_PARAM params[])
+{
+	struct ecdh_ctx *ctx = vctx;
+	struct s96prov_key *key = provkey;
+
+	if (!key || key->slot == S96PROV_SLOT_NONE)
+		return 0;
+
+	s96prov_key_free(ctx->key);
+	ctx->key = s96prov_key_ref(key);
+
+	return 1;
+}
+
+static int ecdh_set_peer(void *vctx, void *provkey)
+{
+	struct ecdh_ctx *ctx = vctx;
+	struct s96prov_key *peer = provkey;
+
+	if (!peer || !peer->has_pub)
+		return 0;
+
+	s96prov_key_free(ctx->peer);
+	ctx->peer = s96prov_key_ref(peer);
+
+	return 1;
+}
+
+/* The device returns the X coordinate of the shared point, which is the
+ * ECDH shared secret as defined by SEC 1.
+ */
+static int ecdh_derive(void *vctx, unsigned char *secret, size_t *secretlen,
+		       size_t outlen)
+{
+	struct ecdh_ctx *ctx = vctx;
+
+	if (!ctx->key || !ctx->peer)
+		return 0;
+
+	*secretlen = S96AT_ECDH_SECRET_LEN;
+	if (!secret)
+		return 1;
+
+	if (outlen < S96AT_ECDH_SECRET_LEN)
+		return 0;
+
+	return s96prov_ecdh(ctx->provctx, ctx->key->slot, &ctx->peer->pub, secret) == 0;
+}
+
+const OSSL_DISPATCH s96prov_keyexch_functions[] = {
+	{ OSSL_FUNC_KEYEXCH_NEWCTX, (void (*)(void))ecdh_newctx },
+	{ OSSL_FUNC_KEYEXCH_FREECTX, (void (*)(void))ecdh_freectx },
+	{ OSSL_FUNC_KEYEXCH_DUPCTX, (void (*)(void))ecdh_dupctx },
+	{ OSSL_FUNC_KEYEXCH_INIT, (void (*)(void))ecdh_init },
+	{ OSSL_FUNC_KEYEXCH_SET_PEER, (void (*)(void))ecdh_set_peer },
+	{ OSSL_FUNC_KEYEXCH_DERIVE, (void (*)(void))ecdh_derive },
+	{ 0, NULL }
+};
@@ -0,0 +1,289 @@
+#include <openssl/core_names.h>
+#include <openssl/obj_mac.h>
+#include <openssl/param_build.h>
+#include <openssl/params.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <s96prov.h>
+
+struct s96prov_key *s96prov_key_new(struct s96prov_ctx *ctx, uint8_t slot)
+{
+	struct s96prov_key *key;
+
+	key = calloc(1, sizeof(*key));
+	if (!key)
+		return NULL;
+
+	key->ctx = ctx;
+	key->refcnt = 1;
+	key->slot = slot;
+
+	if (slot != S96PROV_SLOT_NONE) {
+		if (s96prov_get_pub(ctx, slot, &key->pub)) {
+			free(key);
+			return NULL;
+		}
+		key->has_pub = 1;
+	}
+
+	return key;
+}
+
+struct s96prov_key *s96prov_key_ref(struct s96prov_key *key)
+{
+	__atomic_add_fetch(&key->refcnt, 1, __ATOMIC_RELAXED);
+	return key;
+}
+
+void s96prov_key_free(struct s96prov_key *key)
+{
+	if (!key)
+		return;
+	if (__atomic_sub_fetch(&key->refcnt, 1, __ATOMIC_ACQ_REL) == 0)
+		free(key);
+}
+
+static void encode_pub(const struct s96prov_key *key, uint8_t *buf)
+{
+	buf[0] = 0x04; /* Uncompressed point */
+	memcpy(buf + 1, key->pub.x, S96AT_ECC_PUB_X_LEN);
+	memcpy(buf + 1 + S96AT_ECC_PUB_X_LEN, key->pub.y, S96AT_ECC_PUB_Y_LEN);
+}
+
+static void *keymgmt_new(void *provctx)
+{
+	return s96prov_key_new(provctx, S96PROV_SLOT_NONE);
+}
+
+static void keymgmt_free(void *keydata)
+{
+	s96prov_key_free(keydata);
+}
+
+/* Keys are never loaded by value: the store hands out a reference to a
+ * key object, which is shared with the keymgmt.
+ */
+static void *keymgmt_load(const void *reference, size_t reference_sz)
+{
+	struct s96prov_key *key;
+
+	if (!reference || reference_sz != sizeof(key))
+		return NULL;
+
+	memcpy(&key, reference, sizeof(key));
+	return s96prov_key_ref(key);
+}
+
+static int keymgmt_has(const void *keydata, int selection)
+{
+	const struct s96prov_key *key = keydata;
+
+	if (!key)
+		return 0;
+	if ((selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY) &&
+	    key->slot == S96PROV_SLOT_NONE)
+		return 0;
+	if ((selection & OSSL_KEYMGMT_SELECT_PUBLIC_KEY) && !key->has_pub)
+		return 0;
+
+	return 1;
+}
+
+static int keymgmt_match(const void *keydata1, const void *keydata2, int selection)
+{
+	const struct s96prov_key *k1 = keydata1;
+	const struct s96prov_key *k2 = keydata2;
+
+	if (selection & OSSL_KEYMGMT_SELECT_KEYPAIR) {
+		if (!k1->has_pub || !k2->has_pub)
+			return 0;
+		return !memcmp(&k1->pub, &k2->pub, sizeof(k1->pub));
+	}
+
+	return 1;
+}
+
+static int keymgmt_get_params(void *keydata, OSSL_PARAM params[])
+{
+	struct s96prov_key *key = keydata;
+	uint8_t pub[S96PROV_PUB_LEN];
+	OSSL_PARAM *p;
+
+	p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_BITS);
+	if (p && !OSSL_PARAM_set_int(p, S96PROV_BITS))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_SECURITY_BITS);
+	if (p && !OSSL_PARAM_set_int(p, S96PROV_SECURITY_BITS))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_MAX_SIZE);
+	if (p && !OSSL_PARAM_set_int(p, S96PROV_SIG_MAX_LEN))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_GROUP_NAME);
+	if (p && !OSSL_PARAM_set_utf8_string(p, S96PROV_GROUP_NAME))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_DEFAULT_DIGEST);
+	if (p && !OSSL_PARAM_set_utf8_string(p, "SHA256"))
+		return 0;
+
+	if (key->has_pub) {
+		encode_pub(key, pub);
+
+		p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_PUB_KEY);
+		if (p && !OSSL_PARAM_set_octet_string(p, pub, sizeof(pub)))
+			return 0;
+
+		p = OSSL_PARAM_locate(params, OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY);
+		if (p && !OSSL_PARAM_set_octet_string(p, pub, sizeof(pub)))
+			return 0;
+	}
+
+	return 1;
+}
+
+static const OSSL_PARAM keymgmt_params[] = {
+	OSSL_PARAM_int(OSSL_PKEY_PARAM_BITS, NULL),
+	OSSL_PARAM_int(OSSL_PKEY_PARAM_SECURITY_BITS, NULL),
+	OSSL_PARAM_int(OSSL_PKEY_PARAM_MAX_SIZE, NULL),
+	OSSL_PARAM_utf8_string(OSSL_PKEY_PARAM_GROUP_NAME, NULL, 0),
+	OSSL_PARAM_utf8_string(OSSL_PKEY_PARAM_DEFAULT_DIGEST, NULL, 0),
+	OSSL_PARAM_octet_string(OSSL_PKEY_PARAM_PUB_KEY, NULL, 0),
+	OSSL_PARAM_octet_string(OSSL_PKEY_PARAM_ENCODED_PUBLIC_KEY, NULL, 0),
+	OSSL_PARAM_END
+};
+
+static const OSSL_PARAM *keymgmt_gettable_params(void *provctx)
+{
+	return keymgmt_params;
+}
+
+static const OSSL_PARAM keymgmt_pub_types[] = {
+	OSSL_PARAM_utf8_string(OSSL_PKEY_PARAM_GROUP_NAME, NULL, 0),
+	OSSL_PARAM_octet_string(OSSL_PKEY_PARAM_PUB_KEY, NULL, 0),
+	OSSL_PARAM_END
+};
+
+/* Only the public part of a key is imported, e.g. the peer key of an
+ * ECDH exchange. Private keys never enter the device this way: a private
+ * key in params is ignored.
+ */
+static int keymgmt_import(void *keydata, int selection, const OSSL_PARAM params[])
+{
+	struct s96prov_key *key = keydata;
+	const OSSL_PARAM *p;
+	const char *group;
+	const void *pub;
+	size_t pub_len;
+
+	p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_GROUP_NAME);
+	if (p) {
+		if (!OSSL_PARAM_get_utf8_string_ptr(p, &group))
+			return 0;
+		if (strcmp(group, S96PROV_GROUP_NAME) && strcmp(group, SN_X9_62_prime256v1) &&
+		    strcmp(group, "P-256"))
+			return 0;
+	}
+
+	if (!(selection & OSSL_KEYMGMT_SELECT_PUBLIC_KEY))
+		return 1;
+
+	p = OSSL_PARAM_locate_const(params, OSSL_PKEY_PARAM_PUB_KEY);
+	if (!p || !OSSL_PARAM_get_octet_string_ptr(p, &pub, &pub_len))
+		return 0;
+
+	if (pub_len != S96PROV_PUB_LEN || ((const uint8_t *)pub)[0] != 0x04)
+		return 0;
+
+	memcpy(key->pub.x, (const uint8_t *)pub + 1, S96AT_ECC_PUB_X_LEN);
+	memcpy(key->pub.y, (const uint8_t *)pub + 1 + S96AT_ECC_PUB_X_LEN,
+	       S96AT_ECC_PUB_Y_LEN);
+	key->has_pub = 1;
+
+	return 1;
+}
+
+static const OSSL_PARAM *keymgmt_import_types(int selection)
+{
+	return keymgmt_pub_types;
+}
+
+/* Export the public part, so that the key can be compared with the one
+ * in a certificate and used by other providers for verification.
+ */
+static int keymgmt_export(void *keydata, int selection, OSSL_CALLBACK *cb, void *cbarg)
+{
+	struct s96prov_key *key = keydata;
+	OSSL_PARAM_BLD *bld;
+	OSSL_PARAM *params;
+	uint8_t pub[S96PROV_PUB_LEN];
+	int ret = 0;
+
+	if (selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY)
+		return 0;
+
+	bld = OSSL_PARAM_BLD_new();
+	if (!bld)
+		return 0;
+
+	if (!OSSL_PARAM_BLD_push_utf8_string(bld, OSSL_PKEY_PARAM_GROUP_NAME,
+					     S96PROV_GROUP_NAME, 0))
+		goto out;
+
+	if ((selection & OSSL_KEYMGMT_SELECT_PUBLIC_KEY) && key->has_pub) {
+		encode_pub(key, pub);
+		if (!OSSL_PARAM_BLD_push_octet_string(bld, OSSL_PKEY_PARAM_PUB_KEY,
+						      pub, sizeof(pub)))
+			goto out;
+	}
+
+	params = OSSL_PARAM_BLD_to_param(bld);
+	if (!params)
+		goto out;
+
+	ret = cb(params, cbarg);
+	OSSL_PARAM_free(params);
+out:
+	OSSL_PARAM_BLD_free(bld);
+	return ret;
+}
+
+static const OSSL_PARAM *keymgmt_export_types(int selection)
+{
+	if (selection & OSSL_KEYMGMT_SELECT_PRIVATE_KEY)
+		return NULL;
+	return keymgmt_pub_types;
+}
+
+static const char *keymgmt_query_operation_name(int operation_id)
+{
+	switch (operation_id) {
+	case OSSL_OP_SIGNATURE:
+		return "ECDSA";
+	case OSSL_OP_KEYEXCH:
+		return "ECDH";
+	default:
+		return NULL;
+	}
+}
+
+const OSSL_DISPATCH s96prov_keymgmt_functions[] = {
+	{ OSSL_FUNC_KEYMGMT_NEW, (void (*)(void))keymgmt_new },
+	{ OSSL_FUNC_KEYMGMT_FREE, (void (*)(void))keymgmt_free },
+	{ OSSL_FUNC_KEYMGMT_LOAD, (void (*)(void))keymgmt_load },
+	{ OSSL_FUNC_KEYMGMT_HAS, (void (*)(void))keymgmt_has },
+	{ OSSL_FUNC_KEYMGMT_MATCH, (void (*)(void))keymgmt_match },
+	{ OSSL_FUNC_KEYMGMT_GET_PARAMS, (void (*)(void))keymgmt_get_params },
+	{ OSSL_FUNC_KEYMGMT_GETTABLE_PARAMS, (void (*)(void))keymgmt_gettable_params },
+	{ OSSL_FUNC_KEYMGMT_IMPORT, (void (*)(void))keymgmt_import },
+	{ OSSL_FUNC_KEYMGMT_IMPORT_TYPES, (void (*)(void))keymgmt_import_types },
+	{ OSSL_FUNC_KEYMGMT_EXPORT, (void (*)(void))keymgmt_export },
+	{ OSSL_FUNC_KEYMGMT_EXPORT_TYPES, (void (*)(void))keymgmt_export_types },
+	{ OSSL_FUNC_KEYMGMT_QUERY_OPERATION_NAME, (void (*)(void))keymgmt_query_operation_name },
+	{ 0, NULL }
+};
@@ -0,0 +1,136 @@
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/params.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <s96prov.h>
+
+static const OSSL_ALGORITHM keymgmt_algs[] = {
+	{ "EC:id-ecPublicKey", S96PROV_PROPS, s96prov_keymgmt_functions,
+	  "ATECC508A resident P-256 key" },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static const OSSL_ALGORITHM signature_algs[] = {
+	{ "ECDSA", S96PROV_PROPS, s96prov_signature_functions,
+	  "ATECC508A ECDSA P-256" },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static const OSSL_ALGORITHM keyexch_algs[] = {
+	{ "ECDH", S96PROV_PROPS, s96prov_keyexch_functions,
+	  "ATECC508A ECDH P-256" },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static const OSSL_ALGORITHM store_algs[] = {
+	{ S96PROV_URI_SCHEME, S96PROV_PROPS, s96prov_store_functions,
+	  "ATECC508A key slots" },
+	{ NULL, NULL, NULL, NULL }
+};
+
+static const OSSL_ALGORITHM *prov_query(void *provctx, int operation_id, int *no_cache)
+{
+	*no_cache = 0;
+
+	switch (operation_id) {
+	case OSSL_OP_KEYMGMT:
+		return keymgmt_algs;
+	case OSSL_OP_SIGNATURE:
+		return signature_algs;
+	case OSSL_OP_KEYEXCH:
+		return keyexch_algs;
+	case OSSL_OP_STORE:
+		return store_algs;
+	default:
+		return NULL;
+	}
+}
+
+static const OSSL_PARAM prov_param_types[] = {
+	OSSL_PARAM_DEFN(OSSL_PROV_PARAM_NAME, OSSL_PARAM_UTF8_PTR, NULL, 0),
+	OSSL_PARAM_DEFN(OSSL_PROV_PARAM_VERSION, OSSL_PARAM_UTF8_PTR, NULL, 0),
+	OSSL_PARAM_DEFN(OSSL_PROV_PARAM_BUILDINFO, OSSL_PARAM_UTF8_PTR, NULL, 0),
+	OSSL_PARAM_DEFN(OSSL_PROV_PARAM_STATUS, OSSL_PARAM_INTEGER, NULL, 0),
+	OSSL_PARAM_END
+};
+
+static const OSSL_PARAM *prov_gettable_params(void *provctx)
+{
+	return prov_param_types;
+}
+
+static int prov_get_params(void *provctx, OSSL_PARAM params[])
+{
+	OSSL_PARAM *p;
+
+	p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_NAME);
+	if (p && !OSSL_PARAM_set_utf8_ptr(p, S96PROV_NAME))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_VERSION);
+	if (p && !OSSL_PARAM_set_utf8_ptr(p, PROJECT_VERSION))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_BUILDINFO);
+	if (p && !OSSL_PARAM_set_utf8_ptr(p, "libs96at " S96AT_VERSION))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_PROV_PARAM_STATUS);
+	if (p && !OSSL_PARAM_set_int(p, 1))
+		return 0;
+
+	return 1;
+}
+
+static void prov_teardown(void *provctx)
+{
+	struct s96prov_ctx *ctx = provctx;
+
+	s96prov_session_close(ctx);
+	OSSL_LIB_CTX_free(ctx->libctx);
+	free(ctx);
+}
+
+static const OSSL_DISPATCH prov_functions[] = {
+	{ OSSL_FUNC_PROVIDER_TEARDOWN, (void (*)(void))prov_teardown },
+	{ OSSL_FUNC_PROVIDER_QUERY_OPERATION, (void (*)(void))prov_query },
+	{ OSSL_FUNC_PROVIDER_GETTABLE_PARAMS, (void (*)(void))prov_gettable_params },
+	{ OSSL_FUNC_PROVIDER_GET_PARAMS, (void (*)(void))prov_get_params },
+	{ 0, NULL }
+};
+
+int OSSL_provider_init(const OSSL_CORE_HANDLE *handle, const OSSL_DISPATCH *in,
+		       const OSSL_DISPATCH **out, void **provctx)
+{
+	struct s96prov_ctx *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return 0;
+
+	ctx->handle = handle;
+
+	/* Host-side hashing goes through a child library context, so that
+	 * it is served by the providers loaded by the application.
+	 */
+	ctx->libctx = OSSL_LIB_CTX_new_child(handle, in);
+	if (!ctx->libctx) {
+		free(ctx);
+		return 0;
+	}
+
+	if (s96prov_session_open(ctx)) {
+		OSSL_LIB_CTX_free(ctx->libctx);
+		free(ctx);
+		return 0;
+	}
+
+	*out = prov_functions;
+	*provctx = ctx;
+
+	return 1;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <s96prov.h>
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint8_t wake(struct s96prov_ctx *ctx)
+{
+	for (int i = 0; i < S96PROV_WAKE_RETRIES; i++) {
+		if (s96at_wake(&ctx->desc) == S96AT_STATUS_READY) {
+			ctx->wake_ms = now_ms();
+			return S96AT_STATUS_OK;
+		}
+	}
+	return S96AT_STATUS_EXEC_ERROR;
+}
+
+/* Make sure the device is awake, and stays so for exec_ms, the worst case
+ * execution time of the next commands. Called with the session lock held.
+ */
+static uint8_t session_ready(struct s96prov_ctx *ctx, uint64_t exec_ms)
+{
+	if (now_ms() - ctx->wake_ms + exec_ms + PLAN_MARGIN_MS <= PLAN_WATCHDOG_MS)
+		return S96AT_STATUS_OK;
+
+	s96at_idle(&ctx->desc);
+	return wake(ctx);
+}
+
+static void decode_config(struct s96prov_ctx *ctx)
+{
+	for (int i = 0; i < S96PROV_NUM_SLOTS; i++) {
+		uint8_t *slot_config = ctx->config + SLOT_CONFIG_OFFSET + 2 * i;
+		uint8_t *key_config = ctx->config + KEY_CONFIG_OFFSET + 2 * i;
+		struct s96prov_slot *s = &ctx->slots[i];
+
+		memset(s, 0, sizeof(*s));
+		s->is_ecc = ((key_config[0] >> 2) & 0x07) == 0x04;
+		s->is_private = key_config[0] & 0x01;
+		if (s->is_ecc && s->is_private) {
+			s->ecdh = slot_config[0] & 0x04;
+			s->ecdh_to_slot = slot_config[0] & 0x08;
+		}
+	}
+}
+
+/* Open the device once and keep the session warm for the lifetime of the
+ * provider. The config zone is read and decoded here, so that requests
+ * never have to go back to it.
+ */
+int s96prov_session_open(struct s96prov_ctx *ctx)
+{
+	uint8_t ret;
+
+	if (pthread_mutex_init(&ctx->lock, NULL))
+		return -1;
+
+	ret = s96at_init(S96AT_ATECC508A, S96AT_IO_I2C_LINUX, &ctx->desc);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "s96prov: Could not initialize descriptor\n");
+		goto err;
+	}
+	ctx->open = 1;
+
+	ret = wake(ctx);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "s96prov: Could not wake device\n");
+		goto err;
+	}
+
+	for (int i = 0; i < S96AT_ATECC508A_ZONE_CONFIG_NUM_BLOCKS; i++) {
+		ret = s96at_read_config(&ctx->desc, i, ctx->config + i * S96AT_BLOCK_SIZE);
+		if (ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "s96prov: Failed to read config block %u\n", i);
+			goto err;
+		}
+	}
+	decode_config(ctx);
+
+	return 0;
+err:
+	s96prov_session_close(ctx);
+	return -1;
+}
+
+void s96prov_session_close(struct s96prov_ctx *ctx)
+{
+	if (ctx->open) {
+		s96at_sleep(&ctx->desc);
+		s96at_cleanup(&ctx->desc);
+		ctx->open = 0;
+	}
+	pthread_mutex_destroy(&ctx->lock);
+}
+
+/* The public key of a private key slot is computed by the device with
+ * GenKey in public mode. This is slow, so it is only done once per slot.
+ */
+int s96prov_get_pub(struct s96prov_ctx *ctx, uint8_t slot, struct s96at_ecc_pub *pub)
+{
+	uint8_t ret = S96AT_STATUS_OK;
+	struct s96prov_slot *s;
+
+	if (slot >= S96PROV_NUM_SLOTS)
+		return -1;
+
+	s = &ctx->slots[slot];
+	if (!s->is_ecc || !s->is_private)
+		return -1;
+
+	pthread_mutex_lock(&ctx->lock);
+	if (!s->pub_valid) {
+		ret = session_ready(ctx, PLAN_EXEC_GENKEY_MS);
+		if (ret == S96AT_STATUS_OK)
+			ret = s96at_gen_key(&ctx->desc, S96AT_GENKEY_MODE_PUBLIC, slot, &s->pub);
+		if (ret == S96AT_STATUS_OK)
+			s->pub_valid = 1;
+		else
+			fprintf(stderr, "s96prov: GenKey failed on slot %u\n", slot);
+	}
+	if (ret == S96AT_STATUS_OK)
+		memcpy(pub, &s->pub, sizeof(*pub));
+	pthread_mutex_unlock(&ctx->lock);
+
+	return ret == S96AT_STATUS_OK ? 0 : -1;
+}
+
+int s96prov_sign(struct s96prov_ctx *ctx, uint8_t slot, const uint8_t *digest,
+		 struct s96at_ecdsa_sig *sig)
+{
+	uint8_t ret;
+	uint8_t num_in[S96AT_RANDOM_LEN];
+
+	if (slot >= S96PROV_NUM_SLOTS || !ctx->slots[slot].is_private)
+		return -1;
+
+	memcpy(num_in, digest, S96AT_RANDOM_LEN);
+
+	pthread_mutex_lock(&ctx->lock);
+	ret = session_ready(ctx, PLAN_EXEC_NONCE_MS + PLAN_EXEC_SIGN_MS);
+	if (ret != S96AT_STATUS_OK)
+		goto out;
+
+	ret = s96at_gen_nonce(&ctx->desc, S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "s96prov: Nonce failed\n");
+		goto out;
+	}
+
+	ret = s96at_sign(&ctx->desc, S96AT_SIGN_MODE_EXTERNAL, slot, S96AT_FLAG_NONE, sig);
+	if (ret != S96AT_STATUS_OK)
+		fprintf(stderr, "s96prov: Sign failed\n");
+out:
+	pthread_mutex_unlock(&ctx->lock);
+	return ret == S96AT_STATUS_OK ? 0 : -1;
+}
+
+int s96prov_ecdh(struct s96prov_ctx *ctx, uint8_t slot, const struct s96at_ecc_pub *peer,
+		 uint8_t *secret)
+{
+	uint8_t ret;
+	struct s96at_ecc_pub pub;
+
+	if (slot >= S96PROV_NUM_SLOTS || !ctx->slots[slot].ecdh)
+		return -1;
+
+	/* With ReadKey bit 3 set, the device writes the secret to slot N + 1
+	 * instead of returning it; this provider only supports output in the
+	 * clear.
+	 */
+	if (ctx->slots[slot].ecdh_to_slot)
+		return -1;
+
+	memcpy(&pub, peer, sizeof(pub));
+
+	pthread_mutex_lock(&ctx->lock);
+	ret = session_ready(ctx, PLAN_EXEC_ECDH_MS);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_gen_ecdh(&ctx->desc, slot, &pub, secret);
+	if (ret != S96AT_STATUS_OK)
+		fprintf(stderr, "s96prov: ECDH failed\n");
+	pthread_mutex_unlock(&ctx->lock);
+
+	return ret == S96AT_STATUS_OK ? 0 : -1;
+}
@@ -0,0 +1,261 @@
+#include <openssl/core_names.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/params.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <s96prov.h>
+
+/* DER encoded AlgorithmIdentifier of ecdsa-with-SHA256 */
+static const uint8_t ecdsa_sha256_algid[] = {
+	0x30, 0x0a, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x04, 0x03, 0x02
+};
+
+struct sig_ctx {
+	struct s96prov_ctx *provctx;
+	struct s96prov_key *key;
+	EVP_MD_CTX *mdctx;	/* Set for digest-sign operations */
+};
+
+static int is_sha256(const char *mdname)
+{
+	return !strcasecmp(mdname, "SHA256") || !strcasecmp(mdname, "SHA2-256") ||
+	       !strcasecmp(mdname, "SHA-256");
+}
+
+static void *sig_newctx(void *provctx, const char *propq)
+{
+	struct sig_ctx *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx)
+		ctx->provctx = provctx;
+
+	return ctx;
+}
+
+static void sig_freectx(void *vctx)
+{
+	struct sig_ctx *ctx = vctx;
+
+	if (!ctx)
+		return;
+	EVP_MD_CTX_free(ctx->mdctx);
+	s96prov_key_free(ctx->key);
+	free(ctx);
+}
+
+static void *sig_dupctx(void *vctx)
+{
+	struct sig_ctx *ctx = vctx;
+	struct sig_ctx *dup;
+
+	dup = sig_newctx(ctx->provctx, NULL);
+	if (!dup)
+		return NULL;
+
+	if (ctx->key)
+		dup->key = s96prov_key_ref(ctx->key);
+
+	if (ctx->mdctx) {
+		dup->mdctx = EVP_MD_CTX_new();
+		if (!dup->mdctx || !EVP_MD_CTX_copy_ex(dup->mdctx, ctx->mdctx)) {
+			sig_freectx(dup);
+			return NULL;
+		}
+	}
+
+	return dup;
+}
+
+static int sig_sign_init(void *vctx, void *provkey, const OSSL_PARAM params[])
+{
+	struct sig_ctx *ctx = vctx;
+	struct s96prov_key *key = provkey;
+
+	if (!key || key->slot == S96PROV_SLOT_NONE)
+		return 0;
+
+	s96prov_key_free(ctx->key);
+	ctx->key = s96prov_key_ref(key);
+
+	return 1;
+}
+
+/* The device signs a SHA-256 digest: tbs must be exactly 32 bytes. The
+ * raw r || s from the device is returned DER encoded, as expected by
+ * OpenSSL.
+ */
+static int sig_sign(void *vctx, unsigned char *sig, size_t *siglen, size_t sigsize,
+		    const unsigned char *tbs, size_t tbslen)
+{
+	struct sig_ctx *ctx = vctx;
+	struct s96at_ecdsa_sig raw;
+	ECDSA_SIG *esig;
+	BIGNUM *r, *s;
+	unsigned char *p = sig;
+	int len;
+
+	if (!sig) {
+		*siglen = S96PROV_SIG_MAX_LEN;
+		return 1;
+	}
+
+	if (tbslen != S96AT_SHA_LEN || sigsize < S96PROV_SIG_MAX_LEN)
+		return 0;
+
+	if (s96prov_sign(ctx->provctx, ctx->key->slot, tbs, &raw))
+		return 0;
+
+	esig = ECDSA_SIG_new();
+	r = BN_bin2bn(raw.r, S96AT_ECDSA_R_LEN, NULL);
+	s = BN_bin2bn(raw.s, S96AT_ECDSA_S_LEN, NULL);
+	if (!esig || !r || !s || !ECDSA_SIG_set0(esig, r, s)) {
+		BN_free(r);
+		BN_free(s);
+		ECDSA_SIG_free(esig);
+		return 0;
+	}
+
+	len = i2d_ECDSA_SIG(esig, &p);
+	ECDSA_SIG_free(esig);
+	if (len <= 0)
+		return 0;
+
+	*siglen = len;
+	return 1;
+}
+
+/* Hashing is done on the host: only the final digest goes to the device */
+static int sig_digest_sign_init(void *vctx, const char *mdname, void *provkey,
+				const OSSL_PARAM params[])
+{
+	struct sig_ctx *ctx = vctx;
+	EVP_MD *md;
+	int ret;
+
+	if (mdname && *mdname && !is_sha256(mdname))
+		return 0;
+
+	if (!sig_sign_init(vctx, provkey, params))
+		return 0;
+
+	if (!ctx->mdctx)
+		ctx->mdctx = EVP_MD_CTX_new();
+	if (!ctx->mdctx)
+		return 0;
+
+	md = EVP_MD_fetch(ctx->provctx->libctx, "SHA2-256", "-provider=s96at");
+	if (!md)
+		return 0;
+
+	ret = EVP_DigestInit_ex2(ctx->mdctx, md, NULL);
+	EVP_MD_free(md);
+
+	return ret;
+}
+
+static int sig_digest_sign_update(void *vctx, const unsigned char *data, size_t datalen)
+{
+	struct sig_ctx *ctx = vctx;
+
+	if (!ctx->mdctx)
+		return 0;
+
+	return EVP_DigestUpdate(ctx->mdctx, data, datalen);
+}
+
+static int sig_digest_sign_final(void *vctx, unsigned char *sig, size_t *siglen,
+				 size_t sigsize)
+{
+	struct sig_ctx *ctx = vctx;
+	unsigned char digest[S96AT_SHA_LEN];
+	unsigned int digest_len;
+
+	if (!ctx->mdctx)
+		return 0;
+
+	if (!sig)
+		return sig_sign(vctx, NULL, siglen, sigsize, NULL, 0);
+
+	if (!EVP_DigestFinal_ex(ctx->mdctx, digest, &digest_len))
+		return 0;
+
+	return sig_sign(vctx, sig, siglen, sigsize, digest, digest_len);
+}
+
+static int sig_get_ctx_params(void *vctx, OSSL_PARAM params[])
+{
+	OSSL_PARAM *p;
+
+	p = OSSL_PARAM_locate(params, OSSL_SIGNATURE_PARAM_ALGORITHM_ID);
+	if (p && !OSSL_PARAM_set_octet_string(p, ecdsa_sha256_algid,
+					      sizeof(ecdsa_sha256_algid)))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_SIGNATURE_PARAM_DIGEST);
+	if (p && !OSSL_PARAM_set_utf8_string(p, "SHA256"))
+		return 0;
+
+	p = OSSL_PARAM_locate(params, OSSL_SIGNATURE_PARAM_DIGEST_SIZE);
+	if (p && !OSSL_PARAM_set_size_t(p, S96AT_SHA_LEN))
+		return 0;
+
+	return 1;
+}
+
+static const OSSL_PARAM sig_gettable[] = {
+	OSSL_PARAM_octet_string(OSSL_SIGNATURE_PARAM_ALGORITHM_ID, NULL, 0),
+	OSSL_PARAM_utf8_string(OSSL_SIGNATURE_PARAM_DIGEST, NULL, 0),
+	OSSL_PARAM_size_t(OSSL_SIGNATURE_PARAM_DIGEST_SIZE, NULL),
+	OSSL_PARAM_END
+};
+
+static const OSSL_PARAM *sig_gettable_ctx_params(void *vctx, void *provctx)
+{
+	return sig_gettable;
+}
+
+/* Only SHA-256 can be requested; this is what the device signs */
+static int sig_set_ctx_params(void *vctx, const OSSL_PARAM params[])
+{
+	const OSSL_PARAM *p;
+	const char *mdname;
+
+	p = OSSL_PARAM_locate_const(params, OSSL_SIGNATURE_PARAM_DIGEST);
+	if (p) {
+		if (!OSSL_PARAM_get_utf8_string_ptr(p, &mdname) || !is_sha256(mdname))
+			return 0;
+	}
+
+	return 1;
+}
+
+static const OSSL_PARAM sig_settable[] = {
+	OSSL_PARAM_utf8_string(OSSL_SIGNATURE_PARAM_DIGEST, NULL, 0),
+	OSSL_PARAM_END
+};
+
+static const OSSL_PARAM *sig_settable_ctx_params(void *vctx, void *provctx)
+{
+	return sig_settable;
+}
+
+const OSSL_DISPATCH s96prov_signature_functions[] = {
+	{ OSSL_FUNC_SIGNATURE_NEWCTX, (void (*)(void))sig_newctx },
+	{ OSSL_FUNC_SIGNATURE_FREECTX, (void (*)(void))sig_freectx },
+	{ OSSL_FUNC_SIGNATURE_DUPCTX, (void (*)(void))sig_dupctx },
+	{ OSSL_FUNC_SIGNATURE_SIGN_INIT, (void (*)(void))sig_sign_init },
+	{ OSSL_FUNC_SIGNATURE_SIGN, (void (*)(void))sig_sign },
+	{ OSSL_FUNC_SIGNATURE_DIGEST_SIGN_INIT, (void (*)(void))sig_digest_sign_init },
+	{ OSSL_FUNC_SIGNATURE_DIGEST_SIGN_UPDATE, (void (*)(void))sig_digest_sign_update },
+	{ OSSL_FUNC_SIGNATURE_DIGEST_SIGN_FINAL, (void (*)(void))sig_digest_sign_final },
+	{ OSSL_FUNC_SIGNATURE_GET_CTX_PARAMS, (void (*)(void))sig_get_ctx_params },
+	{ OSSL_FUNC_SIGNATURE_GETTABLE_CTX_PARAMS, (void (*)(void))sig_gettable_ctx_params },
+	{ OSSL_FUNC_SIGNATURE_SET_CTX_PARAMS, (void (*)(void))sig_set_ctx_params },
+	{ OSSL_FUNC_SIGNATURE_SETTABLE_CTX_PARAMS, (void (*)(void))sig_settable_ctx_params },
+	{ 0, NULL }
+};
@@ -0,0 +1,107 @@
+#include <openssl/core_names.h>
+#include <openssl/core_object.h>
+#include <openssl/params.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <s96prov.h>
+
+struct store_ctx {
+	struct s96prov_ctx *provctx;
+	struct s96prov_key *key;
+	int loaded;
+};
+
+/* Keys are addressed as "s96at:<slot>", e.g. "s96at:11" */
+static void *store_open(void *provctx, const char *uri)
+{
+	struct s96prov_ctx *ctx = provctx;
+	struct store_ctx *sctx;
+	const char *p;
+	char *end;
+	long slot;
+
+	if (strncmp(uri, S96PROV_URI_SCHEME ":", strlen(S96PROV_URI_SCHEME) + 1))
+		return NULL;
+
+	p = uri + strlen(S96PROV_URI_SCHEME) + 1;
+	if (!strncmp(p, "slot=", 5))
+		p += 5;
+
+	slot = strtol(p, &end, 10);
+	if (end == p || *end || slot < S96PROV_KEY_SLOT_MIN || slot >= S96PROV_NUM_SLOTS) {
+		fprintf(stderr, "s96prov: Invalid key URI %s\n", uri);
+		return NULL;
+	}
+
+	if (!ctx->slots[slot].is_ecc || !ctx->slots[slot].is_private) {
+		fprintf(stderr, "s96prov: Slot %ld is not an ECC private key\n", slot);
+		return NULL;
+	}
+
+	sctx = calloc(1, sizeof(*sctx));
+	if (!sctx)
+		return NULL;
+
+	sctx->provctx = ctx;
+	sctx->key = s96prov_key_new(ctx, slot);
+	if (!sctx->key) {
+		free(sctx);
+		return NULL;
+	}
+
+	return sctx;
+}
+
+static int store_load(void *loaderctx, OSSL_CALLBACK *object_cb, void *object_cbarg,
+		      OSSL_PASSPHRASE_CALLBACK *pw_cb, void *pw_cbarg)
+{
+	struct store_ctx *sctx = loaderctx;
+	OSSL_PARAM params[4];
+	int type = OSSL_OBJECT_PKEY;
+
+	if (sctx->loaded)
+		return 0;
+	sctx->loaded = 1;
+
+	params[0] = OSSL_PARAM_construct_int(OSSL_OBJECT_PARAM_TYPE, &type);
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_OBJECT_PARAM_DATA_TYPE, "EC", 0);
+	params[2] = OSSL_PARAM_construct_octet_string(OSSL_OBJECT_PARAM_REFERENCE,
+						      &sctx->key, sizeof(sctx->key));
+	params[3] = OSSL_PARAM_construct_end();
+
+	return object_cb(params, object_cbarg);
+}
+
+static int store_eof(void *loaderctx)
+{
+	struct store_ctx *sctx = loaderctx;
+
+	return sctx->loaded;
+}
+
+static int store_close(void *loaderctx)
+{
+	struct store_ctx *sctx = loaderctx;
+
+	s96prov_key_free(sctx->key);
+	free(sctx);
+
+	return 1;
+}
+
+static int store_set_ctx_params(void *loaderctx, const OSSL_PARAM params[])
+{
+	return 1;
+}
+
+const OSSL_DISPATCH s96prov_store_functions[] = {
+	{ OSSL_FUNC_STORE_OPEN, (void (*)(void))store_open },
+	{ OSSL_FUNC_STORE_LOAD, (void (*)(void))store_load },
+	{ OSSL_FUNC_STORE_EOF, (void (*)(void))store_eof },
+	{ OSSL_FUNC_STORE_CLOSE, (void (*)(void))store_close },
+	{ OSSL_FUNC_STORE_SET_CTX_PARAMS, (void (*)(void))store_set_ctx_params },
+	{ 0, NULL }
+};
@@ -0,0 +1,302 @@
+#ifndef __S96CORO_HPP
+#define __S96CORO_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <secure96/s96at.h>
+}
+
+namespace s96 {
+
+using clock = std::chrono::steady_clock;
+
+/* A lazily started coroutine returning a value of type T. The coroutine
+ * starts when awaited, and resumes the awaiting coroutine when it returns.
+ */
+template <typename T>
+class task {
+public:
+	struct promise_type {
+		T value{};
+		std::coroutine_handle<> cont;
+
+		struct final_awaiter {
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+			{
+				return h.promise().cont;
+			}
+			void await_resume() noexcept {}
+		};
+
+		task get_return_object()
+		{
+			return task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		final_awaiter final_suspend() noexcept { return {}; }
+		void return_value(T v) { value = std::move(v); }
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	task(task &&other) noexcept : h(std::exchange(other.h, nullptr)) {}
+	task(const task &) = delete;
+	task &operator=(const task &) = delete;
+	~task()
+	{
+		if (h)
+			h.destroy();
+	}
+
+	bool await_ready() const noexcept { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept
+	{
+		h.promise().cont = cont;
+		return h;
+	}
+	T await_resume() { return std::move(h.promise().value); }
+
+private:
+	explicit task(std::coroutine_handle<promise_type> h) : h(h) {}
+
+	std::coroutine_handle<promise_type> h;
+};
+
+/* Runs coroutines on the thread calling run(). Coroutines are resumed
+ * when a device command completes, or when a timer expires, so a single
+ * thread interleaves the command sequences of any number of devices.
+ */
+class executor {
+public:
+	/* Start t on the executor. Its result is stored in *ret, if given */
+	void spawn(task<uint8_t> t, uint8_t *ret = nullptr);
+
+	/* Run until all spawned tasks have returned */
+	void run();
+
+	/* Resume h on the executor. May be called from any thread */
+	void post(std::coroutine_handle<> h);
+
+	/* Resume h on the executor at time t */
+	void post_at(clock::time_point t, std::coroutine_handle<> h);
+
+	struct sleep_awaiter {
+		executor &ex;
+		clock::time_point when;
+
+		bool await_ready() const noexcept { return clock::now() >= when; }
+		void await_suspend(std::coroutine_handle<> h) { ex.post_at(when, h); }
+		void await_resume() const noexcept {}
+	};
+
+	sleep_awaiter sleep_for(clock::duration d) { return {*this, clock::now() + d}; }
+
+private:
+	struct timer {
+		clock::time_point when;
+		std::coroutine_handle<> h;
+
+		bool operator>(const timer &other) const { return when > other.when; }
+	};
+
+	void task_done();
+
+	std::mutex lock;
+	std::condition_variable cond;
+	std::deque<std::coroutine_handle<>> ready;
+	std::priority_queue<timer, std::vector<timer>, std::greater<timer>> timers;
+	int pending = 0;
+};
+
+/* SlotConfig of a slot (Sect 2.2.1) */
+struct slot_config {
+	uint16_t raw;
+
+	uint8_t read_key() const { return raw & 0x0f; }
+	bool encrypt_read() const { return raw & 0x0040; }
+	bool is_secret() const { return raw & 0x0080; }
+	uint8_t write_key() const { return (raw >> 8) & 0x0f; }
+	uint8_t write_config() const { return raw >> 12; }
+	bool priv_write() const { return raw & 0x4000; }
+};
+
+/* KeyConfig of a slot (Sect 2.2.5) */
+struct key_config {
+	uint16_t raw;
+
+	bool priv() const { return raw & 0x0001; }
+	bool pub_info() const { return raw & 0x0002; }
+	uint8_t key_type() const { return (raw >> 2) & 0x07; }
+	bool req_random() const { return raw & 0x0040; }
+	bool req_auth() const { return raw & 0x0080; }
+	uint8_t auth_key() const { return (raw >> 8) & 0x0f; }
+};
+
+/* The ATECC508A config zone, or the blocks of it that were read */
+class config {
+public:
+	static constexpr size_t slot_config_offset = 20;
+	static constexpr size_t key_config_offset = 96;
+
+	/* SN[0:3] is at bytes 0-3, SN[4:8] at bytes 8-12 */
+	void serial(uint8_t *sn) const;
+
+	slot_config slot(uint8_t n) const { return {le16(slot_config_offset + 2 * n)}; }
+	key_config key(uint8_t n) const { return {le16(key_config_offset + 2 * n)}; }
+	const uint8_t *raw(size_t offset) const { return buf + offset; }
+
+	/* Block mask covering the SlotConfig and KeyConfig of slot n */
+	static uint8_t blocks_for_slot(uint8_t n)
+	{
+		return 1 << ((slot_config_offset + 2 * n) / S96AT_BLOCK_SIZE) |
+		       1 << ((key_config_offset + 2 * n) / S96AT_BLOCK_SIZE);
+	}
+
+	uint8_t buf[S96AT_ATECC508A_ZONE_CONFIG_LEN] = {};
+
+private:
+	uint16_t le16(size_t offset) const { return buf[offset] | buf[offset + 1] << 8; }
+};
+
+class device;
+
+/* Awaiting a command runs it on the I/O thread of the device. The
+ * awaiting coroutine is resumed on the executor with the status.
+ */
+class command {
+public:
+	using fn_type = std::function<uint8_t(struct s96at_desc *)>;
+
+	command(device &dev, fn_type fn) : dev(dev), fn(std::move(fn)) {}
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h);
+	uint8_t await_resume() const noexcept { return ret; }
+
+private:
+	device &dev;
+	fn_type fn;
+	uint8_t ret = S96AT_STATUS_EXEC_ERROR;
+};
+
+/* The device is woken up when the session is opened, and put to idle
+ * when it is destroyed. The idle command is queued after the commands
+ * of the session.
+ */
+class session {
+public:
+	session() = default;
+	explicit session(device *dev) : dev(dev) {}
+	session(session &&other) noexcept : dev(std::exchange(other.dev, nullptr)) {}
+	session &operator=(session &&other) noexcept;
+	session(const session &) = delete;
+	session &operator=(const session &) = delete;
+	~session() { close(); }
+
+	void close();
+
+private:
+	device *dev = nullptr;
+};
+
+/* A descriptor, initialized on construction and cleaned up on
+ * destruction. libs96at commands block for the execution time of the
+ * command, so each device has an I/O thread running its commands in
+ * order, leaving the executor free to run other coroutines.
+ */
+class device {
+public:
+	device(executor &ex, enum s96at_device type = S96AT_ATECC508A);
+	device(const device &) = delete;
+	device &operator=(const device &) = delete;
+	~device();
+
+	/* Status of s96at_init() */
+	uint8_t status() const { return init_status; }
+
+	/* Wake the device up, retrying every wake_retry until it is ready */
+	task<session> wake();
+
+	/* Read block 0 and the config blocks set in mask into cfg */
+	task<uint8_t> read_config(config &cfg, uint8_t mask);
+
+	command run(command::fn_type fn) { return command(*this, std::move(fn)); }
+
+	command gen_nonce(enum s96at_nonce_mode mode, uint8_t *data, uint8_t *rand_out)
+	{
+		return run([=](struct s96at_desc *d) { return s96at_gen_nonce(d, mode, data, rand_out); });
+	}
+
+	command gen_digest(enum s96at_zone zone, uint8_t slot, uint8_t *data)
+	{
+		return run([=](struct s96at_desc *d) { return s96at_gen_digest(d, zone, slot, data); });
+	}
+
+	command gen_key(enum s96at_genkey_mode mode, uint8_t slot, struct s96at_ecc_pub *pub)
+	{
+		return run([=](struct s96at_desc *d) { return s96at_gen_key(d, mode, slot, pub); });
+	}
+
+	command sign(enum s96at_sign_mode mode, uint8_t slot, uint32_t flags,
+		     struct s96at_ecdsa_sig *sig)
+	{
+		return run([=](struct s96at_desc *d) { return s96at_sign(d, mode, slot, flags, sig); });
+	}
+
+	command get_state(uint8_t *state)
+	{
+		return run([=](struct s96at_desc *d) { return s96at_get_state(d, state); });
+	}
+
+	command verify_key(enum s96at_verify_key_mode mode, struct s96at_ecdsa_sig *sig,
+			   uint8_t slot, uint8_t *data)
+	{
+		return run([=](struct s96at_desc *d) { return s96at_verify_key(d, mode, sig, slot, data); });
+	}
+
+	command write_priv(uint8_t slot, const uint8_t *priv, const uint8_t *mac)
+	{
+		return run([=](struct s96at_desc *d) { return s96at_write_priv(d, slot, priv, mac); });
+	}
+
+	static constexpr clock::duration wake_retry = std::chrono::milliseconds(1);
+
+private:
+	friend class command;
+	friend class session;
+
+	struct job {
+		command::fn_type fn;
+		std::coroutine_handle<> h;	/* None for fire and forget */
+		uint8_t *ret;
+	};
+
+	void submit(job j);
+	void io_thread();
+
+	executor &ex;
+	struct s96at_desc desc;
+	uint8_t init_status;
+
+	std::mutex lock;
+	std::condition_variable cond;
+	std::deque<job> jobs;
+	bool stop = false;
+	std::thread thread;
+};
+
+} /* namespace s96 */
+
+#endif
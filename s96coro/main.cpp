@@ -0,0 +1,488 @@
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/sha.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#include <s96coro.hpp>
+
+#define OPCODE_GENDIG		0x15
+#define OPCODE_PRIVWRITE	0x46
+
+/* Sect 9.20 */
+struct __attribute__((__packed__)) verify_msg {
+	uint8_t mode;
+	uint8_t key_id[2];	/* ParentPriv slot */
+	uint8_t slot_config[2];	/* SlotConfig[Pub] */
+	uint8_t key_config[2];	/* KeyConfig[Pub] */
+	uint8_t temp_key_flags;
+	uint8_t zeros[2];
+	uint8_t sn4[4];		/* SN[4:7] or zero */
+	uint8_t sn2[2];		/* SN[2:3] or zero */
+	uint8_t slot_locked;	/* Config.SlotLocked[Pub] */
+	uint8_t pub_key_valid;	/* 0 if pub key is currenlty invalid, 1 if currently valid */
+	uint8_t zero;
+};
+
+/* Sect 9.6 */
+struct __attribute__((__packed__)) gendig_in {
+	uint8_t data[32];
+	uint8_t opcode;
+	uint8_t param1;
+	uint8_t param2[2];
+	uint8_t sn_hi;
+	uint8_t sn_lo[2];
+	uint8_t zero[25];
+	uint8_t temp_key[32];
+};
+
+/* Sect 9.14 */
+struct __attribute__((__packed__)) auth_mac_in {
+	uint8_t temp_key[32];
+	uint8_t opcode;
+	uint8_t param1;
+	uint8_t param2[2];
+	uint8_t sn_hi;
+	uint8_t sn_lo[2];
+	uint8_t zero[21];
+	uint8_t padded_key[36];
+};
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s verify [validate|invalidate] <slot_pub> <slot_parent_priv>\n", progname);
+	fprintf(stderr, "       %s privwrite <slot> <priv.pem>\n", progname);
+	fprintf(stderr, "       %s bench <count> <slot_pub> <slot_parent_priv>\n", progname);
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void notrandom(uint8_t *buf, size_t count)
+{
+	static std::mt19937 gen(time(NULL));
+
+	for (size_t i = 0; i < count; i++)
+		buf[i] = gen() % 0x100;
+}
+
+/* The verify example, as a coroutine */
+static s96::task<uint8_t> verify(s96::device &dev, bool invalidate, uint8_t slot_pub,
+				 uint8_t slot_parent_priv)
+{
+	uint8_t ret;
+	uint8_t state[2];
+	uint8_t num_in[S96AT_RANDOM_LEN];
+	uint32_t sign_flags = invalidate ? S96AT_FLAG_INVALIDATE : S96AT_FLAG_NONE;
+	struct s96at_ecdsa_sig sig;
+	struct verify_msg message;
+	s96::config cfg;
+
+	s96::session session = co_await dev.wake();
+
+	ret = co_await dev.read_config(cfg, s96::config::blocks_for_slot(slot_pub) |
+				       s96::config::blocks_for_slot(slot_parent_priv));
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read device config\n");
+		co_return ret;
+	}
+
+	if (cfg.key(slot_pub).priv()) {
+		fprintf(stderr, "Not a public key\n");
+		co_return S96AT_STATUS_BAD_PARAMETERS;
+	}
+
+	if (!cfg.key(slot_parent_priv).priv()) {
+		fprintf(stderr, "Not a private key\n");
+		co_return S96AT_STATUS_BAD_PARAMETERS;
+	}
+
+	/* ---- SIGN SIDE ---- */
+	notrandom(num_in, sizeof(num_in));
+
+	ret = co_await dev.gen_nonce(S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Nonce failed\n");
+		co_return ret;
+	}
+
+	ret = co_await dev.gen_key(S96AT_GENKEY_MODE_DIGEST, slot_pub, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "GenKey failed\n");
+		co_return ret;
+	}
+
+	ret = co_await dev.sign(S96AT_SIGN_MODE_INTERNAL, slot_parent_priv, sign_flags, &sig);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Sign failed\n");
+		co_return ret;
+	}
+
+	/* ---- VERIFY SIDE ---- */
+	ret = co_await dev.gen_nonce(S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Nonce failed\n");
+		co_return ret;
+	}
+
+	ret = co_await dev.gen_key(S96AT_GENKEY_MODE_DIGEST, slot_pub, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "GenKey failed\n");
+		co_return ret;
+	}
+
+	ret = co_await dev.get_state(state);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Info failed\n");
+		co_return ret;
+	}
+
+	memset(&message, 0, sizeof(message));
+	message.mode = invalidate ? 0x01 : 0x00;
+	message.key_id[0] = slot_parent_priv;
+	memcpy(message.slot_config, cfg.raw(s96::config::slot_config_offset + 2 * slot_pub), 2);
+	memcpy(message.key_config, cfg.raw(s96::config::key_config_offset + 2 * slot_pub), 2);
+	message.temp_key_flags = state[0];
+	message.slot_locked = 0x01; /* Read this from Config */
+	message.pub_key_valid = invalidate ? 1 : 0;
+
+	ret = co_await dev.verify_key(invalidate ? S96AT_VERIFY_KEY_MODE_INVALIDATE :
+						   S96AT_VERIFY_KEY_MODE_VALIDATE,
+				      &sig, slot_pub, (uint8_t *)&message);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Verify failed\n");
+		co_return ret;
+	}
+
+	co_return S96AT_STATUS_OK;
+}
+
+/* Encrypt the private key with the TempKey set by Nonce and GenDig, and
+ * compute the authorizing MAC of PrivWrite (Sect 9.14). By convention,
+ * the key of slot n is all n * 0x11.
+ */
+static void privwrite_prepare(const uint8_t *sn, uint8_t slot, uint8_t parent_slot,
+			      const uint8_t *num_in, const uint8_t *priv,
+			      uint8_t *encrypted_priv, uint8_t *auth_mac)
+{
+	uint8_t temp_key[S96AT_SHA_LEN];
+	uint8_t hashed_temp_key[S96AT_SHA_LEN];
+	uint8_t padded_priv[36] = {0};
+	struct gendig_in digest_in;
+	struct auth_mac_in mac_in;
+
+	memset(&digest_in, 0, sizeof(digest_in));
+	memset(digest_in.data, parent_slot * 0x11, 32);
+	digest_in.opcode = OPCODE_GENDIG;
+	digest_in.param1 = S96AT_ZONE_DATA;
+	digest_in.param2[0] = parent_slot;
+	digest_in.sn_hi = sn[8];
+	digest_in.sn_lo[0] = sn[0];
+	digest_in.sn_lo[1] = sn[1];
+	memcpy(digest_in.temp_key, num_in, 32);
+	SHA256((uint8_t *)&digest_in, sizeof(digest_in), temp_key);
+
+	memcpy(padded_priv + 4, priv, 32);
+	SHA256(temp_key, 32, hashed_temp_key);
+	for (int i = 0; i < 32; i++)
+		encrypted_priv[i] = padded_priv[i] ^ temp_key[i];
+	for (int i = 0; i < 4; i++)
+		encrypted_priv[32 + i] = padded_priv[32 + i] ^ hashed_temp_key[i];
+
+	memset(&mac_in, 0, sizeof(mac_in));
+	memcpy(mac_in.temp_key, temp_key, 32);
+	mac_in.opcode = OPCODE_PRIVWRITE;
+	mac_in.param1 = 1 << 6;
+	mac_in.param2[0] = slot;
+	mac_in.sn_hi = sn[8];
+	mac_in.sn_lo[0] = sn[0];
+	mac_in.sn_lo[1] = sn[1];
+	memcpy(mac_in.padded_key, padded_priv, 36);
+	SHA256((uint8_t *)&mac_in, sizeof(mac_in), auth_mac);
+}
+
+/* The privwrite example, as a coroutine */
+static s96::task<uint8_t> privwrite(s96::device &dev, uint8_t slot, const uint8_t *priv)
+{
+	uint8_t ret;
+	uint8_t parent_slot;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint8_t num_in[S96AT_RANDOM_LEN];
+	uint8_t encrypted_priv[36];
+	uint8_t auth_mac[S96AT_SHA_LEN];
+	s96::config cfg;
+
+	s96::session session = co_await dev.wake();
+
+	ret = co_await dev.read_config(cfg, s96::config::blocks_for_slot(slot));
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read device config\n");
+		co_return ret;
+	}
+
+	if (!cfg.slot(slot).is_secret()) {
+		fprintf(stderr, "Invalid config: SlotConfig.IsSecret = 0\n");
+		co_return S96AT_STATUS_BAD_PARAMETERS;
+	}
+
+	if (!cfg.slot(slot).priv_write()) {
+		fprintf(stderr, "Invalid config: PrivWrite Forbidden\n");
+		co_return S96AT_STATUS_BAD_PARAMETERS;
+	}
+
+	if (!cfg.key(slot).priv()) {
+		fprintf(stderr, "Invalid config: Not a private key\n");
+		co_return S96AT_STATUS_BAD_PARAMETERS;
+	}
+
+	parent_slot = cfg.slot(slot).write_key();
+	cfg.serial(sn);
+
+	notrandom(num_in, sizeof(num_in));
+	ret = co_await dev.gen_nonce(S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not generate nonce\n");
+		co_return ret;
+	}
+
+	ret = co_await dev.gen_digest(S96AT_ZONE_DATA, parent_slot, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not generate digest\n");
+		co_return ret;
+	}
+
+	privwrite_prepare(sn, slot, parent_slot, num_in, priv, encrypted_priv, auth_mac);
+
+	ret = co_await dev.write_priv(slot, encrypted_priv, auth_mac);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not write key: 0x%02x\n", ret);
+		co_return ret;
+	}
+
+	co_return S96AT_STATUS_OK;
+}
+
+/* The sign side of verify, which leaves the keys unchanged */
+static s96::task<uint8_t> sign_digest(s96::device &dev, uint8_t slot_pub, uint8_t slot_parent_priv)
+{
+	uint8_t ret;
+	uint8_t num_in[S96AT_RANDOM_LEN];
+	struct s96at_ecdsa_sig sig;
+
+	s96::session session = co_await dev.wake();
+
+	notrandom(num_in, sizeof(num_in));
+	ret = co_await dev.gen_nonce(S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
+	if (ret == S96AT_STATUS_OK)
+		ret = co_await dev.gen_key(S96AT_GENKEY_MODE_DIGEST, slot_pub, NULL);
+	if (ret == S96AT_STATUS_OK)
+		ret = co_await dev.sign(S96AT_SIGN_MODE_INTERNAL, slot_parent_priv,
+					S96AT_FLAG_NONE, &sig);
+	co_return ret;
+}
+
+static s96::task<uint8_t> sign_digest_loop(s96::device &dev, unsigned int count, uint8_t slot_pub,
+					   uint8_t slot_parent_priv, unsigned int *failed)
+{
+	uint8_t ret;
+
+	for (unsigned int i = 0; i < count; i++) {
+		ret = co_await sign_digest(dev, slot_pub, slot_parent_priv);
+		if (ret != S96AT_STATUS_OK)
+			(*failed)++;
+	}
+	co_return S96AT_STATUS_OK;
+}
+
+/* The same sequence with blocking calls */
+static uint8_t sign_digest_blocking(struct s96at_desc *desc, uint8_t slot_pub,
+				    uint8_t slot_parent_priv)
+{
+	uint8_t ret;
+	uint8_t num_in[S96AT_RANDOM_LEN];
+	struct s96at_ecdsa_sig sig;
+
+	while (s96at_wake(desc) != S96AT_STATUS_READY) {};
+
+	notrandom(num_in, sizeof(num_in));
+	ret = s96at_gen_nonce(desc, S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_gen_key(desc, S96AT_GENKEY_MODE_DIGEST, slot_pub, NULL);
+	if (ret == S96AT_STATUS_OK)
+		ret = s96at_sign(desc, S96AT_SIGN_MODE_INTERNAL, slot_parent_priv,
+				 S96AT_FLAG_NONE, &sig);
+
+	s96at_idle(desc);
+	return ret;
+}
+
+static int read_priv_from_pem(const char *file, uint8_t *buf)
+{
+	int ret = -1;
+	FILE *fp;
+	EVP_PKEY *pkey;
+	BIGNUM *priv = NULL;
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		perror("fopen");
+		return -1;
+	}
+
+	pkey = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+	fclose(fp);
+	if (!pkey) {
+		fprintf(stderr, "Could not read Private Key\n");
+		return -1;
+	}
+
+	if (!EVP_PKEY_get_bn_param(pkey, OSSL_PKEY_PARAM_PRIV_KEY, &priv) ||
+	    BN_bn2binpad(priv, buf, S96AT_ECC_PRIV_LEN) != S96AT_ECC_PRIV_LEN) {
+		fprintf(stderr, "Could not get Private Key\n");
+		goto out;
+	}
+
+	ret = 0;
+out:
+	BN_clear_free(priv);
+	EVP_PKEY_free(pkey);
+	return ret;
+}
+
+static int run_verify(const char *action, uint8_t slot_pub, uint8_t slot_parent_priv)
+{
+	uint8_t ret = S96AT_STATUS_EXEC_ERROR;
+	bool invalidate;
+	s96::executor ex;
+
+	if (!strcmp(action, "validate")) {
+		invalidate = false;
+	} else if (!strcmp(action, "invalidate")) {
+		invalidate = true;
+	} else {
+		fprintf(stderr, "Invalid action: %s\n", action);
+		return -1;
+	}
+
+	if (slot_pub < 8 || slot_pub > 15 || slot_parent_priv > 15) {
+		fprintf(stderr, "Invalid slot\n");
+		return -1;
+	}
+
+	s96::device dev(ex);
+	if (dev.status() != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize descriptor\n");
+		return -1;
+	}
+
+	ex.spawn(verify(dev, invalidate, slot_pub, slot_parent_priv), &ret);
+	ex.run();
+
+	return ret == S96AT_STATUS_OK ? 0 : -1;
+}
+
+static int run_privwrite(uint8_t slot, const char *priv_key_file)
+{
+	uint8_t ret = S96AT_STATUS_EXEC_ERROR;
+	uint8_t priv[S96AT_ECC_PRIV_LEN];
+	s96::executor ex;
+
+	if (slot > 15) {
+		fprintf(stderr, "Invalid slot: %d\n", slot);
+		return -1;
+	}
+
+	if (read_priv_from_pem(priv_key_file, priv))
+		return -1;
+
+	s96::device dev(ex);
+	if (dev.status() != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize descriptor\n");
+		return -1;
+	}
+
+	ex.spawn(privwrite(dev, slot, priv), &ret);
+	ex.run();
+
+	memset(priv, 0, sizeof(priv));
+	return ret == S96AT_STATUS_OK ? 0 : -1;
+}
+
+/* Run count sequences on the device, first with blocking calls one after
+ * another, then as a coroutine on the executor. s96at_init() takes no bus
+ * or address, so there is only ever one device: both runs are bound by its
+ * execution times and the comparison shows the executor's overhead, not a
+ * speedup.
+ */
+static int run_bench(unsigned int count, uint8_t slot_pub, uint8_t slot_parent_priv)
+{
+	struct s96at_desc desc;
+	unsigned int failed = 0;
+	double t;
+
+	if (!count) {
+		usage();
+		return -1;
+	}
+
+	s96::executor ex;
+	s96::device dev(ex);
+	if (dev.status() != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize descriptor\n");
+		return -1;
+	}
+
+	/* The blocking version uses a descriptor of its own */
+	if (s96at_init(S96AT_ATECC508A, S96AT_IO_I2C_LINUX, &desc) != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize descriptor\n");
+		return -1;
+	}
+
+	t = now_s();
+	for (unsigned int i = 0; i < count; i++) {
+		if (sign_digest_blocking(&desc, slot_pub, slot_parent_priv) != S96AT_STATUS_OK)
+			failed++;
+	}
+	t = now_s() - t;
+	printf("Blocking:  %u sequences, %u failed, in %.3f s (%.1f seq/s)\n",
+	       count, failed, t, count / t);
+
+	failed = 0;
+	t = now_s();
+	ex.spawn(sign_digest_loop(dev, count, slot_pub, slot_parent_priv, &failed));
+	ex.run();
+	t = now_s() - t;
+	printf("Coroutine: %u sequences, %u failed, in %.3f s (%.1f seq/s)\n",
+	       count, failed, t, count / t);
+
+	s96at_cleanup(&desc);
+
+	return failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	progname = argv[0];
+
+	if (argc == 5 && !strcmp(argv[1], "verify"))
+		return run_verify(argv[2], atoi(argv[3]), atoi(argv[4]));
+	else if (argc == 4 && !strcmp(argv[1], "privwrite"))
+		return run_privwrite(atoi(argv[2]), argv[3]);
+	else if (argc == 5 && !strcmp(argv[1], "bench"))
+		return run_bench(strtoul(argv[2], NULL, 0), atoi(argv[3]), atoi(argv[4]));
+
+	usage();
+	return -1;
+}
@@ -0,0 +1,207 @@
+#include <cstring>
+
+#include <s96coro.hpp>
+
+namespace s96 {
+
+namespace {
+
+/* Fire and forget coroutine, driving a spawned task to completion */
+struct detached {
+	struct promise_type {
+		detached get_return_object()
+		{
+			return {std::coroutine_handle<promise_type>::from_promise(*this)};
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	std::coroutine_handle<promise_type> h;
+};
+
+} /* namespace */
+
+void executor::spawn(task<uint8_t> t, uint8_t *ret)
+{
+	struct drive {
+		static detached run(executor *ex, task<uint8_t> t, uint8_t *ret)
+		{
+			uint8_t status = co_await std::move(t);
+
+			if (ret)
+				*ret = status;
+			ex->task_done();
+		}
+	};
+
+	detached d = drive::run(this, std::move(t), ret);
+
+	std::lock_guard<std::mutex> l(lock);
+	pending++;
+	ready.push_back(d.h);
+}
+
+void executor::task_done()
+{
+	std::lock_guard<std::mutex> l(lock);
+	pending--;
+}
+
+void executor::post(std::coroutine_handle<> h)
+{
+	std::lock_guard<std::mutex> l(lock);
+	ready.push_back(h);
+	cond.notify_one();
+}
+
+void executor::post_at(clock::time_point t, std::coroutine_handle<> h)
+{
+	std::lock_guard<std::mutex> l(lock);
+	timers.push({t, h});
+	cond.notify_one();
+}
+
+void executor::run()
+{
+	std::unique_lock<std::mutex> l(lock);
+	std::coroutine_handle<> h;
+
+	while (pending) {
+		while (!timers.empty() && timers.top().when <= clock::now()) {
+			ready.push_back(timers.top().h);
+			timers.pop();
+		}
+
+		if (ready.empty()) {
+			if (timers.empty())
+				cond.wait(l);
+			else
+				cond.wait_until(l, timers.top().when);
+			continue;
+		}
+
+		h = ready.front();
+		ready.pop_front();
+		l.unlock();
+		h.resume();
+		l.lock();
+	}
+}
+
+void config::serial(uint8_t *sn) const
+{
+	memcpy(sn, buf, 4);
+	memcpy(sn + 4, buf + 8, 5);
+}
+
+void command::await_suspend(std::coroutine_handle<> h)
+{
+	dev.submit({std::move(fn), h, &ret});
+}
+
+session &session::operator=(session &&other) noexcept
+{
+	if (this != &other) {
+		close();
+		dev = std::exchange(other.dev, nullptr);
+	}
+	return *this;
+}
+
+void session::close()
+{
+	if (!dev)
+		return;
+	dev->submit({s96at_idle, nullptr, nullptr});
+	dev = nullptr;
+}
+
+device::device(executor &ex, enum s96at_device type) : ex(ex)
+{
+	init_status = s96at_init(type, S96AT_IO_I2C_LINUX, &desc);
+	if (init_status == S96AT_STATUS_OK)
+		thread = std::thread(&device::io_thread, this);
+}
+
+device::~device()
+{
+	if (init_status != S96AT_STATUS_OK)
+		return;
+
+	{
+		std::lock_guard<std::mutex> l(lock);
+		stop = true;
+		cond.notify_one();
+	}
+	thread.join();
+	s96at_cleanup(&desc);
+}
+
+void device::submit(job j)
+{
+	std::lock_guard<std::mutex> l(lock);
+	jobs.push_back(std::move(j));
+	cond.notify_one();
+}
+
+/* Queued commands are run before the thread stops */
+void device::io_thread()
+{
+	std::unique_lock<std::mutex> l(lock);
+	uint8_t ret;
+
+	for (;;) {
+		cond.wait(l, [this] { return stop || !jobs.empty(); });
+		if (jobs.empty())
+			break;
+
+		job j = std::move(jobs.front());
+		jobs.pop_front();
+		l.unlock();
+
+		ret = j.fn(&desc);
+		if (j.ret)
+			*j.ret = ret;
+		if (j.h)
+			ex.post(j.h);
+
+		l.lock();
+	}
+}
+
+task<session> device::wake()
+{
+	uint8_t ret;
+
+	for (;;) {
+		ret = co_await run(s96at_wake);
+		if (ret == S96AT_STATUS_READY)
+			break;
+		co_await ex.sleep_for(wake_retry);
+	}
+
+	co_return session(this);
+}
+
+task<uint8_t> device::read_config(config &cfg, uint8_t mask)
+{
+	uint8_t ret;
+
+	mask |= 0x01;
+	for (int i = 0; i < S96AT_ATECC508A_ZONE_CONFIG_NUM_BLOCKS; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+		ret = co_await run([&cfg, i](struct s96at_desc *d) {
+			return s96at_read_config(d, i, cfg.buf + i * S96AT_BLOCK_SIZE);
+		});
+		if (ret != S96AT_STATUS_OK)
+			co_return ret;
+	}
+
+	co_return S96AT_STATUS_OK;
+}
+
+} /* namespace s96 */
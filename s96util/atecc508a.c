@@ -1,3 +1,4 @@
+#include <openssl/evp.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -5,6 +6,7 @@
 
 #include <atecc508a.h>
 #include <common.h>
+#include <session.h>
 
 extern uint8_t atecc508a_slot_config[32];
 extern uint8_t atecc508a_key_config[32];
@@ -44,14 +46,94 @@ int atecc508a_read_config(struct s96at_desc *desc, uint8_t *buf)
 	return ret;
 }
 
-int atecc508a_personalize_config(struct s96at_desc *desc)
+void atecc508a_image_update_crc(struct atecc508a_image *img)
+{
+	const uint8_t *ptr;
+
+	/* Calculate the expected CRC: For the Data / OTP zones, the
+	 * expected CRC is calculated over the concatenation of the
+	 * contents of the two zones.
+	 */
+	img->data_crc = 0;
+	ptr = img->data;
+	for (int i = 0; i < DATA_NUM_SLOTS; i++) {
+		uint16_t slot_len = slot_get_length(i);
+		/* Skip slots containing private keys as they are not
+		 * included in the CRC calculation. See Section 9.10
+		 * of the ATECC508A datasheet.
+		 */
+		if ((img->key_config[i * 2] & 0x01) == 0) {
+			img->data_crc = s96at_crc(ptr, slot_len, img->data_crc);
+		}
+		ptr += slot_len;
+	}
+	img->data_crc = s96at_crc(img->otp, ARRAY_LEN(img->otp), img->data_crc);
+}
+
+/* Replace the symmetric keys in slots 0 onwards with per-device keys,
+ * and update the CRC accordingly. Keys are 32 bytes each; the remaining
+ * bytes of each slot are left as they are.
+ */
+void atecc508a_image_set_keys(struct atecc508a_image *img, const uint8_t *keys,
+			      uint8_t num_keys)
+{
+	uint8_t *ptr = img->data;
+
+	for (int i = 0; i < num_keys; i++) {
+		memcpy(ptr, keys + i * 32, 32);
+		ptr += slot_get_length(i);
+	}
+
+	atecc508a_image_update_crc(img);
+}
+
+void atecc508a_image_init(struct atecc508a_image *img)
+{
+	memcpy(img->slot_config, atecc508a_slot_config, ARRAY_LEN(img->slot_config));
+	memcpy(img->key_config, atecc508a_key_config, ARRAY_LEN(img->key_config));
+	memcpy(img->data, atecc508a_data, ARRAY_LEN(img->data));
+	memcpy(img->priv, atecc508a_priv, ARRAY_LEN(img->priv));
+	memcpy(img->otp, atecc508a_otp, ARRAY_LEN(img->otp));
+
+	atecc508a_image_update_crc(img);
+}
+
+void atecc508a_profile_hash(uint8_t *hash)
+{
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+	uint8_t digest[EVP_MAX_MD_SIZE];
+
+	EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+	EVP_DigestUpdate(ctx, atecc508a_slot_config, ARRAY_LEN(atecc508a_slot_config));
+	EVP_DigestUpdate(ctx, atecc508a_key_config, ARRAY_LEN(atecc508a_key_config));
+	EVP_DigestUpdate(ctx, atecc508a_data, ARRAY_LEN(atecc508a_data));
+	EVP_DigestUpdate(ctx, atecc508a_priv, ARRAY_LEN(atecc508a_priv));
+	EVP_DigestUpdate(ctx, atecc508a_otp, ARRAY_LEN(atecc508a_otp));
+	EVP_DigestFinal_ex(ctx, digest, NULL);
+	EVP_MD_CTX_free(ctx);
+
+	memcpy(hash, digest, AUDIT_PROFILE_LEN);
+}
+
+int atecc508a_personalize_config(struct session *sess)
+{
+	struct atecc508a_image img;
+
+	atecc508a_image_init(&img);
+
+	return atecc508a_personalize_config_image(sess, &img);
+}
+
+int atecc508a_personalize_config_image(struct session *sess,
+				       const struct atecc508a_image *img)
 {
 	uint8_t ret;
 	uint16_t crc;
 	uint8_t lock_config;
+	const uint8_t *config;
 	uint8_t config_buf[S96AT_ATECC508A_ZONE_CONFIG_LEN] = { 0 };
 
-	ret = s96at_get_lock_config(desc, &lock_config);
+	ret = session_get_lock(sess, &lock_config, NULL);
 	if (ret != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not get config lock status\n");
 		goto out;
@@ -67,21 +149,26 @@ int atecc508a_personalize_config(struct s96at_desc *desc)
 	 * and update the slot config and key config parts with the new values,
 	 * before passing it to the CRC function.
 	 */
-	ret = atecc508a_read_config(desc, config_buf);
+	ret = session_read_config(sess, &config);
 	if (ret != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not read current config\n");
 		goto out;
 	}
 
-	memcpy(config_buf + SLOT_CONFIG_OFFSET, atecc508a_slot_config,
-	       ARRAY_LEN(atecc508a_slot_config));
-	memcpy(config_buf + KEY_CONFIG_OFFSET, atecc508a_key_config,
-	       ARRAY_LEN(atecc508a_key_config));
+	memcpy(config_buf, config, ARRAY_LEN(config_buf));
+	memcpy(config_buf + SLOT_CONFIG_OFFSET, img->slot_config,
+	       ARRAY_LEN(img->slot_config));
+	memcpy(config_buf + KEY_CONFIG_OFFSET, img->key_config,
+	       ARRAY_LEN(img->key_config));
 	crc = s96at_crc(config_buf, ARRAY_LEN(config_buf), 0);
 
+	session_wake(sess, (SLOT_CONFIG_NUM_WORDS + KEY_CONFIG_NUM_WORDS) *
+		     SESSION_EXEC_WRITE_MS + SESSION_EXEC_LOCK_MS);
+	session_config_written(sess);
+
 	for (int i = 0; i < SLOT_CONFIG_NUM_WORDS; i++) {
-		ret = s96at_write_config(desc, i + SLOT_CONFIG_START_WORD,
-					 atecc508a_slot_config + i * 4);
+		ret = session_write_config(sess, i + SLOT_CONFIG_START_WORD,
+					   img->slot_config + i * 4);
 		if (ret != S96AT_STATUS_OK) {
 			fprintf(stderr, "Failed writing config slot %d\n", i);
 			goto out;
@@ -89,15 +176,15 @@ int atecc508a_personalize_config(struct s96at_desc *desc)
 	}
 
 	for (int i = 0; i < KEY_CONFIG_NUM_WORDS; i++) {
-		ret = s96at_write_config(desc, i + KEY_CONFIG_START_WORD,
-					 atecc508a_key_config + i * 4);
+		ret = session_write_config(sess, i + KEY_CONFIG_START_WORD,
+					   img->key_config + i * 4);
 		if (ret != S96AT_STATUS_OK) {
 			fprintf(stderr, "Failed writing config slot %d\n", i);
 			goto out;
 		}
 	}
 
-	ret = s96at_lock_zone(desc, S96AT_ZONE_CONFIG, crc);
+	ret = session_lock_zone(sess, S96AT_ZONE_CONFIG, crc);
 	if (ret != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not lock config\n");
 		goto out;
@@ -106,16 +193,25 @@ out:
 	return ret;
 }
 
-int atecc508a_personalize_data(struct s96at_desc *desc)
+int atecc508a_personalize_data(struct session *sess)
+{
+	struct atecc508a_image img;
+
+	atecc508a_image_init(&img);
+
+	return atecc508a_personalize_data_image(sess, &img);
+}
+
+int atecc508a_personalize_data_image(struct session *sess,
+				     const struct atecc508a_image *img)
 {
 	uint8_t ret;
-	uint16_t crc;
 	uint8_t lock_data;
 	uint8_t slot[416]; /* Large enough to fit the largest slot size, ie slot 8 */
 	struct s96at_slot_addr addr;
-	uint8_t *ptr;
+	const uint8_t *ptr;
 
-	ret = s96at_get_lock_data(desc, &lock_data);
+	ret = session_get_lock(sess, NULL, &lock_data);
 	if (ret != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not get config lock status\n");
 		goto out;
@@ -127,14 +223,14 @@ int atecc508a_personalize_data(struct s96at_desc *desc)
 	}
 
 	/* Write data */
-	ptr = atecc508a_data;
+	ptr = img->data;
 	for (int i = 0; i < DATA_NUM_SLOTS; i++) {
 
 		uint16_t slot_len = slot_get_length(i);
 		uint16_t num_blocks = slot_get_blocks(i);
 
 		/* Skip private keys, we write them below using PrivWrite */
-		if ((atecc508a_key_config[i * 2] & 0x01) == 1) {
+		if ((img->key_config[i * 2] & 0x01) == 1) {
 			ptr += slot_len;
 			continue;
 		}
@@ -145,10 +241,17 @@ int atecc508a_personalize_data(struct s96at_desc *desc)
 		memset(slot, 0, ARRAY_LEN(slot));
 		memcpy(slot, ptr, slot_len);
 
+		/* Only wake the device again if the watchdog would put it to
+		 * sleep in the middle of the slot.
+		 */
+		session_wake(sess, num_blocks * SESSION_EXEC_WRITE_MS);
+
 		for (int j = 0; j < num_blocks; j++) {
-			ret = s96at_write_data(desc, &addr, S96AT_FLAG_NONE,
-					       slot + S96AT_BLOCK_SIZE * j,
-					       S96AT_BLOCK_SIZE);
+			sess->slot = i;
+			sess->block = j;
+			ret = session_write_data(sess, &addr,
+						 slot + S96AT_BLOCK_SIZE * j,
+						 S96AT_BLOCK_SIZE);
 			if (ret != S96AT_STATUS_OK) {
 				fprintf(stderr, "Failed writing data slot %d, block %d\n", i, j);
 				goto out;
@@ -156,22 +259,17 @@ int atecc508a_personalize_data(struct s96at_desc *desc)
 			addr.block++;
 		}
 		ptr += slot_len;
-
-		/* Force an idle-wake cycle every 4 slots to prevent the watchdog
-		 * from putting the device to sleep during a write.
-		 */
-		if ((i + 1) % 4 == 0) {
-			s96at_idle(desc);
-			while (s96at_wake(desc) != S96AT_STATUS_READY) {};
-		}
 	}
 
 	/* Write private keys */
-	uint8_t *key = atecc508a_priv;
+	const uint8_t *key = img->priv;
 	for (int i = 0; i < DATA_NUM_SLOTS; i++) {
-		if ((atecc508a_key_config[i * 2] & 0x01) == 0)
+		if ((img->key_config[i * 2] & 0x01) == 0)
 			continue;
-		ret = s96at_write_priv(desc, i, key, NULL);
+		session_wake(sess, SESSION_EXEC_PRIVWRITE_MS);
+		sess->slot = i;
+		sess->block = 0;
+		ret = session_write_priv(sess, i, key);
 		if (ret != S96AT_STATUS_OK) {
 			fprintf(stderr,"Failed writing private key into slot %d\n", i);
 			goto out;
@@ -180,34 +278,19 @@ int atecc508a_personalize_data(struct s96at_desc *desc)
 	}
 
 	/* OTP needs to be written in 2x 32byte blocks */
+	session_wake(sess, 2 * SESSION_EXEC_WRITE_MS + SESSION_EXEC_LOCK_MS);
+	sess->slot = SESSION_NO_SLOT;
 	for (int i = 0; i < 2; i++) {
-		ret = s96at_write_otp(desc, i * 8, atecc508a_otp + i * 32, S96AT_BLOCK_SIZE);
+		sess->block = i;
+		ret = session_write_otp(sess, i * 8, img->otp + i * 32, S96AT_BLOCK_SIZE);
 		if (ret != S96AT_STATUS_OK) {
 			fprintf(stderr, "Failed writing OTP word %d\n", i);
 			goto out;
 		}
 	}
 
-	/* Calculate the expected CRC: For the Data / OTP zones, the
-	 * expected CRC is calculated over the concatenation of the
-	 * contents of the two zones.
-	 */
-	crc = 0;
-	ptr = atecc508a_data;
-	for (int i = 0; i < DATA_NUM_SLOTS; i++) {
-		uint16_t slot_len = slot_get_length(i);
-		/* Skip slots containing private keys as they are not
-		 * included in the CRC calculation. See Section 9.10
-		 * of the ATECC508A datasheet.
-		 */
-		if ((atecc508a_key_config[i * 2] & 0x01) == 0) {
-			crc = s96at_crc(ptr, slot_len, crc);
-		}
-		ptr += slot_len;
-	}
-	crc = s96at_crc(atecc508a_otp, ARRAY_LEN(atecc508a_otp), crc);
-
-	ret = s96at_lock_zone(desc, S96AT_ZONE_DATA, crc);
+	sess->block = SESSION_NO_SLOT;
+	ret = session_lock_zone(sess, S96AT_ZONE_DATA, img->data_crc);
 	if (ret != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not lock Data / OTP\n");
 		goto out;
@@ -1,3 +1,4 @@
+#include <openssl/evp.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -7,6 +8,7 @@
 
 #include <atsha204a.h>
 #include <common.h>
+#include <session.h>
 
 extern uint8_t atsha204a_slot_config[32];
 extern uint8_t atsha204a_data[512];
@@ -26,14 +28,29 @@ int atsha204a_read_config(struct s96at_desc *desc, uint8_t *buf)
 	return ret;
 }
 
-int atsha204a_personalize_config(struct s96at_desc *desc)
+void atsha204a_profile_hash(uint8_t *hash)
+{
+	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+	uint8_t digest[EVP_MAX_MD_SIZE];
+
+	EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+	EVP_DigestUpdate(ctx, atsha204a_slot_config, ARRAY_LEN(atsha204a_slot_config));
+	EVP_DigestUpdate(ctx, atsha204a_data, ARRAY_LEN(atsha204a_data));
+	EVP_DigestUpdate(ctx, atsha204a_otp, ARRAY_LEN(atsha204a_otp));
+	EVP_DigestFinal_ex(ctx, digest, NULL);
+	EVP_MD_CTX_free(ctx);
+
+	memcpy(hash, digest, AUDIT_PROFILE_LEN);
+}
+
+int atsha204a_personalize_config(struct session *sess)
 {
 	uint8_t ret;
 	uint16_t crc;
 	uint8_t lock_config;
 	uint8_t config_buf[ZONE_CONFIG_LEN_MAX] = { 0 };
 
-	ret = s96at_get_lock_config(desc, &lock_config);
+	ret = session_get_lock(sess, &lock_config, NULL);
 	if (ret != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not get config lock status\n");
 		goto out;
@@ -68,7 +85,8 @@ int atsha204a_personalize_config(struct s96at_desc *desc)
 		}
 	}
 */
-	ret = s96at_lock_zone(desc, S96AT_ZONE_CONFIG, crc);
+	session_wake(sess, SESSION_EXEC_LOCK_MS);
+	ret = session_lock_zone(sess, S96AT_ZONE_CONFIG, crc);
 	if (ret != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not lock config\n");
 		goto out;
@@ -77,14 +95,14 @@ out:
 	return ret;
 }
 
-int atsha204a_personalize_data(struct s96at_desc *desc)
+int atsha204a_personalize_data(struct session *sess)
 {
 	uint8_t ret;
 	uint16_t crc;
 	uint8_t lock_data;
 	struct s96at_slot_addr addr = {0};
 
-	ret = s96at_get_lock_data(desc, &lock_data);
+	ret = session_get_lock(sess, NULL, &lock_data);
 	if (ret != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not get config lock status\n");
 		goto out;
@@ -95,18 +113,20 @@ int atsha204a_personalize_data(struct s96at_desc *desc)
 		goto out;
 	}
 
+	session_wake(sess, DATA_NUM_SLOTS * SESSION_EXEC_WRITE_MS);
 	for (int i = 0; i < DATA_NUM_SLOTS; i++) {
 		addr.slot = i;
-		ret = s96at_write_data(desc, &addr, S96AT_FLAG_NONE,
-				       atsha204a_data + (i * 32), 32);
+		sess->slot = i;
+		ret = session_write_data(sess, &addr, atsha204a_data + (i * 32), 32);
 		if (ret != S96AT_STATUS_OK) {
 			fprintf(stderr, "Failed writing data slot %d\n", i);
 			break;
 		}
 	}
 
+	session_wake(sess, 2 * SESSION_EXEC_WRITE_MS + SESSION_EXEC_LOCK_MS);
 	for (int i = 0; i < 2; i++) {
-		ret = s96at_write_otp(desc, i * 8, atsha204a_otp + i * 32, 32);
+		ret = session_write_otp(sess, i * 8, atsha204a_otp + i * 32, 32);
 		if (ret != S96AT_STATUS_OK) {
 			fprintf(stderr, "Failed writing OTP word %d\n", i);
 			break;
@@ -120,7 +140,7 @@ int atsha204a_personalize_data(struct s96at_desc *desc)
 	crc = s96at_crc(atsha204a_data, ARRAY_LEN(atsha204a_data), 0);
 	crc = s96at_crc(atsha204a_otp, ARRAY_LEN(atsha204a_otp), crc);
 
-	ret = s96at_lock_zone(desc, S96AT_ZONE_DATA, crc);
+	ret = session_lock_zone(sess, S96AT_ZONE_DATA, crc);
 	if (ret != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not lock Data / OTP\n");
 		goto out;
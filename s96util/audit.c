@@ -0,0 +1,257 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <audit.h>
+
+#define CHUNK_SIZE	(AUDIT_CHUNK_RECORDS * AUDIT_RECORD_SIZE)
+
+static const char *step_names[AUDIT_STEP_NUM] = {
+	"info", "serial", "config", "data", "verify", "check"
+};
+
+_Static_assert(sizeof(struct audit_header) == AUDIT_RECORD_SIZE, "audit header size");
+_Static_assert(sizeof(struct audit_record) == AUDIT_RECORD_SIZE, "audit record size");
+
+/* CRC-32 (IEEE 802.3), as used by zlib */
+uint32_t audit_crc32(const uint8_t *buf, size_t len)
+{
+	static uint32_t table[256];
+	uint32_t crc = 0xffffffff;
+
+	if (!table[1]) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t c = i;
+
+			for (int j = 0; j < 8; j++)
+				c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+
+	for (size_t i = 0; i < len; i++)
+		crc = table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+
+	return crc ^ 0xffffffff;
+}
+
+int audit_record_valid(const struct audit_record *rec)
+{
+	return rec->crc == audit_crc32((const uint8_t *)rec, offsetof(struct audit_record, crc)) &&
+	       rec->step < AUDIT_STEP_NUM;
+}
+
+const char *audit_step_name(uint8_t step)
+{
+	return step < AUDIT_STEP_NUM ? step_names[step] : "unknown";
+}
+
+static uint64_t now_us(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int map_chunk(struct audit_log *log, off_t chunk)
+{
+	log->map = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+			log->fd, chunk * CHUNK_SIZE);
+	if (log->map == MAP_FAILED) {
+		log->map = NULL;
+		perror("mmap");
+		return -1;
+	}
+
+	log->chunk = chunk;
+	return 0;
+}
+
+/* Sync the records appended since the last sync. msync works on pages,
+ * so the range starts at the page holding the first of them.
+ */
+static void sync_records(struct audit_log *log)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t start = log->synced * AUDIT_RECORD_SIZE / page * page;
+	size_t end = log->pos * AUDIT_RECORD_SIZE;
+
+	if (end > start)
+		msync(log->map + start, end - start, MS_SYNC);
+
+	log->synced = log->pos;
+	log->synced_us = now_us(CLOCK_MONOTONIC);
+}
+
+static int write_header(int fd)
+{
+	struct audit_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, AUDIT_MAGIC, sizeof(hdr.magic));
+	hdr.version = AUDIT_VERSION;
+	hdr.record_size = AUDIT_RECORD_SIZE;
+
+	if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || fsync(fd)) {
+		perror("write");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Find the end of the log: the first record that is not valid, or does
+ * not follow the previous one. What comes after it was written after the
+ * last sync before a power loss, and is cleared so that it can not be
+ * taken for a valid record once new ones are appended before it.
+ */
+static off_t find_end(struct audit_log *log, off_t size)
+{
+	uint8_t buf[CHUNK_SIZE];
+	const struct audit_record *rec;
+	off_t off = AUDIT_RECORD_SIZE;
+	ssize_t len;
+
+	log->seq = 0;
+	while (off < size) {
+		len = pread(log->fd, buf, sizeof(buf), off);
+		if (len < AUDIT_RECORD_SIZE)
+			break;
+
+		for (ssize_t i = 0; i + AUDIT_RECORD_SIZE <= len; i += AUDIT_RECORD_SIZE) {
+			rec = (const struct audit_record *)(buf + i);
+			if (!audit_record_valid(rec) || rec->seq != log->seq)
+				return off + i;
+			log->seq++;
+		}
+		off += len;
+	}
+
+	return off;
+}
+
+int audit_open(struct audit_log *log, const char *path, const uint8_t *profile)
+{
+	struct audit_header hdr;
+	struct stat st;
+	off_t end;
+	off_t size;
+	uint8_t zero[AUDIT_RECORD_SIZE] = { 0 };
+
+	memset(log, 0, sizeof(*log));
+	memcpy(log->profile, profile, sizeof(log->profile));
+
+	log->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (log->fd < 0) {
+		perror("open");
+		return -1;
+	}
+
+	if (fstat(log->fd, &st)) {
+		perror("stat");
+		goto err;
+	}
+
+	size = st.st_size;
+	if (size < AUDIT_RECORD_SIZE) {
+		if (write_header(log->fd))
+			goto err;
+		size = AUDIT_RECORD_SIZE;
+	} else if (pread(log->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+		   memcmp(hdr.magic, AUDIT_MAGIC, sizeof(hdr.magic)) ||
+		   hdr.version != AUDIT_VERSION || hdr.record_size != AUDIT_RECORD_SIZE) {
+		fprintf(stderr, "%s is not an audit log\n", path);
+		goto err;
+	}
+
+	end = find_end(log, size);
+	for (off_t off = end; off < size; off += AUDIT_RECORD_SIZE) {
+		if (pwrite(log->fd, zero, sizeof(zero), off) != sizeof(zero)) {
+			perror("write");
+			goto err;
+		}
+	}
+
+	/* The file always ends on a chunk boundary, past the last record */
+	size = (end / CHUNK_SIZE + 1) * CHUNK_SIZE;
+	if (ftruncate(log->fd, size) || fsync(log->fd)) {
+		perror("truncate");
+		goto err;
+	}
+
+	if (map_chunk(log, end / CHUNK_SIZE))
+		goto err;
+
+	log->pos = end % CHUNK_SIZE / AUDIT_RECORD_SIZE;
+	log->synced = log->pos;
+	log->synced_us = now_us(CLOCK_MONOTONIC);
+
+	return 0;
+err:
+	close(log->fd);
+	return -1;
+}
+
+/* Append a record. It is synced along with the records before it, every
+ * AUDIT_SYNC_RECORDS records, or if the last sync is more than
+ * AUDIT_SYNC_MS old. A log that could not be opened is ignored.
+ */
+void audit_event(struct audit_log *log, const uint8_t *sn, enum audit_step step,
+		 uint8_t status, uint8_t retries, uint32_t duration_us,
+		 uint8_t slot, uint8_t block)
+{
+	struct audit_record *rec;
+
+	if (!log || !log->map)
+		return;
+
+	if (log->pos == AUDIT_CHUNK_RECORDS) {
+		sync_records(log);
+		munmap(log->map, CHUNK_SIZE);
+		log->map = NULL;
+		if (ftruncate(log->fd, (log->chunk + 2) * CHUNK_SIZE) ||
+		    map_chunk(log, log->chunk + 1)) {
+			fprintf(stderr, "Audit log stopped\n");
+			return;
+		}
+		log->pos = 0;
+		log->synced = 0;
+	}
+
+	rec = (struct audit_record *)(log->map + log->pos * AUDIT_RECORD_SIZE);
+	memset(rec, 0, sizeof(*rec));
+	rec->seq = log->seq++;
+	rec->duration_us = duration_us;
+	rec->time_us = now_us(CLOCK_REALTIME);
+	if (sn)
+		memcpy(rec->sn, sn, sizeof(rec->sn));
+	rec->step = step;
+	rec->status = status;
+	rec->retries = retries;
+	rec->slot = slot;
+	rec->block = block;
+	memcpy(rec->profile, log->profile, sizeof(rec->profile));
+	rec->crc = audit_crc32((uint8_t *)rec, offsetof(struct audit_record, crc));
+	log->pos++;
+
+	if (log->pos - log->synced >= AUDIT_SYNC_RECORDS ||
+	    now_us(CLOCK_MONOTONIC) - log->synced_us >= AUDIT_SYNC_MS * 1000ULL)
+		sync_records(log);
+}
+
+void audit_close(struct audit_log *log)
+{
+	if (log->map) {
+		sync_records(log);
+		munmap(log->map, CHUNK_SIZE);
+		log->map = NULL;
+	}
+	close(log->fd);
+}
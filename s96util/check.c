@@ -0,0 +1,304 @@
+#include <openssl/ec.h>
+#include <openssl/obj_mac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atecc508a.h>
+#include <check.h>
+#include <common.h>
+
+#define OPCODE_MAC		0x08
+
+#define PRIV_PAD_LEN		4 /* PrivWrite zero padding in front of the key */
+
+/* Sect 9.13, Mode 0 */
+struct __attribute__((__packed__)) mac_in {
+	uint8_t key[32];
+	uint8_t challenge[32];
+	uint8_t opcode;
+	uint8_t mode;
+	uint8_t param2[2];
+	uint8_t otp[11];	/* Zero unless Mode:5 is set */
+	uint8_t sn8;
+	uint8_t sn4[4];		/* Zero unless Mode:6 is set */
+	uint8_t sn0[2];
+	uint8_t sn2[2];		/* Zero unless Mode:6 is set */
+};
+
+/* SHA-256 digests of the expected contents, computed from the image */
+struct check_digests {
+	uint8_t config[S96AT_SHA_LEN];	/* SlotConfig and KeyConfig */
+	uint8_t slot[DATA_NUM_SLOTS][S96AT_SHA_LEN];
+	uint8_t otp[S96AT_SHA_LEN];
+};
+
+static int pub_from_priv(const uint8_t *priv, uint8_t *pub)
+{
+	int ret = -1;
+	EC_GROUP *group;
+	EC_POINT *point = NULL;
+	BIGNUM *bn = NULL;
+	uint8_t buf[1 + S96AT_ECC_PUB_X_LEN + S96AT_ECC_PUB_Y_LEN];
+
+	group = EC_GROUP_new_by_curve_name(NID_X9_62_prime256v1);
+	if (!group)
+		return -1;
+
+	bn = BN_bin2bn(priv, 32, NULL);
+	point = EC_POINT_new(group);
+	if (!bn || !point)
+		goto out;
+
+	if (!EC_POINT_mul(group, point, bn, NULL, NULL, NULL))
+		goto out;
+
+	if (EC_POINT_point2oct(group, point, POINT_CONVERSION_UNCOMPRESSED,
+			       buf, sizeof(buf), NULL) != sizeof(buf))
+		goto out;
+
+	memcpy(pub, buf + 1, sizeof(buf) - 1);
+	ret = 0;
+out:
+	EC_POINT_free(point);
+	BN_free(bn);
+	EC_GROUP_free(group);
+	return ret;
+}
+
+/* Private keys cannot be read back. Their digest is that of the public key
+ * the device computes from them, and is compared with the public key
+ * computed on the host from the image.
+ */
+static int compute_digests(const struct atecc508a_image *img, struct check_digests *d)
+{
+	uint8_t config[ARRAY_LEN(img->slot_config) + ARRAY_LEN(img->key_config)];
+	uint8_t pub[S96AT_ECC_PUB_X_LEN + S96AT_ECC_PUB_Y_LEN];
+	const uint8_t *ptr = img->data;
+	const uint8_t *key = img->priv;
+
+	memcpy(config, img->slot_config, ARRAY_LEN(img->slot_config));
+	memcpy(config + ARRAY_LEN(img->slot_config), img->key_config,
+	       ARRAY_LEN(img->key_config));
+	SHA256(config, sizeof(config), d->config);
+
+	for (int i = 0; i < DATA_NUM_SLOTS; i++) {
+		if (img->key_config[i * 2] & 0x01) {
+			if (pub_from_priv(key + PRIV_PAD_LEN, pub)) {
+				fprintf(stderr, "Invalid private key for slot %d\n", i);
+				return -1;
+			}
+			SHA256(pub, sizeof(pub), d->slot[i]);
+			key += S96AT_ECC_PRIV_LEN;
+		} else {
+			SHA256(ptr, slot_get_length(i), d->slot[i]);
+		}
+		ptr += slot_get_length(i);
+	}
+
+	SHA256(img->otp, ARRAY_LEN(img->otp), d->otp);
+
+	return 0;
+}
+
+/* Read a slot in as few reads as possible: 32-byte blocks, and 4-byte
+ * words for the remainder.
+ */
+static int read_slot(struct s96at_desc *desc, uint8_t slot, uint8_t *buf)
+{
+	uint8_t ret;
+	uint16_t len = slot_get_length(slot);
+	struct s96at_slot_addr addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.slot = slot;
+
+	for (int i = 0; i < len; ) {
+		if (len - i >= S96AT_BLOCK_SIZE) {
+			ret = s96at_read_data(desc, &addr, S96AT_FLAG_NONE, buf + i,
+					      S96AT_BLOCK_SIZE);
+			addr.block++;
+			i += S96AT_BLOCK_SIZE;
+		} else {
+			ret = s96at_read_data(desc, &addr, S96AT_FLAG_NONE, buf + i,
+					      S96AT_WORD_SIZE);
+			addr.offset++;
+			i += S96AT_WORD_SIZE;
+		}
+		if (ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "Failed reading data slot %d\n", slot);
+			return ret;
+		}
+	}
+
+	return S96AT_STATUS_OK;
+}
+
+/* Secret slots cannot be read back. The device computes a MAC over a
+ * challenge with the key in the slot, which is compared with the MAC
+ * computed on the host with the expected key. This covers the first
+ * 32 bytes of the slot.
+ */
+static int check_mac(struct s96at_desc *desc, uint8_t slot, const uint8_t *key,
+		     const uint8_t *config, uint8_t *mac, uint8_t *expected)
+{
+	uint8_t ret;
+	struct mac_in mac_in;
+
+	memset(&mac_in, 0, sizeof(mac_in));
+	memcpy(mac_in.key, key, sizeof(mac_in.key));
+	if (RAND_bytes(mac_in.challenge, sizeof(mac_in.challenge)) != 1)
+		return S96AT_STATUS_EXEC_ERROR;
+	mac_in.opcode = OPCODE_MAC;
+	mac_in.mode = S96AT_MAC_MODE_0;
+	mac_in.param2[0] = slot;
+	mac_in.sn8 = config[12];
+	mac_in.sn0[0] = config[0];
+	mac_in.sn0[1] = config[1];
+	SHA256((uint8_t *)&mac_in, sizeof(mac_in), expected);
+
+	ret = s96at_gen_mac(desc, S96AT_MAC_MODE_0, slot, mac_in.challenge, mac);
+	if (ret != S96AT_STATUS_OK)
+		fprintf(stderr, "MAC failed on slot %d\n", slot);
+
+	return ret;
+}
+
+/* KeyType P256, in bits 2 to 4 of KeyConfig. Public keys in secret slots
+ * can neither be read back nor used for a MAC, which needs a symmetric
+ * key. All that can be checked is the validity the device reports for
+ * them, with Info in KeyValid mode.
+ */
+static int is_p256(const uint8_t *key_config)
+{
+	return ((key_config[0] >> 2) & 0x07) == 0x04;
+}
+
+static int report(const char *name, const char *method, const uint8_t *got,
+		  const uint8_t *expected)
+{
+	int ok = !memcmp(got, expected, S96AT_SHA_LEN);
+
+	printf("%-8s %-7s %s\n", name, method, ok ? "OK" : "MISMATCH");
+	return ok ? 0 : -1;
+}
+
+int atecc508a_check(struct session *sess, const struct atecc508a_image *img)
+{
+	struct s96at_desc *desc = sess->desc;
+	uint8_t ret;
+	int failed = 0;
+	char name[16];
+	struct check_digests expected;
+	uint8_t digest[S96AT_SHA_LEN];
+	uint8_t mac[S96AT_MAC_LEN];
+	uint8_t valid;
+	const uint8_t *config_buf;
+	uint8_t slot_buf[416]; /* Large enough to fit the largest slot size, ie slot 8 */
+	uint8_t otp_buf[64];
+	struct s96at_ecc_pub pub;
+	const uint8_t *ptr;
+
+	if (compute_digests(img, &expected))
+		return -1;
+
+	/* The config zone is read in full: besides SlotConfig and KeyConfig,
+	 * block 0 holds the serial number used in the MAC and block 2 the
+	 * lock bytes.
+	 */
+	ret = session_read_config(sess, &config_buf);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read config\n");
+		return -1;
+	}
+
+	printf("%-8s %-7s %s\n", "Lock", "config",
+	       config_buf[LOCK_CONFIG_OFFSET] == S96AT_ZONE_LOCKED ? "OK" : "UNLOCKED");
+	printf("%-8s %-7s %s\n", "Lock", "data",
+	       config_buf[LOCK_VALUE_OFFSET] == S96AT_ZONE_LOCKED ? "OK" : "UNLOCKED");
+	if (config_buf[LOCK_CONFIG_OFFSET] != S96AT_ZONE_LOCKED ||
+	    config_buf[LOCK_VALUE_OFFSET] != S96AT_ZONE_LOCKED)
+		failed = 1;
+
+	memcpy(slot_buf, config_buf + SLOT_CONFIG_OFFSET, ARRAY_LEN(img->slot_config));
+	memcpy(slot_buf + ARRAY_LEN(img->slot_config), config_buf + KEY_CONFIG_OFFSET,
+	       ARRAY_LEN(img->key_config));
+	SHA256(slot_buf, ARRAY_LEN(img->slot_config) + ARRAY_LEN(img->key_config), digest);
+	if (report("Config", "digest", digest, expected.config))
+		failed = 1;
+
+	ptr = img->data;
+	for (int i = 0; i < DATA_NUM_SLOTS; i++) {
+		const uint8_t *slot_config = config_buf + SLOT_CONFIG_OFFSET + 2 * i;
+		const uint8_t *key_config = config_buf + KEY_CONFIG_OFFSET + 2 * i;
+		const char *method;
+
+		/* Wake the device again only if the watchdog could put it to
+		 * sleep during the slot, as GenKey and MAC take a while.
+		 */
+		if (key_config[0] & 0x01)
+			session_wake(sess, SESSION_EXEC_GENKEY_MS);
+		else if (is_p256(key_config))
+			session_wake(sess, SESSION_EXEC_READ_MS);
+		else if (slot_config[0] & 0x80)
+			session_wake(sess, SESSION_EXEC_MAC_MS);
+		else
+			session_wake(sess, slot_get_blocks(i) * SESSION_EXEC_READ_MS);
+
+		snprintf(name, sizeof(name), "Slot %d", i);
+		memset(digest, 0, sizeof(digest));
+		memset(mac, 0, sizeof(mac));
+		if (key_config[0] & 0x01) { /* Private */
+			method = "GenKey";
+			ret = s96at_gen_key(desc, S96AT_GENKEY_MODE_PUBLIC, i, &pub);
+			if (ret == S96AT_STATUS_OK)
+				SHA256((uint8_t *)&pub, sizeof(pub), digest);
+			if (report(name, method, digest, expected.slot[i]))
+				failed = 1;
+		} else if (is_p256(key_config)) { /* Public key, maybe IsSecret */
+			method = "Info";
+			ret = s96at_get_key_valid(desc, i, &valid);
+			if (ret == S96AT_STATUS_OK)
+				printf("%-8s %-7s OK (%s)\n", name, method,
+				       valid ? "valid" : "invalid");
+		} else if (slot_config[0] & 0x80) { /* IsSecret */
+			method = "MAC";
+			ret = check_mac(desc, i, ptr, config_buf, mac, digest);
+			if (report(name, method, mac, digest))
+				failed = 1;
+		} else {
+			method = "digest";
+			ret = read_slot(desc, i, slot_buf);
+			if (ret == S96AT_STATUS_OK)
+				SHA256(slot_buf, slot_get_length(i), digest);
+			if (report(name, method, digest, expected.slot[i]))
+				failed = 1;
+		}
+
+		if (ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "%s: %s failed: 0x%02x\n", name, method, ret);
+			failed = 1;
+		}
+		ptr += slot_get_length(i);
+	}
+
+	/* OTP is read in 2x 32byte blocks, like it is written */
+	session_wake(sess, 2 * SESSION_EXEC_READ_MS);
+	for (int i = 0; i < 2; i++) {
+		ret = s96at_read_otp(desc, i * 8, otp_buf + i * S96AT_BLOCK_SIZE);
+		if (ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "Failed reading OTP word %d\n", i * 8);
+			failed = 1;
+		}
+	}
+	SHA256(otp_buf, sizeof(otp_buf), digest);
+	if (report("OTP", "digest", digest, expected.otp))
+		failed = 1;
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+
+	return failed ? -1 : 0;
+}
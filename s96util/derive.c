@@ -0,0 +1,177 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atecc508a.h>
+#include <common.h>
+#include <derive.h>
+
+#define DERIVE_MAX_THREADS	64
+
+struct derive_job {
+	const uint8_t *master;
+	struct derive_tray *tray;
+	size_t start;
+	size_t end;
+};
+
+static int parse_sn(const char *line, uint8_t *sn)
+{
+	for (int i = 0; i < S96AT_SERIAL_NUMBER_LEN; i++) {
+		if (sscanf(line + 2 * i, "%2hhx", &sn[i]) != 1)
+			return -1;
+	}
+	return 0;
+}
+
+/* The tray file lists the serial numbers of the devices in a tray, one
+ * per line, in hex as printed by s96util -i.
+ */
+int derive_tray_read(const char *path, struct derive_tray *tray)
+{
+	FILE *fp;
+	char line[64];
+	size_t max = 0;
+	void *sn;
+
+	memset(tray, 0, sizeof(*tray));
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror("fopen");
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] == '\n' || line[0] == '#')
+			continue;
+
+		if (tray->num == max) {
+			max = max ? 2 * max : 64;
+			sn = realloc(tray->sn, max * sizeof(*tray->sn));
+			if (!sn) {
+				fprintf(stderr, "Out of memory\n");
+				goto err;
+			}
+			tray->sn = sn;
+		}
+
+		if (parse_sn(line, tray->sn[tray->num])) {
+			fprintf(stderr, "Invalid serial number: %s", line);
+			goto err;
+		}
+		tray->num++;
+	}
+	fclose(fp);
+
+	tray->keys = calloc(tray->num, sizeof(*tray->keys));
+	if (!tray->keys && tray->num) {
+		fprintf(stderr, "Out of memory\n");
+		derive_tray_free(tray);
+		return -1;
+	}
+
+	return 0;
+err:
+	fclose(fp);
+	derive_tray_free(tray);
+	return -1;
+}
+
+static void *derive_thread(void *arg)
+{
+	struct derive_job *job = arg;
+
+	for (size_t i = job->start; i < job->end; i++)
+		slotkey_derive(job->master, job->tray->sn[i], job->tray->keys[i]);
+
+	return NULL;
+}
+
+/* Derive the keys of every device in the tray, spread across all cores */
+int derive_tray_keys(const uint8_t *master, struct derive_tray *tray)
+{
+	long num_threads;
+	size_t chunk;
+	pthread_t threads[DERIVE_MAX_THREADS];
+	struct derive_job jobs[DERIVE_MAX_THREADS];
+	int started = 0;
+
+	num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > DERIVE_MAX_THREADS)
+		num_threads = DERIVE_MAX_THREADS;
+	if (num_threads > tray->num)
+		num_threads = tray->num;
+	if (!num_threads)
+		return 0;
+
+	chunk = (tray->num + num_threads - 1) / num_threads;
+	for (int i = 0; i < num_threads; i++) {
+		jobs[i].master = master;
+		jobs[i].tray = tray;
+		jobs[i].start = i * chunk;
+		jobs[i].end = (i + 1) * chunk < tray->num ? (i + 1) * chunk : tray->num;
+		if (jobs[i].start >= jobs[i].end)
+			break;
+
+		if (pthread_create(&threads[i], NULL, derive_thread, &jobs[i])) {
+			/* Do the rest on this thread */
+			jobs[i].end = tray->num;
+			derive_thread(&jobs[i]);
+			break;
+		}
+		started++;
+	}
+
+	for (int i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	return 0;
+}
+
+/* Returns the keys of the device with the given serial number, one after
+ * the other, or NULL if it is not in the tray.
+ */
+const uint8_t *derive_tray_lookup(const struct derive_tray *tray, const uint8_t *sn)
+{
+	for (size_t i = 0; i < tray->num; i++) {
+		if (!memcmp(tray->sn[i], sn, S96AT_SERIAL_NUMBER_LEN))
+			return (const uint8_t *)tray->keys[i];
+	}
+	return NULL;
+}
+
+void derive_tray_free(struct derive_tray *tray)
+{
+	if (tray->keys)
+		memset(tray->keys, 0, tray->num * sizeof(*tray->keys));
+	free(tray->keys);
+	free(tray->sn);
+	memset(tray, 0, sizeof(*tray));
+}
+
+/* Put the keys of the device with serial number sn in img. They are taken
+ * from the tray if the device is in it, and derived on the spot otherwise.
+ */
+void derive_image_keys(const uint8_t *master, const struct derive_tray *tray,
+		       const uint8_t *sn, struct atecc508a_image *img)
+{
+	const uint8_t *tray_keys = NULL;
+	uint8_t keys[DERIVE_NUM_SLOTS][DERIVE_KEY_LEN];
+
+	if (tray)
+		tray_keys = derive_tray_lookup(tray, sn);
+
+	if (tray_keys) {
+		atecc508a_image_set_keys(img, tray_keys, DERIVE_NUM_SLOTS);
+	} else {
+		slotkey_derive(master, sn, keys);
+		atecc508a_image_set_keys(img, (uint8_t *)keys, DERIVE_NUM_SLOTS);
+		memset(keys, 0, sizeof(keys));
+	}
+}
@@ -0,0 +1,357 @@
+#include <openssl/sha.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <atecc508a.h>
+#include <common.h>
+#include <drift.h>
+#include <i2crdwr.h>
+#include <session.h>
+
+#define OPCODE_READ		0x02
+#define READ_32_BYTES		0x80
+#define READ_ZONE_CONFIG	0x00
+#define READ_ZONE_OTP		0x01
+
+/* Count, data and CRC */
+#define RESP_LEN_READ		(1 + S96AT_BLOCK_SIZE + 2)
+
+#define OTP_NUM_BLOCKS		2
+
+/* A bit field of a 16-bit SlotConfig or KeyConfig entry, LSB first */
+struct drift_field {
+	const char *name;
+	uint8_t shift;
+	uint8_t bits;
+};
+
+/* Sect 2.2.1 */
+static const struct drift_field slot_config_fields[] = {
+	{ "ReadKey",		0,  4 },
+	{ "NoMac",		4,  1 },
+	{ "LimitedUse",		5,  1 },
+	{ "EncryptRead",	6,  1 },
+	{ "IsSecret",		7,  1 },
+	{ "WriteKey",		8,  4 },
+	{ "WriteConfig",	12, 4 },
+};
+
+/* Sect 2.2.5 */
+static const struct drift_field key_config_fields[] = {
+	{ "Private",		0,  1 },
+	{ "PubInfo",		1,  1 },
+	{ "KeyType",		2,  3 },
+	{ "Lockable",		5,  1 },
+	{ "ReqRandom",		6,  1 },
+	{ "ReqAuth",		7,  1 },
+	{ "AuthKey",		8,  4 },
+	{ "IntrusionDisable",	12, 1 },
+	{ "RFU",		13, 1 },
+	{ "X509id",		14, 2 },
+};
+
+/* What the profile sets in the config and OTP zones. The rest of the
+ * config zone is either per device, like the serial number, or left to
+ * its factory value.
+ */
+struct __attribute__((__packed__)) drift_snapshot {
+	uint8_t slot_config[32];
+	uint8_t key_config[32];
+	uint8_t lock_value;
+	uint8_t lock_config;
+	uint8_t otp[64];
+};
+
+struct drift_board {
+	pthread_t thread;
+	struct i2crdwr dev;
+	char path[64];
+	uint16_t addr;
+	int index;
+	uint8_t ret;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	struct drift_snapshot snap;
+	uint8_t digest[S96AT_SHA_LEN];
+};
+
+/* Boards holding the same snapshot, which is only decoded once, from the
+ * first of them.
+ */
+struct drift_group {
+	uint8_t digest[S96AT_SHA_LEN];
+	const struct drift_board *first;
+	int count;
+};
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void print_hex(const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		printf("%02x", buf[i]);
+}
+
+/* Read a 32-byte block of the config or OTP zone */
+static uint8_t read_block(struct i2crdwr *dev, uint8_t zone, uint8_t block, uint8_t *buf,
+			  uint32_t flags)
+{
+	uint8_t ret;
+	uint8_t resp[RESP_LEN_READ];
+
+	ret = i2crdwr_command(dev, OPCODE_READ, READ_32_BYTES | zone, block << 3, NULL, 0,
+			      resp, sizeof(resp), flags);
+	if (ret != I2CRDWR_STATUS_OK)
+		return ret;
+	if (resp[0] != sizeof(resp))
+		return I2CRDWR_STATUS_COMM_ERROR;
+
+	memcpy(buf, resp + 1, S96AT_BLOCK_SIZE);
+	return I2CRDWR_STATUS_OK;
+}
+
+/* Each board is read by its own thread, through the I2C_RDWR transport,
+ * which addresses it by adapter and address. The config zone and the
+ * two OTP blocks take a single wake, and the idle is folded into the
+ * last read.
+ */
+static void *drift_thread(void *arg)
+{
+	struct drift_board *b = arg;
+	uint8_t config[S96AT_ATECC508A_ZONE_CONFIG_LEN];
+	int tries = 0;
+
+	b->ret = S96AT_STATUS_EXEC_ERROR;
+	if (i2crdwr_open(&b->dev, I2CRDWR_MODE_RDWR, b->path, b->addr))
+		return NULL;
+
+	while (i2crdwr_wake(&b->dev) != I2CRDWR_STATUS_OK) {
+		if (++tries == SESSION_WAKE_RETRIES) {
+			fprintf(stderr, "Board %d: Device does not answer\n", b->index);
+			goto out;
+		}
+	}
+
+	for (int i = 0; i < S96AT_ATECC508A_ZONE_CONFIG_NUM_BLOCKS; i++) {
+		if (read_block(&b->dev, READ_ZONE_CONFIG, i, config + i * S96AT_BLOCK_SIZE,
+			       I2CRDWR_FLAG_NONE) != I2CRDWR_STATUS_OK) {
+			fprintf(stderr, "Board %d: Failed reading config block %d\n", b->index, i);
+			goto idle;
+		}
+	}
+
+	for (int i = 0; i < OTP_NUM_BLOCKS; i++) {
+		if (read_block(&b->dev, READ_ZONE_OTP, i, b->snap.otp + i * S96AT_BLOCK_SIZE,
+			       i == OTP_NUM_BLOCKS - 1 ? I2CRDWR_FLAG_IDLE : I2CRDWR_FLAG_NONE) !=
+		    I2CRDWR_STATUS_OK) {
+			fprintf(stderr, "Board %d: Failed reading OTP block %d\n", b->index, i);
+			goto idle;
+		}
+	}
+
+	/* SN[0:3] is at bytes 0-3, SN[4:8] at bytes 8-12 */
+	memcpy(b->sn, config, 4);
+	memcpy(b->sn + 4, config + 8, 5);
+	memcpy(b->snap.slot_config, config + SLOT_CONFIG_OFFSET, sizeof(b->snap.slot_config));
+	memcpy(b->snap.key_config, config + KEY_CONFIG_OFFSET, sizeof(b->snap.key_config));
+	b->snap.lock_value = config[LOCK_VALUE_OFFSET];
+	b->snap.lock_config = config[LOCK_CONFIG_OFFSET];
+
+	SHA256((uint8_t *)&b->snap, sizeof(b->snap), b->digest);
+	b->ret = S96AT_STATUS_OK;
+	goto out;
+idle:
+	i2crdwr_idle(&b->dev);
+out:
+	i2crdwr_close(&b->dev);
+	return NULL;
+}
+
+static void diff_config(const char *zone, const struct drift_field *fields,
+			size_t num_fields, const uint8_t *got, const uint8_t *expected)
+{
+	char name[40];
+
+	for (int i = 0; i < DATA_NUM_SLOTS; i++) {
+		uint16_t g = got[2 * i] | got[2 * i + 1] << 8;
+		uint16_t e = expected[2 * i] | expected[2 * i + 1] << 8;
+
+		if (g == e)
+			continue;
+
+		for (int j = 0; j < num_fields; j++) {
+			uint16_t mask = (1 << fields[j].bits) - 1;
+			uint16_t gv = (g >> fields[j].shift) & mask;
+			uint16_t ev = (e >> fields[j].shift) & mask;
+
+			if (gv == ev)
+				continue;
+			snprintf(name, sizeof(name), "%s[%d].%s", zone, i, fields[j].name);
+			printf("    %-32s 0x%x, expected 0x%x\n", name, gv, ev);
+		}
+	}
+}
+
+/* Print the fields of got that differ from expected, by name */
+static void diff_snapshot(const struct drift_snapshot *got,
+			  const struct drift_snapshot *expected)
+{
+	char name[16];
+
+	diff_config("SlotConfig", slot_config_fields, ARRAY_LEN(slot_config_fields),
+		    got->slot_config, expected->slot_config);
+	diff_config("KeyConfig", key_config_fields, ARRAY_LEN(key_config_fields),
+		    got->key_config, expected->key_config);
+
+	if (got->lock_value != expected->lock_value)
+		printf("    %-32s 0x%02x, expected 0x%02x\n", "LockValue",
+		       got->lock_value, expected->lock_value);
+	if (got->lock_config != expected->lock_config)
+		printf("    %-32s 0x%02x, expected 0x%02x\n", "LockConfig",
+		       got->lock_config, expected->lock_config);
+
+	for (int i = 0; i < ARRAY_LEN(got->otp); i += S96AT_WORD_SIZE) {
+		if (!memcmp(got->otp + i, expected->otp + i, S96AT_WORD_SIZE))
+			continue;
+		snprintf(name, sizeof(name), "OTP[%d]", i / S96AT_WORD_SIZE);
+		printf("    %-32s ", name);
+		print_hex(got->otp + i, S96AT_WORD_SIZE);
+		printf(", expected ");
+		print_hex(expected->otp + i, S96AT_WORD_SIZE);
+		printf("\n");
+	}
+}
+
+static int group_cmp(const void *a, const void *b)
+{
+	const struct drift_group *ga = a;
+	const struct drift_group *gb = b;
+
+	if (ga->count != gb->count)
+		return gb->count - ga->count;
+	return ga->first->index - gb->first->index;
+}
+
+int drift_run(char *const *specs, int num_boards, const struct atecc508a_image *img)
+{
+	int ret = -1;
+	int started = 0;
+	int failed = 0;
+	int num_groups = 0;
+	int drifted = 0;
+	struct drift_board *boards;
+	struct drift_group *groups;
+	struct drift_snapshot expected;
+	uint8_t digest[S96AT_SHA_LEN];
+	double t;
+
+	memcpy(expected.slot_config, img->slot_config, sizeof(expected.slot_config));
+	memcpy(expected.key_config, img->key_config, sizeof(expected.key_config));
+	expected.lock_value = S96AT_ZONE_LOCKED;
+	expected.lock_config = S96AT_ZONE_LOCKED;
+	memcpy(expected.otp, img->otp, sizeof(expected.otp));
+	SHA256((uint8_t *)&expected, sizeof(expected), digest);
+
+	boards = calloc(num_boards, sizeof(*boards));
+	groups = calloc(num_boards, sizeof(*groups));
+	if (!boards || !groups)
+		goto out;
+
+	for (int i = 0; i < num_boards; i++) {
+		struct drift_board *b = &boards[i];
+
+		b->index = i;
+		if (i2crdwr_parse(specs[i], b->path, sizeof(b->path), &b->addr)) {
+			fprintf(stderr, "Invalid board %s\n", specs[i]);
+			goto out;
+		}
+	}
+
+	t = now_ms();
+	for (int i = 0; i < num_boards; i++) {
+		if (pthread_create(&boards[i].thread, NULL, drift_thread, &boards[i])) {
+			fprintf(stderr, "Could not start thread %d\n", i);
+			break;
+		}
+		started++;
+	}
+
+	for (int i = 0; i < started; i++)
+		pthread_join(boards[i].thread, NULL);
+	t = now_ms() - t;
+
+	/* Racks hold a few hundred boards at most, and most of them share a
+	 * digest: a linear search over the groups is enough.
+	 */
+	for (int i = 0; i < started; i++) {
+		const struct drift_board *b = &boards[i];
+		int j;
+
+		if (b->ret != S96AT_STATUS_OK) {
+			failed++;
+			continue;
+		}
+
+		for (j = 0; j < num_groups; j++) {
+			if (!memcmp(groups[j].digest, b->digest, sizeof(b->digest)))
+				break;
+		}
+		if (j == num_groups) {
+			memcpy(groups[j].digest, b->digest, sizeof(b->digest));
+			groups[j].first = b;
+			num_groups++;
+		}
+		groups[j].count++;
+	}
+	qsort(groups, num_groups, sizeof(*groups), group_cmp);
+
+	printf("%d board%s read in %.0f ms, %d group%s, %d failed\n", started,
+	       started == 1 ? "" : "s", t, num_groups, num_groups == 1 ? "" : "s", failed);
+
+	for (int i = 0; i < num_groups; i++) {
+		const struct drift_group *g = &groups[i];
+		int match = !memcmp(g->digest, digest, sizeof(digest));
+
+		printf("\nGroup %d: %d board%s, ", i + 1, g->count, g->count > 1 ? "s" : "");
+		print_hex(g->digest, 8);
+		printf(" %s\n", match ? "matches profile" : "DRIFT");
+		if (match)
+			continue;
+
+		drifted += g->count;
+		for (const struct drift_board *b = g->first; b < boards + started; b++) {
+			if (b->ret != S96AT_STATUS_OK ||
+			    memcmp(b->digest, g->digest, sizeof(b->digest)))
+				continue;
+			printf("  %3d ", b->index);
+			print_hex(b->sn, sizeof(b->sn));
+			printf(" %s:0x%02x\n", b->path, b->addr);
+		}
+		diff_snapshot(&g->first->snap, &expected);
+	}
+
+	if (failed) {
+		printf("\nFailed:");
+		for (int i = 0; i < started; i++) {
+			if (boards[i].ret != S96AT_STATUS_OK)
+				printf(" %s:0x%02x", boards[i].path, boards[i].addr);
+		}
+		printf("\n");
+	}
+
+	if (started == num_boards && !failed && !drifted)
+		ret = 0;
+out:
+	free(groups);
+	free(boards);
+	return ret;
+}
@@ -3,10 +3,42 @@
 
 #include <secure96/s96at.h>
 
+#include <session.h>
+
+/* Contents written to a device during personalization */
+struct atecc508a_image {
+	uint8_t slot_config[32];
+	uint8_t key_config[32];
+	uint8_t data[1208];
+	uint8_t priv[128];
+	uint8_t otp[64];
+	uint16_t data_crc;	/* CRC of the Data and OTP zones, used to lock them */
+};
+
+uint16_t slot_get_length(uint8_t slot);
+
+uint16_t slot_get_blocks(uint8_t slot);
+
 int atecc508a_read_config(struct s96at_desc *desc, uint8_t *buf);
 
-int atecc508a_personalize_config(struct s96at_desc *desc);
+void atecc508a_image_init(struct atecc508a_image *img);
+
+void atecc508a_image_update_crc(struct atecc508a_image *img);
+
+void atecc508a_image_set_keys(struct atecc508a_image *img, const uint8_t *keys,
+			      uint8_t num_keys);
+
+/* Truncated SHA-256 of the built-in profile, before per-device keys */
+void atecc508a_profile_hash(uint8_t *hash);
+
+int atecc508a_personalize_config(struct session *sess);
+
+int atecc508a_personalize_config_image(struct session *sess,
+				       const struct atecc508a_image *img);
+
+int atecc508a_personalize_data(struct session *sess);
 
-int atecc508a_personalize_data(struct s96at_desc *desc);
+int atecc508a_personalize_data_image(struct session *sess,
+				     const struct atecc508a_image *img);
 
 #endif
@@ -3,10 +3,15 @@
 
 #include <secure96/s96at.h>
 
+#include <session.h>
+
 int atsha204a_read_config(struct s96at_desc *desc, uint8_t *buf);
 
-int atsha204a_personalize_config(struct s96at_desc *desc);
+/* Truncated SHA-256 of the built-in profile */
+void atsha204a_profile_hash(uint8_t *hash);
+
+int atsha204a_personalize_config(struct session *sess);
 
-int atsha204a_personalize_data(struct s96at_desc *desc);
+int atsha204a_personalize_data(struct session *sess);
 
 #endif
@@ -0,0 +1,79 @@
+#ifndef __AUDIT_H
+#define __AUDIT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <secure96/s96at.h>
+
+#define AUDIT_MAGIC		"S96AUDIT"
+#define AUDIT_VERSION		1
+#define AUDIT_RECORD_SIZE	64
+#define AUDIT_CHUNK_RECORDS	1024	/* The file grows, and is mapped, 64KiB at a time */
+#define AUDIT_SYNC_RECORDS	32	/* Records between two msync */
+#define AUDIT_SYNC_MS		1000	/* Max time before a record is synced */
+#define AUDIT_PROFILE_LEN	16	/* Truncated SHA-256 of the profile */
+#define AUDIT_NONE		0xff	/* No slot or block */
+
+enum audit_step {
+	AUDIT_STEP_INFO,
+	AUDIT_STEP_SERIAL,
+	AUDIT_STEP_CONFIG,
+	AUDIT_STEP_DATA,
+	AUDIT_STEP_VERIFY,
+	AUDIT_STEP_CHECK,
+	AUDIT_STEP_NUM
+};
+
+/* The first record of the file */
+struct __attribute__((__packed__)) audit_header {
+	char magic[8];
+	uint16_t version;
+	uint16_t record_size;
+	uint8_t reserved[52];
+};
+
+/* One step on one device. A record is valid if its CRC matches; records
+ * are appended in order, so the log ends at the first invalid one.
+ */
+struct __attribute__((__packed__)) audit_record {
+	uint32_t seq;
+	uint32_t duration_us;
+	uint64_t time_us;	/* CLOCK_REALTIME at the end of the step */
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint8_t step;
+	uint8_t status;		/* S96AT_STATUS_* */
+	uint8_t retries;	/* Wakes that failed during the step */
+	uint8_t slot;		/* Where the step failed, or AUDIT_NONE */
+	uint8_t block;
+	uint8_t profile[AUDIT_PROFILE_LEN];
+	uint8_t reserved[14];
+	uint32_t crc;		/* CRC-32 of the bytes above */
+};
+
+struct audit_log {
+	int fd;
+	uint8_t *map;		/* Chunk being appended to */
+	off_t chunk;
+	uint32_t pos;		/* Index of the next record in the chunk */
+	uint32_t synced;	/* Index of the first record not synced */
+	uint32_t seq;
+	uint64_t synced_us;
+	uint8_t profile[AUDIT_PROFILE_LEN];
+};
+
+uint32_t audit_crc32(const uint8_t *buf, size_t len);
+
+int audit_record_valid(const struct audit_record *rec);
+
+const char *audit_step_name(uint8_t step);
+
+int audit_open(struct audit_log *log, const char *path, const uint8_t *profile);
+
+void audit_event(struct audit_log *log, const uint8_t *sn, enum audit_step step,
+		 uint8_t status, uint8_t retries, uint32_t duration_us,
+		 uint8_t slot, uint8_t block);
+
+void audit_close(struct audit_log *log);
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef __CHECK_H
+#define __CHECK_H
+
+#include <secure96/s96at.h>
+
+#include <atecc508a.h>
+#include <session.h>
+
+/* Check that a personalized device holds the contents of img. Returns 0 if
+ * it does, -1 otherwise.
+ */
+int atecc508a_check(struct session *sess, const struct atecc508a_image *img);
+
+#endif
@@ -13,6 +13,9 @@
 #define KEY_CONFIG_OFFSET	96
 #define KEY_CONFIG_START_WORD	24
 
+#define LOCK_VALUE_OFFSET	86
+#define LOCK_CONFIG_OFFSET	87
+
 #define DATA_NUM_SLOTS		16 /* Total number of slots in data zone */
 #define OTP_NUM_WORDS		2  /* Total number of slots in otp zone */
 
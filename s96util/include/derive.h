@@ -0,0 +1,34 @@
+#ifndef __DERIVE_H
+#define __DERIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#include <atecc508a.h>
+#include <slotkey.h>
+
+#define DERIVE_MASTER_LEN	SLOTKEY_MASTER_LEN
+#define DERIVE_KEY_LEN		SLOTKEY_LEN
+#define DERIVE_NUM_SLOTS	SLOTKEY_NUM_SLOTS
+
+/* Per-device keys of a tray of devices, derived in one batch */
+struct derive_tray {
+	size_t num;
+	uint8_t (*sn)[S96AT_SERIAL_NUMBER_LEN];
+	uint8_t (*keys)[DERIVE_NUM_SLOTS][DERIVE_KEY_LEN];
+};
+
+int derive_tray_read(const char *path, struct derive_tray *tray);
+
+int derive_tray_keys(const uint8_t *master, struct derive_tray *tray);
+
+const uint8_t *derive_tray_lookup(const struct derive_tray *tray, const uint8_t *sn);
+
+void derive_tray_free(struct derive_tray *tray);
+
+void derive_image_keys(const uint8_t *master, const struct derive_tray *tray,
+		       const uint8_t *sn, struct atecc508a_image *img);
+
+#endif
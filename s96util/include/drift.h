@@ -0,0 +1,16 @@
+#ifndef __DRIFT_H
+#define __DRIFT_H
+
+#include <atecc508a.h>
+
+#define DRIFT_MAX_BOARDS	256
+
+/* Read the config and OTP zones of num_boards ATECC508A boards, given as
+ * adapter[:addr] in specs, one thread per board, and group the boards by
+ * the digest of what the profile sets in them. The fields that differ
+ * from img are printed once for each group that does not match it.
+ * Returns 0 if every board matches img, -1 otherwise.
+ */
+int drift_run(char *const *specs, int num_boards, const struct atecc508a_image *img);
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef __SESSION_H
+#define __SESSION_H
+
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#include <audit.h>
+#include <common.h>
+#include <plan.h>
+
+/* The watchdog and the worst case execution times are shared with the
+ * timing model of dry runs, see plan.h.
+ */
+#define SESSION_WATCHDOG_MS	PLAN_WATCHDOG_MS
+#define SESSION_MARGIN_MS	PLAN_MARGIN_MS
+
+/* Worst case execution times, to size the wake needed by a sequence */
+#define SESSION_EXEC_READ_MS	PLAN_EXEC_READ_MS
+#define SESSION_EXEC_WRITE_MS	PLAN_EXEC_WRITE_MS
+#define SESSION_EXEC_LOCK_MS	PLAN_EXEC_LOCK_MS
+#define SESSION_EXEC_MAC_MS	PLAN_EXEC_MAC_MS
+#define SESSION_EXEC_PRIVWRITE_MS	PLAN_EXEC_PRIVWRITE_MS
+#define SESSION_EXEC_GENKEY_MS	PLAN_EXEC_GENKEY_MS
+
+#define SESSION_NO_SLOT		0xff
+
+/* Wakes sent before a device that does not answer counts as gone */
+#define SESSION_WAKE_RETRIES	20
+
+enum session_state {
+	SESSION_ASLEEP,
+	SESSION_IDLE,
+	SESSION_AWAKE
+};
+
+/* What is known about one device for the duration of a run. The device
+ * is only woken up when it is not awake already, or when the watchdog
+ * would expire before the next sequence completes. The config zone, the
+ * serial number and the lock bytes are read once, and kept until a write
+ * or lock changes them.
+ */
+struct session {
+	struct s96at_desc *desc;
+	struct plan *plan;	/* Dry run, if not NULL */
+	uint8_t dev;
+	enum session_state state;
+	double woken_ms;
+	int lost;		/* Gone or replaced: no more commands are sent */
+
+	int have_config;
+	int have_sn;
+	int have_lock;
+	uint8_t config[ZONE_CONFIG_LEN_MAX];
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	uint8_t lock_config;
+	uint8_t lock_data;
+
+	/* For the audit log, reset once a step is logged */
+	uint8_t retries;	/* Wakes that were not answered */
+	uint8_t slot;		/* Slot and block being written, or SESSION_NO_SLOT */
+	uint8_t block;
+};
+
+void session_init(struct session *sess, struct s96at_desc *desc, uint8_t dev);
+
+void session_init_plan(struct session *sess, struct plan *plan, uint8_t dev);
+
+uint8_t session_wake(struct session *sess, double needed_ms);
+
+uint8_t session_confirm_sn(struct session *sess);
+
+void session_idle(struct session *sess);
+
+void session_sleep(struct session *sess);
+
+int session_read_config(struct session *sess, const uint8_t **config);
+
+int session_get_sn(struct session *sess, uint8_t *sn);
+
+int session_get_lock(struct session *sess, uint8_t *lock_config, uint8_t *lock_data);
+
+uint8_t session_write_config(struct session *sess, uint8_t word, const uint8_t *buf);
+
+uint8_t session_write_data(struct session *sess, struct s96at_slot_addr *addr,
+			   const uint8_t *buf, size_t len);
+
+uint8_t session_write_priv(struct session *sess, uint8_t slot, const uint8_t *priv);
+
+uint8_t session_write_otp(struct session *sess, uint8_t word, const uint8_t *buf,
+			  size_t len);
+
+uint8_t session_lock_zone(struct session *sess, enum s96at_zone zone, uint16_t crc);
+
+void session_config_written(struct session *sess);
+
+void session_zone_locked(struct session *sess, enum s96at_zone zone, uint8_t status);
+
+void session_audit(struct session *sess, struct audit_log *log, enum audit_step step,
+		   uint8_t status, double start_ms);
+
+#endif
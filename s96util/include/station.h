@@ -0,0 +1,17 @@
+#ifndef __STATION_H
+#define __STATION_H
+
+#include <secure96/s96at.h>
+
+#include <audit.h>
+#include <derive.h>
+
+/* Personalize ATECC508A devices as they are inserted, until interrupted.
+ * With a master key, each device gets its own symmetric keys, taken from
+ * the tray if given. Each stage of each device is logged to audit, if
+ * not NULL.
+ */
+int station_run(struct s96at_desc *desc, const uint8_t *master,
+		struct derive_tray *tray, struct audit_log *audit);
+
+#endif
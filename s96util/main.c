@@ -7,12 +7,20 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <secure96/s96at.h>
 
 #include <atecc508a.h>
 #include <atsha204a.h>
+#include <audit.h>
+#include <check.h>
 #include <common.h>
+#include <derive.h>
+#include <drift.h>
+#include <plan.h>
+#include <session.h>
+#include <station.h>
 
 static void usage(char *fname)
 {
@@ -25,10 +33,95 @@ static void usage(char *fname)
 	fprintf(stderr, "Available options:\n");
 	fprintf(stderr, "  -i, --info		Display device info\n");
 	fprintf(stderr, "  -d, --dump-config	Dump config zone\n");
+	fprintf(stderr, "  -c, --check		Check a personalized device against the profile (atecc only)\n");
 	fprintf(stderr, "  -p, --personalize	Write config and data\n");
+	fprintf(stderr, "  -s, --station		Personalize devices as they are inserted (atecc only)\n");
+	fprintf(stderr, "  -f, --fleet <boards>	Compare the config and OTP of boards with the profile, as adapter[:addr],... (atecc only)\n");
+	fprintf(stderr, "  -m, --master <file>	Derive per-device keys from a master key (atecc only)\n");
+	fprintf(stderr, "  -t, --tray <file>	Serial numbers of a tray, to derive their keys in a batch\n");
+	fprintf(stderr, "  -l, --log <file>	Append each step to a binary audit log, read with s96audit\n");
+	fprintf(stderr, "  -n, --dry-run		Print the predicted timeline of -p, without touching the device\n");
+	fprintf(stderr, "  -C, --calibrate <file>	Measured command times for the timeline of -n\n");
 	fprintf(stderr, "  -h, --help		Display this message\n");
 	fprintf(stderr, "  -v, --version	Display version\n");
 	fprintf(stderr, "\n");
+	fprintf(stderr, "-m, -t, -l, -n and -C must come before the options that use them.\n");
+	fprintf(stderr, "\n");
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* With a master key, replace the symmetric keys of the image with the
+ * ones derived for this device.
+ */
+static int image_for_device(struct session *sess, const uint8_t *master,
+			    const struct derive_tray *tray, struct atecc508a_image *img)
+{
+	uint8_t ret;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+
+	atecc508a_image_init(img);
+	if (!master)
+		return S96AT_STATUS_OK;
+
+	ret = session_get_sn(sess, sn);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Failed to get SN\n");
+		return ret;
+	}
+
+	derive_image_keys(master, tray, sn, img);
+	return S96AT_STATUS_OK;
+}
+
+/* Read the serial number up front when logging, so that every record of
+ * the step carries it. A failure is left to the step itself.
+ */
+static void audit_sn(struct session *sess, struct audit_log *audit)
+{
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+
+	if (audit)
+		session_get_sn(sess, sn);
+}
+
+/* Walk the command sequence of -p against the timing model. The blank
+ * device of the dry run has an all-zero serial number, which per-device
+ * keys are derived from.
+ */
+static int plan_personalize(uint8_t dev, const uint8_t *master,
+			    const struct derive_tray *tray)
+{
+	uint8_t ret;
+	struct plan plan;
+	struct session sess;
+	struct atecc508a_image img;
+
+	plan_init(&plan);
+	session_init_plan(&sess, &plan, dev);
+
+	if (dev == S96AT_ATECC508A) {
+		ret = image_for_device(&sess, master, tray, &img);
+		if (ret != S96AT_STATUS_OK)
+			return ret;
+		ret = atecc508a_personalize_config_image(&sess, &img);
+		if (ret == S96AT_STATUS_OK)
+			ret = atecc508a_personalize_data_image(&sess, &img);
+	} else {
+		ret = atsha204a_personalize_config(&sess);
+		if (ret == S96AT_STATUS_OK)
+			ret = atsha204a_personalize_data(&sess);
+	}
+	session_sleep(&sess);
+
+	plan_summary(&plan);
+	return ret;
 }
 
 static int confirm()
@@ -68,22 +161,46 @@ static char *otpmode2str(uint8_t mode)
 
 int main(int argc, char *argv[])
 {
-	uint8_t ret;
+	uint8_t ret = S96AT_STATUS_OK;
 	uint8_t dev;
 	struct s96at_desc desc;
+	struct session sess;
 
 	uint8_t otp_mode;
 	uint8_t lock_config;
 	uint8_t lock_data;
 	uint8_t devrev[S96AT_DEVREV_LEN] = { 0 };
 	uint8_t sn[S96AT_SERIAL_NUMBER_LEN] = { 0 };
-	uint8_t config_buf[ZONE_CONFIG_LEN_MAX] = { 0 };
+	const uint8_t *config_buf;
+	struct atecc508a_image img;
+	uint8_t master_buf[DERIVE_MASTER_LEN];
+	uint8_t *master = NULL;
+	struct derive_tray tray_buf;
+	struct derive_tray *tray = NULL;
+	struct audit_log audit_buf;
+	struct audit_log *audit = NULL;
+	uint8_t profile[AUDIT_PROFILE_LEN];
+	uint8_t status;
+	double t;
+	char *boards[DRIFT_MAX_BOARDS];
+	char *save;
+	int num_boards;
+	int dry_run = 0;
+	int initialized = 0;
 
 	int opt;
 	int opt_idx = 0;
 	static struct option long_opts[] = {
+		{"check",        no_argument, 0, 'c'},
 		{"dump-config",  no_argument, 0, 'd'},
 		{"personalize",  no_argument, 0, 'p'},
+		{"station",      no_argument, 0, 's'},
+		{"fleet",        required_argument, 0, 'f'},
+		{"master",       required_argument, 0, 'm'},
+		{"tray",         required_argument, 0, 't'},
+		{"log",          required_argument, 0, 'l'},
+		{"dry-run",      no_argument, 0, 'n'},
+		{"calibrate",    required_argument, 0, 'C'},
 		{"help",         no_argument, 0, 'h'},
 		{"info",         no_argument, 0, 'i'},
 		{"version",      no_argument, 0, 'v'},
@@ -104,52 +221,62 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	ret = s96at_init(dev, S96AT_IO_I2C_LINUX, &desc);
-	if (ret != S96AT_STATUS_OK) {
-		fprintf(stderr, "Could not initialize a descriptor\n");
-		return ret;
-	}
+	/* Shared by all options, so that a device woken up or a zone read
+	 * by one of them is reused by the next.
+	 */
+	session_init(&sess, &desc, dev);
 
 	while (1) {
 		opt_idx = 0;
-		opt = getopt_long(argc, argv, "idphv", long_opts, &opt_idx);
+		opt = getopt_long(argc, argv, "icdpsf:m:t:l:nC:hv", long_opts, &opt_idx);
 
 		if (opt == -1) /* End of options. */
 			break;
 
+		/* The device is only opened once an option needs it, so that a
+		 * dry run works without one.
+		 */
+		if (!initialized && strchr("icdps", opt) && !(opt == 'p' && dry_run)) {
+			ret = s96at_init(dev, S96AT_IO_I2C_LINUX, &desc);
+			if (ret != S96AT_STATUS_OK) {
+				fprintf(stderr, "Could not initialize a descriptor\n");
+				goto out;
+			}
+			initialized = 1;
+		}
+
 		switch (opt) {
 		case 'i':
-			while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
+			t = now_ms();
+			session_wake(&sess, 5 * SESSION_EXEC_READ_MS);
 
 			ret = s96at_get_devrev(&desc, devrev);
 			if (ret != S96AT_STATUS_OK) {
 				fprintf(stderr, "Failed to get device revision\n");
-				goto out;
+				goto info_out;
 			}
 
-			ret = s96at_get_serialnbr(&desc, sn);
+			ret = session_get_sn(&sess, sn);
 			if (ret != S96AT_STATUS_OK) {
 				fprintf(stderr, "Failed to get SN\n");
-				goto out;
+				goto info_out;
 			}
 
 			ret = s96at_get_otp_mode(&desc, &otp_mode);
 			if (ret != S96AT_STATUS_OK) {
 				fprintf(stderr, "Failed to get OTP mode\n");
-				goto out;
+				goto info_out;
 			}
 
-			ret = s96at_get_lock_config(&desc, &lock_config);
+			ret = session_get_lock(&sess, &lock_config, &lock_data);
 			if (ret != S96AT_STATUS_OK) {
-				fprintf(stderr, "Failed to get config lock status\n");
-				goto out;
+				fprintf(stderr, "Failed to get lock status\n");
+				goto info_out;
 			}
-
-			ret = s96at_get_lock_data(&desc, &lock_data);
-			if (ret != S96AT_STATUS_OK) {
-				fprintf(stderr, "Failed to get LockData\n");
+info_out:
+			session_audit(&sess, audit, AUDIT_STEP_INFO, ret, t);
+			if (ret != S96AT_STATUS_OK)
 				goto out;
-			}
 
 #if 0
 			printf("ATSHA204A on %s @ addr 0x%x\n", I2C_DEVICE, ATSHA204A_ADDR);
@@ -165,46 +292,162 @@ int main(int argc, char *argv[])
 			printf("OTP mode:           %s\n", otpmode2str(otp_mode));
 			break;
 		case 'd':
-			while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
-
-			if (dev == S96AT_ATECC508A)
-				ret = atecc508a_read_config(&desc, config_buf);
-			else
-				ret = atsha204a_read_config(&desc, config_buf);
+			ret = session_read_config(&sess, &config_buf);
 			if (ret != S96AT_STATUS_OK) {
 				fprintf(stderr, "Could not read config\n");
 				goto out;
 			}
 
-			for (int i = 0; i < ARRAY_LEN(config_buf); i ++) {
+			for (int i = 0; i < ZONE_CONFIG_LEN_MAX; i ++) {
 				printf("%c", config_buf[i]);
 			}
 			break;
+		case 'c':
+			if (dev != S96AT_ATECC508A) {
+				fprintf(stderr, "Check is only supported on atecc\n");
+				ret = S96AT_STATUS_EXEC_ERROR;
+				goto out;
+			}
+
+			audit_sn(&sess, audit);
+			ret = image_for_device(&sess, master, tray, &img);
+			if (ret != S96AT_STATUS_OK)
+				goto out;
+
+			t = now_ms();
+			status = atecc508a_check(&sess, &img) ? S96AT_STATUS_EXEC_ERROR : S96AT_STATUS_OK;
+			session_audit(&sess, audit, AUDIT_STEP_CHECK, status, t);
+			ret = status;
+			if (ret != S96AT_STATUS_OK)
+				goto out;
+			break;
 		case 'p':
+			if (dry_run) {
+				ret = plan_personalize(dev, master, tray);
+				break;
+			}
+
 			printf("WARNING: Personalizing the device is an one-time operation! ");
-			if (confirm())
+			if (confirm()) {
+				ret = S96AT_STATUS_EXEC_ERROR;
 				goto out;
+			}
 
-			while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
-			if (dev == S96AT_ATECC508A)
-				ret = atecc508a_personalize_config(&desc);
-			else
-				ret = atsha204a_personalize_config(&desc);
+			audit_sn(&sess, audit);
+			if (dev == S96AT_ATECC508A) {
+				ret = image_for_device(&sess, master, tray, &img);
+				if (ret != S96AT_STATUS_OK)
+					goto out;
+				t = now_ms();
+				ret = atecc508a_personalize_config_image(&sess, &img);
+			} else {
+				t = now_ms();
+				ret = atsha204a_personalize_config(&sess);
+			}
+			session_audit(&sess, audit, AUDIT_STEP_CONFIG, ret, t);
 			if (ret != S96AT_STATUS_OK) {
 				fprintf(stderr, "Personalization failed\n");
 				goto out;
 			}
 
+			t = now_ms();
 			if (dev == S96AT_ATECC508A)
-				ret = atecc508a_personalize_data(&desc);
+				ret = atecc508a_personalize_data_image(&sess, &img);
 			else
-				ret = atsha204a_personalize_data(&desc);
+				ret = atsha204a_personalize_data(&sess);
+			session_audit(&sess, audit, AUDIT_STEP_DATA, ret, t);
 			if (ret != S96AT_STATUS_OK) {
 				fprintf(stderr, "Personalization failed\n");
 				goto out;
 			}
 			printf("Done\n");
 			break;
+		case 's':
+			if (dev != S96AT_ATECC508A) {
+				fprintf(stderr, "Station mode is only supported on atecc\n");
+				ret = S96AT_STATUS_EXEC_ERROR;
+				goto out;
+			}
+
+			printf("WARNING: Every device inserted will be personalized and locked!\n");
+			session_sleep(&sess);
+			ret = station_run(&desc, master, tray, audit);
+			break;
+		case 'f':
+			if (dev != S96AT_ATECC508A) {
+				fprintf(stderr, "Drift check is only supported on atecc\n");
+				ret = S96AT_STATUS_EXEC_ERROR;
+				goto out;
+			}
+
+			/* Boards are given as a comma-separated list */
+			num_boards = 0;
+			for (char *p = strtok_r(optarg, ",", &save); p; p = strtok_r(NULL, ",", &save)) {
+				if (num_boards == DRIFT_MAX_BOARDS) {
+					fprintf(stderr, "Too many boards, at most %d\n", DRIFT_MAX_BOARDS);
+					ret = S96AT_STATUS_EXEC_ERROR;
+					goto out;
+				}
+				boards[num_boards++] = p;
+			}
+			if (!num_boards) {
+				usage(argv[0]);
+				ret = S96AT_STATUS_EXEC_ERROR;
+				goto out;
+			}
+
+			/* Only what the profile sets in config and OTP is
+			 * compared, so per-device keys do not matter.
+			 */
+			atecc508a_image_init(&img);
+			ret = drift_run(boards, num_boards, &img) ? S96AT_STATUS_EXEC_ERROR : S96AT_STATUS_OK;
+			break;
+		case 'm':
+			if (dev != S96AT_ATECC508A) {
+				fprintf(stderr, "Key derivation is only supported on atecc\n");
+				ret = S96AT_STATUS_EXEC_ERROR;
+				goto out;
+			}
+
+			if (slotkey_read_master(optarg, master_buf)) {
+				ret = S96AT_STATUS_EXEC_ERROR;
+				goto out;
+			}
+			master = master_buf;
+			break;
+		case 't':
+			if (tray)
+				derive_tray_free(tray);
+			if (derive_tray_read(optarg, &tray_buf)) {
+				ret = S96AT_STATUS_EXEC_ERROR;
+				goto out;
+			}
+			tray = &tray_buf;
+			break;
+		case 'l':
+			if (audit)
+				audit_close(audit);
+			if (dev == S96AT_ATECC508A)
+				atecc508a_profile_hash(profile);
+			else
+				atsha204a_profile_hash(profile);
+			if (audit_open(&audit_buf, optarg, profile)) {
+				fprintf(stderr, "Could not open audit log %s\n", optarg);
+				audit = NULL;
+				ret = S96AT_STATUS_EXEC_ERROR;
+				goto out;
+			}
+			audit = &audit_buf;
+			break;
+		case 'n':
+			dry_run = 1;
+			break;
+		case 'C':
+			if (plan_calibrate(optarg)) {
+				ret = S96AT_STATUS_EXEC_ERROR;
+				goto out;
+			}
+			break;
 		case 'h':
 			usage(argv[0]);
 			break;
@@ -216,9 +459,20 @@ int main(int argc, char *argv[])
 		}
 	}
 out:
-	ret = s96at_cleanup(&desc);
-	if (ret != S96AT_STATUS_OK)
+	memset(master_buf, 0, sizeof(master_buf));
+	if (tray)
+		derive_tray_free(tray);
+	if (audit)
+		audit_close(audit);
+
+	if (!initialized)
+		return ret;
+
+	session_sleep(&sess);
+	if (s96at_cleanup(&desc) != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not cleanup\n");
+		ret = S96AT_STATUS_EXEC_ERROR;
+	}
 
 	return ret;
 }
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2017, Linaro Ltd and contributors
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <audit.h>
+
+static void print_hex(const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		printf("%02x", buf[i]);
+}
+
+static void print_record(const struct audit_record *rec)
+{
+	char date[32];
+	time_t sec = rec->time_us / 1000000;
+	struct tm tm;
+
+	gmtime_r(&sec, &tm);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+
+	printf("  {\"seq\": %" PRIu32 ", \"time\": \"%s.%06" PRIu64 "Z\", \"sn\": \"",
+	       rec->seq, date, rec->time_us % 1000000);
+	print_hex(rec->sn, sizeof(rec->sn));
+	printf("\", \"profile\": \"");
+	print_hex(rec->profile, sizeof(rec->profile));
+	printf("\", \"step\": \"%s\", \"status\": %u, \"retries\": %u, \"duration_us\": %" PRIu32,
+	       audit_step_name(rec->step), rec->status, rec->retries, rec->duration_us);
+	if (rec->slot != AUDIT_NONE)
+		printf(", \"slot\": %u", rec->slot);
+	if (rec->block != AUDIT_NONE)
+		printf(", \"block\": %u", rec->block);
+	printf("}");
+}
+
+/* Print the records of an audit log as a JSON array, up to the first one
+ * that is not valid. Only zeroes are expected after it.
+ */
+int main(int argc, char *argv[])
+{
+	int ret = -1;
+	FILE *f;
+	uint32_t count = 0;
+	struct audit_header hdr;
+	struct audit_record rec;
+	static const uint8_t zero[AUDIT_RECORD_SIZE];
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <log>\n", argv[0]);
+		return -1;
+	}
+
+	f = fopen(argv[1], "rb");
+	if (!f) {
+		perror(argv[1]);
+		return -1;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(hdr.magic, AUDIT_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != AUDIT_VERSION || hdr.record_size != AUDIT_RECORD_SIZE) {
+		fprintf(stderr, "%s is not an audit log\n", argv[1]);
+		goto out;
+	}
+
+	printf("[");
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if (!audit_record_valid(&rec) || rec.seq != count) {
+			if (memcmp(&rec, zero, sizeof(rec)))
+				fprintf(stderr, "Record %" PRIu32 " is not valid, stopping\n", count);
+			break;
+		}
+		printf("%s\n", count ? "," : "");
+		print_record(&rec);
+		count++;
+	}
+	printf("%s]\n", count ? "\n" : "");
+
+	ret = 0;
+out:
+	fclose(f);
+	return ret;
+}
@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <atecc508a.h>
+#include <atsha204a.h>
+#include <common.h>
+#include <plan.h>
+#include <session.h>
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* In a dry run, time is the worst case clock of the plan */
+static double session_clock(struct session *sess)
+{
+	return sess->plan ? sess->plan->max_ms : now_ms();
+}
+
+void session_init(struct session *sess, struct s96at_desc *desc, uint8_t dev)
+{
+	memset(sess, 0, sizeof(*sess));
+	sess->desc = desc;
+	sess->dev = dev;
+	sess->state = SESSION_ASLEEP;
+	sess->slot = SESSION_NO_SLOT;
+	sess->block = SESSION_NO_SLOT;
+}
+
+/* Run the session against a timing model instead of the device. It then
+ * holds a blank device: the config zone is all zeroes, and unlocked.
+ */
+void session_init_plan(struct session *sess, struct plan *plan, uint8_t dev)
+{
+	session_init(sess, NULL, dev);
+	sess->plan = plan;
+	sess->config[LOCK_VALUE_OFFSET] = S96AT_ZONE_UNLOCKED;
+	sess->config[LOCK_CONFIG_OFFSET] = S96AT_ZONE_UNLOCKED;
+}
+
+/* Compare the serial number of the device with the one read at the start
+ * of the session. A device that was pulled and replaced by another one
+ * answers wakes too, and must not get the rest of the sequence of the
+ * first one.
+ */
+static uint8_t session_check_sn(struct session *sess)
+{
+	uint8_t ret;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+
+	ret = s96at_get_serialnbr(sess->desc, sn);
+	if (ret != S96AT_STATUS_OK || memcmp(sn, sess->sn, sizeof(sn))) {
+		fprintf(stderr, "Device changed during the sequence\n");
+		sess->lost = 1;
+		return S96AT_STATUS_EXEC_ERROR;
+	}
+
+	return S96AT_STATUS_OK;
+}
+
+/* Make sure the device is awake, with at least needed_ms left before the
+ * watchdog expires. An awake device is put to idle first, as the watchdog
+ * only restarts on a wake from idle or sleep. Idle keeps TempKey.
+ *
+ * Once the serial number is known, it is checked again after each wake.
+ * A device that does not answer SESSION_WAKE_RETRIES wakes, or that is
+ * not the same device any more, is lost for the session: this and every
+ * later command fail. A dry run prices the read of the check.
+ */
+uint8_t session_wake(struct session *sess, double needed_ms)
+{
+	double now = session_clock(sess);
+	int tries = 0;
+
+	if (sess->lost)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	if (sess->state == SESSION_AWAKE) {
+		if (now - sess->woken_ms + needed_ms + SESSION_MARGIN_MS <= SESSION_WATCHDOG_MS)
+			return S96AT_STATUS_OK;
+
+		/* Past the watchdog, the device went to sleep on its own */
+		if (now - sess->woken_ms < SESSION_WATCHDOG_MS) {
+			if (sess->plan)
+				plan_idle(sess->plan);
+			else
+				s96at_idle(sess->desc);
+		}
+	}
+
+	if (sess->plan) {
+		plan_wake(sess->plan);
+	} else {
+		while (s96at_wake(sess->desc) != S96AT_STATUS_READY) {
+			if (sess->retries < UINT8_MAX)
+				sess->retries++;
+			if (++tries == SESSION_WAKE_RETRIES) {
+				fprintf(stderr, "Device does not answer\n");
+				sess->state = SESSION_ASLEEP;
+				sess->lost = 1;
+				return S96AT_STATUS_EXEC_ERROR;
+			}
+		}
+	}
+	sess->state = SESSION_AWAKE;
+	sess->woken_ms = session_clock(sess);
+
+	if (!sess->have_sn)
+		return S96AT_STATUS_OK;
+	if (sess->plan) {
+		plan_cmd(sess->plan, PLAN_OP_READ, 0, S96AT_BLOCK_SIZE, "serial number");
+		return S96AT_STATUS_OK;
+	}
+	return session_check_sn(sess);
+}
+
+/* Make sure the device is still the one the session started with */
+uint8_t session_confirm_sn(struct session *sess)
+{
+	uint8_t ret;
+
+	ret = session_wake(sess, SESSION_EXEC_READ_MS);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+	if (sess->plan) {
+		plan_cmd(sess->plan, PLAN_OP_READ, 0, S96AT_BLOCK_SIZE, "serial number");
+		return S96AT_STATUS_OK;
+	}
+
+	return session_check_sn(sess);
+}
+
+void session_idle(struct session *sess)
+{
+	if (sess->state == SESSION_AWAKE) {
+		if (sess->plan)
+			plan_idle(sess->plan);
+		else
+			s96at_idle(sess->desc);
+	}
+	sess->state = SESSION_IDLE;
+}
+
+void session_sleep(struct session *sess)
+{
+	if (sess->state != SESSION_ASLEEP) {
+		if (sess->plan)
+			plan_sleep(sess->plan);
+		else
+			s96at_sleep(sess->desc);
+	}
+	sess->state = SESSION_ASLEEP;
+}
+
+/* The reads atecc508a_read_config and atsha204a_read_config would do */
+static int plan_read_config(struct session *sess)
+{
+	char what[32];
+
+	if (sess->dev == S96AT_ATECC508A) {
+		for (int i = 0; i < S96AT_ATECC508A_ZONE_CONFIG_NUM_BLOCKS; i++) {
+			snprintf(what, sizeof(what), "config block %d", i);
+			plan_cmd(sess->plan, PLAN_OP_READ, 0, S96AT_BLOCK_SIZE, what);
+		}
+	} else {
+		for (int i = 0; i < S96AT_ATSHA204A_ZONE_CONFIG_NUM_WORDS; i++) {
+			snprintf(what, sizeof(what), "config word %d", i);
+			plan_cmd(sess->plan, PLAN_OP_READ, 0, S96AT_WORD_SIZE, what);
+		}
+	}
+
+	return S96AT_STATUS_OK;
+}
+
+/* The whole config zone, read from the device on first use. The buffer
+ * is valid until the config zone is written or a zone is locked.
+ */
+int session_read_config(struct session *sess, const uint8_t **config)
+{
+	uint8_t ret;
+
+	if (!sess->have_config) {
+		ret = session_wake(sess, ZONE_CONFIG_LEN_MAX / S96AT_WORD_SIZE * SESSION_EXEC_READ_MS);
+		if (ret != S96AT_STATUS_OK)
+			return ret;
+
+		if (sess->plan)
+			ret = plan_read_config(sess);
+		else if (sess->dev == S96AT_ATECC508A)
+			ret = atecc508a_read_config(sess->desc, sess->config);
+		else
+			ret = atsha204a_read_config(sess->desc, sess->config);
+		if (ret != S96AT_STATUS_OK)
+			return ret;
+
+		sess->have_config = 1;
+	}
+
+	*config = sess->config;
+	return S96AT_STATUS_OK;
+}
+
+/* The serial number is taken from the config zone if it was read
+ * already, otherwise it takes a single command.
+ */
+int session_get_sn(struct session *sess, uint8_t *sn)
+{
+	uint8_t ret;
+
+	if (!sess->have_sn) {
+		if (sess->have_config) {
+			memcpy(sess->sn, sess->config, 4);
+			memcpy(sess->sn + 4, sess->config + 8, 5);
+		} else {
+			ret = session_wake(sess, SESSION_EXEC_READ_MS);
+			if (ret != S96AT_STATUS_OK)
+				return ret;
+			if (sess->plan) {
+				plan_cmd(sess->plan, PLAN_OP_READ, 0, S96AT_BLOCK_SIZE, "serial number");
+				memset(sess->sn, 0, sizeof(sess->sn));
+				ret = S96AT_STATUS_OK;
+			} else {
+				ret = s96at_get_serialnbr(sess->desc, sess->sn);
+			}
+			if (ret != S96AT_STATUS_OK)
+				return ret;
+		}
+		sess->have_sn = 1;
+	}
+
+	memcpy(sn, sess->sn, sizeof(sess->sn));
+	return S96AT_STATUS_OK;
+}
+
+int session_get_lock(struct session *sess, uint8_t *lock_config, uint8_t *lock_data)
+{
+	uint8_t ret;
+
+	if (!sess->have_lock) {
+		if (sess->have_config) {
+			sess->lock_config = sess->config[LOCK_CONFIG_OFFSET];
+			sess->lock_data = sess->config[LOCK_VALUE_OFFSET];
+		} else if (sess->plan) {
+			session_wake(sess, 2 * SESSION_EXEC_READ_MS);
+			plan_cmd(sess->plan, PLAN_OP_READ, 0, S96AT_WORD_SIZE, "LockConfig");
+			plan_cmd(sess->plan, PLAN_OP_READ, 0, S96AT_WORD_SIZE, "LockValue");
+			sess->lock_config = sess->config[LOCK_CONFIG_OFFSET];
+			sess->lock_data = sess->config[LOCK_VALUE_OFFSET];
+		} else {
+			ret = session_wake(sess, 2 * SESSION_EXEC_READ_MS);
+			if (ret != S96AT_STATUS_OK)
+				return ret;
+			ret = s96at_get_lock_config(sess->desc, &sess->lock_config);
+			if (ret != S96AT_STATUS_OK)
+				return ret;
+			ret = s96at_get_lock_data(sess->desc, &sess->lock_data);
+			if (ret != S96AT_STATUS_OK)
+				return ret;
+		}
+		sess->have_lock = 1;
+	}
+
+	if (lock_config)
+		*lock_config = sess->lock_config;
+	if (lock_data)
+		*lock_data = sess->lock_data;
+	return S96AT_STATUS_OK;
+}
+
+/* Commands that change the device. In a dry run, they are priced with
+ * the timing model instead, and succeed. Nothing is sent to a device the
+ * session lost.
+ */
+uint8_t session_write_config(struct session *sess, uint8_t word, const uint8_t *buf)
+{
+	char what[32];
+
+	if (sess->lost)
+		return S96AT_STATUS_EXEC_ERROR;
+	if (!sess->plan)
+		return s96at_write_config(sess->desc, word, buf);
+
+	snprintf(what, sizeof(what), "config word %u", word);
+	plan_cmd(sess->plan, PLAN_OP_WRITE, S96AT_WORD_SIZE, 0, what);
+	return S96AT_STATUS_OK;
+}
+
+uint8_t session_write_data(struct session *sess, struct s96at_slot_addr *addr,
+			   const uint8_t *buf, size_t len)
+{
+	char what[32];
+
+	if (sess->lost)
+		return S96AT_STATUS_EXEC_ERROR;
+	if (!sess->plan)
+		return s96at_write_data(sess->desc, addr, S96AT_FLAG_NONE, buf, len);
+
+	snprintf(what, sizeof(what), "slot %u block %u", addr->slot, addr->block);
+	plan_cmd(sess->plan, PLAN_OP_WRITE, len, 0, what);
+	return S96AT_STATUS_OK;
+}
+
+uint8_t session_write_priv(struct session *sess, uint8_t slot, const uint8_t *priv)
+{
+	char what[32];
+
+	if (sess->lost)
+		return S96AT_STATUS_EXEC_ERROR;
+	if (!sess->plan)
+		return s96at_write_priv(sess->desc, slot, priv, NULL);
+
+	/* 36 bytes of padded key, and no MAC before the data zone is locked */
+	snprintf(what, sizeof(what), "slot %u", slot);
+	plan_cmd(sess->plan, PLAN_OP_PRIVWRITE, 36, 0, what);
+	return S96AT_STATUS_OK;
+}
+
+uint8_t session_write_otp(struct session *sess, uint8_t word, const uint8_t *buf,
+			  size_t len)
+{
+	char what[32];
+
+	if (sess->lost)
+		return S96AT_STATUS_EXEC_ERROR;
+	if (!sess->plan)
+		return s96at_write_otp(sess->desc, word, buf, len);
+
+	snprintf(what, sizeof(what), "OTP word %u", word);
+	plan_cmd(sess->plan, PLAN_OP_WRITE, len, 0, what);
+	return S96AT_STATUS_OK;
+}
+
+uint8_t session_lock_zone(struct session *sess, enum s96at_zone zone, uint16_t crc)
+{
+	uint8_t ret;
+
+	if (sess->lost) {
+		ret = S96AT_STATUS_EXEC_ERROR;
+	} else if (sess->plan) {
+		plan_cmd(sess->plan, PLAN_OP_LOCK, 0, 0,
+			 zone == S96AT_ZONE_CONFIG ? "config zone" : "data / OTP zones");
+		ret = S96AT_STATUS_OK;
+	} else {
+		ret = s96at_lock_zone(sess->desc, zone, crc);
+	}
+
+	session_zone_locked(sess, zone, ret);
+	return ret;
+}
+
+/* The serial number is read-only, so it is kept across writes */
+void session_config_written(struct session *sess)
+{
+	sess->have_config = 0;
+}
+
+/* The lock bytes are part of the config zone, so it is read again. The
+ * lock state itself is known if the Lock command succeeded.
+ */
+void session_zone_locked(struct session *sess, enum s96at_zone zone, uint8_t status)
+{
+	sess->have_config = 0;
+
+	if (status != S96AT_STATUS_OK) {
+		sess->have_lock = 0;
+		return;
+	}
+
+	if (zone == S96AT_ZONE_CONFIG)
+		sess->lock_config = S96AT_ZONE_LOCKED;
+	else
+		sess->lock_data = S96AT_ZONE_LOCKED;
+}
+
+/* Log a step that started at start_ms, with the wakes it retried and,
+ * if it failed while writing a slot, where.
+ */
+void session_audit(struct session *sess, struct audit_log *log, enum audit_step step,
+		   uint8_t status, double start_ms)
+{
+	audit_event(log, sess->have_sn ? sess->sn : NULL, step, status, sess->retries,
+		    (now_ms() - start_ms) * 1000,
+		    status == S96AT_STATUS_OK ? AUDIT_NONE : sess->slot,
+		    status == S96AT_STATUS_OK ? AUDIT_NONE : sess->block);
+
+	sess->retries = 0;
+	sess->slot = SESSION_NO_SLOT;
+	sess->block = SESSION_NO_SLOT;
+}
@@ -0,0 +1,262 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atecc508a.h>
+#include <common.h>
+#include <session.h>
+#include <station.h>
+
+#define POLL_INTERVAL_US	100000
+#define REMOVED_MISSES		3	/* Failed wakes before a device counts as removed */
+
+enum station_stage {
+	STAGE_DETECT,
+	STAGE_SERIAL,
+	STAGE_CONFIG,
+	STAGE_DATA,
+	STAGE_VERIFY,
+	STAGE_NUM
+};
+
+static const char *stage_names[STAGE_NUM] = {
+	"detect", "serial", "config", "data", "verify"
+};
+
+static volatile sig_atomic_t interrupted;
+
+static void station_sigint(int sig)
+{
+	interrupted = 1;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* A device is present if it answers a wake. It is left idle, so that the
+ * watchdog does not expire while we wait for it to be removed.
+ */
+static int device_present(struct s96at_desc *desc)
+{
+	if (s96at_wake(desc) != S96AT_STATUS_READY)
+		return 0;
+
+	s96at_idle(desc);
+	return 1;
+}
+
+static void wait_inserted(struct s96at_desc *desc)
+{
+	while (!interrupted && !device_present(desc))
+		usleep(POLL_INTERVAL_US);
+}
+
+static void wait_removed(struct s96at_desc *desc)
+{
+	int misses = 0;
+
+	printf("Remove the device\n");
+	while (!interrupted && misses < REMOVED_MISSES) {
+		misses = device_present(desc) ? 0 : misses + 1;
+		usleep(POLL_INTERVAL_US);
+	}
+}
+
+/* Both zones were locked during the sequence, so the session reads the
+ * config zone again, and the lock bytes come from it.
+ */
+static int verify_image(struct session *sess, const struct atecc508a_image *img)
+{
+	uint8_t ret;
+	uint8_t lock_config;
+	uint8_t lock_data;
+	const uint8_t *config_buf;
+
+	ret = session_read_config(sess, &config_buf);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read config\n");
+		return -1;
+	}
+
+	ret = session_get_lock(sess, &lock_config, &lock_data);
+	if (ret != S96AT_STATUS_OK || lock_config != S96AT_ZONE_LOCKED) {
+		fprintf(stderr, "Config zone not locked\n");
+		return -1;
+	}
+
+	if (lock_data != S96AT_ZONE_LOCKED) {
+		fprintf(stderr, "Data zone not locked\n");
+		return -1;
+	}
+
+	if (memcmp(config_buf + SLOT_CONFIG_OFFSET, img->slot_config,
+		   ARRAY_LEN(img->slot_config)) ||
+	    memcmp(config_buf + KEY_CONFIG_OFFSET, img->key_config,
+		   ARRAY_LEN(img->key_config))) {
+		fprintf(stderr, "Config does not match the image\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Run the sequence on the device just inserted, logging each stage.
+ * Returns the stage that failed, or STAGE_NUM on success.
+ */
+static int station_device(struct s96at_desc *desc, struct atecc508a_image *img,
+			  const uint8_t *master, const struct derive_tray *tray,
+			  struct audit_log *audit, uint8_t *sn, double *times)
+{
+	uint8_t ret;
+	uint8_t lock_data;
+	double t;
+	struct session sess;
+
+	/* A new device: nothing is known about it yet */
+	session_init(&sess, desc, S96AT_ATECC508A);
+
+	t = now_ms();
+	ret = session_get_sn(&sess, sn);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Failed to get SN\n");
+		goto serial_out;
+	}
+
+	ret = session_get_lock(&sess, NULL, &lock_data);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Failed to get LockData\n");
+		goto serial_out;
+	}
+
+	if (lock_data == S96AT_ZONE_LOCKED) {
+		fprintf(stderr, "Device already personalized\n");
+		ret = S96AT_STATUS_EXEC_ERROR;
+		goto serial_out;
+	}
+
+	if (master)
+		derive_image_keys(master, tray, sn, img);
+serial_out:
+	times[STAGE_SERIAL] = now_ms() - t;
+	session_audit(&sess, audit, AUDIT_STEP_SERIAL, ret, t);
+	if (ret != S96AT_STATUS_OK)
+		return STAGE_SERIAL;
+
+	/* The session wakes the device again whenever the watchdog could
+	 * expire in the middle of a sequence of commands, and gives up on a
+	 * device that stops answering or is swapped for another one. Each
+	 * stage also starts by checking that the device is still there.
+	 */
+	t = now_ms();
+	ret = session_confirm_sn(&sess);
+	if (ret == S96AT_STATUS_OK)
+		ret = atecc508a_personalize_config_image(&sess, img);
+	times[STAGE_CONFIG] = now_ms() - t;
+	session_audit(&sess, audit, AUDIT_STEP_CONFIG, ret, t);
+	if (ret != S96AT_STATUS_OK)
+		return STAGE_CONFIG;
+
+	t = now_ms();
+	ret = session_confirm_sn(&sess);
+	if (ret == S96AT_STATUS_OK)
+		ret = atecc508a_personalize_data_image(&sess, img);
+	times[STAGE_DATA] = now_ms() - t;
+	session_audit(&sess, audit, AUDIT_STEP_DATA, ret, t);
+	if (ret != S96AT_STATUS_OK)
+		return STAGE_DATA;
+
+	t = now_ms();
+	ret = session_confirm_sn(&sess);
+	if (ret == S96AT_STATUS_OK && verify_image(&sess, img))
+		ret = S96AT_STATUS_EXEC_ERROR;
+	times[STAGE_VERIFY] = now_ms() - t;
+	session_audit(&sess, audit, AUDIT_STEP_VERIFY, ret, t);
+	if (ret != S96AT_STATUS_OK)
+		return STAGE_VERIFY;
+
+	session_sleep(&sess);
+
+	return STAGE_NUM;
+}
+
+int station_run(struct s96at_desc *desc, const uint8_t *master,
+		struct derive_tray *tray, struct audit_log *audit)
+{
+	int stage;
+	unsigned long done = 0;
+	unsigned long failed = 0;
+	double start;
+	double t;
+	double times[STAGE_NUM];
+	double totals[STAGE_NUM] = { 0 };
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	struct atecc508a_image img;
+
+	signal(SIGINT, station_sigint);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	if (master && tray) {
+		t = now_ms();
+		derive_tray_keys(master, tray);
+		printf("Derived keys for %zu devices in %.1f ms\n", tray->num, now_ms() - t);
+	}
+
+	printf("Station ready, insert a device (Ctrl-C to stop)\n");
+	start = now_ms();
+	while (!interrupted) {
+		/* The keys that depend on the serial number are filled in once
+		 * the device is known, from the tray if possible.
+		 */
+		atecc508a_image_init(&img);
+
+		memset(times, 0, sizeof(times));
+		memset(sn, 0, sizeof(sn));
+
+		t = now_ms();
+		wait_inserted(desc);
+		if (interrupted)
+			break;
+		times[STAGE_DETECT] = now_ms() - t;
+
+		stage = station_device(desc, &img, master, tray, audit, sn, times);
+		if (stage == STAGE_NUM) {
+			done++;
+			for (int i = 0; i < STAGE_NUM; i++)
+				totals[i] += times[i];
+		} else {
+			failed++;
+		}
+
+		printf("%lu %02x%02x%02x%02x%02x%02x%02x%02x%02x %s",
+		       done + failed, sn[0], sn[1], sn[2], sn[3], sn[4],
+		       sn[5], sn[6], sn[7], sn[8],
+		       stage == STAGE_NUM ? "OK" : "FAIL");
+		if (stage != STAGE_NUM)
+			printf(" (%s)", stage_names[stage]);
+		for (int i = 0; i < STAGE_NUM; i++)
+			printf(" %s=%.0fms", stage_names[i], times[i]);
+		printf(" | %.1f devices/h\n", done * 3600000.0 / (now_ms() - start));
+
+		wait_removed(desc);
+	}
+
+	printf("\n%lu personalized, %lu failed in %.0f s\n", done, failed,
+	       (now_ms() - start) / 1000);
+	if (done) {
+		printf("Average per device:");
+		for (int i = 0; i < STAGE_NUM; i++)
+			printf(" %s=%.0fms", stage_names[i], totals[i] / done);
+		printf("\n");
+	}
+
+	return 0;
+}
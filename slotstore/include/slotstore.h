@@ -0,0 +1,91 @@
+#ifndef __SLOTSTORE_H
+#define __SLOTSTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <secure96/s96at.h>
+
+#include <slotkey.h>
+
+#define STORE_SLOT		8
+#define STORE_NUM_BLOCKS	13	/* 416 bytes */
+#define STORE_BLOCK_LEN		32
+
+#define STORE_HEADER_BLOCK	0
+#define STORE_COUNTER_BLOCK	1
+#define STORE_FIRST_DATA_BLOCK	2
+
+#define STORE_MAGIC		"S96S"
+#define STORE_VERSION		1
+#define STORE_MAX_RECORDS	6
+#define STORE_MAX_RECORD_LEN	((STORE_NUM_BLOCKS - STORE_FIRST_DATA_BLOCK) * STORE_BLOCK_LEN)
+
+/* Block writes counted in memory before the counters are written back to
+ * block 1, so that block 1 does not take a write for every command.
+ */
+#define STORE_COUNTER_BATCH	16
+
+/* Block 0: the header, with the index of records */
+struct __attribute__((__packed__)) store_index_entry {
+	uint8_t id;		/* 0 if unused */
+	uint8_t block;		/* First block of the record */
+	uint8_t len[2];		/* Little endian */
+};
+
+struct __attribute__((__packed__)) store_header {
+	uint8_t magic[4];
+	uint8_t version;
+	uint8_t num_records;
+	uint8_t reserved[2];
+	struct store_index_entry index[STORE_MAX_RECORDS];
+};
+
+/* Block 1: the number of writes each block has taken, little endian */
+struct __attribute__((__packed__)) store_counters {
+	uint8_t writes[STORE_NUM_BLOCKS][2];
+	uint8_t reserved[6];
+};
+
+struct slotstore {
+	struct s96at_desc *desc;
+	uint8_t sn[S96AT_SERIAL_NUMBER_LEN];
+	int encrypt_read;
+	int encrypt_write;
+	uint8_t read_key_slot;
+	uint8_t write_key_slot;
+	uint8_t read_key[SLOTKEY_LEN];
+	uint8_t write_key[SLOTKEY_LEN];
+	/* Read cache: the contents of each block as last read or written */
+	uint8_t blocks[STORE_NUM_BLOCKS][STORE_BLOCK_LEN];
+	uint16_t cached;	/* Bitmap of valid blocks */
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long writes;
+	unsigned int unflushed;	/* Block writes not counted in block 1 yet */
+	int awake;
+};
+
+/* Open the store in the device behind desc. The keys of encrypted reads
+ * and writes are derived from master, as s96util -m does, or are the ones
+ * of the test configuration if master is NULL.
+ */
+int store_open(struct slotstore *st, struct s96at_desc *desc, const uint8_t *master);
+
+int store_format(struct slotstore *st);
+
+int store_load(struct slotstore *st);
+
+int store_get(struct slotstore *st, uint8_t id, uint8_t *buf, size_t *len);
+
+int store_put(struct slotstore *st, uint8_t id, const uint8_t *buf, size_t len);
+
+int store_del(struct slotstore *st, uint8_t id);
+
+int store_close(struct slotstore *st);
+
+const struct store_header *store_header(const struct slotstore *st);
+
+uint16_t store_block_writes(const struct slotstore *st, int block);
+
+#endif
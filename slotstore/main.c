@@ -0,0 +1,229 @@
+#include <openssl/crypto.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <secure96/s96at.h>
+
+#include <slotkey.h>
+#include <slotstore.h>
+
+#define LINE_LEN_MAX	1024
+#define MAX_ARGS	3
+
+static char *progname;
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: %s [-m master.key] [command]...\n", progname);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  -m <file>        Master key the device keys were derived from by s96util -m\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Commands:\n");
+	fprintf(stderr, "  format           Create an empty store in slot %d\n", STORE_SLOT);
+	fprintf(stderr, "  list             List the records\n");
+	fprintf(stderr, "  get <id>         Print record <id> in hex\n");
+	fprintf(stderr, "  put <id> <hex>   Create or update record <id>\n");
+	fprintf(stderr, "  del <id>         Delete record <id>\n");
+	fprintf(stderr, "  stats            Print the block write counters and cache stats\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Commands are run in order, sharing the read cache. Without commands,\n");
+	fprintf(stderr, "one command per line is read from stdin.\n");
+}
+
+static void print_hex(FILE *fp, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		fprintf(fp, "%02x", buf[i]);
+}
+
+static int parse_hex(const char *str, uint8_t *buf, size_t *len)
+{
+	size_t n = strlen(str);
+
+	if (n % 2 || n / 2 > *len)
+		return -1;
+
+	for (size_t i = 0; i < n / 2; i++) {
+		if (sscanf(str + 2 * i, "%2hhx", &buf[i]) != 1)
+			return -1;
+	}
+	*len = n / 2;
+	return 0;
+}
+
+static int parse_id(const char *str, uint8_t *id)
+{
+	unsigned long val;
+	char *end;
+
+	val = strtoul(str, &end, 0);
+	if (*end || !val || val > 0xff) {
+		fprintf(stderr, "Invalid record id: %s\n", str);
+		return -1;
+	}
+	*id = val;
+	return 0;
+}
+
+static void print_list(const struct slotstore *st)
+{
+	const struct store_header *hdr = store_header(st);
+	const struct store_index_entry *e;
+
+	printf("%u records\n", hdr->num_records);
+	for (int i = 0; i < STORE_MAX_RECORDS; i++) {
+		e = &hdr->index[i];
+		if (!e->id)
+			continue;
+		printf("  id %3u: block %2u, %u bytes\n", e->id, e->block,
+		       e->len[0] | e->len[1] << 8);
+	}
+}
+
+static void print_stats(const struct slotstore *st)
+{
+	printf("Block writes:");
+	for (int b = 0; b < STORE_NUM_BLOCKS; b++)
+		printf(" %u", store_block_writes(st, b));
+	printf("\n");
+	printf("Cache: %lu hits, %lu misses; %lu blocks written\n",
+	       st->hits, st->misses, st->writes);
+}
+
+/* Run one command. argv[0] is the command name. Returns the number of
+ * arguments consumed, or -1 on error.
+ */
+static int run_command(struct slotstore *st, int argc, char **argv)
+{
+	uint8_t id;
+	uint8_t buf[STORE_MAX_RECORD_LEN];
+	size_t len = sizeof(buf);
+
+	if (!strcmp(argv[0], "format")) {
+		return store_format(st) ? -1 : 1;
+	}
+
+	if (store_load(st))
+		return -1;
+
+	if (!strcmp(argv[0], "list")) {
+		print_list(st);
+		return 1;
+	} else if (!strcmp(argv[0], "stats")) {
+		print_stats(st);
+		return 1;
+	} else if (!strcmp(argv[0], "get") && argc >= 2) {
+		if (parse_id(argv[1], &id) || store_get(st, id, buf, &len))
+			return -1;
+		print_hex(stdout, buf, len);
+		printf("\n");
+		return 2;
+	} else if (!strcmp(argv[0], "put") && argc >= 3) {
+		if (parse_id(argv[1], &id))
+			return -1;
+		if (parse_hex(argv[2], buf, &len)) {
+			fprintf(stderr, "Invalid data: %s\n", argv[2]);
+			return -1;
+		}
+		return store_put(st, id, buf, len) ? -1 : 3;
+	} else if (!strcmp(argv[0], "del") && argc >= 2) {
+		if (parse_id(argv[1], &id) || store_del(st, id))
+			return -1;
+		return 2;
+	}
+
+	usage();
+	return -1;
+}
+
+static int run_stdin(struct slotstore *st)
+{
+	int ret = 0;
+	int argc;
+	char line[LINE_LEN_MAX];
+	char *argv[MAX_ARGS];
+	char *tok;
+
+	while (fgets(line, sizeof(line), stdin)) {
+		argc = 0;
+		for (tok = strtok(line, " \t\n"); tok && argc < MAX_ARGS;
+		     tok = strtok(NULL, " \t\n"))
+			argv[argc++] = tok;
+		if (!argc || argv[0][0] == '#')
+			continue;
+		if (run_command(st, argc, argv) < 0)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret = -1;
+	int n;
+	int opt;
+	uint8_t s96_ret;
+	uint8_t master[SLOTKEY_MASTER_LEN];
+	int use_master = 0;
+	struct s96at_desc desc;
+	struct slotstore st;
+
+	progname = argv[0];
+
+	if (argc > 1 && !strcmp(argv[1], "--help")) {
+		usage();
+		return 0;
+	}
+
+	/* Options come before the commands */
+	while ((opt = getopt(argc, argv, "+hm:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (slotkey_read_master(optarg, master))
+				return -1;
+			use_master = 1;
+			break;
+		case 'h':
+			usage();
+			return 0;
+		default:
+			usage();
+			return -1;
+		}
+	}
+
+	s96_ret = s96at_init(S96AT_ATECC508A, S96AT_IO_I2C_LINUX, &desc);
+	if (s96_ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not initialize the device\n");
+		goto key_out;
+	}
+
+	if (store_open(&st, &desc, use_master ? master : NULL))
+		goto out;
+
+	if (optind == argc) {
+		ret = run_stdin(&st);
+		goto store_out;
+	}
+
+	for (int i = optind; i < argc; i += n) {
+		n = run_command(&st, argc - i, argv + i);
+		if (n < 0)
+			goto store_out;
+	}
+	ret = 0;
+store_out:
+	if (store_close(&st))
+		ret = -1;
+out:
+	s96at_sleep(&desc);
+	s96at_cleanup(&desc);
+key_out:
+	OPENSSL_cleanse(master, sizeof(master));
+
+	return ret;
+}
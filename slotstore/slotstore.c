@@ -0,0 +1,629 @@
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <slotstore.h>
+
+#define OPCODE_GENDIG		0x15
+#define OPCODE_WRITE		0x12
+#define WRITE_PARAM1_DATA_32	0x82	/* 32 bytes to the Data zone */
+
+#define SLOT_CONFIG_OFFSET	20
+
+/* SlotConfig bits, Sect 2.2.1 of the ATECC508A datasheet */
+#define SLOT_READ_KEY(c)	((c) & 0x0f)
+#define SLOT_ENCRYPT_READ(c)	((c) & (1 << 6))
+#define SLOT_IS_SECRET(c)	((c) & (1 << 7))
+#define SLOT_WRITE_KEY(c)	(((c) >> 8) & 0x0f)
+#define SLOT_WRITE_CONFIG(c)	(((c) >> 12) & 0x0f)
+
+#define WRITE_CONFIG_ALWAYS	0x0
+#define WRITE_CONFIG_ENCRYPT	0x4	/* 01xx */
+
+struct __attribute__((__packed__)) gendig_in {
+	uint8_t data[32];
+	uint8_t opcode;
+	uint8_t param1;
+	uint8_t param2[2];
+	uint8_t sn_hi;
+	uint8_t sn_lo[2];
+	uint8_t zero[25];
+	uint8_t temp_key[32];
+};
+
+struct __attribute__((__packed__)) write_mac_in {
+	uint8_t temp_key[32];
+	uint8_t opcode;
+	uint8_t param1;
+	uint8_t param2[2];
+	uint8_t sn_hi;
+	uint8_t sn_lo[2];
+	uint8_t zero[25];
+	uint8_t data[32];
+};
+
+static uint16_t get_le16(const uint8_t *buf)
+{
+	return buf[0] | buf[1] << 8;
+}
+
+static void put_le16(uint8_t *buf, uint16_t val)
+{
+	buf[0] = val & 0xff;
+	buf[1] = val >> 8;
+}
+
+/* The device is only woken on the first access that misses the cache, and
+ * put back to idle at the end of each store operation.
+ */
+static void device_acquire(struct slotstore *st)
+{
+	if (st->awake)
+		return;
+	while (s96at_wake(st->desc) != S96AT_STATUS_READY) {};
+	st->awake = 1;
+}
+
+static void device_release(struct slotstore *st)
+{
+	if (!st->awake)
+		return;
+	s96at_idle(st->desc);
+	st->awake = 0;
+}
+
+/* The key in key_slot. Without a master key, the keys of our test
+ * configuration, where all bytes of each symmetric key are set to the
+ * slot number, ie for Slot 0 the key is all 0x00, for Slot 1 the key is
+ * all 0x11 etc. With a master key, the key s96util -m derived for this
+ * device.
+ */
+static int slot_key(const struct slotstore *st, const uint8_t *master, uint8_t key_slot,
+		    uint8_t *key)
+{
+	if (!master) {
+		memset(key, key_slot * 0x11, SLOTKEY_LEN);
+		return 0;
+	}
+
+	if (slotkey_derive_one(master, st->sn, key_slot, key)) {
+		fprintf(stderr, "Key slot %d has no key derived from the master key\n", key_slot);
+		return -1;
+	}
+	return 0;
+}
+
+/* Load TempKey with a digest of key, the key in key_slot, and compute the
+ * same value on the host.
+ */
+static uint8_t gen_temp_key(struct slotstore *st, uint8_t key_slot, const uint8_t *key,
+			    uint8_t *temp_key)
+{
+	uint8_t ret;
+	uint8_t num_in[S96AT_RANDOM_LEN];
+	struct gendig_in digest_in;
+
+	if (RAND_bytes(num_in, sizeof(num_in)) != 1)
+		return S96AT_STATUS_EXEC_ERROR;
+
+	ret = s96at_gen_nonce(st->desc, S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not generate nonce\n");
+		return ret;
+	}
+
+	ret = s96at_gen_digest(st->desc, S96AT_ZONE_DATA, key_slot, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not generate digest\n");
+		return ret;
+	}
+
+	memcpy(digest_in.data, key, 32);
+	digest_in.opcode = OPCODE_GENDIG;
+	digest_in.param1 = S96AT_ZONE_DATA;
+	digest_in.param2[0] = key_slot;
+	digest_in.param2[1] = 0x00;
+	digest_in.sn_hi = st->sn[8];
+	digest_in.sn_lo[0] = st->sn[0];
+	digest_in.sn_lo[1] = st->sn[1];
+	memset(digest_in.zero, 0, 25);
+	memcpy(digest_in.temp_key, num_in, 32);
+
+	SHA256((uint8_t *)&digest_in, sizeof(digest_in), temp_key);
+
+	return S96AT_STATUS_OK;
+}
+
+static uint8_t read_block(struct slotstore *st, int block, uint8_t *buf)
+{
+	uint8_t ret;
+	uint8_t temp_key[S96AT_SHA_LEN];
+	struct s96at_slot_addr addr = {
+		.slot = STORE_SLOT,
+		.block = block,
+		.offset = 0
+	};
+
+	if (st->cached & (1 << block)) {
+		memcpy(buf, st->blocks[block], STORE_BLOCK_LEN);
+		st->hits++;
+		return S96AT_STATUS_OK;
+	}
+
+	st->misses++;
+	device_acquire(st);
+
+	if (st->encrypt_read) {
+		ret = gen_temp_key(st, st->read_key_slot, st->read_key, temp_key);
+		if (ret != S96AT_STATUS_OK)
+			return ret;
+		ret = s96at_read_data(st->desc, &addr, S96AT_FLAG_ENCRYPT, buf, STORE_BLOCK_LEN);
+		for (int i = 0; i < STORE_BLOCK_LEN; i++)
+			buf[i] ^= temp_key[i];
+	} else {
+		ret = s96at_read_data(st->desc, &addr, S96AT_FLAG_NONE, buf, STORE_BLOCK_LEN);
+	}
+
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not read block %d\n", block);
+		return ret;
+	}
+
+	memcpy(st->blocks[block], buf, STORE_BLOCK_LEN);
+	st->cached |= 1 << block;
+
+	return S96AT_STATUS_OK;
+}
+
+/* An encrypted Write takes the data XORed with TempKey, followed by a MAC
+ * over the plaintext (Sect 9.21 of the ATECC508A datasheet).
+ */
+static uint8_t write_block_encrypted(struct slotstore *st, struct s96at_slot_addr *addr,
+				     const uint8_t *buf)
+{
+	uint8_t ret;
+	uint8_t temp_key[S96AT_SHA_LEN];
+	uint8_t payload[2 * STORE_BLOCK_LEN];
+	struct write_mac_in mac_in;
+
+	ret = gen_temp_key(st, st->write_key_slot, st->write_key, temp_key);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	memcpy(mac_in.temp_key, temp_key, 32);
+	mac_in.opcode = OPCODE_WRITE;
+	mac_in.param1 = WRITE_PARAM1_DATA_32;
+	mac_in.param2[0] = addr->slot << 3;
+	mac_in.param2[1] = addr->block;
+	mac_in.sn_hi = st->sn[8];
+	mac_in.sn_lo[0] = st->sn[0];
+	mac_in.sn_lo[1] = st->sn[1];
+	memset(mac_in.zero, 0, 25);
+	memcpy(mac_in.data, buf, 32);
+
+	for (int i = 0; i < STORE_BLOCK_LEN; i++)
+		payload[i] = buf[i] ^ temp_key[i];
+	SHA256((uint8_t *)&mac_in, sizeof(mac_in), payload + STORE_BLOCK_LEN);
+
+	return s96at_write_data(st->desc, addr, S96AT_FLAG_ENCRYPT, payload, sizeof(payload));
+}
+
+static uint8_t device_write(struct slotstore *st, int block, const uint8_t *buf)
+{
+	uint8_t ret;
+	struct s96at_slot_addr addr = {
+		.slot = STORE_SLOT,
+		.block = block,
+		.offset = 0
+	};
+
+	device_acquire(st);
+
+	if (st->encrypt_write)
+		ret = write_block_encrypted(st, &addr, buf);
+	else
+		ret = s96at_write_data(st->desc, &addr, S96AT_FLAG_NONE, buf, STORE_BLOCK_LEN);
+
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Could not write block %d\n", block);
+		st->cached &= ~(1 << block);
+		return ret;
+	}
+
+	memcpy(st->blocks[block], buf, STORE_BLOCK_LEN);
+	st->cached |= 1 << block;
+	st->writes++;
+
+	return S96AT_STATUS_OK;
+}
+
+/* Write a block, unless it already holds the same data. Blocks are read
+ * before they are written if not cached, to save EEPROM writes. The write
+ * counters are updated in the cache, and written back by sync_counters().
+ */
+static uint8_t write_block(struct slotstore *st, int block, const uint8_t *buf)
+{
+	uint8_t ret;
+	uint8_t cur[STORE_BLOCK_LEN];
+	struct store_counters *counters;
+
+	ret = read_block(st, STORE_COUNTER_BLOCK, cur);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	ret = read_block(st, block, cur);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	if (!memcmp(cur, buf, STORE_BLOCK_LEN))
+		return S96AT_STATUS_OK;
+
+	ret = device_write(st, block, buf);
+	if (ret != S96AT_STATUS_OK)
+		return ret;
+
+	counters = (struct store_counters *)st->blocks[STORE_COUNTER_BLOCK];
+	put_le16(counters->writes[block], get_le16(counters->writes[block]) + 1);
+	st->unflushed++;
+
+	return S96AT_STATUS_OK;
+}
+
+static uint8_t flush_counters(struct slotstore *st)
+{
+	uint8_t buf[STORE_BLOCK_LEN];
+	struct store_counters *counters = (struct store_counters *)buf;
+
+	memcpy(buf, st->blocks[STORE_COUNTER_BLOCK], STORE_BLOCK_LEN);
+	put_le16(counters->writes[STORE_COUNTER_BLOCK],
+		 get_le16(counters->writes[STORE_COUNTER_BLOCK]) + 1);
+
+	return device_write(st, STORE_COUNTER_BLOCK, buf);
+}
+
+/* Write the counters back once STORE_COUNTER_BATCH block writes were
+ * counted, or whenever some are pending if forced. Writes counted since
+ * the last sync are lost if the process dies: the counters are a wear
+ * estimate, and block 1 would otherwise wear out first.
+ */
+static uint8_t sync_counters(struct slotstore *st, int force)
+{
+	uint8_t ret;
+
+	if (!st->unflushed || (!force && st->unflushed < STORE_COUNTER_BATCH))
+		return S96AT_STATUS_OK;
+
+	ret = flush_counters(st);
+	if (ret == S96AT_STATUS_OK)
+		st->unflushed = 0;
+
+	return ret;
+}
+
+int store_open(struct slotstore *st, struct s96at_desc *desc, const uint8_t *master)
+{
+	int ret = -1;
+	uint8_t lock_data;
+	uint8_t config[2 * S96AT_BLOCK_SIZE];
+	uint16_t slot_config;
+
+	memset(st, 0, sizeof(*st));
+	st->desc = desc;
+
+	device_acquire(st);
+
+	if (s96at_get_lock_data(desc, &lock_data) != S96AT_STATUS_OK ||
+	    lock_data != S96AT_ZONE_LOCKED) {
+		fprintf(stderr, "Data zone not locked\n");
+		goto out;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		if (s96at_read_config(desc, i, config + i * S96AT_BLOCK_SIZE) != S96AT_STATUS_OK) {
+			fprintf(stderr, "Could not read config block %d\n", i);
+			goto out;
+		}
+	}
+
+	/* SN[0:3] is at bytes 0-3 of the config zone, SN[4:8] at 8-12 */
+	memcpy(st->sn, config, 4);
+	memcpy(st->sn + 4, config + 8, 5);
+
+	slot_config = get_le16(config + SLOT_CONFIG_OFFSET + 2 * STORE_SLOT);
+
+	if (!SLOT_IS_SECRET(slot_config)) {
+		st->encrypt_read = 0;
+	} else if (SLOT_ENCRYPT_READ(slot_config)) {
+		st->encrypt_read = 1;
+		st->read_key_slot = SLOT_READ_KEY(slot_config);
+		if (slot_key(st, master, st->read_key_slot, st->read_key))
+			goto out;
+	} else {
+		fprintf(stderr, "Slot %d is secret and cannot be read\n", STORE_SLOT);
+		goto out;
+	}
+
+	if (SLOT_WRITE_CONFIG(slot_config) == WRITE_CONFIG_ALWAYS) {
+		st->encrypt_write = 0;
+	} else if ((SLOT_WRITE_CONFIG(slot_config) & 0x0c) == WRITE_CONFIG_ENCRYPT) {
+		st->encrypt_write = 1;
+		st->write_key_slot = SLOT_WRITE_KEY(slot_config);
+		if (slot_key(st, master, st->write_key_slot, st->write_key))
+			goto out;
+	} else {
+		fprintf(stderr, "Slot %d cannot be written (WriteConfig 0x%x)\n",
+			STORE_SLOT, SLOT_WRITE_CONFIG(slot_config));
+		goto out;
+	}
+
+	ret = 0;
+out:
+	device_release(st);
+	if (ret) {
+		OPENSSL_cleanse(st->read_key, sizeof(st->read_key));
+		OPENSSL_cleanse(st->write_key, sizeof(st->write_key));
+	}
+	return ret;
+}
+
+/* Write an empty index. The write counters are kept if the slot already
+ * holds a store.
+ */
+int store_format(struct slotstore *st)
+{
+	int ret = -1;
+	uint8_t buf[STORE_BLOCK_LEN];
+	struct store_header *hdr = (struct store_header *)buf;
+
+	if (read_block(st, STORE_COUNTER_BLOCK, buf) != S96AT_STATUS_OK ||
+	    read_block(st, STORE_HEADER_BLOCK, buf) != S96AT_STATUS_OK)
+		goto out;
+
+	if (memcmp(hdr->magic, STORE_MAGIC, sizeof(hdr->magic)))
+		memset(st->blocks[STORE_COUNTER_BLOCK], 0, STORE_BLOCK_LEN);
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(hdr->magic, STORE_MAGIC, sizeof(hdr->magic));
+	hdr->version = STORE_VERSION;
+
+	if (write_block(st, STORE_HEADER_BLOCK, buf) != S96AT_STATUS_OK)
+		goto out;
+
+	if (sync_counters(st, 1) != S96AT_STATUS_OK)
+		goto out;
+
+	ret = 0;
+out:
+	device_release(st);
+	return ret;
+}
+
+int store_load(struct slotstore *st)
+{
+	int ret = -1;
+	uint8_t buf[STORE_BLOCK_LEN];
+	struct store_header *hdr = (struct store_header *)buf;
+
+	if (read_block(st, STORE_HEADER_BLOCK, buf) != S96AT_STATUS_OK)
+		goto out;
+
+	if (memcmp(hdr->magic, STORE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != STORE_VERSION) {
+		fprintf(stderr, "Slot %d does not hold a store\n", STORE_SLOT);
+		goto out;
+	}
+
+	if (read_block(st, STORE_COUNTER_BLOCK, buf) != S96AT_STATUS_OK)
+		goto out;
+
+	ret = 0;
+out:
+	device_release(st);
+	return ret;
+}
+
+static struct store_index_entry *find_entry(struct store_header *hdr, uint8_t id)
+{
+	for (int i = 0; i < STORE_MAX_RECORDS; i++) {
+		if (hdr->index[i].id == id)
+			return &hdr->index[i];
+	}
+	return NULL;
+}
+
+static int num_blocks(size_t len)
+{
+	return (len + STORE_BLOCK_LEN - 1) / STORE_BLOCK_LEN;
+}
+
+/* First fit of a contiguous run of blocks. The blocks of a record being
+ * replaced count as used: they only become free once the index points to
+ * the new ones.
+ */
+static int alloc_blocks(const struct store_header *hdr, int count)
+{
+	uint16_t used = 0;
+	int run = 0;
+
+	for (int i = 0; i < STORE_MAX_RECORDS; i++) {
+		const struct store_index_entry *e = &hdr->index[i];
+
+		if (!e->id)
+			continue;
+		for (int b = 0; b < num_blocks(get_le16(e->len)); b++)
+			used |= 1 << (e->block + b);
+	}
+
+	for (int b = STORE_FIRST_DATA_BLOCK; b < STORE_NUM_BLOCKS; b++) {
+		run = (used & (1 << b)) ? 0 : run + 1;
+		if (run == count)
+			return b - count + 1;
+	}
+	return -1;
+}
+
+int store_get(struct slotstore *st, uint8_t id, uint8_t *buf, size_t *len)
+{
+	int ret = -1;
+	uint8_t hdr_buf[STORE_BLOCK_LEN];
+	uint8_t block[STORE_BLOCK_LEN];
+	size_t rec_len;
+	size_t n;
+	struct store_header *hdr = (struct store_header *)hdr_buf;
+	struct store_index_entry *e;
+
+	if (read_block(st, STORE_HEADER_BLOCK, hdr_buf) != S96AT_STATUS_OK)
+		goto out;
+
+	e = id ? find_entry(hdr, id) : NULL;
+	if (!e) {
+		fprintf(stderr, "No record %u\n", id);
+		goto out;
+	}
+
+	rec_len = get_le16(e->len);
+	if (rec_len > *len) {
+		fprintf(stderr, "Record %u does not fit in %zu bytes\n", id, *len);
+		goto out;
+	}
+
+	for (int b = 0; b < num_blocks(rec_len); b++) {
+		if (read_block(st, e->block + b, block) != S96AT_STATUS_OK)
+			goto out;
+		n = rec_len - b * STORE_BLOCK_LEN;
+		if (n > STORE_BLOCK_LEN)
+			n = STORE_BLOCK_LEN;
+		memcpy(buf + b * STORE_BLOCK_LEN, block, n);
+	}
+	*len = rec_len;
+
+	ret = 0;
+out:
+	device_release(st);
+	return ret;
+}
+
+/* A record that keeps the same number of blocks is updated in place, and
+ * only the blocks whose contents change are written. Otherwise the record
+ * is written to free blocks first, and the index is updated last, so that
+ * an interrupted update leaves the previous record intact.
+ */
+int store_put(struct slotstore *st, uint8_t id, const uint8_t *buf, size_t len)
+{
+	int ret = -1;
+	int first;
+	uint8_t hdr_buf[STORE_BLOCK_LEN];
+	uint8_t block[STORE_BLOCK_LEN];
+	size_t n;
+	struct store_header *hdr = (struct store_header *)hdr_buf;
+	struct store_index_entry *e;
+
+	if (!id || !len || len > STORE_MAX_RECORD_LEN) {
+		fprintf(stderr, "Invalid record %u of %zu bytes\n", id, len);
+		return -1;
+	}
+
+	if (read_block(st, STORE_HEADER_BLOCK, hdr_buf) != S96AT_STATUS_OK)
+		goto out;
+
+	e = find_entry(hdr, id);
+	if (e && num_blocks(get_le16(e->len)) == num_blocks(len)) {
+		first = e->block;
+	} else {
+		if (!e)
+			e = find_entry(hdr, 0);
+		if (!e) {
+			fprintf(stderr, "Index full\n");
+			goto out;
+		}
+		first = alloc_blocks(hdr, num_blocks(len));
+		if (first < 0) {
+			fprintf(stderr, "Not enough free blocks for %zu bytes\n", len);
+			goto out;
+		}
+	}
+
+	for (int b = 0; b < num_blocks(len); b++) {
+		memset(block, 0, sizeof(block));
+		n = len - b * STORE_BLOCK_LEN;
+		if (n > STORE_BLOCK_LEN)
+			n = STORE_BLOCK_LEN;
+		memcpy(block, buf + b * STORE_BLOCK_LEN, n);
+		if (write_block(st, first + b, block) != S96AT_STATUS_OK)
+			goto out;
+	}
+
+	if (!e->id)
+		hdr->num_records++;
+	e->id = id;
+	e->block = first;
+	put_le16(e->len, len);
+	if (write_block(st, STORE_HEADER_BLOCK, hdr_buf) != S96AT_STATUS_OK)
+		goto out;
+
+	ret = 0;
+out:
+	if (sync_counters(st, 0) != S96AT_STATUS_OK)
+		ret = -1;
+	device_release(st);
+	return ret;
+}
+
+int store_del(struct slotstore *st, uint8_t id)
+{
+	int ret = -1;
+	uint8_t hdr_buf[STORE_BLOCK_LEN];
+	struct store_header *hdr = (struct store_header *)hdr_buf;
+	struct store_index_entry *e;
+
+	if (read_block(st, STORE_HEADER_BLOCK, hdr_buf) != S96AT_STATUS_OK)
+		goto out;
+
+	e = id ? find_entry(hdr, id) : NULL;
+	if (!e) {
+		fprintf(stderr, "No record %u\n", id);
+		goto out;
+	}
+
+	memset(e, 0, sizeof(*e));
+	hdr->num_records--;
+	if (write_block(st, STORE_HEADER_BLOCK, hdr_buf) != S96AT_STATUS_OK)
+		goto out;
+
+	ret = 0;
+out:
+	if (sync_counters(st, 0) != S96AT_STATUS_OK)
+		ret = -1;
+	device_release(st);
+	return ret;
+}
+
+/* Write back the counters of the block writes since the last sync */
+int store_close(struct slotstore *st)
+{
+	int ret = 0;
+
+	if (sync_counters(st, 1) != S96AT_STATUS_OK)
+		ret = -1;
+	device_release(st);
+	OPENSSL_cleanse(st->read_key, sizeof(st->read_key));
+	OPENSSL_cleanse(st->write_key, sizeof(st->write_key));
+	return ret;
+}
+
+const struct store_header *store_header(const struct slotstore *st)
+{
+	return (const struct store_header *)st->blocks[STORE_HEADER_BLOCK];
+}
+
+uint16_t store_block_writes(const struct slotstore *st, int block)
+{
+	const struct store_counters *counters;
+
+	counters = (const struct store_counters *)st->blocks[STORE_COUNTER_BLOCK];
+	return get_le16(counters->writes[block]);
+}
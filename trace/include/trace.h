@@ -0,0 +1,44 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC		"S96T"
+#define TRACE_VERSION		1
+
+#define TRACE_DATA_LEN_MAX	256	/* Larger than any command or response */
+
+/* Record types */
+#define TRACE_OPEN		0x01	/* Adapter opened */
+#define TRACE_ADDR		0x02	/* I2C_SLAVE ioctl, data: 16-bit address */
+#define TRACE_WRITE		0x03	/* Bytes written to the device */
+#define TRACE_READ		0x04	/* Bytes read from the device */
+#define TRACE_CLOSE		0x05	/* Adapter closed */
+
+/* Record flags */
+#define TRACE_F_ERROR		0x01	/* Operation failed, data: 32-bit errno */
+
+struct __attribute__((__packed__)) trace_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t reserved;
+};
+
+/* Each record is followed by len bytes of data. Multi-byte fields are in
+ * host byte order: traces are meant to be replayed on the kind of machine
+ * that recorded them.
+ */
+struct __attribute__((__packed__)) trace_record {
+	uint8_t type;
+	uint8_t flags;
+	uint16_t len;
+	uint32_t delta_us;	/* Time since the previous record */
+};
+
+/* I2C word address, first byte of every write */
+#define TRACE_WORD_ADDR_RESET	0x00
+#define TRACE_WORD_ADDR_SLEEP	0x01
+#define TRACE_WORD_ADDR_IDLE	0x02
+#define TRACE_WORD_ADDR_COMMAND	0x03
+
+#endif
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <trace.h>
+
+#define MAX_TRACES	8
+
+struct opcode {
+	uint8_t opcode;
+	const char *name;
+};
+
+static const struct opcode opcodes[] = {
+	{ 0x02, "Read" },
+	{ 0x08, "MAC" },
+	{ 0x11, "HMAC" },
+	{ 0x12, "Write" },
+	{ 0x15, "GenDig" },
+	{ 0x16, "Nonce" },
+	{ 0x17, "Lock" },
+	{ 0x1b, "Random" },
+	{ 0x1c, "DeriveKey" },
+	{ 0x20, "UpdateExtra" },
+	{ 0x24, "Counter" },
+	{ 0x28, "CheckMac" },
+	{ 0x30, "Info" },
+	{ 0x40, "GenKey" },
+	{ 0x41, "Sign" },
+	{ 0x43, "ECDH" },
+	{ 0x45, "Verify" },
+	{ 0x46, "PrivWrite" },
+	{ 0x47, "SHA" },
+};
+
+struct trace_stats {
+	unsigned long commands[256];
+	unsigned long wakes;
+	unsigned long idles;
+	unsigned long sleeps;
+	unsigned long writes;
+	unsigned long reads;
+	unsigned long errors;
+	unsigned long bytes;
+	uint64_t total_us;
+};
+
+static const char *opcode2str(uint8_t opcode)
+{
+	for (int i = 0; i < sizeof(opcodes) / sizeof(opcodes[0]); i++) {
+		if (opcodes[i].opcode == opcode)
+			return opcodes[i].name;
+	}
+	return NULL;
+}
+
+static void usage(char *fname)
+{
+	fprintf(stderr, "Usage: %s stats <trace> [trace ...]\n", fname);
+	fprintf(stderr, "       %s dump <trace>\n", fname);
+}
+
+static FILE *open_trace(const char *path)
+{
+	FILE *fp;
+	struct trace_header hdr;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		perror("fopen");
+		return NULL;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != TRACE_VERSION) {
+		fprintf(stderr, "%s is not a trace\n", path);
+		fclose(fp);
+		return NULL;
+	}
+
+	return fp;
+}
+
+static int next(FILE *fp, struct trace_record *rec, uint8_t *data)
+{
+	if (fread(rec, sizeof(*rec), 1, fp) != 1)
+		return 0;
+
+	if (rec->len > TRACE_DATA_LEN_MAX ||
+	    (rec->len && fread(data, rec->len, 1, fp) != 1)) {
+		fprintf(stderr, "Truncated trace\n");
+		return 0;
+	}
+
+	return 1;
+}
+
+/* A wake is signalled by a write to the general call address; commands
+ * are writes to the device with the command word address.
+ */
+static int collect(const char *path, struct trace_stats *s)
+{
+	FILE *fp;
+	struct trace_record rec;
+	uint8_t data[TRACE_DATA_LEN_MAX];
+	uint16_t addr = 0;
+
+	fp = open_trace(path);
+	if (!fp)
+		return -1;
+
+	memset(s, 0, sizeof(*s));
+	while (next(fp, &rec, data)) {
+		s->total_us += rec.delta_us;
+		if (rec.flags & TRACE_F_ERROR)
+			s->errors++;
+
+		switch (rec.type) {
+		case TRACE_ADDR:
+			memcpy(&addr, data, sizeof(addr));
+			break;
+		case TRACE_WRITE:
+			s->writes++;
+			if (rec.flags & TRACE_F_ERROR)
+				break;
+			s->bytes += rec.len;
+			if (addr == 0) {
+				s->wakes++;
+				break;
+			}
+			if (!rec.len)
+				break;
+			if (data[0] == TRACE_WORD_ADDR_COMMAND && rec.len > 2)
+				s->commands[data[2]]++;
+			else if (data[0] == TRACE_WORD_ADDR_IDLE)
+				s->idles++;
+			else if (data[0] == TRACE_WORD_ADDR_SLEEP)
+				s->sleeps++;
+			break;
+		case TRACE_READ:
+			s->reads++;
+			if (!(rec.flags & TRACE_F_ERROR))
+				s->bytes += rec.len;
+			break;
+		}
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/* Print the stats of one or more traces side by side, e.g. before and
+ * after a host-side change, to spot changes in the number of transactions.
+ */
+static int do_stats(int num, char *paths[])
+{
+	static struct trace_stats s[MAX_TRACES];
+
+	if (num > MAX_TRACES)
+		num = MAX_TRACES;
+
+	for (int i = 0; i < num; i++) {
+		if (collect(paths[i], &s[i]))
+			return -1;
+	}
+
+	printf("%-14s", "");
+	for (int i = 0; i < num; i++)
+		printf(" %12.12s", paths[i]);
+	printf("\n");
+
+	for (int op = 0; op < 256; op++) {
+		int used = 0;
+
+		for (int i = 0; i < num; i++)
+			used |= s[i].commands[op] != 0;
+		if (!used)
+			continue;
+
+		if (opcode2str(op))
+			printf("%-14s", opcode2str(op));
+		else
+			printf("Opcode 0x%02x   ", op);
+		for (int i = 0; i < num; i++)
+			printf(" %12lu", s[i].commands[op]);
+		printf("\n");
+	}
+
+#define ROW(name, field, fmt, scale)				\
+	do {							\
+		printf("%-14s", name);				\
+		for (int i = 0; i < num; i++)			\
+			printf(" %12" fmt, s[i].field scale);	\
+		printf("\n");					\
+	} while (0)
+
+	ROW("Wake", wakes, "lu", );
+	ROW("Idle", idles, "lu", );
+	ROW("Sleep", sleeps, "lu", );
+	ROW("Writes", writes, "lu", );
+	ROW("Reads", reads, "lu", );
+	ROW("Errors", errors, "lu", );
+	ROW("Bytes", bytes, "lu", );
+	ROW("Duration (ms)", total_us, ".1f", / 1000.0);
+#undef ROW
+
+	return 0;
+}
+
+static int do_dump(const char *path)
+{
+	FILE *fp;
+	struct trace_record rec;
+	uint8_t data[TRACE_DATA_LEN_MAX];
+	uint64_t t = 0;
+	const char *types[] = { "?", "OPEN", "ADDR", "WRITE", "READ", "CLOSE" };
+
+	fp = open_trace(path);
+	if (!fp)
+		return -1;
+
+	while (next(fp, &rec, data)) {
+		t += rec.delta_us;
+		printf("%10.3f ms  %-5s", t / 1000.0,
+		       rec.type <= TRACE_CLOSE ? types[rec.type] : types[0]);
+
+		if (rec.flags & TRACE_F_ERROR) {
+			int err;
+
+			memcpy(&err, data, sizeof(err));
+			printf(" error %d\n", err);
+			continue;
+		}
+
+		if (rec.type == TRACE_OPEN) {
+			printf(" %.*s\n", rec.len, data);
+			continue;
+		}
+
+		for (int i = 0; i < rec.len; i++)
+			printf(" %02x", data[i]);
+		if (rec.type == TRACE_WRITE && rec.len > 2 &&
+		    data[0] == TRACE_WORD_ADDR_COMMAND && opcode2str(data[2]))
+			printf("  (%s)", opcode2str(data[2]));
+		printf("\n");
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	if (!strcmp(argv[1], "stats"))
+		return do_stats(argc - 2, argv + 2);
+	else if (!strcmp(argv[1], "dump") && argc == 3)
+		return do_dump(argv[2]);
+
+	usage(argv[0]);
+	return -1;
+}
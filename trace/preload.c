@@ -0,0 +1,419 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/i2c-dev.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <trace.h>
+
+#define I2C_DEV_PREFIX	"/dev/i2c-"
+#define MAX_FDS		8
+
+enum trace_mode {
+	MODE_OFF,
+	MODE_RECORD,
+	MODE_REPLAY,
+};
+
+static enum trace_mode mode;
+static int fast;		/* Replay as fast as possible */
+static FILE *trace_fp;
+static int fds[MAX_FDS];
+static int num_fds;
+static uint64_t last_us;	/* Time of the previous record */
+static uint64_t start_us;
+
+static struct {
+	unsigned long writes;
+	unsigned long reads;
+	unsigned long errors;
+	unsigned long bytes;
+	unsigned long mismatches;
+} stats;
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_open64)(const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static int (*real_usleep)(useconds_t);
+static int (*real_nanosleep)(const struct timespec *, struct timespec *);
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int is_traced(int fd)
+{
+	for (int i = 0; i < num_fds; i++) {
+		if (fds[i] == fd)
+			return 1;
+	}
+	return 0;
+}
+
+static void untrack(int fd)
+{
+	for (int i = 0; i < num_fds; i++) {
+		if (fds[i] == fd) {
+			fds[i] = fds[--num_fds];
+			return;
+		}
+	}
+}
+
+static void record(uint8_t type, uint8_t flags, const void *data, uint16_t len)
+{
+	struct trace_record rec;
+	uint64_t now = now_us();
+
+	rec.type = type;
+	rec.flags = flags;
+	rec.len = len;
+	rec.delta_us = now - last_us;
+	last_us = now;
+
+	fwrite(&rec, sizeof(rec), 1, trace_fp);
+	if (len)
+		fwrite(data, len, 1, trace_fp);
+}
+
+static void record_result(uint8_t type, ssize_t ret, const void *data)
+{
+	int err = errno;
+
+	if (ret < 0) {
+		stats.errors++;
+		record(type, TRACE_F_ERROR, &err, sizeof(err));
+	} else {
+		stats.bytes += ret;
+		record(type, 0, data, ret);
+	}
+	errno = err;
+}
+
+/* Fetch the next record of the trace. In recorded-speed mode, wait until
+ * as much time has passed since the previous record as it did when the
+ * trace was recorded. Sleeps done by the application count towards that.
+ */
+static int next_record(uint8_t type, struct trace_record *rec, uint8_t *data)
+{
+	uint64_t due;
+
+	if (fread(rec, sizeof(*rec), 1, trace_fp) != 1 ||
+	    rec->len > TRACE_DATA_LEN_MAX ||
+	    (rec->len && fread(data, rec->len, 1, trace_fp) != 1)) {
+		fprintf(stderr, "s96trace: end of trace reached\n");
+		return -1;
+	}
+
+	if (rec->type != type) {
+		fprintf(stderr, "s96trace: out of sync, expected record type %u, got %u\n",
+			type, rec->type);
+		return -1;
+	}
+
+	if (!fast) {
+		due = last_us + rec->delta_us;
+		while (now_us() < due) {
+			struct timespec ts = { 0, (due - now_us()) * 1000 };
+
+			real_nanosleep(&ts, NULL);
+		}
+	}
+	last_us = now_us();
+
+	return 0;
+}
+
+static ssize_t replay_result(struct trace_record *rec, uint8_t *data)
+{
+	if (rec->flags & TRACE_F_ERROR) {
+		stats.errors++;
+		memcpy(&errno, data, sizeof(int));
+		return -1;
+	}
+	stats.bytes += rec->len;
+	return rec->len;
+}
+
+static void trace_open(const char *path, int fd)
+{
+	if (mode == MODE_OFF || fd < 0 || strncmp(path, I2C_DEV_PREFIX, strlen(I2C_DEV_PREFIX)))
+		return;
+
+	if (num_fds == MAX_FDS) {
+		fprintf(stderr, "s96trace: too many adapters open, not tracing %s\n", path);
+		return;
+	}
+	fds[num_fds++] = fd;
+
+	if (mode == MODE_RECORD) {
+		record(TRACE_OPEN, 0, path, strlen(path));
+	} else {
+		struct trace_record rec;
+		uint8_t data[TRACE_DATA_LEN_MAX];
+
+		next_record(TRACE_OPEN, &rec, data);
+	}
+}
+
+/* In replay mode the adapter does not need to exist: /dev/null stands in
+ * for it, and every access is served from the trace.
+ */
+static int do_open(int (*fn)(const char *, int, ...), const char *path, int flags,
+		   mode_t mode_arg)
+{
+	int fd;
+
+	if (mode == MODE_REPLAY && !strncmp(path, I2C_DEV_PREFIX, strlen(I2C_DEV_PREFIX)))
+		fd = fn("/dev/null", O_RDWR);
+	else
+		fd = fn(path, flags, mode_arg);
+
+	trace_open(path, fd);
+	return fd;
+}
+
+int open(const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode_arg = 0;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode_arg = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return do_open(real_open, path, flags, mode_arg);
+}
+
+int open64(const char *path, int flags, ...)
+{
+	va_list ap;
+	mode_t mode_arg = 0;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode_arg = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return do_open(real_open64, path, flags, mode_arg);
+}
+
+int close(int fd)
+{
+	struct trace_record rec;
+	uint8_t data[TRACE_DATA_LEN_MAX];
+
+	if (is_traced(fd)) {
+		untrack(fd);
+		if (mode == MODE_RECORD)
+			record(TRACE_CLOSE, 0, NULL, 0);
+		else
+			next_record(TRACE_CLOSE, &rec, data);
+	}
+
+	return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	unsigned long arg;
+	uint16_t addr;
+	int ret;
+	struct trace_record rec;
+	uint8_t data[TRACE_DATA_LEN_MAX];
+
+	va_start(ap, request);
+	arg = va_arg(ap, unsigned long);
+	va_end(ap);
+
+	if (!is_traced(fd) || request != I2C_SLAVE)
+		return real_ioctl(fd, request, arg);
+
+	addr = arg;
+	if (mode == MODE_RECORD) {
+		ret = real_ioctl(fd, request, arg);
+		record(TRACE_ADDR, ret < 0 ? TRACE_F_ERROR : 0, &addr, sizeof(addr));
+		return ret;
+	}
+
+	if (next_record(TRACE_ADDR, &rec, data)) {
+		errno = EIO;
+		return -1;
+	}
+	if (memcmp(data, &addr, sizeof(addr)))
+		stats.mismatches++;
+
+	return (rec.flags & TRACE_F_ERROR) ? -1 : 0;
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	ssize_t ret;
+	struct trace_record rec;
+	uint8_t data[TRACE_DATA_LEN_MAX];
+
+	if (!is_traced(fd))
+		return real_write(fd, buf, count);
+
+	stats.writes++;
+	if (mode == MODE_RECORD) {
+		ret = real_write(fd, buf, count);
+		record_result(TRACE_WRITE, ret, buf);
+		return ret;
+	}
+
+	if (next_record(TRACE_WRITE, &rec, data)) {
+		errno = EIO;
+		return -1;
+	}
+
+	/* Host-side changes may legitimately change what is sent, e.g. a
+	 * different nonce. Count it, and keep going with the recorded
+	 * response.
+	 */
+	if (!(rec.flags & TRACE_F_ERROR) &&
+	    (rec.len != count || memcmp(data, buf, count)))
+		stats.mismatches++;
+
+	return replay_result(&rec, data);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	ssize_t ret;
+	struct trace_record rec;
+	uint8_t data[TRACE_DATA_LEN_MAX];
+
+	if (!is_traced(fd))
+		return real_read(fd, buf, count);
+
+	stats.reads++;
+	if (mode == MODE_RECORD) {
+		ret = real_read(fd, buf, count);
+		record_result(TRACE_READ, ret, buf);
+		return ret;
+	}
+
+	if (next_record(TRACE_READ, &rec, data)) {
+		errno = EIO;
+		return -1;
+	}
+
+	ret = replay_result(&rec, data);
+	if (ret > 0) {
+		if (ret > count)
+			ret = count;
+		memcpy(buf, data, ret);
+	}
+
+	return ret;
+}
+
+/* When replaying as fast as possible, the execution-time sleeps of the
+ * library are skipped: the responses are already known.
+ */
+int usleep(useconds_t usec)
+{
+	if (mode == MODE_REPLAY && fast && num_fds)
+		return 0;
+
+	return real_usleep(usec);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+	if (mode == MODE_REPLAY && fast && num_fds)
+		return 0;
+
+	return real_nanosleep(req, rem);
+}
+
+__attribute__((constructor))
+static void trace_init(void)
+{
+	const char *path;
+	const char *speed;
+	struct trace_header hdr;
+
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_open64 = dlsym(RTLD_NEXT, "open64");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_usleep = dlsym(RTLD_NEXT, "usleep");
+	real_nanosleep = dlsym(RTLD_NEXT, "nanosleep");
+
+	start_us = last_us = now_us();
+
+	path = getenv("S96TRACE_RECORD");
+	if (path) {
+		trace_fp = fopen(path, "w");
+		if (!trace_fp) {
+			perror("s96trace: fopen");
+			return;
+		}
+		memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+		hdr.version = TRACE_VERSION;
+		hdr.reserved = 0;
+		fwrite(&hdr, sizeof(hdr), 1, trace_fp);
+		mode = MODE_RECORD;
+		return;
+	}
+
+	path = getenv("S96TRACE_REPLAY");
+	if (path) {
+		trace_fp = fopen(path, "r");
+		if (!trace_fp) {
+			perror("s96trace: fopen");
+			return;
+		}
+		if (fread(&hdr, sizeof(hdr), 1, trace_fp) != 1 ||
+		    memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) ||
+		    hdr.version != TRACE_VERSION) {
+			fprintf(stderr, "s96trace: %s is not a trace\n", path);
+			fclose(trace_fp);
+			trace_fp = NULL;
+			return;
+		}
+		speed = getenv("S96TRACE_SPEED");
+		fast = speed && !strcmp(speed, "fast");
+		mode = MODE_REPLAY;
+	}
+}
+
+__attribute__((destructor))
+static void trace_fini(void)
+{
+	if (mode == MODE_OFF)
+		return;
+
+	fclose(trace_fp);
+	mode = MODE_OFF;
+
+	fprintf(stderr, "s96trace: %s: %lu writes, %lu reads, %lu errors, %lu bytes",
+		getenv("S96TRACE_RECORD") ? "recorded" : "replayed",
+		stats.writes, stats.reads, stats.errors, stats.bytes);
+	if (getenv("S96TRACE_REPLAY"))
+		fprintf(stderr, ", %lu mismatches", stats.mismatches);
+	fprintf(stderr, " in %.3f s\n", (now_us() - start_us) / 1e6);
+}
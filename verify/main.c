@@ -8,12 +8,19 @@
 
 #include <secure96/s96at.h>
 
+#include <configcache.h>
+
 #define VALIDATE	0
 #define INVALIDATE	1
 
 #define SLOT_CONFIG_OFFSET	20
 #define KEY_CONFIG_OFFSET	96
 
+/* Info command in State mode (Sect 9.9) */
+#define STATE_KEY_ID_MASK	0x0f	/* Byte 0 */
+#define STATE_GEN_KEY_DATA	0x40	/* Byte 0 */
+#define STATE_TEMPKEY_VALID	0x80	/* Byte 1 */
+
 #define ARRAY_LEN(arr) (sizeof(arr) / sizeof(arr[0]))
 
 /* Sect 9.20 */
@@ -31,25 +38,67 @@ struct __attribute__((__packed__)) verify_msg {
 	uint8_t zero;
 };
 
-static int atecc508a_read_config(struct s96at_desc *desc, uint8_t *buf)
+/* What the host knows TempKey holds: the digest GenKey computed from the
+ * public key in a slot and the Nonce input, if any. The device clears
+ * TempKey.Valid when it consumes TempKey or goes to sleep, so the model
+ * is checked against the state flags before relying on it.
+ */
+struct tempkey {
+	int gen_key_digest;
+	uint8_t slot;
+	uint8_t num_in[S96AT_RANDOM_LEN];
+};
+
+static void notrandom(uint8_t *buf, size_t count)
+{
+	srand (time(NULL));
+	for (int i = 0; i < count; i++)
+		buf[i] = rand() % 0x100;
+}
+
+/* Load TempKey with the digest of the public key in slot, computed by
+ * GenKey over num_in.
+ */
+static int tempkey_gen_digest(struct s96at_desc *desc, struct tempkey *tk, uint8_t slot,
+			      uint8_t *num_in)
 {
 	uint8_t ret;
 
-	for (int i = 0; i < S96AT_ATECC508A_ZONE_CONFIG_NUM_BLOCKS; i++) {
-		ret = s96at_read_config(desc, i, buf + i * S96AT_BLOCK_SIZE);
-		if (ret != S96AT_STATUS_OK) {
-			fprintf(stderr, "Failed to read config block %u\n", i);
-			continue;
-		}
+	tk->gen_key_digest = 0;
+
+	ret = s96at_gen_nonce(desc, S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "Nonce failed\n");
+		return ret;
 	}
-	return ret;
+
+	ret = s96at_gen_key(desc, S96AT_GENKEY_MODE_DIGEST, slot, NULL);
+	if (ret != S96AT_STATUS_OK) {
+		fprintf(stderr, "GenKey failed\n");
+		return ret;
+	}
+
+	tk->gen_key_digest = 1;
+	tk->slot = slot;
+	memcpy(tk->num_in, num_in, sizeof(tk->num_in));
+
+	return S96AT_STATUS_OK;
 }
 
-static void notrandom(uint8_t *buf, size_t count)
+/* TempKey holds the digest of the public key in slot over num_in if the
+ * model says so, and the device agrees it is still a valid GenKey result
+ * for that slot.
+ */
+static int tempkey_holds_digest(const struct tempkey *tk, const uint8_t *state,
+				uint8_t slot, const uint8_t *num_in)
 {
-	srand (time(NULL));
-	for (int i = 0; i < count; i++)
-		buf[i] = rand() % 0x100;
+	if (!tk->gen_key_digest || tk->slot != slot ||
+	    memcmp(tk->num_in, num_in, sizeof(tk->num_in)))
+		return 0;
+
+	return (state[1] & STATE_TEMPKEY_VALID) &&
+	       (state[0] & STATE_GEN_KEY_DATA) &&
+	       (state[0] & STATE_KEY_ID_MASK) == slot;
 }
 
 int main(int argc, char *argv[])
@@ -68,8 +117,10 @@ int main(int argc, char *argv[])
 	uint8_t state[2];
 
 	uint8_t config_buf[S96AT_ATECC508A_ZONE_CONFIG_LEN] = {0};
+	uint8_t config_offsets[3];
 
 	uint8_t num_in[S96AT_RANDOM_LEN] = {0};
+	struct tempkey tk = {0};
 
 	struct s96at_ecdsa_sig sig;
 	uint32_t sign_flags = S96AT_FLAG_NONE;
@@ -114,17 +165,22 @@ int main(int argc, char *argv[])
 
 	while (s96at_wake(&desc) != S96AT_STATUS_READY) {};
 
-	ret = atecc508a_read_config(&desc, config_buf);
+	config_offsets[0] = SLOT_CONFIG_OFFSET + 2 * slot_pub;
+	config_offsets[1] = KEY_CONFIG_OFFSET + 2 * slot_pub;
+	config_offsets[2] = KEY_CONFIG_OFFSET + 2 * slot_parent_priv;
+
+	ret = configcache_read(&desc, config_buf, config_offsets,
+			      ARRAY_LEN(config_offsets));
 	if (ret != S96AT_STATUS_OK) {
 		fprintf(stderr, "Could not read device config\n");
 		ret = -1;
 		goto out;
 	}
 
-	slot_config_pub = config_buf + SLOT_CONFIG_OFFSET + 2 * slot_pub;
-	key_config_pub = config_buf + KEY_CONFIG_OFFSET + 2 * slot_pub;
+	slot_config_pub = config_buf + config_offsets[0];
+	key_config_pub = config_buf + config_offsets[1];
 
-	key_config_parent_priv = config_buf + KEY_CONFIG_OFFSET + 2 * slot_parent_priv;
+	key_config_parent_priv = config_buf + config_offsets[2];
 
 	if (key_config_pub[0] & 0x01) {
 		fprintf(stderr, "Not a public key\n");
@@ -147,17 +203,9 @@ int main(int argc, char *argv[])
 	 */
 	notrandom(num_in, ARRAY_LEN(num_in));
 
-	ret = s96at_gen_nonce(&desc, S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
-	if (ret != S96AT_STATUS_OK) {
-		fprintf(stderr, "Nonce failed\n");
-		goto out;
-	}
-
-	ret = s96at_gen_key(&desc, S96AT_GENKEY_MODE_DIGEST, slot_pub, NULL);
-	if (ret != S96AT_STATUS_OK) {
-		fprintf(stderr, "GenKey failed\n");
+	ret = tempkey_gen_digest(&desc, &tk, slot_pub, num_in);
+	if (ret != S96AT_STATUS_OK)
 		goto out;
-	}
 
 	ret = s96at_sign(&desc, S96AT_SIGN_MODE_INTERNAL, slot_parent_priv,
 			 sign_flags, &sig);
@@ -167,24 +215,30 @@ int main(int argc, char *argv[])
 	}
 
 	/* ---- VERIFY SIDE ---- */
-	ret = s96at_gen_nonce(&desc, S96AT_NONCE_MODE_PASSTHROUGH, num_in, NULL);
-	if (ret != S96AT_STATUS_OK) {
-		fprintf(stderr, "Nonce failed\n");
-		goto out;
-	}
-	ret = s96at_gen_key(&desc, S96AT_GENKEY_MODE_DIGEST, slot_pub, NULL);
-	if (ret != S96AT_STATUS_OK) {
-		fprintf(stderr, "GenKey failed\n");
-		goto out;
-	}
 
-	/* Prepare message to be passed to OtherData */
+	/* The state flags go into the message passed to OtherData. They also
+	 * tell whether the digest the sign side left in TempKey is still
+	 * valid. On the same device, Sign does not change TempKey, so Nonce
+	 * and GenKey only need to run again if the device cleared it.
+	 */
 	ret = s96at_get_state(&desc, state);
 	if (ret != S96AT_STATUS_OK) {
 		fprintf(stderr, "Info failed\n");
 		goto out;
 	}
 
+	if (!tempkey_holds_digest(&tk, state, slot_pub, num_in)) {
+		ret = tempkey_gen_digest(&desc, &tk, slot_pub, num_in);
+		if (ret != S96AT_STATUS_OK)
+			goto out;
+
+		ret = s96at_get_state(&desc, state);
+		if (ret != S96AT_STATUS_OK) {
+			fprintf(stderr, "Info failed\n");
+			goto out;
+		}
+	}
+
 	memset(&message, 0, sizeof(struct verify_msg));
 	message.mode = (action == VALIDATE) ? 0x00 : 0x01;
 	message.key_id[0] = slot_parent_priv;